@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# Benchmark end-to-end su localhost: mhbench fa da Sender e da Receiver,
+# ritardatore sostituisce il Ritardatore. Per ogni profilo di disturbi e ogni
+# carico stampa una riga chiave=valore con l'uscita di mhbench e il tempo di
+# CPU consumato da psend e precv.
+#
+# Uso: bench.sh [ directory_eseguibili ]
+# MHBENCH_ARGS aggiunge opzioni a mhbench (es. -n 1048576 -t 20), PROFILES
+# e WORKLOADS restringono la matrice (es. PROFILES="clean stall"). CAPTURE,
+# una cattura di psend -C, aggiunge il carico replay, riprodotto da mhreplay
+# con le opzioni MHREPLAY_ARGS. PROXY_ARGS passa opzioni a psend e precv,
+# che di default usano i loro timeout: il profilo stall chiude il canale 1 e
+# misura anche la sua riapertura.
+
+BIN=${1:-.}
+PROFILES=${PROFILES:-"clean delay asym stall"}
+WORKLOADS=${WORKLOADS:-"bulk interactive mixed${CAPTURE:+ replay}"}
+TMP=${TMPDIR:-/tmp}/mhbench.$$
+
+profile_args ()
+{
+	case "$1" in
+	clean)	echo "" ;;
+	delay)	echo "-d *:20 -j *:5" ;;
+	asym)	echo "-d 0:10 -d 1:40 -j 1:10 -d 2:80 -r 2:250000" ;;
+	stall)	echo "-d *:10 -s 1:3:1" ;;
+	*)	echo "profilo sconosciuto: $1" >&2; exit 1 ;;
+	esac
+}
+
+# Secondi di CPU (utente + sistema) del processo $1, finche' e' vivo.
+cpu_secs ()
+{
+	if [ -r /proc/$1/stat ]; then
+		awk -v hz="$(getconf CLK_TCK)" \
+		    '{ printf "%.2f", ($14 + $15) / hz }' /proc/$1/stat
+	else
+		echo "na"
+	fi
+}
+
+stop ()
+{
+	kill $PIDS 2>/dev/null
+	wait $PIDS 2>/dev/null
+	PIDS=
+}
+
+trap 'stop; rm -f $TMP; exit 1' INT TERM
+
+for p in $PROFILES; do
+	rargs=$(profile_args $p) || exit 1
+	for w in $WORKLOADS; do
+		# mhbench deve essere in ascolto prima che parta precv.
+		if [ $w = replay ]; then
+			$BIN/mhreplay $MHREPLAY_ARGS "$CAPTURE" > $TMP &
+		else
+			$BIN/mhbench -w $w $MHBENCH_ARGS > $TMP &
+		fi
+		bench=$!
+		sleep 0.2
+		$BIN/precv $PROXY_ARGS > /dev/null 2>&1 &
+		precv=$!
+		sleep 0.2
+		set -f
+		$BIN/ritardatore $rargs > /dev/null 2>&1 &
+		rit=$!
+		set +f
+		sleep 0.2
+		$BIN/psend $PROXY_ARGS > /dev/null 2>&1 &
+		psend=$!
+		PIDS="$psend $rit $precv"
+
+		wait $bench
+		cpu_s=$(cpu_secs $psend)
+		cpu_r=$(cpu_secs $precv)
+		stop
+
+		line=$(cat $TMP)
+		[ -n "$line" ] || line="workload=$w complete=0"
+		bytes=$(echo "$line" | sed -n 's/.*bytes=\([0-9]*\).*/\1/p')
+		awk -v p=$p -v l="$line" -v s=$cpu_s -v r=$cpu_r -v b=${bytes:-0} \
+		    'BEGIN {
+			printf "profile=%s %s cpu_psend_s=%s cpu_precv_s=%s", \
+			       p, l, s, r
+			if (s != "na" && b > 0)
+				printf " cpu_s_per_gb=%.2f", (s + r) * 1e9 / b
+			printf "\n"
+		    }'
+		sleep 0.5
+	done
+done
+rm -f $TMP
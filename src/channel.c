@@ -1,14 +1,21 @@
 #include "h/channel.h"
 #include "h/cqueue.h"
+#include "h/crono.h"
+#include "h/histo.h"
+#include "h/probes.h"
 #include "h/rqueue.h"
 #include "h/segment.h"
 #include "h/seghash.h"
+#include "h/sim.h"
+#include "h/stats.h"
 #include "h/timeout.h"
+#include "h/trace.h"
 #include "h/types.h"
 #include "h/util.h"
 
 #include <config.h>
 #include <string.h>
+#include <sys/uio.h>
 #if !HAVE_MSG_NOSIGNAL
 #include <signal.h>
 #endif
@@ -21,62 +28,50 @@
 
 
 /*******************************************************************************
-			       Variabili locali
+				 Definizioni
 *******************************************************************************/
 
-/* Canali. */
-static struct chan ch[CHANNELS];
-
-/* Contatore statico per politica round robin. */
-static cd_t rrcd;
-
-/* Buffer applicazione. */
-static cqueue_t *host_rcvbuf;
-static cqueue_t *host_sndbuf;
-
-static rqueue_t *net_rcvbuf[NETCHANNELS];
-static rqueue_t *net_sndbuf[NETCHANNELS];
-
-/* Code dei segmenti urgenti. */
-#define     URGNO     4
-static struct segwrap *urgentq[URGNO];
-/* Relativi indici: il loro ordine deve essere coerente con segwrap_urgcmp. */
-#define     NAKQ     0
-#define     CRTQ     1
-#define     ACKQ     2
-#define     DATQ     3
-
-/* Coda dei segmenti ricevuti dal ritardatore. */
-static struct segwrap *joinq;
-
-/* Ultimo seqnum inviato all ritardatore. */
-static seq_t outseq;
-/* Ultimo seqnum inviato all'host. */
-static seq_t last_sent;
-
-static struct segwrap *last_ack_rcvd;
-static bool ack_handled;
+/* Indici delle code urgenti: il loro ordine deve essere coerente con
+ * segwrap_urgcmp. Sonde ed echi non passano dalla urgentq, sono legati al
+ * loro canale. */
+#define     PRBQ     0
+#define     NAKQ     1
+#define     CRTQ     2
+#define     ACKQ     3
+#define     DATQ     4
 
 
 /*******************************************************************************
 				    Macro
 *******************************************************************************/
 
-#define     ROTATE_RRCD     (rrcd = (rrcd + 1) % NETCHANNELS)
+#define     ROTATE_RRCD(px)                                             \
+	((px)->px_rrcd = ((px)->px_rrcd + 1) % NETCHANNELS)
 
 
 /*******************************************************************************
 		       Prototipi delle funzioni locali
 *******************************************************************************/
 
-static bool check_read_activity (cd_t cd, int nread);
-static bool check_write_activity (cd_t cd, int nwrite);
-static int connect_noblock (cd_t cd);
-static int listen_noblock (cd_t cd);
-static void host2net (void);
-static void net2urg (void);
-static void urg2net (void);
-static void netsndbuf_rm_acked (struct segwrap *ack);
+static void chan_reset (proxy_t *px, cd_t cd);
+static void channel_reopen (proxy_t *px, cd_t cd);
+static int connect_noblock (proxy_t *px, cd_t cd);
+static void consume_marks (tmarks_t *tm, uint64_t pos, int stage);
+static void deliver (proxy_t *px, seg_t *seg, size_t seglen, double joined,
+		size_t written);
+static int listen_noblock (proxy_t *px, cd_t cd);
+static void host2net (proxy_t *px);
+static void host_gather_write (proxy_t *px);
+static int host_local_drain (proxy_t *px);
+static int host_local_init (proxy_t *px);
+static void host_local_notify (proxy_t *px);
+static void host_local_wake (proxy_t *px);
+static void host_read_done (proxy_t *px, size_t nread);
+static void host_write_done (proxy_t *px, size_t nwrite);
+static void kernel2net (proxy_t *px);
+static void net2urg (proxy_t *px);
+static void urg2net (proxy_t *px);
+static void netsndbuf_rm_acked (proxy_t *px, struct segwrap *ack);
 
 
 /*******************************************************************************
@@ -84,99 +79,282 @@ static void netsndbuf_rm_acked (struct segwrap *ack);
 *******************************************************************************/
 
 void
-channel_activity_notice (cd_t cd)
+channel_activity_notice (proxy_t *px, cd_t cd)
 {
+	/* Il peer ha spedito qualcosa sul canale cd: e' vivo e non serve
+	 * sondarlo. */
+
 	assert (VALID_CD (cd));
-	timeout_reset (ch[cd].c_activity);
+	timeout_reset (px->px_ch[cd].c_activity);
+	timeout_reset (px->px_ch[cd].c_probe);
+}
+
+
+void
+channel_add_ctrl (proxy_t *px, cd_t cd, struct segwrap *sw)
+{
+	/* Accoda il segmento di controllo sw (sonda o echo) sul canale cd,
+	 * davanti ai segmenti non ancora spediti. Se il canale non e'
+	 * connesso o il buffer e' pieno sw viene scartato: la sonda
+	 * successiva ripete la misura. */
+
+	int err;
+
+	assert (VALID_CD (cd) && cd != HOSTCD);
+	assert (sw != NULL);
+
+	err = -1;
+	if (channel_is_connected (px, cd))
+		err = rqueue_add_urgent (px->px_net_sndbuf[cd], sw);
+	if (err)
+		segwrap_destroy (px, sw);
 }
 
 
 bool
-channel_can_read (cd_t cd)
+channel_can_read (proxy_t *px, cd_t cd)
 {
 	assert (VALID_CD (cd));
 
+	/* L'host nello stesso processo ha solo la pipe di risveglio, sempre
+	 * da leggere. */
+	if (cd == HOSTCD && px->px_host_local)
+		return TRUE;
 	if (cd == HOSTCD)
-		return cqueue_can_read (host_rcvbuf);
-	return rqueue_can_read (net_rcvbuf[cd]);
+		return cqueue_can_read (px->px_host_rcvbuf);
+	return rqueue_can_read (px->px_net_rcvbuf[cd]);
 }
 
 
 bool
-channel_can_write (cd_t cd)
+channel_can_write (proxy_t *px, cd_t cd)
 {
 	assert (VALID_CD (cd));
 
+	if (cd == HOSTCD && px->px_host_local)
+		return FALSE;
 	if (cd == HOSTCD)
-		return cqueue_can_write (host_sndbuf);
-	return rqueue_can_write (net_sndbuf[cd]);
+		return cqueue_can_write (px->px_host_sndbuf);
+	return rqueue_can_write (px->px_net_sndbuf[cd]);
 }
 
 
 void
-channel_close (cd_t cd)
+channel_close (proxy_t *px, cd_t cd)
 {
 	/* Rimuove tutti i segwrap dalla rqueue di upload, li travasa nella
-	 * urgentq e invalida il canale. */
+	 * urgentq e invalida il canale. Sonde ed echi misurano l'RTT di
+	 * questo canale e vengono distrutti. Il canale con l'host non ha
+	 * rqueue, e nemmeno quello la cui connessione e' fallita.
+	 * Un canale di rete viene riaperto dopo un timeout di attivita',
+	 * raddoppiato a ogni chiusura entro TOREOPEN_MAX dalla precedente
+	 * riapertura. I byte rimasti nella rqueue di download appartengono
+	 * alla vecchia connessione e vengono scartati, i segmenti persi li
+	 * recuperano NAK e ACK. */
+
+	struct segwrap *sw;
+	struct chan *chptr;
 
 	fprintf (stderr, "Canale %d CHIUSO\n", cd);
+	MH_PROBE2 (channel_close, cd, errno);
+
+	if (cd != HOSTCD && px->px_net_sndbuf[cd] != NULL)
+		while ((sw = qdequeue (&px->px_net_sndbuf[cd]->rq_sgmt))
+		       != NULL) {
+			if (segwrap_prio (sw) == PRBQ)
+				segwrap_destroy (px, sw);
+			else
+				urgent_add (px, sw);
+		}
 
-	while (!isEmpty (net_sndbuf[cd]->rq_sgmt))
-		urgent_add (qdequeue (&net_sndbuf[cd]->rq_sgmt));
+	channel_invalidate (px, cd);
+
+	if (cd != HOSTCD) {
+		if (px->px_net_rcvbuf[cd] != NULL) {
+			rqueue_destroy (px->px_net_rcvbuf[cd]);
+			px->px_net_rcvbuf[cd] = NULL;
+		}
+		chptr = &px->px_ch[cd];
+		if (crono_measure (&chptr->c_uptime) >= TOREOPEN_MAX)
+			chptr->c_reopen_val = px->px_toact_val;
+		timeout_set_maxval (chptr->c_reopen, chptr->c_reopen_val);
+		timeout_reset (chptr->c_reopen);
+		add_timeout (px, chptr->c_reopen, TOACT);
+		chptr->c_reopen_val = MIN (2 * chptr->c_reopen_val,
+				TOREOPEN_MAX);
+	}
+}
+
+
+double
+channel_get_srtt (proxy_t *px, cd_t cd)
+{
+	/* Ritorna la media mobile dell'RTT del canale, 0 se non ci sono
+	 * ancora campioni. */
 
-	channel_invalidate (cd);
+	assert (VALID_CD (cd) && cd != HOSTCD);
+	return px->px_ch[cd].c_srtt;
 }
 
 
 fd_t
-channel_get_listfd (cd_t cd)
+channel_get_listfd (proxy_t *px, cd_t cd)
 {
 	assert (VALID_CD (cd));
-	return ch[cd].c_listfd;
+	return px->px_ch[cd].c_listfd;
 }
 
 
 fd_t
-channel_get_sockfd (cd_t cd)
+channel_get_sockfd (proxy_t *px, cd_t cd)
 {
 	assert (VALID_CD (cd));
-	return ch[cd].c_sockfd;
+	return px->px_ch[cd].c_sockfd;
+}
+
+
+ssize_t
+channel_host_get (proxy_t *px, seg_t *buf, size_t len)
+{
+	/* Equivalente di channel_write per il Receiver nello stesso processo:
+	 * sposta in buf fino a len byte da host_sndbuf. Va chiamata dal
+	 * thread dell'applicazione.
+	 * Ritorna i byte spostati, -1 con errno EAGAIN se host_sndbuf e'
+	 * vuoto. */
+
+	int err;
+	size_t n;
+
+	assert (px->px_host_local && !px->px_host_sender);
+	assert (buf != NULL);
+
+	pthread_mutex_lock (&px->px_host_lock);
+	n = MIN (len, cqueue_get_used (px->px_host_sndbuf));
+	if (n > 0) {
+		err = cqueue_remove (px->px_host_sndbuf, buf, n);
+		assert (!err);
+		host_write_done (px, n);
+		/* Lo spazio liberato puo' sbloccare feed_download. */
+		host_local_wake (px);
+	}
+	host_local_notify (px);
+	pthread_mutex_unlock (&px->px_host_lock);
+
+	if (n == 0 && len > 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return n;
+}
+
+
+void
+channel_host_lock (proxy_t *px)
+{
+	/* Con l'host nello stesso processo prende il lock dei buffer
+	 * applicazione, altrimenti non fa nulla. */
+
+	if (px->px_host_local)
+		pthread_mutex_lock (&px->px_host_lock);
+}
+
+
+ssize_t
+channel_host_put (proxy_t *px, seg_t *buf, size_t len)
+{
+	/* Equivalente di channel_read per il Sender nello stesso processo:
+	 * copia in host_rcvbuf fino a len byte di buf. Va chiamata dal
+	 * thread dell'applicazione.
+	 * Ritorna i byte copiati, -1 con errno EAGAIN se host_rcvbuf e'
+	 * pieno. */
+
+	int err;
+	size_t n;
+
+	assert (px->px_host_local && px->px_host_sender);
+	assert (buf != NULL);
+
+	pthread_mutex_lock (&px->px_host_lock);
+	n = MIN (len, cqueue_get_aval (px->px_host_rcvbuf));
+	if (n > 0) {
+		err = cqueue_add (px->px_host_rcvbuf, buf, n);
+		assert (!err);
+		host_read_done (px, n);
+		host_local_wake (px);
+	}
+	host_local_notify (px);
+	pthread_mutex_unlock (&px->px_host_lock);
+
+	if (n == 0 && len > 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return n;
+}
+
+
+fd_t
+channel_host_readyfd (proxy_t *px)
+{
+	/* Ritorna il fd leggibile finche' channel_host_put (Sender) o
+	 * channel_host_get (Receiver) possono spostare dati. */
+
+	assert (px->px_host_local);
+	return px->px_ready[0];
+}
+
+
+void
+channel_host_unlock (proxy_t *px)
+{
+	/* Aggiorna px_ready e rilascia il lock preso con
+	 * channel_host_lock. */
+
+	if (px->px_host_local) {
+		host_local_notify (px);
+		pthread_mutex_unlock (&px->px_host_lock);
+	}
 }
 
 
 int
-channel_init (cd_t cd, port_t listport, char *connip, port_t connport)
+channel_init (proxy_t *px, cd_t cd, port_t listport, char *connip,
+		port_t connport)
 {
 	int err;
+	struct chan *chptr;
 
 	assert (VALID_CD (cd));
 
-	ch[cd].c_sockfd = -1;
-	ch[cd].c_listfd = -1;
-
-	memset (&ch[cd].c_laddr, 0, sizeof (ch[cd].c_laddr));
-	memset (&ch[cd].c_raddr, 0, sizeof (ch[cd].c_raddr));
-	if (listport != 0) {
+	chptr = &px->px_ch[cd];
+	chptr->c_sockfd = -1;
+	chptr->c_listfd = -1;
+
+	memset (&chptr->c_cfg_laddr, 0, sizeof (chptr->c_cfg_laddr));
+	memset (&chptr->c_cfg_raddr, 0, sizeof (chptr->c_cfg_raddr));
+	if (cd == HOSTCD && px->px_host_path != NULL) {
+		/* Socket AF_UNIX al posto di ip e porta. */
+		err = set_unix_addr (listport != 0 ? &chptr->c_cfg_laddr
+		                                   : &chptr->c_cfg_raddr,
+				px->px_host_path);
+	} else if (listport != 0) {
 		assert (connip == NULL);
 		assert (connport == 0);
-		err = set_addr (&ch[cd].c_laddr, NULL, listport);
+		err = set_addr (&chptr->c_cfg_laddr, NULL, listport);
 	} else {
 		assert (connip != NULL);
 		assert (connport != 0);
-		err = set_addr (&ch[cd].c_raddr, connip, connport);
+		err = set_addr (&chptr->c_cfg_raddr, connip, connport);
 	}
 	if (err)
 		goto error;
 
-	ch[cd].c_tcp_rcvbuf_len = 0;
-	ch[cd].c_tcp_sndbuf_len = 0;
-
-	ch[cd].c_activity = NULL;
-	if (cd != HOSTCD) {
-		ch[cd].c_tcp_sndbuf_len = TCP_MIN_SNDBUF_SIZE;
-		ch[cd].c_activity = timeout_create (TOACT_VAL, channel_close,
-				cd, FALSE);
-	}
+	chptr->c_reopen = NULL;
+	chptr->c_reopen_val = px->px_toact_val;
+	if (cd != HOSTCD)
+		chptr->c_reopen = timeout_create (px, px->px_toact_val,
+				channel_reopen, cd, FALSE);
+	chan_reset (px, cd);
 	return 0;
 
 error:
@@ -185,54 +363,68 @@ error:
 
 
 void
-channel_invalidate (cd_t cd)
+channel_invalidate (proxy_t *px, cd_t cd)
 {
 	/* Dealloca tutte le strutture dati associate al canale. */
 
-	rqueue_destroy (net_sndbuf[cd]);
-	net_sndbuf[cd] = NULL;
+	struct chan *chptr;
+
+	if (cd != HOSTCD && px->px_net_sndbuf[cd] != NULL) {
+		rqueue_destroy (px->px_net_sndbuf[cd]);
+		px->px_net_sndbuf[cd] = NULL;
+	}
 
 	/* Chiusura socket. */
-	if (ch[cd].c_listfd >= 0)
-		tcp_close (&ch[cd].c_listfd);
-	if (ch[cd].c_sockfd >= 0)
-		tcp_close (&ch[cd].c_sockfd);
+	chptr = &px->px_ch[cd];
+	if (chptr->c_listfd >= 0)
+		tcp_close (&chptr->c_listfd);
+	if (chptr->c_sockfd >= 0)
+		tcp_close (&chptr->c_sockfd);
 
 	/* Timeout attivita'. */
-	if (ch[cd].c_activity != NULL) {
-		del_timeout (ch[cd].c_activity, TOACT);
-		timeout_destroy (ch[cd].c_activity);
+	if (chptr->c_activity != NULL) {
+		del_timeout (px, chptr->c_activity, TOACT);
+		timeout_destroy (px, chptr->c_activity);
+	}
+
+	/* Timeout sonda. */
+	if (chptr->c_probe != NULL) {
+		del_timeout (px, chptr->c_probe, TOPRB);
+		timeout_destroy (px, chptr->c_probe);
 	}
 
 	/* Reinizializzazione campi. */
-	memset (&ch[cd].c_laddr, 0, sizeof(ch[cd].c_laddr));
-	memset (&ch[cd].c_raddr, 0, sizeof(ch[cd].c_raddr));
+	memset (&chptr->c_laddr, 0, sizeof(chptr->c_laddr));
+	memset (&chptr->c_raddr, 0, sizeof(chptr->c_raddr));
+
+	chptr->c_tcp_rcvbuf_len = -1;
+	chptr->c_tcp_sndbuf_len = -1;
 
-	ch[cd].c_tcp_rcvbuf_len = -1;
-	ch[cd].c_tcp_sndbuf_len = -1;
+	chptr->c_activity = NULL;
+	chptr->c_probe = NULL;
 
-	ch[cd].c_activity = NULL;
+	STATS_SET (st_chan[cd].cs_connected, 0);
 }
 
 
 bool
-channel_is_activable (cd_t cd)
+channel_is_activable (proxy_t *px, cd_t cd)
 {
 	assert (VALID_CD (cd));
 
-	if (channel_is_connected (cd)
-	    || channel_is_listening (cd)
-	    || (!addr_is_set (&ch[cd].c_laddr)
-	        && !addr_is_set (&ch[cd].c_raddr)))
+	if (channel_is_connected (px, cd)
+	    || channel_is_listening (px, cd)
+	    || (!addr_is_set (&px->px_ch[cd].c_laddr)
+	        && !addr_is_set (&px->px_ch[cd].c_raddr)))
 		return FALSE;
 
 	if (cd == HOSTCD) {
 		/* Proxy Receiver. */
-		if (channel_must_connect (cd)) {
+		if (channel_must_connect (px, cd)) {
 			bool ok = FALSE;
 			cd_t ncd = NETCD;
 			while (!ok && ncd < NETCHANNELS) {
-				ok = channel_is_connected (ncd);
+				ok = channel_is_connected (px, ncd);
 				ncd++;
 			}
 			return ok;
@@ -244,22 +436,27 @@ channel_is_activable (cd_t cd)
 	/* NETCD */
 
 	/* Proxy Sender. */
-	if (channel_must_connect (cd))
-		return channel_is_connected (HOSTCD);
+	if (channel_must_connect (px, cd))
+		return channel_is_connected (px, HOSTCD);
 	/* Proxy Receiver. */
 	return TRUE;
 }
 
 
 bool
-channel_is_connected (cd_t cd)
+channel_is_connected (proxy_t *px, cd_t cd)
 {
+	struct chan *chptr;
+
 	assert (VALID_CD (cd));
 
-	if (ch[cd].c_listfd < 0
-	    && ch[cd].c_sockfd >= 0
-	    && addr_is_set (&ch[cd].c_laddr)
-	    && addr_is_set (&ch[cd].c_raddr))
+	chptr = &px->px_ch[cd];
+	if (cd == HOSTCD && px->px_host_local)
+		return (chptr->c_sockfd >= 0 ? TRUE : FALSE);
+	if (chptr->c_listfd < 0
+	    && chptr->c_sockfd >= 0
+	    && addr_is_set (&chptr->c_laddr)
+	    && addr_is_set (&chptr->c_raddr))
 		return TRUE;
 
 	return FALSE;
@@ -267,18 +464,21 @@ channel_is_connected (cd_t cd)
 
 
 bool
-channel_is_connecting (cd_t cd)
+channel_is_connecting (proxy_t *px, cd_t cd)
 {
 	/* Se il socket del canale e' valido ed e' impostato solo l'addr
 	 * remoto e non quello locale, allora c'e' una connect non bloccante
 	 * in corso. */
 
+	struct chan *chptr;
+
 	assert (VALID_CD (cd));
 
-	if (ch[cd].c_sockfd >= 0
-	    && !addr_is_set (&ch[cd].c_laddr)
-	    && addr_is_set (&ch[cd].c_raddr)) {
-		assert (ch[cd].c_listfd < 0);
+	chptr = &px->px_ch[cd];
+	if (chptr->c_sockfd >= 0
+	    && !addr_is_set (&chptr->c_laddr)
+	    && addr_is_set (&chptr->c_raddr)) {
+		assert (chptr->c_listfd < 0);
 		return TRUE;
 	}
 	return FALSE;
@@ -286,17 +486,20 @@ channel_is_connecting (cd_t cd)
 
 
 bool
-channel_is_listening (cd_t cd)
+channel_is_listening (proxy_t *px, cd_t cd)
 {
 	/* Se il socket listening del canale e' valido ed e' impostato l'addr
 	 * locale ma non quello remoto, allora il canale e' in ascolto. */
 
+	struct chan *chptr;
+
 	assert (VALID_CD (cd));
 
-	if (ch[cd].c_listfd >= 0
-	    && addr_is_set (&ch[cd].c_laddr)
-	    && !addr_is_set (&ch[cd].c_raddr)) {
-		assert (ch[cd].c_sockfd < 0);
+	chptr = &px->px_ch[cd];
+	if (chptr->c_listfd >= 0
+	    && addr_is_set (&chptr->c_laddr)
+	    && !addr_is_set (&chptr->c_raddr)) {
+		assert (chptr->c_sockfd < 0);
 		return TRUE;
 	}
 	return FALSE;
@@ -304,17 +507,20 @@ channel_is_listening (cd_t cd)
 
 
 bool
-channel_must_connect (cd_t cd)
+channel_must_connect (proxy_t *px, cd_t cd)
 {
 	/* Il canale deve essere connesso se l'indirizzo remoto e' impostato,
 	 * ma il socket non e' un fd valido. */
 
+	struct chan *chptr;
+
 	assert (VALID_CD (cd));
 
-	if (!addr_is_set (&ch[cd].c_laddr)
-	    && addr_is_set (&ch[cd].c_raddr)
-	    && ch[cd].c_sockfd < 0) {
-		assert (ch[cd].c_listfd < 0);
+	chptr = &px->px_ch[cd];
+	if (!addr_is_set (&chptr->c_laddr)
+	    && addr_is_set (&chptr->c_raddr)
+	    && chptr->c_sockfd < 0) {
+		assert (chptr->c_listfd < 0);
 		return TRUE;
 	}
 	return FALSE;
@@ -322,17 +528,20 @@ channel_must_connect (cd_t cd)
 
 
 bool
-channel_must_listen (cd_t cd)
+channel_must_listen (proxy_t *px, cd_t cd)
 {
 	/* Il canale deve essere messo in ascolto se l'indirizzo locale e'
 	 * impostato, ma il socket listening non e' un fd valido. */
 
+	struct chan *chptr;
+
 	assert (VALID_CD (cd));
 
-	if (addr_is_set (&ch[cd].c_laddr)
-	    && !addr_is_set (&ch[cd].c_raddr)
-	    && ch[cd].c_listfd < 0) {
-		assert (ch[cd].c_sockfd < 0);
+	chptr = &px->px_ch[cd];
+	if (addr_is_set (&chptr->c_laddr)
+	    && !addr_is_set (&chptr->c_raddr)
+	    && chptr->c_listfd < 0) {
+		assert (chptr->c_sockfd < 0);
 		return TRUE;
 	}
 	return FALSE;
@@ -340,21 +549,23 @@ channel_must_listen (cd_t cd)
 
 
 char *
-channel_name (cd_t cd)
+channel_name (proxy_t *px, cd_t cd)
 {
-	/* Ritorna una stringa allocata staticamente e terminata da '\0' della
-	 * forma "xxx.xxx.xxx.xxx:yyyyy - xxx.xxx.xxx.xxx:yyyyy", dove il
-	 * primo e' l'indirizzo locale, il secondo quello remoto. */
+	/* Ritorna una stringa terminata da '\0' della forma
+	 * "xxx.xxx.xxx.xxx:yyyyy - xxx.xxx.xxx.xxx:yyyyy", dove il primo e'
+	 * l'indirizzo locale, il secondo quello remoto. La stringa sta in px
+	 * e viene sovrascritta dalla chiamata successiva. */
 
 	char *bufptr;
-	static char bufname[46];
+	char *bufname;
 
 	assert (VALID_CD (cd));
 
-	memset (bufname, 0, sizeof (bufname));
+	bufname = px->px_name;
+	memset (bufname, 0, sizeof (px->px_name));
 
 	/* Indirizzo locale. */
-	bufptr = addrstr (&ch[cd].c_laddr, bufname);
+	bufptr = addrstr (&px->px_ch[cd].c_laddr, bufname);
 
 	/* Separatore. */
 	strcpy (bufptr, " - ");
@@ -363,138 +574,310 @@ channel_name (cd_t cd)
 	assert (bufptr != NULL);
 
 	/* Indirizzo remoto. */
-	bufptr = addrstr (&ch[cd].c_raddr, bufptr);
+	bufptr = addrstr (&px->px_ch[cd].c_raddr, bufptr);
 
 	/* Overflow? */
-	assert (bufname[45] == '\0');
+	assert (bufname[sizeof (px->px_name) - 1] == '\0');
 
 	return bufname;
 }
 
 
 void
-channel_prepare_io (cd_t cd)
+channel_prepare_io (proxy_t *px, cd_t cd)
 {
+	fd_t sockfd;
+
 	assert (VALID_CD (cd));
 
+	sockfd = px->px_ch[cd].c_sockfd;
 	if (cd == HOSTCD) {
 		size_t buflen;
 
-		assert (host_rcvbuf == NULL);
-		assert (host_sndbuf == NULL);
+		assert (px->px_host_rcvbuf == NULL);
+		assert (px->px_host_sndbuf == NULL);
 
-		buflen = tcp_get_buffer_size (ch[cd].c_sockfd, SO_RCVBUF);
-		host_rcvbuf = cqueue_create (buflen);
+		buflen = tcp_get_buffer_size (sockfd, SO_RCVBUF);
+		px->px_host_rcvbuf = cqueue_create (buflen);
 
-		buflen = tcp_get_buffer_size (ch[cd].c_sockfd, SO_SNDBUF);
-		host_sndbuf = cqueue_create (buflen);
+		buflen = tcp_get_buffer_size (sockfd, SO_SNDBUF);
+		px->px_host_sndbuf = cqueue_create (buflen);
 	}
 	/* NET */
 	else {
 		size_t buflen;
 
-		assert (net_rcvbuf[cd] == NULL);
-		assert (net_sndbuf[cd] == NULL);
+		assert (px->px_net_rcvbuf[cd] == NULL);
+		assert (px->px_net_sndbuf[cd] == NULL);
 
 		buflen = MAX (SEGMAXLEN,
-				tcp_get_buffer_size (ch[cd].c_sockfd,
-					SO_RCVBUF))
+				tcp_get_buffer_size (sockfd, SO_RCVBUF))
 			+ SEGMAXLEN;
-		net_rcvbuf[cd] = rqueue_create (buflen);
+		px->px_net_rcvbuf[cd] = rqueue_create (px, cd, buflen, FALSE);
+
+		buflen = tcp_get_buffer_size (sockfd, SO_SNDBUF);
+		px->px_net_sndbuf[cd] = rqueue_create (px, cd, buflen, TRUE);
+
+		/* Il kernel non deve tenere in vita il canale piu' a lungo
+		 * del timeout di attivita' iniziale. */
+		if (tcp_set_user_timeout (sockfd,
+				MAX (px->px_toact_val, TOACT_INIT)))
+			fprintf (stderr, "Canale %s, TCP_USER_TIMEOUT non "
+					"impostato: %s\n",
+					channel_name (px, cd),
+					strerror (errno));
+
+		if (px->px_busy_val > 0
+		    && tcp_set_busy_poll (sockfd, px->px_busy_val))
+			fprintf (stderr, "Canale %s, SO_BUSY_POLL non "
+					"impostato: %s\n",
+					channel_name (px, cd),
+					strerror (errno));
+
+		timeout_reset (px->px_ch[cd].c_activity);
+		add_timeout (px, px->px_ch[cd].c_activity, TOACT);
+		timeout_reset (px->px_ch[cd].c_probe);
+		add_timeout (px, px->px_ch[cd].c_probe, TOPRB);
+
+		px->px_net_written[cd] = 0;
+		tmarks_reset (&px->px_kernel_marks[cd]);
+	}
+	STATS_SET (st_chan[cd].cs_connected, 1);
+}
 
-		buflen = tcp_get_buffer_size (ch[cd].c_sockfd, SO_SNDBUF);
-		net_sndbuf[cd] = rqueue_create (buflen);
 
-		timeout_reset (ch[cd].c_activity);
-		add_timeout (ch[cd].c_activity, TOACT);
-	}
+void
+channel_probe (proxy_t *px, cd_t cd)
+{
+	/* Trigger del timeout sonda: il canale e' rimasto muto per un
+	 * intervallo, chiede al peer un echo. */
+
+	assert (VALID_CD (cd) && cd != HOSTCD);
+
+	channel_add_ctrl (px, cd,
+			segwrap_probe_create (px, px->px_ch[cd].c_prbseq++));
 }
 
 
 int
-channel_read (cd_t cd)
+channel_read (proxy_t *px, cd_t cd)
 {
+	size_t nread;
+	fd_t sockfd;
+
 	assert (VALID_CD (cd));
-	assert (channel_is_connected (cd));
-	assert (channel_can_read (cd));
+	assert (channel_is_connected (px, cd));
+	assert (channel_can_read (px, cd));
+
+	if (cd == HOSTCD && px->px_host_local)
+		return host_local_drain (px);
 
+	sockfd = px->px_ch[cd].c_sockfd;
 	if (cd == HOSTCD)
-		return cqueue_read (ch[cd].c_sockfd, host_rcvbuf);
-	return  rqueue_read (ch[cd].c_sockfd, net_rcvbuf[cd]);
+		nread = cqueue_read (sockfd, px->px_host_rcvbuf);
+	else
+		nread = rqueue_read (sockfd, px->px_net_rcvbuf[cd]);
+
+	if (nread == 0 || nread == (size_t)-1)
+		return nread;
+
+	if (cd == HOSTCD)
+		host_read_done (px, nread);
+	else
+		STATS_ADD (st_chan[cd].cs_bytes_in, nread);
+	return nread;
+}
+
+
+void
+channel_rtt_sample (proxy_t *px, cd_t cd, double rtt)
+{
+	/* Registra un campione di RTT del canale cd e aggiorna la media
+	 * mobile, con lo stesso peso usato da TCP (1/8). Il timeout di
+	 * attivita' non scende sotto il tempo in cui il peer risponde a una
+	 * sonda: l'intervallo di sonda piu' due RTT, perche' un percorso
+	 * lento non venga chiuso finche' e' vivo. */
+
+	struct chan *chptr;
+
+	assert (VALID_CD (cd) && cd != HOSTCD);
+	assert (rtt >= 0);
+
+	chptr = &px->px_ch[cd];
+	chptr->c_rtt = rtt;
+	if (chptr->c_srtt == 0)
+		chptr->c_srtt = rtt;
+	else
+		chptr->c_srtt = (7 * chptr->c_srtt + rtt) / 8;
+
+	timeout_set_maxval (chptr->c_activity, MAX (px->px_toact_val,
+				px->px_toprb_val + 2 * chptr->c_srtt));
+
+	STATS_SET (st_chan[cd].cs_srtt_us, chptr->c_srtt * 1000000);
+}
+
+
+void
+channel_set_busy_poll (proxy_t *px, double interval)
+{
+	/* Dopo ogni evento il ciclo principale controlla i fd senza
+	 * bloccarsi per interval secondi, e i socket dei canali di rete
+	 * fanno busy poll nel kernel per lo stesso intervallo: meno latenza
+	 * di risveglio al prezzo di al piu' interval secondi di cpu per
+	 * evento. Va chiamata prima di proxy_init. */
+
+	assert (interval > 0);
+
+	px->px_busy_val = interval;
+}
+
+
+void
+channel_set_host_local (proxy_t *px, bool sender)
+{
+	/* L'host sta nello stesso processo e non ha socket: l'applicazione
+	 * usa channel_host_put (sender = TRUE) o channel_host_get da un
+	 * altro thread, mentre il ciclo principale gira con core. Va
+	 * chiamata prima di proxy_init. */
+
+	assert (BOOL_VALUE (sender));
+	assert (px->px_host_path == NULL);
+
+	px->px_host_local = TRUE;
+	px->px_host_sender = sender;
+}
+
+
+void
+channel_set_host_path (proxy_t *px, char *path)
+{
+	/* Il canale con l'host usa il socket AF_UNIX path al posto di tcp:
+	 * psend vi accetta il Sender, precv vi si connette al Receiver. Va
+	 * chiamata prima di proxy_init, path deve restare valido. */
+
+	assert (path != NULL);
+	assert (!px->px_host_local);
+
+	px->px_host_path = path;
+}
+
+
+void
+channel_set_timeouts (proxy_t *px, double activity, double probe)
+{
+	/* Imposta la durata dei timeout di attivita' e di invio sonda dei
+	 * canali di rete. Va chiamata prima di proxy_init. */
+
+	assert (activity > 0);
+	assert (probe > 0);
+
+	px->px_toact_val = activity;
+	px->px_toprb_val = probe;
 }
 
 
 int
-channel_write (cd_t cd)
+channel_write (proxy_t *px, cd_t cd)
 {
+	size_t nwrite;
+	uint64_t segs;
+	fd_t sockfd;
+
 	assert (VALID_CD (cd));
-	assert (channel_is_connected (cd));
-	assert (channel_can_write (cd));
+	assert (channel_is_connected (px, cd));
+	assert (channel_can_write (px, cd));
 
+	segs = STATS_GET (mh_stats->st_chan[cd].cs_segs_out);
+	sockfd = px->px_ch[cd].c_sockfd;
 	if (cd == HOSTCD)
-		return cqueue_write (ch[cd].c_sockfd, host_sndbuf);
-	return rqueue_write (ch[cd].c_sockfd, net_sndbuf[cd]);
+		nwrite = cqueue_write (sockfd, px->px_host_sndbuf);
+	else
+		nwrite = rqueue_write (sockfd, px->px_net_sndbuf[cd]);
+
+	if (nwrite == 0 || nwrite == (size_t)-1)
+		return nwrite;
+
+	if (cd == HOSTCD) {
+		host_write_done (px, nwrite);
+		return nwrite;
+	}
+
+	STATS_ADD (st_chan[cd].cs_bytes_out, nwrite);
+	if (latency_enabled ()) {
+		/* Marca i segmenti completati da questa scrittura, vedi
+		 * kernel2net. */
+		px->px_net_written[cd] += nwrite;
+		segs = STATS_GET (mh_stats->st_chan[cd].cs_segs_out) - segs;
+		if (segs > 0)
+			tmarks_push (&px->px_kernel_marks[cd],
+					px->px_net_written[cd],
+					tstamp_now (), FALSE, 0, segs);
+	}
+	return nwrite;
 }
 
 
 void
-feed_download (void)
+feed_download (proxy_t *px)
 {
-	int err;
 	struct segwrap *head;
 
-	while ((head = getHead (joinq)) != NULL
-	       && seqcmp (seg_seq (head->sw_seg), last_sent + 1) == 0
-	       && seg_pld_len (head->sw_seg) <= cqueue_get_aval (host_sndbuf))
+	/* Con l'host su socket i payload pronti partono subito, senza
+	 * passare da host_sndbuf; il resto e' copiato in host_sndbuf. */
+	if (!px->px_host_local)
+		host_gather_write (px);
+
+	while ((head = getHead (px->px_joinq)) != NULL
+	       && seqcmp (seg_seq (head->sw_seg), px->px_last_sent + 1) == 0
+	       && seg_pld_len (head->sw_seg)
+	          <= cqueue_get_aval (px->px_host_sndbuf))
 	{
-		head = qdequeue (&joinq);
-		err = cqueue_add (host_sndbuf,
-				seg_pld (head->sw_seg),
-				seg_pld_len (head->sw_seg));
-		assert (!err);
-		last_sent = seg_seq (head->sw_seg);
-		segwrap_destroy (head);
+		head = qdequeue (&px->px_joinq);
+		STATS_SUB (st_joinq, 1);
+		deliver (px, head->sw_seg, head->sw_seglen, head->sw_tstamp,
+				0);
+		segwrap_destroy (px, head);
 	}
+	/* Conferma al Sender, che non supera SEQWIN segmenti in volo. */
+	if ((seq_t)(px->px_last_sent - px->px_last_ack_sent) >= ACKEVERY)
+		join_ack (px, FALSE);
 }
 
 
 void
-feed_upload (void)
+feed_upload (proxy_t *px)
 {
-	if (last_ack_rcvd != NULL && !ack_handled) {
-		netsndbuf_rm_acked (last_ack_rcvd);
-		ack_handled = TRUE;
+	if (px->px_last_ack_rcvd != NULL && !px->px_ack_handled) {
+		netsndbuf_rm_acked (px, px->px_last_ack_rcvd);
+		px->px_ack_handled = TRUE;
 	}
-	urg2net ();
-	host2net ();
+	urg2net (px);
+	host2net (px);
+	if (latency_enabled ())
+		kernel2net (px);
 }
 
 
-cd_t
-get_cd_from (void *element, int type)
+void
+join_ack (proxy_t *px, bool timer)
 {
-	cd_t cd;
-	cd_t retcd;
-
-	assert (element != NULL);
-
-	retcd = -1;
-	switch (type) {
-	case ELRQUEUE :
-		for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++)
-			if (net_rcvbuf[cd] == (rqueue_t *)element
-			    || net_sndbuf[cd] == (rqueue_t *)element)
-				retcd = cd;
-		break;
-	default:
-		assert (FALSE);
-	}
-	return retcd;
+	/* Conferma al peer tutti i segmenti consegnati all'host, se ce ne
+	 * sono stati. */
+
+	struct segwrap *ack;
+
+	if (px->px_last_sent == SEQMAX && px->px_last_ack_sent == SEQMAX)
+		return;
+	ack = segwrap_ack_create (px, px->px_last_sent);
+	if (timer)
+		ack->sw_seg[FLG] |= RPTFLAG;
+	urgent_add (px, ack);
+	px->px_last_ack_sent = px->px_last_sent;
 }
 
 
 void
-join_add (struct segwrap *sw)
+join_add (proxy_t *px, struct segwrap *sw)
 {
 	seq_t s;
 	seq_t seqsw;
@@ -505,51 +888,203 @@ join_add (struct segwrap *sw)
 	seqsw = seg_seq (sw->sw_seg);
 
 	/* Segmento vecchio, scartato. */
-	if (seqcmp (seqsw, last_sent) <= 0) {
-		segwrap_destroy (sw);
+	if (seqcmp (seqsw, px->px_last_sent) <= 0) {
+		MH_PROBE2 (join_dup, seqsw, px->px_last_sent);
+		trace_segment (TR_DUP, sw, -1);
+		STATS_ADD (st_dups, 1);
+		segwrap_destroy (px, sw);
 		return;
 	}
 
-	head = getHead (joinq);
+	head = getHead (px->px_joinq);
 	if (head == NULL) {
-		if (seqcmp (seqsw, last_sent + 1) != 0)
-			for (s = last_sent + 1; seqcmp (s, seqsw) < 0; s++)
-				add_nak_timeout (s);
-		qenqueue (&joinq, sw);
+		if (seqcmp (seqsw, px->px_last_sent + 1) != 0)
+			for (s = px->px_last_sent + 1; seqcmp (s, seqsw) < 0;
+			     s++)
+				add_nak_timeout (px, s);
+		qenqueue (&px->px_joinq, sw);
 	} else {
 		seq_t seqhd;
 		seq_t seqtl;
 		seqhd = seg_seq (head->sw_seg);
-		seqtl = seg_seq (joinq->sw_seg);
+		seqtl = seg_seq (px->px_joinq->sw_seg);
 		/* Maggiore della coda. */
 		if (seqcmp (seqsw, seqtl + 1) > 0) {
 			for (s = seqtl + 1; seqcmp (s, seqsw) < 0; s++)
-				add_nak_timeout (s);
-			qenqueue (&joinq, sw);
+				add_nak_timeout (px, s);
+			qenqueue (&px->px_joinq, sw);
 		}
 		/* Successivo a quello in coda. */
 		else if (seqcmp (seqsw, seqtl + 1) == 0)
-			qenqueue (&joinq, sw);
+			qenqueue (&px->px_joinq, sw);
 		/* Precedente alla testa. */
 		else if (seqcmp (seqsw, seqhd) < 0) {
-			del_nak_timeout (seqsw);
-			qpush (&joinq, sw);
+			del_nak_timeout (px, seqsw);
+			qpush (&px->px_joinq, sw);
 		}
 		/* Tra testa e coda. */
 		else {
-			del_nak_timeout (seqsw);
-			qinorder_insert (&joinq, sw, segwrap_seqcmp);
+			del_nak_timeout (px, seqsw);
+			qinorder_insert (&px->px_joinq, sw, segwrap_seqcmp);
 			/* Annulla inserimento se duplicato. */
 			if (seg_seq (sw->sw_next->sw_seg) == seqsw
-			    || seg_seq (sw->sw_prev->sw_seg) == seqsw)
-				qremove (&joinq, sw);
+			    || seg_seq (sw->sw_prev->sw_seg) == seqsw) {
+				qremove (&px->px_joinq, sw);
+				MH_PROBE2 (join_dup, seqsw, px->px_last_sent);
+				trace_segment (TR_DUP, sw, -1);
+				STATS_ADD (st_dups, 1);
+				segwrap_destroy (px, sw);
+				return;
+			}
+		}
+	}
+	STATS_ADD (st_joinq, 1);
+	MH_PROBE3 (join_add, seqsw, px->px_last_sent,
+			STATS_GET (mh_stats->st_joinq));
+}
+
+
+int
+join_add_inplace (proxy_t *px, seg_t *seg, size_t seglen, cd_t cd)
+{
+	seq_t seq;
+	struct segwrap *head;
+
+	assert (seg != NULL);
+	assert (VALID_CD (cd) && cd != HOSTCD);
+
+	if (seg_pld (seg) == NULL)
+		return -1;
+
+	seq = seg_seq (seg);
+	head = getHead (px->px_joinq);
+
+	/* Segmento vecchio o uguale alla testa della joinq, scartato senza
+	 * allocare nulla. */
+	if (seqcmp (seq, px->px_last_sent) <= 0
+	    || (head != NULL && seg_seq (head->sw_seg) == seq)) {
+		STATS_ADD (st_chan[cd].cs_segs_in, 1);
+		trace_seg (TR_RECV, seg, seglen, cd);
+		MH_PROBE2 (join_dup, seq, px->px_last_sent);
+		trace_seg (TR_DUP, seg, seglen, -1);
+		STATS_ADD (st_dups, 1);
+		return 0;
+	}
+
+	/* Il prossimo in ordine va direttamente all'host, come farebbe
+	 * feed_download: i segmenti nella joinq lo seguono tutti. Con l'host
+	 * nello stesso processo host_sndbuf va usato con il lock. */
+	if (seqcmp (seq, px->px_last_sent + 1) != 0
+	    || !channel_is_connected (px, HOSTCD))
+		return -1;
+
+	channel_host_lock (px);
+	if (seg_pld_len (seg) > cqueue_get_aval (px->px_host_sndbuf)) {
+		channel_host_unlock (px);
+		return -1;
+	}
+	STATS_ADD (st_chan[cd].cs_segs_in, 1);
+	trace_seg (TR_RECV, seg, seglen, cd);
+	if (head != NULL)
+		del_nak_timeout (px, seq);
+	deliver (px, seg, seglen, -1, 0);
+	channel_host_unlock (px);
+
+	if ((seq_t)(px->px_last_sent - px->px_last_ack_sent) >= ACKEVERY)
+		join_ack (px, FALSE);
+	return 0;
+}
+
+
+proxy_t *
+proxy_create (void)
+{
+	/* Alloca un proxy con i timeout predefiniti. Le strutture dati vanno
+	 * inizializzate con proxy_init. */
+
+	cd_t cd;
+	proxy_t *px;
+
+	px = xmalloc (sizeof (proxy_t));
+	memset (px, 0, sizeof (proxy_t));
+	for (cd = 0; cd < CHANNELS; cd++) {
+		px->px_ch[cd].c_sockfd = -1;
+		px->px_ch[cd].c_listfd = -1;
+	}
+	px->px_toact_val = TOACT_VAL;
+	px->px_toprb_val = TOPRB_VAL;
+
+	pthread_mutex_init (&px->px_host_lock, NULL);
+	px->px_wake[0] = px->px_wake[1] = -1;
+	px->px_ready[0] = px->px_ready[1] = -1;
+
+	return px;
+}
+
+
+void
+proxy_destroy (proxy_t *px)
+{
+	/* Chiude i canali e dealloca px con tutti i segmenti e i timeout che
+	 * contiene. Il ciclo principale di px deve essere terminato. */
+
+	int i;
+	cd_t cd;
+	struct segwrap *sw;
+
+	/* Canali: channel_invalidate chiude i socket e rilascia timeout e
+	 * net_sndbuf, i cui segmenti vanno prima scartati. Il timeout di
+	 * riapertura resta fino alla distruzione. */
+	for (cd = 0; cd < CHANNELS; cd++) {
+		if (cd != HOSTCD && px->px_net_sndbuf[cd] != NULL)
+			while ((sw = qdequeue (&px->px_net_sndbuf[cd]->rq_sgmt))
+			       != NULL)
+				segwrap_destroy (px, sw);
+		channel_invalidate (px, cd);
+		if (px->px_ch[cd].c_reopen != NULL) {
+			del_timeout (px, px->px_ch[cd].c_reopen, TOACT);
+			timeout_destroy (px, px->px_ch[cd].c_reopen);
+			px->px_ch[cd].c_reopen = NULL;
+		}
+		if (cd != HOSTCD && px->px_net_rcvbuf[cd] != NULL) {
+			rqueue_destroy (px->px_net_rcvbuf[cd]);
+			px->px_net_rcvbuf[cd] = NULL;
 		}
 	}
+	if (px->px_host_rcvbuf != NULL)
+		cqueue_destroy (px->px_host_rcvbuf);
+	if (px->px_host_sndbuf != NULL)
+		cqueue_destroy (px->px_host_sndbuf);
+
+	/* Il lato di lettura di px_wake era il sockfd dell'host. */
+	if (px->px_wake[1] >= 0)
+		tcp_close (&px->px_wake[1]);
+	for (i = 0; i < 2; i++)
+		if (px->px_ready[i] >= 0)
+			tcp_close (&px->px_ready[i]);
+	pthread_mutex_destroy (&px->px_host_lock);
+
+	/* Code di segmenti. */
+	while ((sw = qdequeue (&px->px_joinq)) != NULL) {
+		STATS_SUB (st_joinq, 1);
+		segwrap_destroy (px, sw);
+	}
+	for (i = 0; i < URGNO; i++)
+		while ((sw = qdequeue (&px->px_urgentq[i])) != NULL) {
+			STATS_SUB (st_urgentq[i], 1);
+			segwrap_destroy (px, sw);
+		}
+	if (px->px_last_ack_rcvd != NULL)
+		segwrap_destroy (px, px->px_last_ack_rcvd);
+
+	destroy_timeout_module (px);
+	destroy_segment_module (px);
+	xfree (px);
 }
 
 
 int
-proxy_init (port_t hostlistport,
+proxy_init (proxy_t *px, port_t hostlistport,
 		char *netconnaddr[NETCHANNELS],
 		port_t netconnport[NETCHANNELS],
 		port_t netlistport[NETCHANNELS],
@@ -561,12 +1096,19 @@ proxy_init (port_t hostlistport,
 	int i;
 	cd_t cd;
 
+	init_timeout_module (px);
+	init_segment_module (px);
+
 	/* Canale con l'host e relativi buffer applicazione. */
-	err = channel_init (HOSTCD, hostlistport, hostconnaddr, hostconnport);
+	px->px_host_rcvbuf = NULL;
+	px->px_host_sndbuf = NULL;
+	if (px->px_host_local)
+		err = host_local_init (px);
+	else
+		err = channel_init (px, HOSTCD, hostlistport, hostconnaddr,
+				hostconnport);
 	if (err)
 		goto error;
-	host_rcvbuf = NULL;
-	host_sndbuf = NULL;
 
 	/* Canali con il ritardatore e relativi buffer applicazione. */
 	for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++) {
@@ -574,28 +1116,29 @@ proxy_init (port_t hostlistport,
 		port_t connport = (netconnport ? netconnport[cd] : 0);
 		char *connaddr = (netconnaddr ? netconnaddr[cd] : NULL);
 
-		err = channel_init (cd, listport, connaddr, connport);
+		err = channel_init (px, cd, listport, connaddr, connport);
 		if (err)
 			goto error;
-		net_rcvbuf[cd] = NULL;
-		net_sndbuf[cd] = NULL;
+		px->px_net_rcvbuf[cd] = NULL;
+		px->px_net_sndbuf[cd] = NULL;
 	}
 
 	/* Contatori numeri di sequenza. */
-	outseq = 0;
-	last_sent = SEQMAX;
+	px->px_outseq = 0;
+	px->px_last_sent = SEQMAX;
+	px->px_last_ack_sent = SEQMAX;
 
 	/* Code di segmenti. */
-	joinq = newQueue ();
+	px->px_joinq = newQueue ();
 	for (i = 0; i < URGNO; i++)
-		urgentq[i] = newQueue ();
+		px->px_urgentq[i] = newQueue ();
 
 	/* Indice round robin per routing. */
-	rrcd = NETCD;
+	px->px_rrcd = NETCD;
 
 	/* Gestione ack ricevuti. */
-	last_ack_rcvd = NULL;
-	ack_handled = TRUE;
+	px->px_last_ack_rcvd = NULL;
+	px->px_ack_handled = TRUE;
 
 #if !HAVE_MSG_NOSIGNAL
 	/* Ignora SIGPIPE nei sistemi che non hanno MSG_NOSIGNAL. */
@@ -622,42 +1165,77 @@ error:
 }
 
 
+void
+proxy_stop (proxy_t *px)
+{
+	/* Chiede al ciclo principale di px, in esecuzione in un altro
+	 * thread, di terminare. Solo con l'host nello stesso processo. */
+
+	assert (px->px_host_local);
+
+	pthread_mutex_lock (&px->px_host_lock);
+	px->px_stop = TRUE;
+	host_local_wake (px);
+	pthread_mutex_unlock (&px->px_host_lock);
+}
+
+
+bool
+proxy_stopped (proxy_t *px)
+{
+	/* Ritorna TRUE se e' stato chiamato proxy_stop. */
+
+	bool stop;
+
+	channel_host_lock (px);
+	stop = px->px_stop;
+	channel_host_unlock (px);
+
+	return stop;
+}
+
+
 int
-accept_connection (cd_t cd)
+accept_connection (proxy_t *px, cd_t cd)
 {
 	int err;
 	socklen_t raddr_len;
+	struct chan *chptr;
 
 	assert (VALID_CD (cd));
-	assert (ch[cd].c_sockfd < 0);
-	assert (ch[cd].c_listfd >= 0);
-	assert (addr_is_set (&ch[cd].c_laddr));
-	assert (!addr_is_set (&ch[cd].c_raddr));
+	chptr = &px->px_ch[cd];
+	assert (chptr->c_sockfd < 0);
+	assert (chptr->c_listfd >= 0);
+	assert (addr_is_set (&chptr->c_laddr));
+	assert (!addr_is_set (&chptr->c_raddr));
 
 	do {
-		raddr_len = sizeof (ch[cd].c_raddr);
-		ch[cd].c_sockfd = accept (ch[cd].c_listfd,
-				(struct sockaddr *)&ch[cd].c_raddr,
-				&raddr_len);
-	} while (ch[cd].c_sockfd < 0 && errno == EINTR);
+		raddr_len = sizeof (chptr->c_raddr);
+		chptr->c_sockfd = accept (chptr->c_listfd,
+				&chptr->c_raddr.a_sa, &raddr_len);
+	} while (chptr->c_sockfd < 0 && errno == EINTR);
 
-	assert (!(ch[cd].c_sockfd < 0
+	assert (!(chptr->c_sockfd < 0
 	          && (errno == EAGAIN || errno == EWOULDBLOCK)));
 
-	if (ch[cd].c_sockfd < 0) {
+	if (chptr->c_sockfd < 0) {
 		fprintf (stderr, "Canale %s, accept fallita: %s\n",
-				channel_name (cd), strerror (errno));
+				channel_name (px, cd), strerror (errno));
 	}
 
 	/* A prescindere dall'esito dell'accept, chiusura del socket
 	 * listening. */
-	tcp_close (&ch[cd].c_listfd);
+	tcp_close (&chptr->c_listfd);
 
-	if (ch[cd].c_sockfd < 0) {
+	if (chptr->c_sockfd < 0) {
 		return -1;
 	}
 
-	err = tcp_set_block (ch[cd].c_sockfd, FALSE);
+	/* Il client AF_UNIX di solito non ha nome. */
+	if (!addr_is_set (&chptr->c_raddr))
+		chptr->c_raddr.a_sa.sa_family = chptr->c_laddr.a_sa.sa_family;
+
+	err = tcp_set_block (chptr->c_sockfd, FALSE);
 	assert (!err);
 
 	return 0;
@@ -665,33 +1243,39 @@ accept_connection (cd_t cd)
 
 
 void
-activate_channels (void)
+activate_channels (proxy_t *px)
 {
 	int i;
 	int err;
 
-	for (i = 0; i < CHANNELS; i++) if (channel_is_activable (i)) {
+	for (i = 0; i < CHANNELS; i++) if (channel_is_activable (px, i)) {
 
-		if (channel_must_connect (i)) {
-			err = connect_noblock (i);
+		if (channel_must_connect (px, i)) {
+			/* Un canale di rete che non si connette riprova con il
+			 * timeout di riapertura. */
+			err = connect_noblock (px, i);
+			if (err && i != HOSTCD) {
+				channel_close (px, i);
+				continue;
+			}
 			assert (!err); /* FIXME controllo errore decente. */
 
 			/* Connect gia' conclusa, recupera nome del socket. */
 			if (errno != EINPROGRESS) {
-				tcp_sockname (ch[i].c_sockfd,
-						&ch[i].c_laddr);
-				channel_prepare_io (i);
+				tcp_sockname (px->px_ch[i].c_sockfd,
+						&px->px_ch[i].c_laddr);
+				channel_prepare_io (px, i);
 			}
-			printf ("Canale %s %s.\n", channel_name (i),
-					addr_is_set (&ch[i].c_laddr) ?
+			printf ("Canale %s %s.\n", channel_name (px, i),
+					addr_is_set (&px->px_ch[i].c_laddr) ?
 					"connesso" : "in connessione");
 		}
-		else if (channel_must_listen (i)) {
-			err = listen_noblock (i);
+		else if (channel_must_listen (px, i)) {
+			err = listen_noblock (px, i);
 			assert (!err); /* FIXME controllo errore decente. */
 
 			printf ("Canale %s in ascolto.\n",
-					channel_name (i));
+					channel_name (px, i));
 		}
 		else {
 			assert (FALSE);
@@ -701,49 +1285,51 @@ activate_channels (void)
 
 
 int
-finalize_connection (cd_t cd)
+finalize_connection (proxy_t *px, cd_t cd)
 {
 	int err;
 	int optval;
 	socklen_t optsize;
+	struct chan *chptr;
 
 	assert (VALID_CD (cd));
-	assert (ch[cd].c_sockfd >= 0);
-	assert (ch[cd].c_listfd < 0);
-	assert (!addr_is_set (&ch[cd].c_laddr));
-	assert (addr_is_set (&ch[cd].c_raddr));
+	chptr = &px->px_ch[cd];
+	assert (chptr->c_sockfd >= 0);
+	assert (chptr->c_listfd < 0);
+	assert (!addr_is_set (&chptr->c_laddr));
+	assert (addr_is_set (&chptr->c_raddr));
 
 	optsize = sizeof (optval);
 
 	/*
 	 * Verifica esito connessione.
 	 */
-	err = getsockopt (ch[cd].c_sockfd, SOL_SOCKET, SO_ERROR, &optval,
+	err = getsockopt (chptr->c_sockfd, SOL_SOCKET, SO_ERROR, &optval,
 			&optsize);
 	if (err) {
 		fprintf (stderr, "Canale %s, getsockopt in "
 				"finalize_connection fallita: %s\n",
-				channel_name (cd), strerror (errno));
+				channel_name (px, cd), strerror (errno));
 		return -1;
 	}
 
 	if (optval != 0) {
 		fprintf (stderr, "Canale %s, tentativo di connessione "
-				"fallito.\n", channel_name (cd));
+				"fallito.\n", channel_name (px, cd));
 		return -1;
 	}
 
 	/*
 	 * Connessione riuscita.
 	 */
-	tcp_sockname (ch[cd].c_sockfd, &ch[cd].c_laddr);
+	tcp_sockname (chptr->c_sockfd, &chptr->c_laddr);
 
 	return 0;
 }
 
 
 fd_t
-set_file_descriptors (fd_set *rdset, fd_set *wrset)
+set_file_descriptors (proxy_t *px, fd_set *rdset, fd_set *wrset)
 {
 	int i;
 	fd_t max;
@@ -754,24 +1340,24 @@ set_file_descriptors (fd_set *rdset, fd_set *wrset)
 	max = -1;
 	for (i = 0; i < CHANNELS; i++) {
 		/* Dati da leggere e/o scrivere. */
-		if (channel_is_connected (i)) {
-			if (channel_can_read (i)) {
-				FD_SET (ch[i].c_sockfd, rdset);
-				max = MAX (ch[i].c_sockfd, max);
+		if (channel_is_connected (px, i)) {
+			if (channel_can_read (px, i)) {
+				FD_SET (px->px_ch[i].c_sockfd, rdset);
+				max = MAX (px->px_ch[i].c_sockfd, max);
 			}
-			if (channel_can_write (i)) {
-				FD_SET (ch[i].c_sockfd, wrset);
-				max = MAX (ch[i].c_sockfd, max);
+			if (channel_can_write (px, i)) {
+				FD_SET (px->px_ch[i].c_sockfd, wrset);
+				max = MAX (px->px_ch[i].c_sockfd, max);
 			}
 		}
 		/* Connessioni da completare o accettare. */
 		else {
-			if (channel_is_connecting (i)) {
-				FD_SET (ch[i].c_sockfd, wrset);
-				max = MAX (ch[i].c_sockfd, max);
-			} else if (channel_is_listening (i)) {
-				FD_SET (ch[i].c_listfd, rdset);
-				max = MAX (ch[i].c_listfd, max);
+			if (channel_is_connecting (px, i)) {
+				FD_SET (px->px_ch[i].c_sockfd, wrset);
+				max = MAX (px->px_ch[i].c_sockfd, max);
+			} else if (channel_is_listening (px, i)) {
+				FD_SET (px->px_ch[i].c_listfd, rdset);
+				max = MAX (px->px_ch[i].c_listfd, max);
 			}
 		}
 	}
@@ -780,40 +1366,45 @@ set_file_descriptors (fd_set *rdset, fd_set *wrset)
 
 
 struct segwrap *
-set_last_ack_rcvd (struct segwrap *ack)
+set_last_ack_rcvd (proxy_t *px, struct segwrap *ack)
 {
+	/* Se ack conferma piu' dell'ultimo ricevuto ne prende il posto.
+	 * Ritorna il segwrap non piu' utilizzato, da deallocare. */
+
 	struct segwrap *old_ack;
 
-	if (last_ack_rcvd == NULL
-	    || segwrap_seqcmp (last_ack_rcvd, ack) < 0) {
-		old_ack = last_ack_rcvd;
-		last_ack_rcvd = ack;
-		ack_handled = FALSE;
+	if (px->px_last_ack_rcvd == NULL
+	    || segwrap_seqcmp (px->px_last_ack_rcvd, ack) < 0) {
+		old_ack = px->px_last_ack_rcvd;
+		px->px_last_ack_rcvd = ack;
+		px->px_ack_handled = FALSE;
 	} else
-		old_ack = NULL;
+		old_ack = ack;
 
 	return old_ack;
 }
 
 
 void
-urgent_add (struct segwrap *sw)
+urgent_add (proxy_t *px, struct segwrap *sw)
 {
 	int i;
 
 	assert (sw != NULL);
 
+	trace_segment (TR_URGENT, sw, -1);
 	i = segwrap_prio (sw);
-	qinorder_insert (&urgentq[i], sw, &segwrap_urgcmp);
+	qinorder_insert (&px->px_urgentq[i], sw, &segwrap_urgcmp);
+	STATS_ADD (st_urgentq[i], 1);
 }
 
 
 bool
-urgent_empty (void)
+urgent_empty (proxy_t *px)
 {
 	int i;
 
-	for (i = 0; i < URGNO && isEmpty (urgentq[i]); i++);
+	for (i = 0; i < URGNO && isEmpty (px->px_urgentq[i]); i++);
 
 	if (i < URGNO)
 		return TRUE;
@@ -822,41 +1413,46 @@ urgent_empty (void)
 
 
 struct segwrap *
-urgent_head (void)
+urgent_head (proxy_t *px)
 {
 	int i;
 
-	for (i = 0; i < URGNO && isEmpty (urgentq[i]); i++);
+	for (i = 0; i < URGNO && isEmpty (px->px_urgentq[i]); i++);
 
 	if (i < URGNO)
-		return getHead (urgentq[i]);
+		return getHead (px->px_urgentq[i]);
 	return NULL;
 }
 
 
 struct segwrap *
-urgent_remove (void)
+urgent_remove (proxy_t *px)
 {
 	int i;
 
-	for (i = 0; i < URGNO && isEmpty (urgentq[i]); i++);
+	for (i = 0; i < URGNO && isEmpty (px->px_urgentq[i]); i++);
 
-	if (i < URGNO)
-		return qdequeue (&urgentq[i]);
+	if (i < URGNO) {
+		STATS_SUB (st_urgentq[i], 1);
+		return qdequeue (&px->px_urgentq[i]);
+	}
 	return NULL;
 }
 
 
 void
-urgent_rm_acked (struct segwrap *ack)
+urgent_rm_acked (proxy_t *px, struct segwrap *ack)
 {
 	int i;
 	struct segwrap *rmvdq;
 
 	for (i = 0; i < URGNO; i++) {
-		rmvdq = qremove_all_that (&urgentq[i], &segwrap_is_acked, ack);
-		while (!isEmpty (rmvdq))
-			segwrap_destroy (qdequeue (&rmvdq));
+		rmvdq = qremove_all_that (&px->px_urgentq[i], &segwrap_is_acked,
+				ack);
+		while (!isEmpty (rmvdq)) {
+			STATS_SUB (st_urgentq[i], 1);
+			segwrap_destroy (px, qdequeue (&rmvdq));
+		}
 	}
 }
 
@@ -866,54 +1462,133 @@ urgent_rm_acked (struct segwrap *ack)
 *******************************************************************************/
 
 
-static bool
-check_read_activity (cd_t cd, int nread)
+static void
+chan_reset (proxy_t *px, cd_t cd)
 {
-	static int prev_used[NETCHANNELS];
-	int now_used;
-	bool is_active;
+	/* Riporta il canale cd, chiuso, allo stato impostato da
+	 * channel_init: activate_channels lo connette o lo mette in ascolto
+	 * al prossimo giro. */
 
-	assert (nread >= 0);
+	struct chan *chptr;
 
-	is_active = FALSE;
-	now_used = tcp_get_used_space (ch[cd].c_sockfd, SO_RCVBUF);
-	assert (now_used >= 0);
+	chptr = &px->px_ch[cd];
+	assert (chptr->c_sockfd < 0);
+	assert (chptr->c_listfd < 0);
 
-	fprintf (stderr, "check_READ_activity: now_used = %d, nwrite = %d, prev_used = %d\n", now_used, nread, prev_used[cd]);
+	chptr->c_laddr = chptr->c_cfg_laddr;
+	chptr->c_raddr = chptr->c_cfg_raddr;
+	crono_start (&chptr->c_uptime);
 
-	if (now_used + nread > prev_used[cd])
-		is_active = TRUE;
-	prev_used[cd] = now_used;
+	chptr->c_tcp_rcvbuf_len = 0;
+	chptr->c_tcp_sndbuf_len = 0;
 
-	return is_active;
+	chptr->c_activity = NULL;
+	chptr->c_probe = NULL;
+	chptr->c_prbseq = 0;
+	chptr->c_rtt = 0;
+	chptr->c_srtt = 0;
+	if (cd != HOSTCD) {
+		chptr->c_tcp_sndbuf_len = TCP_MIN_SNDBUF_SIZE;
+		chptr->c_activity = timeout_create (px,
+				MAX (px->px_toact_val, TOACT_INIT),
+				channel_close, cd, FALSE);
+		chptr->c_probe = timeout_create (px, px->px_toprb_val,
+				channel_probe, cd, FALSE);
+	}
+	if (sim_enabled ()) {
+		chptr->c_tcp_rcvbuf_len = TCP_SIM_BUF_SIZE;
+		if (chptr->c_tcp_sndbuf_len == 0)
+			chptr->c_tcp_sndbuf_len = TCP_SIM_BUF_SIZE;
+	}
 }
 
 
-static bool
-check_write_activity (cd_t cd, int nwrite)
+static void
+channel_reopen (proxy_t *px, cd_t cd)
 {
-	static int prev_used[NETCHANNELS];
-	int now_used;
-	bool is_active;
+	/* Trigger del timeout di riapertura di un canale di rete chiuso. */
+
+	assert (VALID_CD (cd) && cd != HOSTCD);
+
+	del_timeout (px, px->px_ch[cd].c_reopen, TOACT);
+	fprintf (stderr, "Canale %d riaperto.\n", cd);
+	chan_reset (px, cd);
+}
+
+
+static void
+consume_marks (tmarks_t *tm, uint64_t pos, int stage)
+{
+	/* Rimuove i marcatori di tm che terminano entro pos e registra nella
+	 * fase stage il tempo trascorso dalla marcatura. Per i marcatori con
+	 * timestamp registra anche la latenza totale. */
+
+	tst_t now;
+	struct tmark *mark;
+
+	assert (tm != NULL);
+	assert (stage >= 0 && stage < HSTAGES);
+
+	if (tmarks_first (tm) == NULL)
+		return;
+
+	now = tstamp_now ();
+	while ((mark = tmarks_first (tm)) != NULL && mark->tm_end <= pos) {
+		histo_add (&mh_stats->st_histo[stage],
+				tstamp_diff (now, mark->tm_time),
+				mark->tm_count);
+		/* Il timestamp viene dall'orologio del Sender: una
+		 * differenza negativa e' dovuta alla sincronizzazione e vale
+		 * 0. */
+		if (mark->tm_has_tst)
+			histo_add (&mh_stats->st_histo[HS_TOTAL],
+					(int32_t)(now - mark->tm_tst)
+					/ 1000000.0,
+					mark->tm_count);
+		tmarks_pop (tm);
+	}
+}
 
-	assert (nwrite >= 0);
 
-	is_active = FALSE;
-	now_used = tcp_get_used_space (ch[cd].c_sockfd, SO_SNDBUF);
-	assert (now_used >= 0);
+static void
+deliver (proxy_t *px, seg_t *seg, size_t seglen, double joined,
+		size_t written)
+{
+	/* Consegna il segmento seg, lungo seglen, che deve essere il
+	 * prossimo: copia in host_sndbuf il payload tranne i primi written
+	 * byte, gia' scritti all'host. joined e' l'istante in cui seg e'
+	 * entrato nella joinq, negativo se non ci e' passato. */
 
-	fprintf (stderr, "check_WRITE_activity: now_used = %d, nwrite = %d, prev_used = %d\n", now_used, nwrite, prev_used[cd]);
+	int err;
 
-	if (now_used - nwrite < prev_used[cd])
-		is_active = TRUE;
-	prev_used[cd] = now_used;
+	assert (written <= seg_pld_len (seg));
 
-	return is_active;
+	if (written < seg_pld_len (seg)) {
+		err = cqueue_add (px->px_host_sndbuf, seg_pld (seg) + written,
+				seg_pld_len (seg) - written);
+		assert (!err);
+	}
+	if (latency_enabled ()) {
+		struct timeval now;
+		bool has_tst;
+
+		gettime (&now);
+		histo_add (&mh_stats->st_histo[HS_JOINQ],
+				joined >= 0 ? tv2d (&now, FALSE) - joined : 0,
+				1);
+		px->px_host_queued += seg_pld_len (seg);
+		has_tst = seg_has_tst (seg);
+		tmarks_push (&px->px_sndbuf_marks, px->px_host_queued,
+				tstamp_now (), has_tst,
+				has_tst ? seg_tst (seg) : 0, 1);
+	}
+	px->px_last_sent = seg_seq (seg);
+	trace_seg (TR_DELIVER, seg, seglen, -1);
 }
 
 
 static int
-connect_noblock (cd_t cd)
+connect_noblock (proxy_t *px, cd_t cd)
 {
 	/* Connessione non bloccante. Crea un socket, lo imposta non bloccante
 	 * ed esegue una connect (senza bind) usando la struct sockaddr_in del
@@ -926,13 +1601,13 @@ connect_noblock (cd_t cd)
 	struct chan *chptr;
 
 	assert (VALID_CD (cd));
-	assert (!addr_is_set (&ch[cd].c_laddr));
-	assert (addr_is_set (&ch[cd].c_raddr));
-	assert (ch[cd].c_listfd < 0);
-	assert (ch[cd].c_sockfd < 0);
+	chptr = &px->px_ch[cd];
+	assert (!addr_is_set (&chptr->c_laddr));
+	assert (addr_is_set (&chptr->c_raddr));
+	assert (chptr->c_listfd < 0);
+	assert (chptr->c_sockfd < 0);
 
-	chptr = &ch[cd];
-	chptr->c_sockfd = xtcp_socket ();
+	chptr->c_sockfd = xtcp_socket (chptr->c_raddr.a_sa.sa_family);
 
 	err = tcp_set_block (chptr->c_sockfd, FALSE);
 	if (err)
@@ -957,9 +1632,8 @@ connect_noblock (cd_t cd)
 
 	/* Tentativo di connessione. */
 	do {
-		err = connect (chptr->c_sockfd,
-				(struct sockaddr *)&chptr->c_raddr,
-				sizeof (chptr->c_raddr));
+		err = connect (chptr->c_sockfd, &chptr->c_raddr.a_sa,
+				addr_len (&chptr->c_raddr));
 	} while (err == -1 && errno == EINTR);
 
 	if (!err || errno == EINPROGRESS)
@@ -967,27 +1641,32 @@ connect_noblock (cd_t cd)
 
 error:
 	fprintf (stderr, "Canale %s, errore di connessione: %s\n",
-			channel_name (cd), strerror (errno));
+			channel_name (px, cd), strerror (errno));
 	tcp_close (&chptr->c_sockfd);
 	return -1;
 }
 
 
 static int
-listen_noblock (cd_t cd)
+listen_noblock (proxy_t *px, cd_t cd)
 {
 	int err;
 	char *errmsg;
 	struct chan *chptr;
 
 	assert (VALID_CD (cd));
-	assert (addr_is_set (&ch[cd].c_laddr));
-	assert (!addr_is_set (&ch[cd].c_raddr));
-	assert (ch[cd].c_listfd < 0);
-	assert (ch[cd].c_sockfd < 0);
+	chptr = &px->px_ch[cd];
+	assert (addr_is_set (&chptr->c_laddr));
+	assert (!addr_is_set (&chptr->c_raddr));
+	assert (chptr->c_listfd < 0);
+	assert (chptr->c_sockfd < 0);
 
-	chptr = &ch[cd];
-	chptr->c_listfd = xtcp_socket ();
+	chptr->c_listfd = xtcp_socket (chptr->c_laddr.a_sa.sa_family);
+
+	/* Il path di un socket AF_UNIX resta anche dopo la chiusura, va
+	 * rimosso prima della bind. */
+	if (chptr->c_laddr.a_sa.sa_family == AF_UNIX)
+		unlink (chptr->c_laddr.a_un.sun_path);
 
 	err = tcp_set_reusable (chptr->c_listfd, TRUE);
 	if (err) {
@@ -995,8 +1674,8 @@ listen_noblock (cd_t cd)
 		goto error;
 	}
 
-	err = bind (chptr->c_listfd, (struct sockaddr *)&chptr->c_laddr,
-			sizeof (chptr->c_laddr));
+	err = bind (chptr->c_listfd, &chptr->c_laddr.a_sa,
+			addr_len (&chptr->c_laddr));
 	if (err) {
 		errmsg = "bind fallita";
 		goto error;
@@ -1036,7 +1715,7 @@ listen_noblock (cd_t cd)
 	return 0;
 
 error:
-	fprintf (stderr, "Canale %s, %s: %s\n", channel_name (cd), errmsg,
+	fprintf (stderr, "Canale %s, %s: %s\n", channel_name (px, cd), errmsg,
 			strerror (errno));
 	tcp_close (&chptr->c_listfd);
 	return -1;
@@ -1044,38 +1723,279 @@ error:
 
 
 static void
-host2net (void)
+host2net (proxy_t *px)
 {
 	int needmask;
 	size_t host_nbytes;
 	len_t pldlen;
+	seq_t acked;
+	cd_t rrcd;
 
+	/* Con SEQWIN segmenti in volo si aspetta un ACK. */
+	acked = (px->px_last_ack_rcvd != NULL
+	         ? seg_seq (px->px_last_ack_rcvd->sw_seg) : SEQMAX);
 	needmask = 0x7;
-	host_nbytes = cqueue_get_used (host_rcvbuf);
+	host_nbytes = cqueue_get_used (px->px_host_rcvbuf);
 	pldlen = MIN (host_nbytes, PLDDEFLEN);
-	while (needmask != 0x0 && host_nbytes > 0) {
-		if (channel_is_connected (rrcd)
-		    && rqueue_get_aval (net_sndbuf[rrcd]) >= (HDRMAXLEN
-		                                              + pldlen)) {
+	while (needmask != 0x0 && host_nbytes > 0
+	       && (seq_t)(px->px_outseq - acked - 1) < SEQWIN) {
+		rrcd = px->px_rrcd;
+		if (channel_is_connected (px, rrcd)
+		    && rqueue_get_aval (px->px_net_sndbuf[rrcd])
+		       >= HDRMAXLEN + pldlen) {
 			struct segwrap *newsw;
+			struct tmark *mark;
+
+			/* Con le misure abilitate il segmento porta l'istante
+			 * di lettura del suo primo byte. */
+			newsw = segwrap_create (px);
+			mark = tmarks_first (&px->px_rcvbuf_marks);
+			segwrap_fill (newsw, px->px_host_rcvbuf, pldlen,
+					px->px_outseq++,
+					(mark != NULL ? &mark->tm_time : NULL));
+			trace_segment (TR_CREATE, newsw, -1);
+			if (mark != NULL) {
+				px->px_host_taken += pldlen;
+				consume_marks (&px->px_rcvbuf_marks,
+						px->px_host_taken, HS_RCVBUF);
+			}
 
-			newsw = segwrap_create ();
-			segwrap_fill (newsw, host_rcvbuf, pldlen,
-					outseq++);
-
-			rqueue_add (net_sndbuf[rrcd], newsw);
+			rqueue_add (px->px_net_sndbuf[rrcd], newsw);
+			trace_segment (TR_QUEUE, newsw, rrcd);
 
-			host_nbytes = cqueue_get_used (host_rcvbuf);
+			host_nbytes = cqueue_get_used (px->px_host_rcvbuf);
 			pldlen = MIN (host_nbytes, PLDDEFLEN);
 		} else
 			needmask &= ~(0x1 << rrcd);
-		ROTATE_RRCD;
+		ROTATE_RRCD (px);
+	}
+}
+
+
+static void
+host_gather_write (proxy_t *px)
+{
+	/* Scrive all'host con una sola sendmsg quanto e' in host_sndbuf e
+	 * di seguito i payload dei segmenti della joinq pronti per la
+	 * consegna. I segmenti scritti, anche in parte, sono consegnati; se
+	 * la scrittura fallisce se ne occupera' channel_write. */
+
+	int niov;
+	int errno_s;
+	size_t used;
+	size_t nwrite;
+	ssize_t nw;
+	seq_t next;
+	struct segwrap *cur;
+	struct iovec iov[IOVLEN];
+	struct msghdr msg;
+
+	if (!channel_is_connected (px, HOSTCD))
+		return;
+
+	niov = 0;
+	used = cqueue_get_used (px->px_host_sndbuf);
+	if (used > 0) {
+		iov[niov].iov_base = cqueue_head (px->px_host_sndbuf);
+		iov[niov++].iov_len = used;
+	}
+	next = px->px_last_sent + 1;
+	for (cur = getHead (px->px_joinq);
+	     cur != NULL && niov < IOVLEN && seg_seq (cur->sw_seg) == next;
+	     cur = (cur != px->px_joinq ? getNext (cur) : NULL), next++) {
+		iov[niov].iov_base = seg_pld (cur->sw_seg);
+		iov[niov++].iov_len = seg_pld_len (cur->sw_seg);
+	}
+	if (niov == 0 || (used > 0 && niov == 1))
+		return;
+
+	errno_s = errno;
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+	do {
+		nw = sendmsg (px->px_ch[HOSTCD].c_sockfd, &msg, MSG_NOSIGNAL);
+	} while (nw == -1 && errno == EINTR);
+	errno = errno_s;
+	if (nw <= 0)
+		return;
+
+	/* Prima i byte di host_sndbuf, poi i segmenti, l'ultimo dei quali
+	 * puo' essere stato scritto in parte. */
+	nwrite = nw;
+	if (used > 0) {
+		cqueue_drop_head (px->px_host_sndbuf, MIN (used, nwrite));
+		nwrite -= MIN (used, nwrite);
+	}
+	while (nwrite > 0) {
+		size_t written;
+
+		cur = qdequeue (&px->px_joinq);
+		assert (cur != NULL);
+		STATS_SUB (st_joinq, 1);
+		written = MIN (nwrite, seg_pld_len (cur->sw_seg));
+		nwrite -= written;
+		deliver (px, cur->sw_seg, cur->sw_seglen, cur->sw_tstamp,
+				written);
+		segwrap_destroy (px, cur);
+	}
+	host_write_done (px, nw);
+}
+
+
+static int
+host_local_drain (proxy_t *px)
+{
+	/* Svuota la pipe di risveglio dell'host nello stesso processo. Il
+	 * flag va azzerato prima: un risveglio successivo riscrive nella
+	 * pipe, al piu' ne viene letto uno in anticipo.
+	 * Ritorna 0, con errno 0 se non ci sono errori. */
+
+	char buf[64];
+	ssize_t nr;
+
+	pthread_mutex_lock (&px->px_host_lock);
+	px->px_wake_pending = FALSE;
+	pthread_mutex_unlock (&px->px_host_lock);
+
+	do {
+		nr = read (px->px_ch[HOSTCD].c_sockfd, buf, sizeof (buf));
+	} while (nr > 0 || (nr == -1 && errno == EINTR));
+
+	if (nr == -1 && errno == EAGAIN)
+		errno = 0;
+	else if (nr == 0)
+		errno = EREOF;
+	return 0;
+}
+
+
+static int
+host_local_init (proxy_t *px)
+{
+	/* Prepara il canale con l'host nello stesso processo: non ha socket,
+	 * il suo sockfd e' il lato di lettura della pipe di risveglio e i
+	 * buffer applicazione esistono da subito.
+	 * Ritorna -1 se fallisce, 0 se riesce. */
+
+	int i;
+	struct chan *chptr;
+
+	if (pipe (px->px_wake) || pipe (px->px_ready)) {
+		perror ("pipe");
+		return -1;
+	}
+	for (i = 0; i < 2; i++)
+		if (tcp_set_block (px->px_wake[i], FALSE)
+		    || tcp_set_block (px->px_ready[i], FALSE)) {
+			perror ("tcp_set_block");
+			return -1;
+		}
+
+	chptr = &px->px_ch[HOSTCD];
+	memset (chptr, 0, sizeof (struct chan));
+	chptr->c_listfd = -1;
+	chptr->c_sockfd = px->px_wake[0];
+
+	px->px_host_rcvbuf = cqueue_create (HOST_LOCAL_BUF_SIZE);
+	px->px_host_sndbuf = cqueue_create (HOST_LOCAL_BUF_SIZE);
+	host_local_notify (px);
+
+	STATS_SET (st_chan[HOSTCD].cs_connected, 1);
+	return 0;
+}
+
+
+static void
+host_local_notify (proxy_t *px)
+{
+	/* Tiene in px_ready un byte finche' l'applicazione puo' scrivere
+	 * (Sender) o leggere (Receiver). Va chiamata con il lock. */
+
+	bool ready;
+	char c;
+
+	if (px->px_host_sender)
+		ready = (cqueue_get_aval (px->px_host_rcvbuf) > 0);
+	else
+		ready = (cqueue_get_used (px->px_host_sndbuf) > 0);
+
+	if (ready && !px->px_ready_set) {
+		if (write (px->px_ready[1], "", 1) == 1)
+			px->px_ready_set = TRUE;
+	} else if (!ready && px->px_ready_set) {
+		if (read (px->px_ready[0], &c, 1) == 1)
+			px->px_ready_set = FALSE;
+	}
+}
+
+
+static void
+host_local_wake (proxy_t *px)
+{
+	/* Sveglia il ciclo principale, se non e' gia' stato fatto dall'ultima
+	 * host_local_drain. Va chiamata con il lock. */
+
+	if (!px->px_wake_pending
+	    && write (px->px_wake[1], "", 1) == 1)
+		px->px_wake_pending = TRUE;
+}
+
+
+static void
+host_read_done (proxy_t *px, size_t nread)
+{
+	/* Contabilita' dei byte ricevuti dall'host. */
+
+	STATS_ADD (st_chan[HOSTCD].cs_bytes_in, nread);
+	capture_host_read (nread);
+	if (latency_enabled ()) {
+		px->px_host_rcvd += nread;
+		tmarks_push (&px->px_rcvbuf_marks, px->px_host_rcvd,
+				tstamp_now (), FALSE, 0, 1);
+	}
+}
+
+
+static void
+host_write_done (proxy_t *px, size_t nwrite)
+{
+	/* Contabilita' dei byte consegnati all'host. */
+
+	STATS_ADD (st_chan[HOSTCD].cs_bytes_out, nwrite);
+	if (latency_enabled ()) {
+		px->px_host_written += nwrite;
+		consume_marks (&px->px_sndbuf_marks, px->px_host_written,
+				HS_HOSTQ);
+	}
+}
+
+
+static void
+kernel2net (proxy_t *px)
+{
+	/* Registra in HS_KERNEL l'attesa nel buffer tcp dei segmenti che il
+	 * peer ha confermato: i byte scritti meno quelli ancora nel buffer
+	 * danno la posizione raggiunta nel flusso. */
+
+	cd_t cd;
+	int outq;
+
+	for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++) {
+		if (!channel_is_connected (px, cd)
+		    || tmarks_first (&px->px_kernel_marks[cd]) == NULL)
+			continue;
+		outq = tcp_get_used_space (px->px_ch[cd].c_sockfd, SO_SNDBUF);
+		if (outq < 0)
+			continue;
+		consume_marks (&px->px_kernel_marks[cd],
+				px->px_net_written[cd] - outq, HS_KERNEL);
 	}
 }
 
 
 static void
-urg2net (void)
+urg2net (proxy_t *px)
 {
 	/* Trasferisce i segwrap dalla struttura dei segmenti urgenti ai
 	 * buffer dei canali di rete in maniera round robin, finche' ci sono
@@ -1084,11 +2004,12 @@ urg2net (void)
 	int err;
 	int needmask;
 	cd_t cd;
+	cd_t rrcd;
 	bool do_reorg;
 	struct segwrap *sw;
 	struct segwrap *most_urg;
 
-	most_urg = urgent_head ();
+	most_urg = urgent_head (px);
 	if (most_urg == NULL)
 		goto transfer;
 
@@ -1099,48 +2020,58 @@ urg2net (void)
 	for (do_reorg = FALSE, cd = NETCD;
 	     cd < NETCD + NETCHANNELS && !do_reorg;
 	     cd++)
-		if (channel_is_connected (cd)
-		    && rqueue_get_used (net_sndbuf[cd]) > 0
-		    && segwrap_urgcmp (net_sndbuf[cd]->rq_sgmt, most_urg) > 0)
+		if (channel_is_connected (px, cd)
+		    && rqueue_get_used (px->px_net_sndbuf[cd]) > 0
+		    && segwrap_urgcmp (px->px_net_sndbuf[cd]->rq_sgmt,
+		                       most_urg) > 0)
 			do_reorg = TRUE;
 
 	if (!do_reorg)
 		goto transfer;
 
 	/* Riorganizzazione buffer. */
+	MH_PROBE2 (urg_reorg, seg_seq (most_urg->sw_seg),
+			segwrap_prio (most_urg));
 	for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++)
-		if (channel_is_connected (cd)
-		    && rqueue_get_used (net_sndbuf[cd]) > 0) {
+		if (channel_is_connected (px, cd)
+		    && rqueue_get_used (px->px_net_sndbuf[cd]) > 0) {
 			struct segwrap *unsentq;
-			/* Taglio e travaso. */
-			unsentq = rqueue_cut_unsent (net_sndbuf[cd]);
+			/* Taglio e travaso. Sonde ed echi restano sul loro
+			 * canale: sono i piu' urgenti, quindi in testa. */
+			unsentq = rqueue_cut_unsent (px->px_net_sndbuf[cd]);
 			while ((sw = qdequeue (&unsentq)) != NULL)
-				urgent_add (sw);
+				if (segwrap_prio (sw) == PRBQ)
+					rqueue_add (px->px_net_sndbuf[cd], sw);
+				else
+					urgent_add (px, sw);
 		}
 
 	/* Riempimento net_sndbuf. */
 transfer:
 	needmask = 0x7;
-	while ((sw = urgent_head ()) != NULL  && needmask != 0x0) {
-		if (channel_is_connected (rrcd)
-		    && sw->sw_seglen <= rqueue_get_aval (net_sndbuf[rrcd])) {
-			sw = urgent_remove ();
+	while ((sw = urgent_head (px)) != NULL  && needmask != 0x0) {
+		rrcd = px->px_rrcd;
+		if (channel_is_connected (px, rrcd)
+		    && sw->sw_seglen
+		       <= rqueue_get_aval (px->px_net_sndbuf[rrcd])) {
+			sw = urgent_remove (px);
 			assert (sw != NULL);
-			err = rqueue_add (net_sndbuf[rrcd], sw);
+			err = rqueue_add (px->px_net_sndbuf[rrcd], sw);
 			assert (!err);
+			trace_segment (TR_QUEUE, sw, rrcd);
 		} else
 			needmask &= ~(0x1 << rrcd);
-		ROTATE_RRCD;
+		ROTATE_RRCD (px);
 	}
 }
 
 
 static void
-netsndbuf_rm_acked (struct segwrap *ack)
+netsndbuf_rm_acked (proxy_t *px, struct segwrap *ack)
 {
 	cd_t cd;
 
 	for (cd = NETCD; cd < NETCHANNELS; cd++)
-		if (channel_is_connected (cd))
-			rqueue_rm_acked (net_sndbuf[cd], ack);
+		if (channel_is_connected (px, cd))
+			rqueue_rm_acked (px->px_net_sndbuf[cd], ack);
 }
@@ -1,21 +1,43 @@
 #include "h/channel.h"
 #include "h/crono.h"
+#include "h/histo.h"
+#include "h/realtime.h"
 #include "h/segment.h"
+#include "h/sim.h"
+#include "h/stats.h"
 #include "h/timeout.h"
+#include "h/trace.h"
 #include "h/types.h"
 #include "h/util.h"
 
 #include <config.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/select.h>
 
 
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Impostata da SIGUSR1, il ciclo principale stampa gli istogrammi. */
+static volatile sig_atomic_t dump_requested = 0;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void dump_histos (void);
+static void request_dump (int sig);
+
+
 /*******************************************************************************
 			      Funzioni pubbliche
 *******************************************************************************/
 
 int
-core (void)
+core (proxy_t *px)
 {
 	int err;
 	int rdy;
@@ -25,28 +47,41 @@ core (void)
 	fd_set wrset;
 	double min_timeout;
 	struct timeval tv_timeout;
-
-	/* DEBUG */
-	if (TOACT_VAL > 1)
-		fprintf (stderr,
-		        "\nOCCHIO!!!\nTIMEOUT ATTIVITA' = %f\n\n",
-		        TOACT_VAL);
-
-	/*
-	 * Inizializzazione moduli.
-	 */
-	init_timeout_module ();
-	init_segment_module ();
-
-	for (;;) {
-		activate_channels ();
-
-		min_timeout = check_timeouts ();
-
-		/* Lo stato dei canali p_net e' controllato dalle funzioni. */
-		if (channel_is_connected (HOSTCD)) {
-			feed_upload ();
-			feed_download ();
+	bool busy;
+	bool polling;
+	uint64_t busy_end;
+
+	/* I moduli di timeout e segmenti sono inizializzati da proxy_init. */
+	init_trace_module ();
+	realtime_start ();
+	alloc_loop_enter ();
+
+	if (latency_enabled ())
+		signal (SIGUSR1, request_dump);
+
+	/* In simulazione il tempo virtuale avanza solo quando i proxy si
+	 * bloccano: il busy poll non finirebbe mai. */
+	busy = (px->px_busy_val > 0 && !sim_enabled ());
+	busy_end = 0;
+
+	while (!proxy_stopped (px)) {
+		STATS_ADD (st_loops, 1);
+		if (dump_requested) {
+			dump_requested = 0;
+			dump_histos ();
+		}
+		activate_channels (px);
+
+		min_timeout = check_timeouts (px);
+
+		/* Lo stato dei canali p_net e' controllato dalle funzioni.
+		 * feed_download precede feed_upload perche' l'ACK che accoda
+		 * parta in questo giro e non dopo la select. */
+		if (channel_is_connected (px, HOSTCD)) {
+			channel_host_lock (px);
+			feed_download (px);
+			feed_upload (px);
+			channel_host_unlock (px);
 		}
 
 		/*
@@ -55,7 +90,14 @@ core (void)
 		do {
 			struct timeval *toptr;
 
-			if (min_timeout > 0) {
+			/* Busy poll: finche' non e' passato px_busy_val
+			 * dall'ultimo evento, select non si blocca. */
+			polling = (busy && clock_ns () < busy_end);
+			if (polling) {
+				toptr = &tv_timeout;
+				toptr->tv_sec = 0;
+				toptr->tv_usec = 0;
+			} else if (min_timeout > 0) {
 				toptr = &tv_timeout;
 				d2tv (min_timeout, toptr);
 			} else
@@ -66,9 +108,14 @@ core (void)
 			FD_ZERO (&wrset);
 
 			/* Selezione dei fd in base allo stato dei canali. */
-			maxfd = set_file_descriptors (&rdset, &wrset);
-
-			rdy = select (maxfd + 1, &rdset, &wrset, NULL, toptr);
+			maxfd = set_file_descriptors (px, &rdset, &wrset);
+
+			if (sim_enabled ())
+				rdy = sim_select (maxfd + 1, &rdset, &wrset,
+						toptr);
+			else
+				rdy = select (maxfd + 1, &rdset, &wrset, NULL,
+						toptr);
 		} while (rdy == -1 && errno == EINTR);
 
 		if (rdy < 0) {
@@ -77,61 +124,66 @@ core (void)
 			exit (EXIT_FAILURE);
 		}
 
+		if (busy && rdy > 0)
+			busy_end = clock_ns () + px->px_busy_val * 1e9;
+		else if (polling)
+			STATS_ADD (st_polls, 1);
+
 		/*
 		 * Gestione eventi.
 		 */
 		if (rdy > 0 ) for (cd = 0; cd < CHANNELS; cd++) {
-			fd_t listfd = channel_get_listfd (cd);
-			fd_t sockfd = channel_get_sockfd (cd);
+			fd_t listfd = channel_get_listfd (px, cd);
+			fd_t sockfd = channel_get_sockfd (px, cd);
 
 			/* Connessione da concludere. */
-			if (channel_is_connecting (cd)
+			if (channel_is_connecting (px, cd)
 			    && FD_ISSET (sockfd, &wrset)) {
-				err = finalize_connection (cd);
+				err = finalize_connection (px, cd);
 				if (err) {
-					channel_close (cd);
+					channel_close (px, cd);
 				} else {
-					channel_prepare_io (cd);
+					channel_prepare_io (px, cd);
 					printf ("Canale %s connesso.\n",
-							channel_name (cd));
+							channel_name (px, cd));
 				}
 			}
 
 			/* Connessione da accettare. */
-			else if (channel_is_listening (cd)
+			else if (channel_is_listening (px, cd)
 			         && FD_ISSET (listfd, &rdset)) {
-				err = accept_connection (cd);
+				err = accept_connection (px, cd);
 				if (err) {
-					channel_close (cd);
+					channel_close (px, cd);
 				} else {
-					channel_prepare_io (cd);
+					channel_prepare_io (px, cd);
 					printf ("Canale %s, connessione "
 							"accettata.\n",
-							channel_name (cd));
+							channel_name (px, cd));
 				}
 			}
 
 			/* I/O. */
 			else {
 				/* Dati da leggere. */
-				if (channel_is_connected (cd)
+				if (channel_is_connected (px, cd)
 				    && FD_ISSET (sockfd, &rdset)) {
 					ssize_t nr;
-					nr = channel_read (cd);
+					nr = channel_read (px, cd);
 					if (errno != 0) {
 						perror ("errore channel_read");
-						channel_close (cd);
+						channel_close (px, cd);
 					}
 				}
 
 				/* Dati da scrivere. */
-				if (channel_is_connected (cd)
+				if (channel_is_connected (px, cd)
 				    && FD_ISSET (sockfd, &wrset)) {
 					ssize_t nw;
-					nw = channel_write (cd);
+					nw = channel_write (px, cd);
 					if (errno != 0) {
 						perror ("errore channel_write");
-						channel_close (cd);
+						channel_close (px, cd);
 					}
 				}
 			}
@@ -139,3 +191,27 @@ core (void)
 	}
 	return 0;
 }
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+dump_histos (void)
+{
+	int i;
+
+	fprintf (stderr, "%-16s %10s %10s %10s %10s %10s\n", "fase (ms)",
+			"campioni", "p50", "p99", "p999", "max");
+	for (i = 0; i < HSTAGES; i++)
+		histo_print (stderr, &mh_stats->st_histo[i],
+				histo_stage_name (i));
+}
+
+
+static void
+request_dump (int sig)
+{
+	dump_requested = 1;
+}
@@ -4,18 +4,27 @@
 #include "h/util.h"
 
 #include <config.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 /*******************************************************************************
 				    Macro
 *******************************************************************************/
 
-/* Incremento e decremento circolare. */
-#define     CINC(x,inc,len)     ((x) = ((x) + (inc)) % (len))
-#define     CDEC(x,dec,len)     ((x) = ((x) - (dec)) % (len))
+/* Posizione nel buffer del contatore x. */
+#define     CIDX(cq,x)     ((x) & (cq)->cq_mask)
 
-#if !HAVE_MSG_NOSIGNAL
+/* Lettura e pubblicazione dei contatori: con acquire e release i byte
+ * scritti prima di spostare un contatore sono visibili a chi legge il nuovo
+ * valore dall'altro lato. */
+#define     LOAD(x)        __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define     STORE(x,v)     __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+
+/* Senza MSG_NOSIGNAL SIGPIPE e' ignorato, vedi proxy_init. */
+#ifndef MSG_NOSIGNAL
 #define     MSG_NOSIGNAL     0
 #endif
 
@@ -24,8 +33,8 @@
 		       Prototipi delle funzioni locali
 *******************************************************************************/
 
-static size_t cqueue_get_aval_chunk (const cqueue_t *cq);
-static size_t cqueue_get_used_chunk (const cqueue_t *cq);
+static seg_t *mirror_alloc (size_t len);
+static fd_t mirror_fd (size_t len);
 
 
 /*******************************************************************************
@@ -35,35 +44,18 @@ static size_t cqueue_get_used_chunk (const cqueue_t *cq);
 int
 cqueue_add (cqueue_t *cq, seg_t *buf, size_t nbytes)
 {
-	/* Copia nbytes bytes da buf in coda a cq.
+	/* Copia nbytes bytes da buf in coda a cq. Lato produttore.
 	 * Ritorna 0 se riesce, -1 se cq non ha abbastanza spazio. */
 
-	size_t chunk_1;
-	size_t chunk_2;
-
 	assert (cq != NULL);
 	assert (buf != NULL);
 	assert (nbytes > 0);
 
 	if (cqueue_get_aval (cq) >= nbytes) {
-		assert (cq->cq_wrap || cq->cq_tail >= cq->cq_head);
-		assert (!cq->cq_wrap || cq->cq_tail < cq->cq_head);
-
-		chunk_1 = MIN (cqueue_get_aval_chunk (cq), nbytes);
-		chunk_2 = (nbytes > chunk_1 ? nbytes - chunk_1 : 0);
-
-		memcpy (&cq->cq_data[cq->cq_tail], buf, chunk_1);
-		CINC (cq->cq_tail, chunk_1, cq->cq_len);
-		buf += chunk_1;
-		if (cq->cq_tail == 0) {
-			assert (!cq->cq_wrap);
-			cq->cq_wrap = TRUE;
-		}
-
-		if (chunk_2 > 0) {
-			memcpy (&cq->cq_data[cq->cq_tail], buf, chunk_2);
-			CINC (cq->cq_tail, chunk_2, cq->cq_len);
-		}
+		/* Grazie alla seconda mappatura la copia e' contigua anche
+		 * se attraversa la fine del buffer. */
+		memcpy (&cq->cq_data[CIDX (cq, cq->cq_tail)], buf, nbytes);
+		STORE (cq->cq_tail, cq->cq_tail + nbytes);
 		return 0;
 	}
 	return -1;
@@ -101,16 +93,23 @@ cqueue_can_write (void *arg)
 cqueue_t *
 cqueue_create (size_t len)
 {
+	/* Crea una coda di almeno len byte: la capacita' e' la prima potenza
+	 * di 2 non minore di len e della pagina, vedi mirror_alloc. */
+
+	size_t size;
 	cqueue_t *cq;
 
 	assert (len > 0);
 
+	for (size = sysconf (_SC_PAGESIZE); size < len; size <<= 1)
+		;
+
 	cq = xmalloc (sizeof (cqueue_t));
-	cq->cq_data = xmalloc (len * sizeof (seg_t));
-	cq->cq_len = len;
+	cq->cq_data = mirror_alloc (size);
+	cq->cq_len = size;
+	cq->cq_mask = size - 1;
 	cq->cq_head = 0;
 	cq->cq_tail = 0;
-	cq->cq_wrap = FALSE;
 
 	return cq;
 }
@@ -121,7 +120,7 @@ cqueue_destroy (cqueue_t *cq)
 {
 	assert (cq != NULL);
 
-	xfree (cq->cq_data);
+	munmap (cq->cq_data, 2 * cq->cq_len);
 	xfree (cq);
 }
 
@@ -129,30 +128,35 @@ cqueue_destroy (cqueue_t *cq)
 void
 cqueue_drop_head (cqueue_t *cq, size_t nbytes)
 {
-	/* Scart nbytes bytes dalla testa di cq. */
+	/* Scart nbytes bytes dalla testa di cq. Lato consumatore. */
 
 	assert (cq != NULL);
 	assert (nbytes > 0);
 	assert (nbytes <= cqueue_get_used (cq));
 
-	CINC (cq->cq_head, nbytes, cq->cq_len);
-	if (cq->cq_head <= cq->cq_tail)
-		cq->cq_wrap = FALSE;
+	STORE (cq->cq_head, cq->cq_head + nbytes);
 }
 
 
 void
 cqueue_drop_tail (cqueue_t *cq, size_t nbytes)
 {
-	/* Scart nbytes bytes dalla coda di cq. */
+	/* Scart nbytes bytes dalla coda di cq. Solo con produttore e
+	 * consumatore nello stesso thread. */
 
 	assert (cq != NULL);
 	assert (nbytes > 0);
 	assert (nbytes <= cqueue_get_used (cq));
 
-	CDEC (cq->cq_tail, nbytes, cq->cq_len);
-	if (cq->cq_head <= cq->cq_tail)
-		cq->cq_wrap = FALSE;
+	cq->cq_tail -= nbytes;
+}
+
+
+seg_t *
+cqueue_head (cqueue_t *cq)
+{
+	assert (cq != NULL);
+	return &cq->cq_data[CIDX (cq, cq->cq_head)];
 }
 
 
@@ -161,28 +165,27 @@ cqueue_get_aval (cqueue_t *cq)
 {
 	/* Ritorna il numero di byte disponibili in cq. */
 
-	size_t aval;
-
 	assert (cq != NULL);
-
-	if (cq->cq_wrap) {
-		assert (cq->cq_head >= cq->cq_tail);
-		aval = cq->cq_head - cq->cq_tail;
-	} else {
-		assert (cq->cq_head <= cq->cq_tail);
-		aval = cq->cq_len - (cq->cq_tail - cq->cq_head);
-	}
-	return aval;
+	return (cq->cq_len - cqueue_get_used (cq));
 }
 
 
 size_t
 cqueue_get_used (cqueue_t *cq)
 {
-	/* Ritorna il numero di byte usati in cq. */
+	/* Ritorna il numero di byte usati in cq. La testa va letta per prima:
+	 * la coda, letta dopo, non puo' esserle minore. */
+
+	size_t head;
+	size_t used;
 
 	assert (cq != NULL);
-	return (cq->cq_len - cqueue_get_aval (cq));
+
+	head = LOAD (cq->cq_head);
+	used = LOAD (cq->cq_tail) - head;
+	assert (used <= cq->cq_len);
+
+	return used;
 }
 
 
@@ -192,10 +195,11 @@ cqueue_seglen (cqueue_t *cq)
 	/* Ritorna la lunghezza del primo segmento contenuto se cq ha in testa
 	 * un segmento completo, 0 altrimenti.
 	 * XXX assume che il byte in testa sia l'inizio di un segmento e che
-	 * quindi contenga il campo flags. */
+	 * quindi contenga il campo flags. Lato consumatore. */
 
 	seg_t *flgptr;
 	size_t used;
+	size_t tstlen;
 
 	assert (cq != NULL);
 
@@ -203,64 +207,37 @@ cqueue_seglen (cqueue_t *cq)
 	if (used == 0)
 		return 0;
 
-	flgptr = &cq->cq_data[cq->cq_head];
+	flgptr = &cq->cq_data[CIDX (cq, cq->cq_head)];
 
-	if (seg_is_nak (flgptr) && used >= NAKLEN) {
-#ifndef NDEBUG
-		fprintf (stdout, "cqueue_seglen NAK\n");
-		fflush (stdout);
-#endif
+	if (seg_is_nak (flgptr) && used >= NAKLEN)
 		return NAKLEN;
-	}
 
-	if (seg_is_ack (flgptr) && used >= ACKLEN) {
-#ifndef NDEBUG
-		fprintf (stdout, "cqueue_seglen ACK\n");
-		fflush (stdout);
-#endif
+	if (seg_is_ack (flgptr) && used >= ACKLEN)
 		return ACKLEN;
-	}
+
+	/* Sonde ed echi hanno lunghezza fissa. */
+	if (seg_is_probe (flgptr) || seg_is_echo (flgptr))
+		return (used >= PRBLEN ? PRBLEN : 0);
 
 	assert (*flgptr & PLDFLAG);
 
+	/* Timestamp opzionale, dopo il campo len. */
+	tstlen = (*flgptr & TSTFLAG ? TSTLEN : 0);
+
 	/* Payload di lunghezza standard. */
 	if (!(*flgptr & LENFLAG)) {
-#ifndef NDEBUG
-		fprintf (stdout, "cqueue_seglen NO LENFLAG...");
-		fflush (stdout);
-#endif
-		if (used >= FLGLEN + SEQLEN + PLDDEFLEN) {
-#ifndef NDEBUG
-			fprintf (stdout, "OK\n");
-			fflush (stdout);
-#endif
-			return (FLGLEN + SEQLEN + PLDDEFLEN);
-		}
+		if (used >= FLGLEN + SEQLEN + tstlen + PLDDEFLEN)
+			return (FLGLEN + SEQLEN + tstlen + PLDDEFLEN);
 	}
 	/* Payload di lunghezza non standard, bisogna accedere al campo len,
-	 * se presente. */
-	else {
-#ifndef NDEBUG
-		fprintf (stdout, "cqueue_seglen LENFLAG...");
-		fflush (stdout);
-#endif
-		if (used > LEN) {
-			int i;
-			i = (cq->cq_head + LEN) % cq->cq_len;
-			if (used >= FLGLEN + SEQLEN + LENLEN + cq->cq_data[i]) {
-#ifndef NDEBUG
-				fprintf (stdout, "OK\n");
-				fflush (stdout);
-#endif
-				return (FLGLEN + SEQLEN + LENLEN + cq->cq_data[i]);
-			}
-		}
+	 * se presente. L'intestazione e' contigua anche a cavallo della fine
+	 * del buffer. */
+	else if (used > LEN) {
+		if (used >= FLGLEN + SEQLEN + LENLEN + tstlen + flgptr[LEN])
+			return (FLGLEN + SEQLEN + LENLEN + tstlen
+			        + flgptr[LEN]);
 	}
 
-#ifndef NDEBUG
-	fprintf (stdout, "BHO!\n");
-	fflush (stdout);
-#endif
 	return 0;
 }
 
@@ -268,33 +245,19 @@ cqueue_seglen (cqueue_t *cq)
 int
 cqueue_push (cqueue_t *cq, seg_t *buf, size_t nbytes)
 {
-	/* Copia nbytes byte da buf in testa a cq. */
+	/* Copia nbytes byte da buf in testa a cq. Solo con produttore e
+	 * consumatore nello stesso thread. */
 
-	size_t chunk_1;
-	size_t chunk_2;
+	assert (cq != NULL);
+	assert (buf != NULL);
+	assert (nbytes > 0);
 
 	if (cqueue_get_aval (cq) >= nbytes) {
-		assert (cq->cq_wrap || cq->cq_tail >= cq->cq_head);
-		assert (!cq->cq_wrap || cq->cq_tail < cq->cq_head);
-
-		chunk_1 = cq->cq_head - (cq->cq_wrap ? cq->cq_tail : 0);
-		chunk_2 = (nbytes > chunk_1 ? nbytes - chunk_1 : 0);
-
-		if (chunk_1 > 0) {
-			CDEC (cq->cq_head, chunk_1, cq->cq_len);
-			memcpy (&cq->cq_data[cq->cq_head], buf, chunk_1);
-			buf += chunk_1;
-		}
-		if (cq->cq_head + chunk_1 > cq->cq_len) {
-			assert (!cq->cq_wrap);
-			cq->cq_wrap = TRUE;
-		}
-		if (chunk_2 > 0) {
-			memcpy (&cq->cq_data[cq->cq_head], buf, chunk_2);
-			cq->cq_head -= chunk_2;
-			assert (cq->cq_head >= 0);
-			assert (cq->cq_head >= cq->cq_tail);
-		}
+		/* Se la testa torna indietro oltre l'inizio del buffer la
+		 * copia parte dalla fine, e prosegue contigua nella seconda
+		 * mappatura. */
+		cq->cq_head -= nbytes;
+		memcpy (&cq->cq_data[CIDX (cq, cq->cq_head)], buf, nbytes);
 		return 0;
 	}
 	return -1;
@@ -304,80 +267,50 @@ cqueue_push (cqueue_t *cq, seg_t *buf, size_t nbytes)
 size_t
 cqueue_read (fd_t fd, cqueue_t *cq)
 {
-	/* Legge piu' byte possibili da fd e li salva in cq.
+	/* Legge piu' byte possibili da fd e li salva in cq, con una sola
+	 * read: lo spazio libero e' contiguo. Lato produttore.
 	 * Ritorna il numero di byte letti (0 o piu').
 	 * In caso di errore imposta errno come quello di read, altrimenti a
 	 * zero; se la read legge l'EOF imposta errno a EREOF. */
 
 	ssize_t nread;
-	size_t nrcvd;
-	size_t chunk;
 
 	assert (fd > 0);
 	assert (cq != NULL);
 	assert (cqueue_get_aval (cq) > 0);
 	/* TODO assert (NONBLOCK); */
 
-	chunk = cqueue_get_aval_chunk (cq);
-	assert (chunk > 0);
-
-	/* Questo ciclo viene eseguito al massimo due volte. */
-	nrcvd = 0;
 	do {
-		nread = read (fd, &(cq->cq_data[cq->cq_tail]), chunk);
-		if (nread > 0) {
-			nrcvd += nread;
-			CINC (cq->cq_tail, nread, cq->cq_len);
-			if (cq->cq_tail == 0) {
-				assert (!cq->cq_wrap);
-				cq->cq_wrap = TRUE;
-				/* Se chunk > 0 vinciamo un altro giro. */
-				chunk = cqueue_get_aval_chunk (cq);
-			}
-		}
-	} while ((nread > 0 && cq->cq_tail == 0 && chunk > 0)
-	          || (nread == -1 && errno == EINTR));
-
-	if (nread > 0
-	    || (nread == -1 && errno == EAGAIN))
+		nread = read (fd, &cq->cq_data[CIDX (cq, cq->cq_tail)],
+				cqueue_get_aval (cq));
+	} while (nread == -1 && errno == EINTR);
+
+	if (nread > 0) {
+		STORE (cq->cq_tail, cq->cq_tail + nread);
+		errno = 0;
+		return nread;
+	}
+
+	if (nread == -1 && errno == EAGAIN)
 		errno = 0;
 	else if (nread == 0)
 		errno = EREOF;
-
-	return nrcvd;
+	return 0;
 }
 
 
 int
 cqueue_remove (cqueue_t *cq, seg_t *buf, size_t nbytes)
 {
-	/* Copia nbytes byte dalla testa di cq in buf rimuovendoli da cq. */
-
-	size_t chunk_1;
-	size_t chunk_2;
+	/* Copia nbytes byte dalla testa di cq in buf rimuovendoli da cq.
+	 * Lato consumatore. */
 
 	assert (cq != NULL);
 	assert (buf != NULL);
 
 	if (cqueue_get_used (cq) >= nbytes) {
-		assert (cq->cq_wrap || cq->cq_tail > cq->cq_head);
-		assert (!cq->cq_wrap || cq->cq_tail <= cq->cq_head);
-
-		chunk_1 = MIN (cqueue_get_used_chunk (cq), nbytes);
-		chunk_2 = (nbytes > chunk_1 ? nbytes - chunk_1 : 0);
-
-		memcpy (buf, &(cq->cq_data[cq->cq_head]), chunk_1);
-		CINC (cq->cq_head, chunk_1, cq->cq_len);
-		buf += chunk_1;
-		if (cq->cq_head == 0) {
-			assert (cq->cq_wrap);
-			cq->cq_wrap = FALSE;
-		}
-
-		if (chunk_2 > 0) {
-			memcpy (buf, &(cq->cq_data[cq->cq_head]), chunk_2);
-			CINC (cq->cq_head, chunk_2, cq->cq_len);
-		}
+		memcpy (buf, &cq->cq_data[CIDX (cq, cq->cq_head)], nbytes);
+		STORE (cq->cq_head, cq->cq_head + nbytes);
 		return 0;
 	}
 	return -1;
@@ -387,51 +320,35 @@ cqueue_remove (cqueue_t *cq, seg_t *buf, size_t nbytes)
 size_t
 cqueue_write (fd_t fd, cqueue_t *cq)
 {
-	/* Scrive piu' dati possibile sul file descriptor fd dalla coda cq.
+	/* Scrive piu' dati possibile sul file descriptor fd dalla coda cq,
+	 * con una sola send: i dati sono contigui. Lato consumatore.
 	 * Ritorna il numero di byte spediti (0 o piu').
 	 * In caso di errore imposta l'errno come quello di send, altrimenti a
 	 * zero. */
 
 	ssize_t nwrite;
-	size_t nsent;
-	size_t chunk;
 
 	assert (fd > 0);
 	assert (cq != NULL);
 	assert (cqueue_get_used (cq) > 0);
 	/* TODO assert (NONBLOCK); */
 
-	chunk = cqueue_get_used_chunk (cq);
-	assert (chunk > 0);
-
-	/* Questo ciclo viene eseguito al massimo due volte: se la coda ha
-	 * ciclato e la prima iterazione scrive tutti i dati dalla testa alla
-	 * fine del buffer, prova a scrivere anche i dati dall'inizio del
-	 * buffer alla coda. */
-	nsent = 0;
 	do {
-		nwrite = send (fd, &(cq->cq_data[cq->cq_head]), chunk,
-				MSG_NOSIGNAL);
-		assert (nwrite != 0);
-		if (nwrite > 0) {
-			nsent += nwrite;
-			CINC (cq->cq_head, nwrite, cq->cq_len);
-			if (cq->cq_head == 0) {
-				assert (cq->cq_wrap);
-				cq->cq_wrap = FALSE;
-				/* Se chunk > 0 vinciamo un altro giro. */
-				chunk = cqueue_get_used_chunk (cq);
-			}
-		}
-	} while ((nwrite > 0 && cq->cq_head == 0 && chunk > 0)
-	          || (nwrite == -1 && errno == EINTR));
+		nwrite = send (fd, &cq->cq_data[CIDX (cq, cq->cq_head)],
+				cqueue_get_used (cq), MSG_NOSIGNAL);
+	} while (nwrite == -1 && errno == EINTR);
+	assert (nwrite != 0);
 
-	/* Pulisce il valore di errno se tutto e' andato liscio. */
-	if (nwrite > 0
-	    || (nwrite == -1 && errno == EAGAIN))
+	if (nwrite > 0) {
+		STORE (cq->cq_head, cq->cq_head + nwrite);
 		errno = 0;
+		return nwrite;
+	}
 
-	return nsent;
+	/* Pulisce il valore di errno se tutto e' andato liscio. */
+	if (errno == EAGAIN)
+		errno = 0;
+	return 0;
 }
 
 
@@ -439,21 +356,80 @@ cqueue_write (fd_t fd, cqueue_t *cq)
 			       Funzioni locali
 *******************************************************************************/
 
-static size_t
-cqueue_get_aval_chunk (const cqueue_t *cq)
+static seg_t *
+mirror_alloc (size_t len)
 {
-	assert (cq != NULL);
-	return (cq->cq_wrap ?
-		cq->cq_head :
-		cq->cq_len) - cq->cq_tail;
+	/* Alloca un buffer di len byte mappato due volte di seguito, per cui
+	 * data[i] e data[i + len] sono lo stesso byte e ogni intervallo di
+	 * al piu' len byte a partire da testa o coda e' contiguo. len deve
+	 * essere multiplo della pagina. Come xmalloc, se fallisce termina il
+	 * processo. */
+
+	fd_t fd;
+	char *base;
+	void *first;
+	void *second;
+
+	assert (len > 0);
+
+	alloc_note ("cqueue", len);
+	fd = mirror_fd (len);
+	if (fd < 0)
+		goto error;
+
+	/* Riserva 2 * len byte di indirizzi contigui e vi sovrappone le due
+	 * mappature dello stesso file. */
+	base = mmap (NULL, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	if (base == MAP_FAILED) {
+		close (fd);
+		goto error;
+	}
+	first = mmap (base, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	second = mmap (base + len, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	close (fd);
+	if (first == MAP_FAILED || second == MAP_FAILED) {
+		munmap (base, 2 * len);
+		goto error;
+	}
+	return (seg_t *) base;
+
+error:
+	perror ("Impossibile creare il buffer circolare");
+	exit (EXIT_FAILURE);
 }
 
 
-static size_t
-cqueue_get_used_chunk (const cqueue_t *cq)
+static fd_t
+mirror_fd (size_t len)
 {
-	assert (cq != NULL);
-	return (cq->cq_wrap ?
-		cq->cq_len :
-		cq->cq_tail) - cq->cq_head;
+	/* Ritorna un file anonimo in memoria di len byte, -1 se fallisce.
+	 * Senza memfd_create usa un oggetto di memoria condivisa rimosso
+	 * subito dopo la creazione. */
+
+	fd_t fd;
+
+#if HAVE_MEMFD_CREATE
+	fd = memfd_create ("mh-cqueue", 0);
+#else
+	static unsigned int count = 0;
+	char name[32];
+
+	do {
+		sprintf (name, "/mh-cq-%ld-%u", (long)getpid (), count++);
+		fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	} while (fd < 0 && errno == EEXIST);
+	if (fd >= 0)
+		shm_unlink (name);
+#endif
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate (fd, len)) {
+		close (fd);
+		return -1;
+	}
+	return fd;
 }
@@ -4,6 +4,7 @@
 
 #include <config.h>
 #include <math.h>
+#include <time.h>
 
 
 /*******************************************************************************
@@ -13,6 +14,15 @@
 #define     ONE_MILLION     1000000
 
 
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Istante virtuale in ns imposto da crono_set_virtual, 0 se il proxy usa gli
+ * orologi di sistema. */
+static uint64_t virtual_ns = 0;
+
+
 /*******************************************************************************
 		       Prototipi delle funzioni locali
 *******************************************************************************/
@@ -40,7 +50,7 @@ crono_measure (crono_t *cr)
 	gettime (&now);
 	cr->cr_elapsed = tv_diff (&now, &cr->cr_start);
 
-	assert (cr->cr_elapsed > 0);
+	assert (cr->cr_elapsed >= 0);
 
 	return crono_read (cr);
 }
@@ -73,6 +83,11 @@ gettime (struct timeval *tv)
 {
 	assert (tv != NULL);
 
+	if (virtual_ns != 0) {
+		tv->tv_sec = virtual_ns / 1000000000;
+		tv->tv_usec = (virtual_ns % 1000000000) / 1000;
+		return;
+	}
 	gettimeofday (tv, NULL);
 	tv_normalize (tv);
 }
@@ -109,6 +124,73 @@ tv2d (struct timeval *tv, bool must_free)
 }
 
 
+/*
+ * Timestamp delle sonde.
+ */
+
+double
+tstamp_diff (tst_t later, tst_t earlier)
+{
+	/* Ritorna in secondi l'intervallo tra due timestamp. L'aritmetica
+	 * senza segno gestisce il ciclo del contatore, purche' l'intervallo
+	 * sia minore di 2^32 microsecondi. */
+
+	tst_t diff;
+
+	diff = later - earlier;
+	return (double)diff / (double)ONE_MILLION;
+}
+
+
+tst_t
+tstamp_now (void)
+{
+	/* Ritorna l'istante attuale in microsecondi, modulo 2^32. */
+
+	struct timeval now;
+
+	gettime (&now);
+	return (tst_t)now.tv_sec * ONE_MILLION + (tst_t)now.tv_usec;
+}
+
+
+/*
+ * Orologio monotono.
+ */
+
+uint64_t
+clock_ns (void)
+{
+	/* Ritorna i nanosecondi trascorsi da un istante arbitrario ma fisso,
+	 * senza i salti di gettimeofday. */
+
+	struct timespec now;
+
+	if (virtual_ns != 0)
+		return virtual_ns;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/*
+ * Orologio virtuale.
+ */
+
+void
+crono_set_virtual (uint64_t ns)
+{
+	/* Da questo momento gettime e clock_ns ritornano l'istante ns, finche'
+	 * non viene impostato il successivo: il tempo del proxy e' quello del
+	 * simulatore, vedi sim.c. */
+
+	assert (ns > 0);
+	assert (ns >= virtual_ns);
+
+	virtual_ns = ns;
+}
+
+
 /*******************************************************************************
 			       Funzioni locali
 *******************************************************************************/
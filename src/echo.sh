@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Benchmark di interattivita': mhecho spedisce tasti attraverso la coppia
+# psend/precv di andata e li riceve indietro attraverso una seconda coppia
+# di ritorno; ogni coppia ha il suo ritardatore con gli stessi disturbi. Per
+# ogni profilo stampa una riga chiave=valore con la distribuzione dei round
+# trip e la percentuale di echi oltre la scadenza.
+#
+# Uso: echo.sh [ directory_eseguibili ]
+# MHECHO_ARGS aggiunge opzioni a mhecho (es. -m 100 -D 300), PROFILES
+# restringe i profili; RIT_ARGS, se presente, sostituisce i profili con un
+# solo profilo "custom" con quelle opzioni di ritardatore (es. -f schedule).
+# PROXY_ARGS passa opzioni ai proxy, che di default usano i loro timeout:
+# gli stalli chiudono i canali e i profili misurano anche la loro riapertura.
+
+BIN=${1:-.}
+PROFILES=${PROFILES:-"clean stall0 stall01 slow2"}
+[ -n "$RIT_ARGS" ] && PROFILES=custom
+TMP=${TMPDIR:-/tmp}/mhecho.$$
+
+profile_args ()
+{
+	case "$1" in
+	clean)	 echo "-d *:10" ;;
+	stall0)	 echo "-d *:10 -s 0:4:1" ;;
+	stall01) echo "-d *:10 -s 0:4:1 -s 1:6:2" ;;
+	slow2)	 echo "-d *:10 -d 2:400 -j 2:100" ;;
+	custom)	 echo "$RIT_ARGS" ;;
+	*)	 echo "profilo sconosciuto: $1" >&2; exit 1 ;;
+	esac
+}
+
+stop ()
+{
+	kill $PIDS 2>/dev/null
+	wait $PIDS 2>/dev/null
+	PIDS=
+}
+
+trap 'stop; rm -f $TMP; exit 1' INT TERM
+
+for p in $PROFILES; do
+	rargs=$(profile_args $p) || exit 1
+
+	# Prima i precv, che si connettono a mhecho, poi i ritardatori e i
+	# psend, a cui si connette mhecho.
+	$BIN/mhecho $MHECHO_ARGS > $TMP &
+	mhecho=$!
+	sleep 0.2
+	$BIN/precv $PROXY_ARGS > /dev/null 2>&1 &
+	PIDS="$!"
+	$BIN/precv $PROXY_ARGS 8101 8102 8103 - 9101 > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	sleep 0.2
+	set -f
+	$BIN/ritardatore $rargs > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	$BIN/ritardatore -l 7101 -c 8101 $rargs > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	set +f
+	sleep 0.2
+	$BIN/psend $PROXY_ARGS > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	$BIN/psend $PROXY_ARGS 6101 - 7101 - 7102 - 7103 > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+
+	wait $mhecho
+	stop
+
+	line=$(cat $TMP)
+	echo "profile=$p ${line:-sent=0}"
+	sleep 0.5
+done
+rm -f $TMP
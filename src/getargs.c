@@ -1,10 +1,25 @@
+#include "h/channel.h"
+#include "h/getargs.h"
+#include "h/histo.h"
+#include "h/realtime.h"
+#include "h/slab.h"
+#include "h/trace.h"
 #include "h/util.h"
 
 #include <config.h>
+#include <sched.h>
 #include <string.h>
 #include <stdarg.h>
 
 
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static int parse_int (char *str, int min, int max, int *value);
+static int parse_seconds (char *str, double *value);
+
+
 /*******************************************************************************
 			      Funzioni pubbliche
 *******************************************************************************/
@@ -12,39 +27,39 @@
 int
 getargs (int argc, char **argv, char *fmt, ...)
 {
-
 	int err = 0;
-	int i;	/* su fmt */
-	int j;	/* su argv */
+	int i;
 	va_list args;
 
+	assert (argc >= 0);
 	assert (argv != NULL);
 	assert (fmt != NULL);
 
+	if (argc > strlen (fmt)) {
+		fprintf (stderr, "troppi argomenti.\n");
+		return -1;
+	}
+
 	va_start (args, fmt);
 
-	for (i = 0, j = 1;
-	     !err && i <= strlen (fmt) && j < argc;
-	     i++, j++) {
-		struct sockaddr_in *addr;
+	for (i = 0; !err && i < argc; i++) {
+		char **addr;
 		port_t *port;
 
 		switch (fmt[i]) {
 
 		/* Indirizzo ip. */
 		case 'a' :
-			addr = va_arg (args, struct sockaddr_in *);
-			if (!streq (argv[j], "-")) {
-				err = inet_pton (AF_INET, argv[j],
-				                 &addr->sin_addr);
-				assert (err >= 0);
-				if (err == 0) {
+			addr = va_arg (args, char **);
+			if (!streq (argv[i], "-")) {
+				struct in_addr tmp;
+				if (inet_pton (AF_INET, argv[i], &tmp) != 1) {
 					fprintf (stderr,
 					         "ip non valido: %s.\n",
-						 argv[j]);
+						 argv[i]);
 					err = -1;
 				} else {
-					err = 0;
+					*addr = argv[i];
 				}
 			}
 		break;
@@ -52,19 +67,21 @@ getargs (int argc, char **argv, char *fmt, ...)
 		/* Porta. */
 		case 'p' :
 			port = va_arg (args, port_t *);
-			if (!streq (argv[j], "-")) {
+			if (!streq (argv[i], "-")) {
+				long val;
 				char *endptr;
 				errno = 0;
-				*port = strtol (argv[j], &endptr, 10);
+				val = strtol (argv[i], &endptr, 10);
 				if (errno != 0
-				    || argv[j] == endptr
-				    || *endptr != '\0') {
+				    || argv[i] == endptr
+				    || *endptr != '\0'
+				    || val <= 0 || val > UINT16_MAX) {
 					fprintf (stderr,
 						 "porta non valida: %s.\n",
-						 argv[j]);
+						 argv[i]);
 					err = -1;
 				} else {
-					*port = htons (*port);
+					*port = val;
 				}
 			}
 		break;
@@ -81,3 +98,178 @@ getargs (int argc, char **argv, char *fmt, ...)
 
 	return err;
 }
+
+
+int
+getopts_proxy (proxy_t *px, int argc, char **argv)
+{
+	int opt;
+	int err;
+	int val;
+	double activity;
+	double busy;
+	double probe;
+
+	assert (px != NULL);
+	assert (argv != NULL);
+
+	activity = TOACT_VAL;
+	probe = TOPRB_VAL;
+
+	err = 0;
+	while (!err
+	       && (opt = getopt (argc, argv, "Ab:c:C:HlLp:R:t:T:u:")) != -1) {
+		switch (opt) {
+		case 'A' :
+			alloc_report_enable ();
+			break;
+		case 'b' :
+			err = parse_seconds (optarg, &busy);
+			if (!err)
+				channel_set_busy_poll (px, busy);
+			break;
+		case 'c' :
+			err = parse_int (optarg, 0,
+					sysconf (_SC_NPROCESSORS_CONF) - 1,
+					&val);
+			if (!err)
+				realtime_set_cpu (val);
+			break;
+		case 'C' :
+			err = capture_open (optarg, argv[0]);
+			break;
+		case 'H' :
+			slab_hugepages_enable ();
+			break;
+		case 'l' :
+			latency_enable ();
+			break;
+		case 'L' :
+			realtime_enable ();
+			break;
+		case 'p' :
+			err = parse_seconds (optarg, &probe);
+			break;
+		case 'R' :
+			err = parse_int (optarg,
+					sched_get_priority_min (SCHED_FIFO),
+					sched_get_priority_max (SCHED_FIFO),
+					&val);
+			if (!err)
+				realtime_set_priority (val);
+			break;
+		case 't' :
+			err = parse_seconds (optarg, &activity);
+			break;
+		case 'T' :
+			err = trace_open (optarg, argv[0]);
+			break;
+		case 'u' :
+			channel_set_host_path (px, optarg);
+			break;
+		default :
+			err = -1;
+		}
+	}
+	if (err)
+		return -1;
+
+	channel_set_timeouts (px, activity, probe);
+
+	return optind;
+}
+
+
+void
+print_options_help (void)
+{
+	printf ("\n"
+"Opzioni:\n"
+"  -l          misura le latenze delle fasi; SIGUSR1 stampa gli\n"
+"              istogrammi, visibili anche con mhstat.\n"
+"  -t secondi  un canale di rete muto per piu' di secondi viene chiuso\n"
+"              (predefinito %.3f; su un percorso lento almeno\n"
+"              l'intervallo di sonda piu' due RTT).\n"
+"  -p secondi  intervallo di silenzio dopo cui un canale viene sondato\n"
+"              (predefinito %.3f).\n",
+		TOACT_VAL, TOPRB_VAL);
+	printf (
+"  -T file     scrive su file la traccia degli eventi dei segmenti, da\n"
+"              analizzare con mhtrace.\n"
+"  -C file     registra su file istante e dimensione di ogni lettura\n"
+"              dall'host, da riprodurre con mhreplay.\n"
+"  -u path     il canale con l'host usa il socket AF_UNIX path al posto\n"
+"              di tcp: psend vi accetta il Sender, precv vi si connette\n"
+"              al Receiver. Porta e indirizzo dell'host sono ignorati.\n"
+		);
+	printf (
+"  -H          alloca segwrap e timeout in arene da 2 MiB su hugepage\n"
+"              trasparenti.\n"
+		);
+	printf (
+"  -A          segnala su stderr ogni allocazione fatta dal ciclo\n"
+"              principale; mhstat ne mostra il conteggio.\n"
+"  -L          latenza deterministica: blocca in memoria il proxy, slab\n"
+"              e buffer dei canali compresi, e all'avvio ne stampa\n"
+"              l'occupazione.\n"
+"  -R prio     come -L, e il ciclo principale gira in SCHED_FIFO con\n"
+"              priorita' prio.\n"
+"  -c cpu      come -L, e il ciclo principale gira solo sulla cpu cpu.\n"
+		);
+	printf (
+"  -b secondi  dopo ogni evento il ciclo principale e i socket dei canali\n"
+"              di rete fanno busy poll per secondi invece di bloccarsi:\n"
+"              meno latenza di risveglio, piu' cpu.\n"
+		);
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static int
+parse_int (char *str, int min, int max, int *value)
+{
+	/* Converte str in un intero tra min e max.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	char *endptr;
+	long val;
+
+	assert (str != NULL);
+	assert (value != NULL);
+
+	errno = 0;
+	val = strtol (str, &endptr, 10);
+	if (errno != 0 || str == endptr || *endptr != '\0'
+	    || val < min || val > max) {
+		fprintf (stderr, "valore non valido: %s.\n", str);
+		return -1;
+	}
+	*value = val;
+	return 0;
+}
+
+
+static int
+parse_seconds (char *str, double *value)
+{
+	/* Converte str in un intervallo positivo in secondi.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	char *endptr;
+	double val;
+
+	assert (str != NULL);
+	assert (value != NULL);
+
+	errno = 0;
+	val = strtod (str, &endptr);
+	if (errno != 0 || str == endptr || *endptr != '\0' || val <= 0) {
+		fprintf (stderr, "intervallo non valido: %s.\n", str);
+		return -1;
+	}
+	*value = val;
+	return 0;
+}
@@ -9,141 +9,243 @@
 *******************************************************************************/
 
 void
-channel_activity_notice (cd_t cd);
+channel_activity_notice (proxy_t *px, cd_t cd);
+
+
+void
+channel_add_ctrl (proxy_t *px, cd_t cd, struct segwrap *sw);
 
 
 bool
-channel_can_read (cd_t cd);
+channel_can_read (proxy_t *px, cd_t cd);
 
 
 bool
-channel_can_write (cd_t cd);
+channel_can_write (proxy_t *px, cd_t cd);
 
 
 void
-channel_close (cd_t cd);
+channel_close (proxy_t *px, cd_t cd);
+
+
+double
+channel_get_srtt (proxy_t *px, cd_t cd);
 
 
 fd_t
-channel_get_listfd (cd_t cd);
+channel_get_listfd (proxy_t *px, cd_t cd);
+
+
+fd_t
+channel_get_sockfd (proxy_t *px, cd_t cd);
+
+
+ssize_t
+channel_host_get (proxy_t *px, seg_t *buf, size_t len);
+/* Receiver nello stesso processo: sposta in buf fino a len byte consegnati
+ * dal proxy. Ritorna i byte spostati, -1 con errno EAGAIN se non ce ne
+ * sono. */
+
+
+void
+channel_host_lock (proxy_t *px);
+/* Lock dei buffer applicazione dell'host nello stesso processo, vedi
+ * channel_set_host_local: core lo tiene mentre li usa. */
+
+
+ssize_t
+channel_host_put (proxy_t *px, seg_t *buf, size_t len);
+/* Sender nello stesso processo: copia nel proxy fino a len byte di buf.
+ * Ritorna i byte copiati, -1 con errno EAGAIN se non c'e' spazio. */
 
 
 fd_t
-channel_get_sockfd (cd_t cd);
+channel_host_readyfd (proxy_t *px);
+/* Leggibile finche' channel_host_put o channel_host_get possono spostare
+ * dati. */
+
+
+void
+channel_host_unlock (proxy_t *px);
 
 
 int
-channel_init (cd_t cd, port_t listport, char *connip, port_t connport);
+channel_init (proxy_t *px, cd_t cd, port_t listport, char *connip,
+		port_t connport);
 
 
 void
-channel_invalidate (cd_t cd);
+channel_invalidate (proxy_t *px, cd_t cd);
 /* Rende il canale inutilizzabile. */
 
 
 bool
-channel_is_activable (cd_t cd);
+channel_is_activable (proxy_t *px, cd_t cd);
 
 
 bool
-channel_is_connected (cd_t cd);
+channel_is_connected (proxy_t *px, cd_t cd);
 
 
 bool
-channel_is_connecting (cd_t cd);
+channel_is_connecting (proxy_t *px, cd_t cd);
 
 
 bool
-channel_is_listening (cd_t cd);
+channel_is_listening (proxy_t *px, cd_t cd);
 
 
 bool
-channel_must_connect (cd_t cd);
+channel_must_connect (proxy_t *px, cd_t cd);
 
 
 bool
-channel_must_listen (cd_t cd);
+channel_must_listen (proxy_t *px, cd_t cd);
 
 
 char *
-channel_name (cd_t cd);
-/* Ritorna una stringa allocata staticamente e terminata da '\0' della forma
+channel_name (proxy_t *px, cd_t cd);
+/* Ritorna una stringa terminata da '\0' della forma
  * "xxx.xxx.xxx.xxx:yyyyy - xxx.xxx.xxx.xxx:yyyyy", dove il primo e'
- * l'indirizzo locale, il secondo quello remoto. */
+ * l'indirizzo locale, il secondo quello remoto. La stringa sta in px e viene
+ * sovrascritta dalla chiamata successiva. */
 
 
 void
-channel_prepare_io (cd_t cd);
+channel_prepare_io (proxy_t *px, cd_t cd);
+
+
+void
+channel_probe (proxy_t *px, cd_t cd);
 
 
 int
-channel_read (cd_t cd);
+channel_read (proxy_t *px, cd_t cd);
+
+
+void
+channel_rtt_sample (proxy_t *px, cd_t cd, double rtt);
+
+
+void
+channel_set_busy_poll (proxy_t *px, double interval);
+/* Dopo ogni evento il ciclo principale non si blocca per interval secondi.
+ * Va chiamata prima di proxy_init. */
+
+
+void
+channel_set_host_local (proxy_t *px, bool sender);
+/* L'host sta nello stesso processo, in un altro thread. Va chiamata prima
+ * di proxy_init. */
+
+
+void
+channel_set_host_path (proxy_t *px, char *path);
+/* Il canale con l'host usa il socket AF_UNIX path. Va chiamata prima di
+ * proxy_init. */
+
+
+void
+channel_set_timeouts (proxy_t *px, double activity, double probe);
+/* Va chiamata prima di proxy_init. */
 
 
 int
-channel_write (cd_t cd);
+channel_write (proxy_t *px, cd_t cd);
+
+
+void
+feed_download (proxy_t *px);
 
 
 void
-feed_download (void);
+feed_upload (proxy_t *px);
 
 
 void
-feed_upload (void);
+join_ack (proxy_t *px, bool timer);
+/* Conferma al peer i segmenti consegnati all'host. timer e' TRUE per la
+ * ripetizione periodica, marcata con RPTFLAG. */
 
 
-cd_t
-get_cd_from (void *element, int type);
+void
+join_add (proxy_t *px, struct segwrap *sw);
+
+
+int
+join_add_inplace (proxy_t *px, seg_t *seg, size_t seglen, cd_t cd);
+/* Gestisce senza segwrap il segmento seg, lungo seglen e appena ricevuto dal
+ * canale cd, se e' un segmento dati vecchio o duplicato, che viene scartato,
+ * oppure il prossimo da consegnare, il cui payload viene copiato
+ * direttamente in host_sndbuf.
+ * Ritorna 0 se lo ha gestito, -1 se va passato a handle_rcvd_segment. */
+
+
+proxy_t *
+proxy_create (void);
+/* Alloca un proxy, da inizializzare con proxy_init. */
 
 
 void
-join_add (struct segwrap *sw);
+proxy_destroy (proxy_t *px);
+/* Chiude i canali e dealloca px. core non deve essere in esecuzione. */
 
 
 int
-proxy_init (port_t hostlistport,
+proxy_init (proxy_t *px, port_t hostlistport,
 		char *netconnaddr[NETCHANNELS],
 		port_t netconnport[NETCHANNELS],
 		port_t netlistport[NETCHANNELS],
 		char *hostconnaddr, port_t hostconnport);
 
+
+void
+proxy_stop (proxy_t *px);
+/* Fa terminare core, chiamata da un altro thread. Solo con l'host nello
+ * stesso processo. */
+
+
+bool
+proxy_stopped (proxy_t *px);
+
+
 int
-accept_connection (cd_t cd);
+accept_connection (proxy_t *px, cd_t cd);
 
 
 void
-activate_channels (void);
+activate_channels (proxy_t *px);
 
 
 int
-finalize_connection (cd_t cd);
+finalize_connection (proxy_t *px, cd_t cd);
 
 
 fd_t
-set_file_descriptors (fd_set *rdset, fd_set *wrset);
+set_file_descriptors (proxy_t *px, fd_set *rdset, fd_set *wrset);
 
 
 struct segwrap *
-set_last_ack_rcvd (struct segwrap *ack);
+set_last_ack_rcvd (proxy_t *px, struct segwrap *ack);
 
 
 void
-urgent_add (struct segwrap *sw);
+urgent_add (proxy_t *px, struct segwrap *sw);
 
 
 bool
-urgent_empty (void);
+urgent_empty (proxy_t *px);
 
 
 struct segwrap *
-urgent_head (void);
+urgent_head (proxy_t *px);
 
 
 struct segwrap *
-urgent_remove (void);
+urgent_remove (proxy_t *px);
 
 
 void
-urgent_rm_acked (struct segwrap *ack);
+urgent_rm_acked (proxy_t *px, struct segwrap *ack);
 
 #endif /* CHANNEL_H */
@@ -9,7 +9,7 @@
 *******************************************************************************/
 
 int
-core (void);
+core (proxy_t *px);
 
 
 #endif /* CORE_H */
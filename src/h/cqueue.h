@@ -36,6 +36,12 @@ void
 cqueue_drop_tail (cqueue_t *cq, size_t nbytes);
 
 
+seg_t *
+cqueue_head (cqueue_t *cq);
+/* Ritorna il puntatore al primo byte di cq, seguito da cqueue_get_used (cq)
+ * byte contigui, per leggerli senza copiarli. Lato consumatore. */
+
+
 size_t
 cqueue_get_aval (cqueue_t *cq);
 
@@ -39,4 +39,32 @@ d2tv (double value, struct timeval *tv);
 double
 tv2d (struct timeval *tv, bool must_free);
 
+
+/*
+ * Timestamp delle sonde.
+ */
+
+double
+tstamp_diff (tst_t later, tst_t earlier);
+
+
+tst_t
+tstamp_now (void);
+
+
+/*
+ * Orologio monotono.
+ */
+
+uint64_t
+clock_ns (void);
+
+
+/*
+ * Orologio virtuale.
+ */
+
+void
+crono_set_virtual (uint64_t ns);
+
 #endif /* CRONO_H */
@@ -1,6 +1,8 @@
 #ifndef GETARGS_H
 #define GETARGS_H
 
+#include "types.h"
+
 
 /*******************************************************************************
 				  Prototipi
@@ -8,15 +10,30 @@
 
 int
 getargs (int argc, char **argv, char *fmt, ...);
-/* Secondo il formato fmt, converte i vari argv[i] in indirizzi o porte e li
- * scrive negli indirizzi dati.
+/* Secondo il formato fmt, converte gli argc argomenti di argv in indirizzi o
+ * porte e li scrive negli indirizzi dati, nello stesso ordine.
  *
- * Ogni carattere della stringa fmt specifica o un indirizzo ip ('a') o una
- * porta ('p').
+ * Ogni carattere della stringa fmt specifica o un indirizzo ip ('a'), scritto
+ * in un char * dopo averne controllato la validita', o una porta ('p'),
+ * scritta in un port_t in host byte order.
  *
  * Se il valore da linea di comando e' '-', lascia il valore di default.
  *
- * Ritorna TRUE se riesce, FALSE se fallisce. */
+ * Ritorna 0 se riesce, -1 se un argomento non e' valido o se sono piu' dei
+ * caratteri di fmt. */
+
+
+int
+getopts_proxy (proxy_t *px, int argc, char **argv);
+/* Interpreta le opzioni comuni a psend e precv, descritte da
+ * print_options_help, e configura px e i moduli relativi.
+ *
+ * Ritorna l'indice in argv del primo argomento che non e' un'opzione, -1 se
+ * un'opzione non e' valida. */
+
+
+void
+print_options_help (void);
 
 
 #endif /* GETARGS_H */
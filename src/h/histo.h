@@ -0,0 +1,73 @@
+#ifndef HISTO_H
+#define HISTO_H
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+/*
+ * Istogrammi.
+ */
+
+void
+histo_add (struct histo *h, double secs, uint32_t n);
+/* Aggiunge n campioni di durata secs. E' sicura rispetto a lettori
+ * concorrenti purche' lo scrittore sia uno solo. */
+
+
+uint64_t
+histo_percentile (struct histo *h, double p);
+/* Ritorna in microsecondi il valore sotto cui cade la frazione p dei
+ * campioni, arrotondato al limite superiore dell'intervallo. */
+
+
+void
+histo_print (FILE *f, struct histo *h, char *name);
+
+
+char *
+histo_stage_name (int stage);
+
+
+/*
+ * Abilitazione delle misure nel proxy.
+ */
+
+void
+latency_enable (void);
+
+
+bool
+latency_enabled (void);
+
+
+/*
+ * Marcatori temporali.
+ */
+
+struct tmark *
+tmarks_first (tmarks_t *tm);
+/* Ritorna il marcatore piu' vecchio, NULL se non ce ne sono. */
+
+
+void
+tmarks_pop (tmarks_t *tm);
+
+
+void
+tmarks_reset (tmarks_t *tm);
+
+
+void
+tmarks_push (tmarks_t *tm, uint64_t end, tst_t time, bool has_tst, tst_t tst,
+		uint32_t count);
+/* Se tm e' pieno il marcatore viene fuso con l'ultimo, che si estende fino
+ * a end. */
+
+
+#endif /* HISTO_H */
@@ -0,0 +1,74 @@
+#ifndef MULTIHOMING_H
+#define MULTIHOMING_H
+
+/*
+ * libmultihoming: psend o precv dentro l'applicazione. Il proxy gira in un
+ * thread suo e l'host e' l'applicazione stessa, che scrive e legge i buffer
+ * del proxy con mh_send e mh_recv senza passare da un socket. Le
+ * statistiche restano nel processo, senza regione condivisa per mhstat.
+ *
+ * L'header non dipende dagli altri del proxy e viene installato.
+ */
+
+#include <sys/types.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Numero di canali di rete, come NETCHANNELS. */
+#define     MH_CHANNELS     3
+
+typedef struct mh mh_t;
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+void
+mh_close (mh_t *mh);
+/* Ferma il proxy e ne rilascia le risorse. I dati non ancora consegnati
+ * vanno persi. */
+
+
+int
+mh_fd (mh_t *mh);
+/* Ritorna il fd da attendere in lettura con select o poll: e' leggibile
+ * finche' mh_send (Sender) o mh_recv (Receiver) possono spostare dati. Non
+ * va letto ne' chiuso. */
+
+
+mh_t *
+mh_open_receiver (unsigned short netlistport[MH_CHANNELS]);
+/* Avvia un proxy Receiver in ascolto dal Ritardatore sulle porte
+ * netlistport, NULL per quelle di precv.
+ * Ritorna NULL se fallisce. */
+
+
+mh_t *
+mh_open_sender (char *netconnaddr[MH_CHANNELS],
+		unsigned short netconnport[MH_CHANNELS]);
+/* Avvia un proxy Sender che si connette al Ritardatore sugli indirizzi
+ * netconnaddr, in formato xxx.xxx.xxx.xxx, e sulle porte netconnport; NULL
+ * per i valori di psend.
+ * Ritorna NULL se fallisce. */
+
+
+ssize_t
+mh_recv (mh_t *mh, void *buf, size_t len);
+/* Receiver: copia in buf fino a len byte ricevuti, nell'ordine in cui il
+ * Sender li ha spediti. Non blocca.
+ * Ritorna i byte copiati, -1 con errno EAGAIN se non ce ne sono, EINVAL se
+ * mh e' un Sender. */
+
+
+ssize_t
+mh_send (mh_t *mh, const void *buf, size_t len);
+/* Sender: accoda fino a len byte di buf per la spedizione. Non blocca.
+ * Ritorna i byte accodati, -1 con errno EAGAIN se il buffer del proxy e'
+ * pieno, EINVAL se mh e' un Receiver. */
+
+
+#endif /* MULTIHOMING_H */
@@ -0,0 +1,32 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Punti di tracciamento statici (USDT) per perf, bpftrace e systemtap, con
+ * provider "mh". Se sys/sdt.h non c'e' le macro non generano codice e gli
+ * argomenti non vengono valutati: non devono avere effetti collaterali.
+ * Con sys/sdt.h ogni punto costa un nop finche' nessuno vi si aggancia.
+ */
+
+#include <config.h>
+
+#if HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define     MH_PROBE1(name, a)                                          \
+	DTRACE_PROBE1 (mh, name, a)
+#define     MH_PROBE2(name, a, b)                                       \
+	DTRACE_PROBE2 (mh, name, a, b)
+#define     MH_PROBE3(name, a, b, c)                                    \
+	DTRACE_PROBE3 (mh, name, a, b, c)
+
+#else /* HAVE_SYS_SDT_H */
+
+#define     MH_PROBE1(name, a)               do { } while (0)
+#define     MH_PROBE2(name, a, b)            do { } while (0)
+#define     MH_PROBE3(name, a, b, c)         do { } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* PROBES_H */
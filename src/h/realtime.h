@@ -0,0 +1,36 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "types.h"
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+void
+realtime_enable (void);
+/* Abilita il modo a latenza deterministica: realtime_start blocca in memoria
+ * il processo e stampa l'occupazione risultante. */
+
+
+void
+realtime_set_cpu (int cpu);
+/* Con il modo abilitato, realtime_start lega il thread del ciclo principale
+ * alla cpu cpu. Abilita il modo. */
+
+
+void
+realtime_set_priority (int prio);
+/* Con il modo abilitato, realtime_start porta il thread del ciclo principale
+ * in SCHED_FIFO con priorita' prio. Abilita il modo. */
+
+
+void
+realtime_start (void);
+/* Chiamata dal ciclo principale prima di entrarvi, se il modo e' abilitato
+ * applica le impostazioni al thread chiamante e, alla prima chiamata, al
+ * processo. Quelle che falliscono sono segnalate su stderr e saltate. */
+
+
+#endif /* REALTIME_H */
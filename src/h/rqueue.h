@@ -12,6 +12,10 @@ int
 rqueue_add (rqueue_t *rq, struct segwrap *sw);
 
 
+int
+rqueue_add_urgent (rqueue_t *rq, struct segwrap *sw);
+
+
 bool
 rqueue_can_read (rqueue_t *rq);
 
@@ -21,7 +25,7 @@ rqueue_can_write (rqueue_t *rq);
 
 
 rqueue_t *
-rqueue_create (size_t len);
+rqueue_create (proxy_t *px, cd_t cd, size_t len, bool out);
 
 
 struct segwrap *
@@ -25,8 +25,9 @@ struct segwrap *
 seghash_remove (struct segwrap **hash_table, size_t table_size, seq_t key);
 
 
-void
+struct segwrap *
 seghash_rm_acked
 (struct segwrap **hash_table, size_t table_size, struct segwrap *ack);
+/* Ritorna la coda dei segwrap rimossi perche' confermati da ack. */
 
 #endif /* SEGHASH_H */
@@ -9,15 +9,27 @@
 *******************************************************************************/
 
 void
-handle_rcvd_segment (struct segwrap *sw);
+destroy_segment_module (proxy_t *px);
 
 
 void
-handle_sent_segment (struct segwrap *sent);
+handle_rcvd_segment (proxy_t *px, struct segwrap *sw, cd_t cd);
 
 
 void
-init_segment_module (void);
+handle_sent_segment (proxy_t *px, struct segwrap *sent);
+
+
+void
+init_segment_module (proxy_t *px);
+
+
+size_t
+seg_hdr_len (seg_t *seg);
+
+
+bool
+seg_has_tst (seg_t *seg);
 
 
 bool
@@ -28,10 +40,18 @@ bool
 seg_is_critical (seg_t *seg);
 
 
+bool
+seg_is_echo (seg_t *seg);
+
+
 bool
 seg_is_nak (seg_t *seg);
 
 
+bool
+seg_is_probe (seg_t *seg);
+
+
 pld_t *
 seg_pld (seg_t *seg);
 
@@ -44,24 +64,37 @@ seq_t
 seg_seq (seg_t *seg);
 
 
+tst_t
+seg_tst (seg_t *seg);
+
+
 struct segwrap *
-segwrap_create (void);
+segwrap_create (proxy_t *px);
 
 
 struct segwrap *
-segwrap_nak_create (seq_t nakseq);
+segwrap_ctrl_create (proxy_t *px);
 
 
-void
-segwrap_destroy (struct segwrap *sw);
+struct segwrap *
+segwrap_ack_create (proxy_t *px, seq_t ackseq);
+
+
+struct segwrap *
+segwrap_nak_create (proxy_t *px, seq_t nakseq);
+
+
+struct segwrap *
+segwrap_probe_create (proxy_t *px, seq_t prbseq);
 
 
 void
-segwrap_fill (struct segwrap *sw, cqueue_t *src, len_t pldlen, seq_t seqnum);
+segwrap_destroy (proxy_t *px, struct segwrap *sw);
 
 
 void
-segwrap_flush_cache (void);
+segwrap_fill (struct segwrap *sw, cqueue_t *src, len_t pldlen, seq_t seqnum,
+		tst_t *tst);
 
 
 bool
@@ -87,20 +120,4 @@ segwrap_urgcmp (struct segwrap *sw_1, struct segwrap *sw_2);
 int
 seqcmp (seq_t a, seq_t b);
 
-
-void
-urgent_add (struct segwrap *sw);
-
-
-bool
-urgent_empty (void);
-
-
-struct segwrap *
-urgent_head (void);
-
-
-struct segwrap *
-urgent_remove (void);
-
 #endif /* SEGMENT_H */
@@ -0,0 +1,31 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "types.h"
+
+#include <sys/select.h>
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+bool
+sim_enabled (void);
+/* Ritorna TRUE se il proxy gira sotto mhsim. */
+
+
+void
+sim_init (void);
+/* Se l'ambiente contiene MHSIM_FD il proxy gira sotto mhsim: attende il via
+ * e da quel momento usa il tempo virtuale del simulatore. Va chiamata prima
+ * di proxy_init. */
+
+
+int
+sim_select (int nfds, fd_set *rdset, fd_set *wrset, struct timeval *timeout);
+/* Come select, ma l'attesa avviene in tempo virtuale: quando nessun fd e'
+ * pronto il proxy cede il turno a mhsim fino alla scadenza di timeout o
+ * finche' il simulatore non lo risveglia. */
+
+#endif /* SIM_H */
@@ -0,0 +1,46 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+void *
+slab_alloc (slab_t *sl);
+/* Ritorna un oggetto di sl, mappando una nuova arena se non ce ne sono di
+ * liberi. Come xmalloc, se fallisce termina il processo. */
+
+
+void
+slab_destroy (slab_t *sl);
+/* Rilascia tutte le arene di sl, compresi gli oggetti ancora in uso. */
+
+
+void
+slab_free (slab_t *sl, void *obj);
+/* Restituisce a sl l'oggetto obj. */
+
+
+void
+slab_hugepages_enable (void);
+/* Le slab inizializzate da qui in poi usano arene di SLAB_HUGE_ARENA byte
+ * su hugepage trasparenti, dove il sistema le supporta. */
+
+
+void
+slab_init (slab_t *sl, size_t objsize, size_t align, int id);
+/* Inizializza sl, senza arene, per oggetti di objsize byte allineati ad
+ * align, potenza di 2 non maggiore di CACHE_LINE. id e' l'indice delle
+ * statistiche in st_slab. */
+
+
+void
+slab_reserve (slab_t *sl, size_t nobj);
+/* Mappa subito le arene per nobj oggetti e alza le soglie di sl perche'
+ * restino: finche' gli oggetti in uso non superano nobj, sl non mappa ne'
+ * rilascia arene. */
+
+#endif /* SLAB_H */
@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"
+
+
+/*******************************************************************************
+				   Costanti
+*******************************************************************************/
+
+/* Identificano una regione di statistiche valida. */
+#define     STATS_MAGIC       0x6d687374UL
+#define     STATS_VERSION     6
+
+/* Prefisso del nome della regione, seguito dal pid. */
+#define     STATS_PREFIX      "/mh-"
+
+
+/*******************************************************************************
+				    Macro
+*******************************************************************************/
+
+/*
+ * I contatori hanno piu' scrittori: con libmultihoming il thread
+ * dell'applicazione conta i byte in channel_host_put e channel_host_get, e i
+ * proxy dello stesso processo condividono la regione. STATS_ADD e STATS_SUB
+ * sono quindi read-modify-write atomici, rilassati perche' nessun altro dato
+ * dipende dal loro ordine. STATS_SET resta uno store per i valori che
+ * fotografano uno stato, dove vince l'ultimo scrittore. mhstat legge con
+ * STATS_GET e vede sempre valori interi, eventualmente non allineati tra
+ * loro di un'iterazione.
+ */
+#define     STATS_GET(field)                                            \
+	__atomic_load_n (&(field), __ATOMIC_RELAXED)
+
+#define     STATS_SET(field, val)                                       \
+	__atomic_store_n (&mh_stats->field, (uint64_t)(val), __ATOMIC_RELAXED)
+
+#define     STATS_ADD(field, n)                                         \
+	((void)__atomic_fetch_add (&mh_stats->field, (uint64_t)(n),       \
+	                           __ATOMIC_RELAXED))
+
+#define     STATS_SUB(field, n)                                         \
+	((void)__atomic_fetch_sub (&mh_stats->field, (uint64_t)(n),       \
+	                           __ATOMIC_RELAXED))
+
+
+/*******************************************************************************
+				  Variabili
+*******************************************************************************/
+
+/* Regione del processo, sempre valida dopo stats_init. */
+extern struct mhstats *mh_stats;
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+void
+stats_init (char *name);
+/* Crea la regione condivisa STATS_PREFIX<pid>, che viene rimossa all'uscita
+ * del processo. Se la memoria condivisa non e' disponibile le statistiche
+ * restano locali al processo. */
+
+
+char *
+stats_region_name (void);
+/* Ritorna il nome della regione, NULL se non e' condivisa. */
+
+#endif /* STATS_H */
@@ -8,40 +8,44 @@
 *******************************************************************************/
 
 void
-add_timeout (timeout_t *to, int class);
+add_timeout (proxy_t *px, timeout_t *to, int class);
 
 
 void
-add_nak_timeout (seq_t seq);
+add_nak_timeout (proxy_t *px, seq_t seq);
 
 
 double
-check_timeouts (void);
+check_timeouts (proxy_t *px);
 
 
 void
-del_timeout (timeout_t *to, int class);
+del_timeout (proxy_t *px, timeout_t *to, int class);
 
 
 void
-del_nak_timeout (seq_t seq);
+destroy_timeout_module (proxy_t *px);
+
+
+void
+del_nak_timeout (proxy_t *px, seq_t seq);
 
 
 timeout_t *
-get_timeout (int class, int id);
+get_timeout (proxy_t *px, int class, int id);
 
 
 void
-init_timeout_module (void);
+init_timeout_module (proxy_t *px);
 
 
 timeout_t *
-timeout_create
-(double maxval, timeout_handler_t trigger, int trigger_arg, bool oneshot);
+timeout_create (proxy_t *px, double maxval, timeout_handler_t trigger,
+		int trigger_arg, bool oneshot);
 
 
 void
-timeout_destroy (timeout_t *to);
+timeout_destroy (proxy_t *px, timeout_t *to);
 
 
 void
@@ -52,4 +56,9 @@ timeout_init (timeout_t *to, double maxval, timeout_handler_t trigger,
 void
 timeout_reset (timeout_t *to);
 
+
+void
+timeout_set_maxval (timeout_t *to, double maxval);
+/* Cambia la durata di to, dal prossimo controllo. */
+
 #endif /* TIMEOUT_MANAGER_H */
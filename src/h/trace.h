@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+
+
+/*******************************************************************************
+				  Prototipi
+*******************************************************************************/
+
+int
+capture_open (char *path, char *name);
+/* Apre path e vi scrive l'intestazione: da questo momento istante e
+ * dimensione di ogni lettura dall'host vengono registrati, per riprodurli con
+ * mhreplay.
+ * Ritorna 0 se riesce, -1 altrimenti. */
+
+
+void
+capture_host_read (size_t nread);
+/* Registra una lettura di nread byte dall'host, se la cattura e' attiva. */
+
+
+void
+init_trace_module (void);
+
+
+void
+trace_flush (void);
+/* Scrive sui file gli eventi e le letture negli anelli, se i file sono
+ * aperti. */
+
+
+int
+trace_open (char *path, char *name);
+/* Apre path e vi scrive l'intestazione: da questo momento l'anello viene
+ * scaricato sul file ogni volta che si riempie.
+ * Ritorna 0 se riesce, -1 altrimenti. */
+
+
+void
+trace_seg (int type, seg_t *seg, size_t seglen, cd_t cd);
+/* Registra l'evento type del segmento seg, lungo seglen, sul canale cd, -1 se
+ * nessuno, se la traccia e' aperta. */
+
+
+void
+trace_segment (int type, struct segwrap *sw, cd_t cd);
+/* Come trace_seg, per il segmento di sw. */
+
+#endif /* TRACE_H */
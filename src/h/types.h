@@ -6,11 +6,14 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 
@@ -44,10 +47,25 @@ typedef uint16_t port_t;
 typedef int fd_t;     /* file e socket */
 typedef int cd_t;     /* canali */
 
+/*
+ * Indirizzi dei canali: ip e porta, oppure il path di un socket AF_UNIX per
+ * il canale con l'host.
+ */
+typedef union {
+	struct sockaddr a_sa;
+	struct sockaddr_in a_in;
+	struct sockaddr_un a_un;
+} addr_t;
+
+/*
+ * Stato di un proxy, vedi struct proxy.
+ */
+typedef struct proxy proxy_t;
+
 /*
  * Puntatori a funzione.
  */
-typedef void (*timeout_handler_t)(int args);
+typedef void (*timeout_handler_t)(proxy_t *px, int args);
 typedef bool (*condition_checker_t)(void *args);
 typedef int (*io_performer_t)(fd_t fd, void *args);
 
@@ -64,6 +82,8 @@ typedef uint8_t pld_t;
 typedef uint8_t flag_t;
 /* Buffer contentente un segmento. */
 typedef uint8_t seg_t;
+/* Timestamp delle sonde, in microsecondi modulo 2^32. */
+typedef uint32_t tst_t;
 
 
 /*******************************************************************************
@@ -90,23 +110,68 @@ typedef uint8_t seg_t;
 
 /*
  * Tipo e durata dei timeout in secondi.
+ * TOACT_VAL e TOPRB_VAL sono i valori predefiniti, modificabili da linea di
+ * comando.
  */
-#define     TOACT_VAL     100000000.0
-/* #define     TOACT_VAL     0.250 */
+#define     TOACT_VAL     0.250
+#define     TOPRB_VAL     0.050
+/* Timeout di attivita' minimo di un canale senza campioni di RTT, come l'RTO
+ * iniziale di TCP: l'echo della prima sonda arriva solo dopo un RTT. */
+#define     TOACT_INIT    1.0
+/* Attesa massima prima di riaprire un canale chiuso: un canale che resta
+ * aperto almeno questo tempo riparte dall'attesa minima. */
+#define     TOREOPEN_MAX  8.0
 #define     TONAK_VAL     0.130
 #define     TOACK_VAL     2
 /* Numero di tipi di timeout. */
-#define     TMOUTS      3
+#define     TMOUTS      4
 /* Indici */
 #define     TONAK       0
 #define     TOACT       1
 #define     TOACK       2
+#define     TOPRB       3
 
 
 /* Valore minimo del buffer tcp di spedizione.
  * Per Linux e' 1024, NetBSD sembra accettare anche 1 (!). */
 #define     TCP_MIN_SNDBUF_SIZE     1024
 
+/* Buffer tcp dei canali sotto mhsim, dove non si puo' lasciarli all'autotuning
+ * del kernel, che dipende dal tempo reale. */
+#define     TCP_SIM_BUF_SIZE     (128 * 1024)
+
+/* Buffer applicazione del canale con l'host quando questo sta nello stesso
+ * processo, vedi channel_set_host_local. */
+#define     HOST_LOCAL_BUF_SIZE     (256 * 1024)
+
+/* Lunghezza massima di un indirizzo in forma di stringa, terminatore
+ * compreso, vedi addrstr. */
+#define     ADDRSTRLEN     (sizeof (((struct sockaddr_un *)0)->sun_path))
+
+/* Dimensione di una linea di cache, per separare i campi scritti da thread
+ * diversi. */
+#define     CACHE_LINE     64
+
+/* Segmenti al piu' raccolti da una sola sendmsg. */
+#define     IOVLEN     256
+
+/*
+ * Slab dei segwrap, dei segwrap di controllo e dei timeout, vedi slab.c. Le
+ * arene sono di SLAB_ARENA byte, SLAB_HUGE_ARENA con le hugepage
+ * trasparenti. Quando gli oggetti liberi superano SLAB_HIWAT arene le arene
+ * vuote vengono restituite al sistema, finche' ne restano liberi almeno
+ * SLAB_LOWAT arene.
+ */
+#define     SLAB_ARENA          (64 * 1024)
+#define     SLAB_HUGE_ARENA     (2 * 1024 * 1024)
+#define     SLAB_HIWAT          4
+#define     SLAB_LOWAT          1
+/* Numero di slab e indici in st_slab. */
+#define     SLABS      3
+#define     SLSW       0
+#define     SLTO       1
+#define     SLCT       2
+
 
 /*
  * Segmenti.
@@ -115,18 +180,28 @@ typedef uint8_t seg_t;
 #define     FLG     0
 #define     SEQ     1
 #define     LEN     2
+/* Nelle sonde e negli echi, al posto di LEN. Nei segmenti dati con TSTFLAG
+ * il timestamp segue LEN, se presente, vedi seg_hdr_len. */
+#define     TST     2
 
 /* Dimensione campi, in byte. */
 #define     SEQLEN     sizeof(seq_t)
 #define     LENLEN     sizeof(len_t)
 #define     FLGLEN     sizeof(flag_t)
+#define     TSTLEN     sizeof(tst_t)
 
 /* Massimo numero di sequenza. */
 #define     SEQMAX     UINT8_MAX
+/* Massimo numero di segmenti dati spediti e non ancora confermati dal peer.
+ * Deve restare sotto meta' dello spazio dei seqnum, altrimenti il peer
+ * scambia i segmenti nuovi per vecchi, vedi seqcmp. */
+#define     SEQWIN     (SEQMAX / 2 - 1)
+/* Segmenti consegnati all'host dopo i quali si spedisce un ACK. */
+#define     ACKEVERY     (SEQWIN / 4)
 
 /* Limiti dei segmenti, in byte. */
 #define     HDRMINLEN     (FLGLEN + SEQLEN)
-#define     HDRMAXLEN     (FLGLEN + SEQLEN + LENLEN)
+#define     HDRMAXLEN     (FLGLEN + SEQLEN + LENLEN + TSTLEN)
 
 /* XXX sono possibili payload minori di PLDMINLEN, e' solo indicativo.
  * XXX PLDMAXLEN invece e' un limite reale. */
@@ -139,6 +214,10 @@ typedef uint8_t seg_t;
 
 #define     NAKLEN        FLGLEN + SEQLEN
 #define     ACKLEN        NAKLEN
+/* Sonde ed echi: flag, seqnum della sonda e timestamp del mittente. */
+#define     PRBLEN        (HDRMINLEN + TSTLEN)
+/* Segmenti di controllo: sonde, echi, NAK e ACK. */
+#define     CTRLMAXLEN    PRBLEN
 
 /* Bit del campo flag */
 #define     CRTFLAG     0x1
@@ -146,11 +225,75 @@ typedef uint8_t seg_t;
 #define     LENFLAG     0x4
 #define     NAKFLAG     0x8
 #define     ACKFLAG     0x10
+#define     PRBFLAG     0x20
+#define     ECHFLAG     0x40
+#define     TSTFLAG     0x80
+
+/* Su un ACK, che non e' mai rispedito, CRTFLAG indica la ripetizione del
+ * timeout degli ACK, che non segnala perdite. */
+#define     RPTFLAG     CRTFLAG
+
+
+/* Numero di classi di segmenti urgenti, vedi segwrap_prio. */
+#define     URGNO     5
+
+/* Dimensione della tabella hash dei segwrap spediti. */
+#define     HT_SENT_SIZE     10
+
+
+/*
+ * Istogrammi delle latenze.
+ */
+/* Bit dei sotto-intervalli lineari di ogni potenza di 2: errore relativo
+ * massimo 1 / 2^HISTO_SUBBITS. */
+#define     HISTO_SUBBITS     3
+#define     HISTO_SUB         (1 << HISTO_SUBBITS)
+/* Intervalli sufficienti per valori fino a 2^32 microsecondi. */
+#define     HISTO_BUCKETS     ((32 - HISTO_SUBBITS + 1) * HISTO_SUB)
+
+/* Fasi misurate. */
+#define     HSTAGES       6
+#define     HS_RCVBUF     0     /* Sender: attesa in host_rcvbuf. */
+#define     HS_SNDQ       1     /* Sender: attesa in urgentq e rqueue. */
+#define     HS_KERNEL     2     /* Sender: attesa nel buffer tcp. */
+#define     HS_JOINQ      3     /* Receiver: attesa in joinq. */
+#define     HS_HOSTQ      4     /* Receiver: attesa in host_sndbuf. */
+#define     HS_TOTAL      5     /* Lettura dal Sender - scrittura al
+                                   Receiver. */
+
+/* Marcatori temporali in attesa per ogni flusso di byte. */
+#define     TMARKS        64
+
+
+/*
+ * Traccia degli eventi dei segmenti.
+ */
+#define     TRACE_MAGIC       0x6d687472UL
+#define     TRACE_VERSION     1
+/* Eventi nell'anello, scritti su file in un solo blocco. */
+#define     TRACE_EVENTS      4096
+
+/* Tipi di evento. */
+#define     TRTYPES       10
+#define     TR_CREATE     0     /* Creato dai dati dell'host. */
+#define     TR_URGENT     1     /* Accodato nella urgentq. */
+#define     TR_QUEUE      2     /* Accodato sul net_sndbuf di un canale. */
+#define     TR_SENT       3     /* Spedito completamente. */
+#define     TR_RECV       4     /* Ricevuto completamente. */
+#define     TR_DUP        5     /* Scartato dalla joinq perche' duplicato. */
+#define     TR_NAKGEN     6     /* NAK generato per un seqnum mancante. */
+#define     TR_RETRANS    7     /* Recuperato per un NAK, diventa critico. */
+#define     TR_DELIVER    8     /* Consegnato all'host. */
+#define     TR_ACK        9     /* Confermati i seqnum fino a questo. */
 
+/*
+ * Cattura delle letture dall'host, da riprodurre con mhreplay.
+ */
+#define     CAPTURE_MAGIC     0x6d686361UL
+#define     CAPTURE_VERSION   1
+/* Letture nell'anello, scritte su file in un solo blocco. */
+#define     CAPTURE_READS     4096
 
-/* Tipi degli elementi da usare in get_cd_from */
-#define     ELRQUEUE     0
-#define     ELCQUEUE     1
 
 /*******************************************************************************
 				  Strutture
@@ -196,61 +339,374 @@ struct chan {
 	int c_listfd;
 
 	/* Indirizzi locale e remoto. */
-	struct sockaddr_in c_laddr;
-	struct sockaddr_in c_raddr;
+	addr_t c_laddr;
+	addr_t c_raddr;
+
+	/* Indirizzi impostati da channel_init, da cui il canale riparte dopo
+	 * una chiusura. */
+	addr_t c_cfg_laddr;
+	addr_t c_cfg_raddr;
 
 	/* Dimensioni dei buffer tcp. */
 	size_t c_tcp_rcvbuf_len;
 	size_t c_tcp_sndbuf_len;
 
-	/* Timeout di attivita'. */
+	/* Timeout di attivita' e, a canale chiuso, di riapertura.
+	 * c_reopen_val e' la prossima attesa prima di riaprire, c_uptime
+	 * misura da quando il canale e' stato (ri)aperto. */
 	timeout_t *c_activity;
+	timeout_t *c_reopen;
+	double c_reopen_val;
+	crono_t c_uptime;
+
+	/* Timeout di invio sonda e relativo seqnum. */
+	timeout_t *c_probe;
+	seq_t c_prbseq;
+
+	/* Ultimo RTT misurato con le sonde e media mobile, in secondi. */
+	double c_rtt;
+	double c_srtt;
 };
 
 
 /*
- * Coda circolare a dimensione fissa.
+ * Coda circolare a dimensione fissa, con un solo produttore (add, read) e un
+ * solo consumatore (remove, write, seglen) che possono stare in thread
+ * diversi senza lock. Testa e coda sono contatori che crescono senza mai
+ * tornare indietro, l'indice nel buffer si ottiene con la maschera; ognuno
+ * sta in una linea di cache propria, scritta solo dal suo lato.
  */
 typedef struct {
-	/* TRUE quando tail e' minore di head, distingue coda completamente
-	 * vuota da completamente piena. */
-	bool cq_wrap;
-
-	/* Puntatore al buffer. */
+	/* Puntatore al buffer, mappato due volte di seguito. */
 	seg_t *cq_data;
 
-	/* Dimensione del buffer. */
+	/* Dimensione del buffer, potenza di 2, e maschera degli indici. */
 	size_t cq_len;
+	size_t cq_mask;
+	char cq_pad0[CACHE_LINE - sizeof (size_t)];
 
-	/* Testa e coda. */
+	/* Testa, scritta dal consumatore. */
 	size_t cq_head;
+	char cq_pad1[CACHE_LINE - sizeof (size_t)];
+
+	/* Coda, scritta dal produttore. */
 	size_t cq_tail;
+	char cq_pad2[CACHE_LINE - sizeof (size_t)];
 } cqueue_t;
 
 
 /*
- * Wrapper per creare code di segmenti.
+ * Wrapper per creare code di segmenti. I segwrap sono allineati alla linea
+ * di cache, in cui stanno i collegamenti, i campi confrontati da
+ * segwrap_urgcmp e l'header del segmento: scorrere una coda tocca una
+ * linea per segwrap. sw_seg sta in fondo anche perche' i segwrap dei
+ * segmenti di controllo ne hanno solo CTRLMAXLEN byte, vedi
+ * segwrap_ctrl_create.
  */
 struct segwrap {
-	seg_t sw_seg[SEGMAXLEN];
-	size_t sw_seglen;
 	struct segwrap *sw_next;
 	struct segwrap *sw_prev;
 	double sw_tstamp;
+	size_t sw_seglen;
+	bool sw_ctrl;
+	seg_t sw_seg[SEGMAXLEN];
+};
+
+/* Dimensione di un segwrap di controllo. */
+#define     CTRLWRAPLEN     (offsetof (struct segwrap, sw_seg) + CTRLMAXLEN)
+
+
+/*
+ * Arena di una slab: una regione allineata alla propria dimensione, con in
+ * testa questa struct e a seguire gli oggetti, per cui l'arena di un oggetto
+ * si ottiene azzerando i bit bassi del suo indirizzo.
+ */
+struct slab_arena {
+	/* Oggetti liberati, in lista attraverso il loro primo puntatore, e
+	 * primo oggetto mai usato. */
+	void *sa_free;
+	char *sa_bump;
+	/* Oggetti in uso. */
+	size_t sa_used;
+	struct slab_arena *sa_next;
+	struct slab_arena *sa_prev;
 };
 
+/*
+ * Allocatore di oggetti di dimensione fissa. Le arene stanno in tre code:
+ * con oggetti sia in uso sia liberi, piene, senza oggetti in uso.
+ */
+typedef struct {
+	size_t sl_objsize;
+	size_t sl_arenasize;
+	size_t sl_perarena;
+	struct slab_arena *sl_partial;
+	struct slab_arena *sl_full;
+	struct slab_arena *sl_empty;
+	/* Oggetti liberi in tutte le arene e soglie in oggetti, vedi
+	 * SLAB_HIWAT. */
+	size_t sl_nfree;
+	size_t sl_hiwat;
+	size_t sl_lowat;
+	/* Indice in st_slab. */
+	int sl_id;
+} slab_t;
+
 
 /*
- * Coda di routing.
+ * Coda di routing. In entrata i byte letti dal sockfd passano per rq_data e
+ * ne vengono estratti i segmenti; in uscita non c'e' buffer: i segmenti di
+ * rq_sgmt vengono spediti direttamente dai loro segwrap, per cui
+ * riorganizzarli o spostarli su un altro canale non copia byte.
  */
 typedef struct {
-	/* Buffer circolare per I/O sul sockfd. */
+	/* Buffer circolare per la lettura dal sockfd, NULL in uscita. */
 	cqueue_t *rq_data;
 	/* Coda dei segmenti in uscita / in entrata. */
 	struct segwrap *rq_sgmt;
 	/* Numero di byte da spedire per completare il segmento
 	 * corrente. */
 	ssize_t rq_nbytes;
+	/* In uscita: capacita' in byte e byte ancora da spedire. */
+	size_t rq_len;
+	size_t rq_used;
+	/* Proxy e canale a cui appartiene. */
+	proxy_t *rq_px;
+	cd_t rq_cd;
 } rqueue_t;
 
+
+/*
+ * Istogramma a intervalli logaritmici di latenze in microsecondi.
+ */
+struct histo {
+	uint64_t h_count;
+	uint64_t h_max;
+	uint64_t h_bucket[HISTO_BUCKETS];
+};
+
+
+/*
+ * Marcatori temporali su un flusso di byte: tm_end e' la posizione nel
+ * flusso dell'ultimo byte marcato, tm_time l'istante della marcatura. Se
+ * presente, tm_tst e' il timestamp portato dal segmento.
+ */
+struct tmark {
+	uint64_t tm_end;
+	tst_t tm_time;
+	tst_t tm_tst;
+	bool tm_has_tst;
+	uint32_t tm_count;
+};
+
+typedef struct {
+	struct tmark tm_ring[TMARKS];
+	size_t tm_head;
+	size_t tm_used;
+} tmarks_t;
+
+
+/*
+ * Stato di un proxy: canali, buffer, code di segmenti e timeout. Le funzioni
+ * di channel, segment e timeout lo ricevono come primo argomento, per cui un
+ * processo puo' far girare piu' proxy, ciascuno in un solo thread; solo i
+ * buffer applicazione dell'host nello stesso processo sono condivisi con il
+ * thread dell'applicazione, sotto px_host_lock. Statistiche, traccia, misure
+ * di latenza e simulazione restano invece del processo.
+ */
+struct proxy {
+	/* Canali e indice round robin per il routing. */
+	struct chan px_ch[CHANNELS];
+	cd_t px_rrcd;
+
+	/* Buffer applicazione. */
+	cqueue_t *px_host_rcvbuf;
+	cqueue_t *px_host_sndbuf;
+	rqueue_t *px_net_rcvbuf[NETCHANNELS];
+	rqueue_t *px_net_sndbuf[NETCHANNELS];
+
+	/* Code dei segmenti urgenti, una per classe, e dei segmenti ricevuti
+	 * dal ritardatore. */
+	struct segwrap *px_urgentq[URGNO];
+	struct segwrap *px_joinq;
+
+	/* Ultimo seqnum inviato al ritardatore, all'host e confermato al peer
+	 * con un ACK. */
+	seq_t px_outseq;
+	seq_t px_last_sent;
+	seq_t px_last_ack_sent;
+
+	/* Ultimo ACK ricevuto e se e' gia' stato applicato ai net_sndbuf. */
+	struct segwrap *px_last_ack_rcvd;
+	bool px_ack_handled;
+
+	/* Misure di latenza, vedi HS_*: posizioni raggiunte nei flussi di
+	 * byte e marcatori in attesa che i byte marcati le superino. */
+	uint64_t px_host_rcvd;
+	uint64_t px_host_taken;
+	tmarks_t px_rcvbuf_marks;
+	uint64_t px_host_queued;
+	uint64_t px_host_written;
+	tmarks_t px_sndbuf_marks;
+	uint64_t px_net_written[NETCHANNELS];
+	tmarks_t px_kernel_marks[NETCHANNELS];
+
+	/* Durata dei timeout di attivita' e di invio sonda. */
+	double px_toact_val;
+	double px_toprb_val;
+
+	/* Durata del busy poll dopo un evento, 0 se disabilitato, vedi
+	 * channel_set_busy_poll. */
+	double px_busy_val;
+
+	/* Buffer del nome ritornato da channel_name. */
+	char px_name[2 * ADDRSTRLEN + 3];
+
+	/* Host nello stesso processo, vedi channel_host_put e
+	 * channel_host_get. Il lock protegge i buffer applicazione e i campi
+	 * che seguono, px_wake sveglia il ciclo principale e px_ready e'
+	 * leggibile finche' l'applicazione puo' scrivere (Sender) o leggere
+	 * (Receiver). */
+	bool px_host_local;
+	bool px_host_sender;
+	pthread_mutex_t px_host_lock;
+	fd_t px_wake[2];
+	fd_t px_ready[2];
+	bool px_wake_pending;
+	bool px_ready_set;
+	bool px_stop;
+
+	/* Path del socket AF_UNIX del canale con l'host, NULL per tcp. */
+	char *px_host_path;
+
+	/* Slab dei segwrap, completi e di controllo, e tabella hash di
+	 * quelli spediti. */
+	slab_t px_sw_slab;
+	slab_t px_ct_slab;
+	struct segwrap *px_ht_sent[HT_SENT_SIZE];
+	bool px_segment_ready;
+
+	/* Code di timeout per classe, slab da cui sono allocati e timeout
+	 * di ripetizione degli ACK. */
+	timeout_t *px_tqueue[TMOUTS];
+	slab_t px_to_slab;
+	timeout_t px_ack_timeout;
+	bool px_timeout_ready;
+};
+
+
+/*
+ * Evento della traccia, 16 byte. I file di traccia contengono una
+ * trace_header seguita dagli eventi, nel byte order della macchina.
+ */
+struct trace_event {
+	uint64_t te_time;     /* Nanosecondi, CLOCK_MONOTONIC. */
+	uint16_t te_len;      /* Lunghezza del segmento. */
+	uint8_t te_type;      /* TR_* */
+	uint8_t te_seq;
+	uint8_t te_flags;
+	int8_t te_cd;         /* -1 se l'evento non riguarda un canale. */
+	uint8_t te_pad[2];
+};
+
+struct trace_header {
+	uint32_t th_magic;
+	uint32_t th_version;
+	uint32_t th_evsize;
+	uint32_t th_pid;
+	char th_name[16];
+};
+
+/*
+ * Lettura dall'host catturata, 8 byte. I file di cattura contengono una
+ * trace_header con CAPTURE_MAGIC seguita dalle letture, nel byte order della
+ * macchina.
+ */
+struct capture_read {
+	uint32_t ca_gap_us;   /* Microsecondi dalla lettura precedente, 0 per
+	                         la prima. */
+	uint32_t ca_len;      /* Byte letti. */
+};
+
+
+/*
+ * Statistiche, condivise con mhstat attraverso la memoria condivisa.
+ * Tutti i contatori sono a 64 bit e hanno piu' scrittori (il thread
+ * dell'applicazione con libmultihoming, piu' proxy nello stesso processo):
+ * si aggiornano con fetch_add e fetch_sub atomici, vedi stats.h. La regione
+ * e' una per processo, quindi anche i contatori per canale sono del
+ * processo: se vi girano piu' proxy, quelli del canale cd si sommano.
+ */
+struct chanstats {
+	/* Byte letti e scritti sul socket. */
+	uint64_t cs_bytes_in;
+	uint64_t cs_bytes_out;
+
+	/* Segmenti completi ricevuti e spediti (solo canali di rete). */
+	uint64_t cs_segs_in;
+	uint64_t cs_segs_out;
+
+	/* NAK ricevuti e spediti, segmenti critici rispediti. */
+	uint64_t cs_naks_in;
+	uint64_t cs_naks_out;
+	uint64_t cs_retrans;
+
+	/* Media mobile dell'RTT misurato dalle sonde, in microsecondi. */
+	uint64_t cs_srtt_us;
+
+	/* 1 se il canale e' connesso. */
+	uint64_t cs_connected;
+};
+
+struct slabstats {
+	/* Oggetti in uso e liberi nelle arene. */
+	uint64_t ss_used;
+	uint64_t ss_free;
+
+	/* Arene mappate e relativi byte; arene mappate e rilasciate in
+	 * totale. */
+	uint64_t ss_arenas;
+	uint64_t ss_bytes;
+	uint64_t ss_maps;
+	uint64_t ss_unmaps;
+};
+
+struct mhstats {
+	/* Intestazione: identifica la regione e il processo. */
+	uint64_t st_magic;
+	uint64_t st_version;
+	uint64_t st_pid;
+	char st_name[16];
+
+	struct chanstats st_chan[CHANNELS];
+
+	/* Segmenti vecchi o duplicati scartati da join_add. */
+	uint64_t st_dups;
+
+	/* Profondita' delle code. */
+	uint64_t st_joinq;
+	uint64_t st_urgentq[URGNO];
+
+	/* Allocatori di segwrap, segwrap di controllo e timeout, per
+	 * slab. */
+	struct slabstats st_slab[SLABS];
+
+	/* Timeout attivi e timeout scaduti, per classe. */
+	uint64_t st_timers[TMOUTS];
+	uint64_t st_fired[TMOUTS];
+
+	/* Iterazioni del ciclo principale e, tra queste, quelle di busy
+	 * poll senza eventi. */
+	uint64_t st_loops;
+	uint64_t st_polls;
+
+	/* Allocazioni fatte dal ciclo principale e relativi byte, vedi
+	 * alloc_note. */
+	uint64_t st_allocs;
+	uint64_t st_alloc_bytes;
+
+	/* Latenze delle fasi, vedi HS_*. */
+	struct histo st_histo[HSTAGES];
+};
+
 #endif /* MH_TYPES_H */
@@ -35,19 +35,27 @@
 *******************************************************************************/
 
 /*
- * Funzioni su struct sockaddr_in.
+ * Funzioni sugli indirizzi dei canali.
  */
 
+socklen_t
+addr_len (addr_t *addr);
+
+
 bool
-addr_is_set (struct sockaddr_in *addr);
+addr_is_set (addr_t *addr);
 
 
 char *
-addrstr (struct sockaddr_in *addr, char *buf);
+addrstr (addr_t *addr, char *buf);
+
+
+int
+set_addr (addr_t *addr, char *ip, port_t port);
 
 
 int
-set_addr (struct sockaddr_in *addr, char *ip, port_t port);
+set_unix_addr (addr_t *addr, char *path);
 
 
 /*
@@ -62,6 +70,23 @@ streq (char *str1, char *str2);
  * Funzioni per la gestione della memoria.
  */
 
+void
+alloc_loop_enter (void);
+/* Il thread chiamante esegue il ciclo principale di un proxy: da qui in
+ * poi le sue allocazioni sono contate in st_allocs. */
+
+
+void
+alloc_note (const char *what, size_t size);
+/* Registra un'allocazione di size byte fatta da what: xmalloc, le arene
+ * delle slab e i buffer circolari passano tutti di qui. */
+
+
+void
+alloc_report_enable (void);
+/* alloc_note stampa anche ogni allocazione del ciclo principale. */
+
+
 void
 xfree (void *ptr);
 
@@ -94,6 +119,10 @@ int
 tcp_set_buffer_size (fd_t sockfd, int bufname, size_t buflen);
 
 
+int
+tcp_set_busy_poll (fd_t fd, double interval);
+
+
 int
 tcp_set_nagle (fd_t fd, bool active);
 
@@ -102,12 +131,16 @@ int
 tcp_set_reusable (fd_t fd, bool reusable);
 
 
+int
+tcp_set_user_timeout (fd_t fd, double timeout);
+
+
 void
-tcp_sockname (fd_t fd, struct sockaddr_in *laddr);
+tcp_sockname (fd_t fd, addr_t *laddr);
 
 
 fd_t
-xtcp_socket (void);
+xtcp_socket (int family);
 
 
 #endif /* UTIL_H */
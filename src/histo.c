@@ -0,0 +1,263 @@
+#include "h/histo.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+
+
+/*******************************************************************************
+				    Macro
+*******************************************************************************/
+
+/* Incremento atomico rilassato, vedi STATS_ADD. */
+#define     HADD(field, n)                                              \
+	((void)__atomic_fetch_add (&(field), (uint64_t)(n), __ATOMIC_RELAXED))
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static char *stage_names[HSTAGES] = {
+	"host_rcvbuf",
+	"urgentq+rqueue",
+	"buffer tcp",
+	"joinq",
+	"host_sndbuf",
+	"totale"
+};
+
+static bool lat_enabled = FALSE;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static int bucket_index (uint32_t usec);
+static uint64_t bucket_high (int idx);
+static uint64_t bucket_low (int idx);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+/*
+ * Istogrammi.
+ */
+
+void
+histo_add (struct histo *h, double secs, uint32_t n)
+{
+	int i;
+	uint32_t usec;
+	uint64_t max;
+
+	assert (h != NULL);
+
+	if (secs < 0)
+		secs = 0;
+	usec = (secs * 1000000 >= UINT32_MAX ?
+	        UINT32_MAX : (uint32_t)(secs * 1000000));
+
+	i = bucket_index (usec);
+	HADD (h->h_bucket[i], n);
+	max = __atomic_load_n (&h->h_max, __ATOMIC_RELAXED);
+	while (usec > max
+	       && !__atomic_compare_exchange_n (&h->h_max, &max, usec, TRUE,
+	                                        __ATOMIC_RELAXED,
+	                                        __ATOMIC_RELAXED))
+		;
+	HADD (h->h_count, n);
+}
+
+
+uint64_t
+histo_percentile (struct histo *h, double p)
+{
+	int i;
+	uint64_t count;
+	uint64_t seen;
+	uint64_t rank;
+
+	assert (h != NULL);
+	assert (p >= 0 && p <= 1);
+
+	count = __atomic_load_n (&h->h_count, __ATOMIC_RELAXED);
+	if (count == 0)
+		return 0;
+
+	rank = p * count;
+	if (rank == 0)
+		rank = 1;
+
+	seen = 0;
+	for (i = 0; i < HISTO_BUCKETS; i++) {
+		seen += __atomic_load_n (&h->h_bucket[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			return MIN (bucket_high (i),
+			            __atomic_load_n (&h->h_max,
+			                             __ATOMIC_RELAXED));
+	}
+	return __atomic_load_n (&h->h_max, __ATOMIC_RELAXED);
+}
+
+
+void
+histo_print (FILE *f, struct histo *h, char *name)
+{
+	/* Stampa una riga con numero di campioni, p50, p99, p999 e massimo,
+	 * in millisecondi. */
+
+	assert (f != NULL);
+	assert (h != NULL);
+	assert (name != NULL);
+
+	fprintf (f, "%-16s %10lu %10.3f %10.3f %10.3f %10.3f\n", name,
+			(unsigned long)__atomic_load_n (&h->h_count,
+			                                __ATOMIC_RELAXED),
+			histo_percentile (h, 0.50) / 1000.0,
+			histo_percentile (h, 0.99) / 1000.0,
+			histo_percentile (h, 0.999) / 1000.0,
+			__atomic_load_n (&h->h_max, __ATOMIC_RELAXED)
+			/ 1000.0);
+}
+
+
+char *
+histo_stage_name (int stage)
+{
+	assert (stage >= 0 && stage < HSTAGES);
+	return stage_names[stage];
+}
+
+
+/*
+ * Abilitazione delle misure nel proxy.
+ */
+
+void
+latency_enable (void)
+{
+	lat_enabled = TRUE;
+}
+
+
+bool
+latency_enabled (void)
+{
+	return lat_enabled;
+}
+
+
+/*
+ * Marcatori temporali.
+ */
+
+struct tmark *
+tmarks_first (tmarks_t *tm)
+{
+	assert (tm != NULL);
+
+	if (tm->tm_used == 0)
+		return NULL;
+	return &tm->tm_ring[tm->tm_head];
+}
+
+
+void
+tmarks_pop (tmarks_t *tm)
+{
+	assert (tm != NULL);
+	assert (tm->tm_used > 0);
+
+	tm->tm_head = (tm->tm_head + 1) % TMARKS;
+	tm->tm_used--;
+}
+
+
+void
+tmarks_push (tmarks_t *tm, uint64_t end, tst_t time, bool has_tst, tst_t tst,
+		uint32_t count)
+{
+	struct tmark *mark;
+
+	assert (tm != NULL);
+	assert (BOOL_VALUE (has_tst));
+
+	if (tm->tm_used == TMARKS) {
+		mark = &tm->tm_ring[(tm->tm_head + TMARKS - 1) % TMARKS];
+		mark->tm_end = end;
+		mark->tm_count += count;
+		return;
+	}
+
+	mark = &tm->tm_ring[(tm->tm_head + tm->tm_used) % TMARKS];
+	mark->tm_end = end;
+	mark->tm_time = time;
+	mark->tm_has_tst = has_tst;
+	mark->tm_tst = tst;
+	mark->tm_count = count;
+	tm->tm_used++;
+}
+
+
+void
+tmarks_reset (tmarks_t *tm)
+{
+	assert (tm != NULL);
+
+	tm->tm_head = 0;
+	tm->tm_used = 0;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static int
+bucket_index (uint32_t usec)
+{
+	/* I valori minori di HISTO_SUB hanno un intervallo ciascuno, poi
+	 * ogni potenza di 2 e' divisa in HISTO_SUB intervalli uguali. */
+
+	int msb;
+
+	if (usec < HISTO_SUB)
+		return usec;
+
+	msb = 31 - __builtin_clz (usec);
+	return (msb - HISTO_SUBBITS + 1) * HISTO_SUB
+		+ ((usec >> (msb - HISTO_SUBBITS)) & (HISTO_SUB - 1));
+}
+
+
+static uint64_t
+bucket_high (int idx)
+{
+	/* Ultimo valore contenuto nell'intervallo idx. */
+
+	if (idx + 1 >= HISTO_BUCKETS)
+		return UINT32_MAX;
+	return bucket_low (idx + 1) - 1;
+}
+
+
+static uint64_t
+bucket_low (int idx)
+{
+	/* Primo valore contenuto nell'intervallo idx. */
+
+	int msb;
+
+	assert (idx >= 0 && idx < HISTO_BUCKETS);
+
+	if (idx < HISTO_SUB)
+		return idx;
+
+	msb = idx / HISTO_SUB + HISTO_SUBBITS - 1;
+	return (uint64_t)(HISTO_SUB + idx % HISTO_SUB)
+		<< (msb - HISTO_SUBBITS);
+}
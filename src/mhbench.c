@@ -0,0 +1,559 @@
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Intestazione dei record del flusso di prova, in network byte order:
+ *   lunghezza del record | numero | istante di spedizione in ns (2 x 32 bit)
+ * Il bit alto del numero distingue i messaggi interattivi. */
+#define     RECHDR       16
+#define     RECINT       0x80000000UL
+
+/* Carichi. */
+#define     BULK         0x1
+#define     INTERACTIVE  0x2
+#define     MIXED        (BULK | INTERACTIVE)
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+/* Una direzione del flusso: buffer con il record in scrittura o i byte letti
+ * non ancora elaborati. */
+struct flow {
+	fd_t f_fd;
+	char *f_buf;
+	size_t f_len;
+	size_t f_off;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static int workload = BULK;
+
+/* Carico bulk: byte totali e dimensione dei record. */
+static uint64_t bulk_bytes = 4 * 1024 * 1024;
+static size_t bulk_rec = 16384;
+
+/* Carico interattivo: numero, dimensione e intervallo dei messaggi. */
+static unsigned long int_count = 200;
+static size_t int_size = 64;
+static double int_every = 0.020;
+
+static double time_limit = 60;
+static port_t connport = 6001;
+static port_t listport = 9001;
+
+/* Latenze di consegna in secondi, separate per tipo di record. */
+static double *lat[2];
+static unsigned long nlat[2];
+static unsigned long maxlat[2];
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static uint64_t clock_now (void);
+static int connect_sender (uint64_t deadline);
+static int dblcmp (const void *a, const void *b);
+static int listen_receiver (void);
+static double percentile (double *v, unsigned long n, double p);
+static int parse_option (int opt, char *arg);
+static void print_help (const char *program_name);
+static void put_record (struct flow *fl, uint32_t num, size_t len);
+static unsigned long take_records (struct flow *fl, uint32_t *next);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	int listfd;
+	int kind;
+	uint32_t num;
+	uint32_t next;
+	uint64_t start;
+	uint64_t last;
+	uint64_t deadline;
+	uint64_t int_next;
+	uint64_t bulk_left;
+	uint64_t rcvd;
+	uint64_t total;
+	unsigned long int_sent;
+	unsigned long errors;
+	struct flow out;
+	struct flow in;
+	bool complete;
+
+	while ((opt = getopt (argc, argv, "b:c:i:l:m:n:s:t:w:")) != -1)
+		if (opt == '?' || parse_option (opt, optarg))
+			goto error;
+	if (optind != argc)
+		goto error;
+	if (!(workload & INTERACTIVE))
+		int_count = 0;
+	if (!(workload & BULK))
+		bulk_bytes = 0;
+
+	signal (SIGPIPE, SIG_IGN);
+
+	/* Byte attesi dal Receiver, intestazioni comprese. */
+	total = int_count * int_size + bulk_bytes
+		+ (bulk_bytes + bulk_rec - RECHDR - 1) / (bulk_rec - RECHDR)
+		* RECHDR;
+	maxlat[0] = bulk_bytes / (bulk_rec - RECHDR) + 1;
+	maxlat[1] = int_count + 1;
+	lat[0] = malloc (maxlat[0] * sizeof (double));
+	lat[1] = malloc (maxlat[1] * sizeof (double));
+	out.f_buf = malloc (MAX (bulk_rec, int_size));
+	in.f_buf = malloc (2 * MAX (bulk_rec, int_size));
+	if (lat[0] == NULL || lat[1] == NULL || out.f_buf == NULL
+	    || in.f_buf == NULL) {
+		perror ("malloc");
+		return EXIT_FAILURE;
+	}
+	out.f_len = out.f_off = 0;
+	in.f_len = in.f_off = 0;
+	in.f_fd = -1;
+
+	/* Il Receiver deve essere in ascolto prima che precv si connetta. */
+	listfd = listen_receiver ();
+	if (listfd < 0)
+		return EXIT_FAILURE;
+
+	start = clock_now ();
+	deadline = start + time_limit * NS;
+	out.f_fd = connect_sender (deadline);
+	if (out.f_fd < 0)
+		return EXIT_FAILURE;
+
+	start = last = clock_now ();
+	deadline = start + time_limit * NS;
+	int_next = start;
+	int_sent = 0;
+	bulk_left = bulk_bytes;
+	num = 0;
+	next = 0;
+	rcvd = 0;
+	errors = 0;
+	while (rcvd < total) {
+		int maxfd;
+		int rdy;
+		uint64_t now;
+		uint64_t wake;
+		fd_set rdset;
+		fd_set wrset;
+		struct timeval tv;
+
+		now = clock_now ();
+		if (now >= deadline)
+			break;
+
+		/* Prossimo record, tra uno e l'altro: i messaggi interattivi
+		 * hanno la precedenza, come un tasto premuto durante un
+		 * trasferimento. */
+		if (out.f_len == 0) {
+			if (int_sent < int_count && int_next <= now) {
+				put_record (&out, num++ | RECINT, int_size);
+				int_sent++;
+				int_next += int_every * NS;
+			} else if (bulk_left > 0) {
+				size_t pld = MIN (bulk_left, bulk_rec - RECHDR);
+				put_record (&out, num++, pld + RECHDR);
+				bulk_left -= pld;
+			}
+		}
+
+		FD_ZERO (&rdset);
+		FD_ZERO (&wrset);
+		maxfd = -1;
+		if (out.f_len > 0) {
+			FD_SET (out.f_fd, &wrset);
+			maxfd = MAX (maxfd, out.f_fd);
+		}
+		if (in.f_fd < 0) {
+			FD_SET (listfd, &rdset);
+			maxfd = MAX (maxfd, listfd);
+		} else {
+			FD_SET (in.f_fd, &rdset);
+			maxfd = MAX (maxfd, in.f_fd);
+		}
+
+		wake = deadline;
+		if (int_sent < int_count && out.f_len == 0)
+			wake = MIN (wake, int_next);
+		wake = (wake > now ? wake - now : 0);
+		tv.tv_sec = wake / 1000000000;
+		tv.tv_usec = (wake % 1000000000) / 1000;
+		rdy = select (maxfd + 1, &rdset, &wrset, NULL, &tv);
+		if (rdy < 0) {
+			if (errno == EINTR)
+				continue;
+			perror ("select");
+			return EXIT_FAILURE;
+		}
+
+		if (out.f_len > 0 && FD_ISSET (out.f_fd, &wrset)) {
+			ssize_t nw;
+
+			nw = write (out.f_fd, out.f_buf + out.f_off,
+					out.f_len - out.f_off);
+			if (nw < 0 && errno != EAGAIN && errno != EINTR) {
+				perror ("scrittura verso psend");
+				break;
+			}
+			if (nw > 0) {
+				out.f_off += nw;
+				if (out.f_off == out.f_len)
+					out.f_len = out.f_off = 0;
+			}
+		}
+
+		if (in.f_fd < 0 && FD_ISSET (listfd, &rdset)) {
+			in.f_fd = accept (listfd, NULL, NULL);
+			if (in.f_fd >= 0)
+				fcntl (in.f_fd, F_SETFL,
+				       fcntl (in.f_fd, F_GETFL) | O_NONBLOCK);
+		} else if (in.f_fd >= 0 && FD_ISSET (in.f_fd, &rdset)) {
+			ssize_t nr;
+
+			nr = read (in.f_fd, in.f_buf + in.f_len,
+					2 * MAX (bulk_rec, int_size)
+					- in.f_len);
+			if (nr == 0 || (nr < 0 && errno != EAGAIN
+			                && errno != EINTR)) {
+				fprintf (stderr, "precv ha chiuso la "
+						"connessione\n");
+				break;
+			}
+			if (nr > 0) {
+				in.f_len += nr;
+				rcvd += nr;
+				last = clock_now ();
+				errors += take_records (&in, &next);
+			}
+		}
+	}
+	complete = (rcvd == total && errors == 0 ? TRUE : FALSE);
+
+	/* Una riga chiave=valore: le latenze sono quelle dei messaggi
+	 * interattivi se ce ne sono, dei record bulk altrimenti. */
+	kind = (nlat[1] > 0 ? 1 : 0);
+	qsort (lat[kind], nlat[kind], sizeof (double), dblcmp);
+	printf ("workload=%s complete=%d bytes=%.0f secs=%.3f "
+	        "goodput_Bps=%.0f records=%lu errors=%lu "
+	        "lat_n=%lu lat_p50_ms=%.3f lat_p99_ms=%.3f lat_max_ms=%.3f\n",
+	        (workload == MIXED ? "mixed" :
+	         workload == BULK ? "bulk" : "interactive"),
+	        complete, (double)rcvd, (last - start) / NS,
+	        (last > start ? rcvd / ((last - start) / NS) : 0),
+	        (unsigned long)(nlat[0] + nlat[1]), errors, nlat[kind],
+	        percentile (lat[kind], nlat[kind], 0.50) * 1000,
+	        percentile (lat[kind], nlat[kind], 0.99) * 1000,
+	        percentile (lat[kind], nlat[kind], 1) * 1000);
+
+	return (complete ? EXIT_SUCCESS : EXIT_FAILURE);
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static uint64_t
+clock_now (void)
+{
+	/* Come clock_ns di crono.c, che non puo' essere collegata senza il
+	 * resto del proxy. */
+
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static int
+connect_sender (uint64_t deadline)
+{
+	/* Si connette a psend come farebbe il Sender, riprovando finche'
+	 * psend non e' in ascolto o scade deadline.
+	 * Ritorna il socket non bloccante, -1 in caso di errore. */
+
+	fd_t fd;
+	int err;
+	int optval;
+	struct sockaddr_in addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (connport);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	for (;;) {
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror ("socket");
+			return -1;
+		}
+		if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) == 0)
+			break;
+		err = errno;
+		close (fd);
+		if (err != ECONNREFUSED || clock_now () >= deadline) {
+			fprintf (stderr, "connessione a psend, porta %d: %s\n",
+					connport, strerror (err));
+			return -1;
+		}
+		usleep (50000);
+	}
+
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	optval = 1;
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+	return fd;
+}
+
+
+static int
+dblcmp (const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+
+static int
+listen_receiver (void)
+{
+	int fd;
+	int optval;
+	struct sockaddr_in addr;
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror ("socket");
+		return -1;
+	}
+	optval = 1;
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof (optval));
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (listport);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if (bind (fd, (struct sockaddr *)&addr, sizeof (addr))
+	    || listen (fd, 1)) {
+		fprintf (stderr, "porta %d: %s\n", listport, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static int
+parse_option (int opt, char *arg)
+{
+	/* Ritorna 0 se riesce, -1 altrimenti. */
+
+	double val;
+	char *endptr;
+
+	if (opt == 'w') {
+		if (strcmp (arg, "bulk") == 0)
+			workload = BULK;
+		else if (strcmp (arg, "interactive") == 0)
+			workload = INTERACTIVE;
+		else if (strcmp (arg, "mixed") == 0)
+			workload = MIXED;
+		else
+			return -1;
+		return 0;
+	}
+
+	val = strtod (arg, &endptr);
+	if (endptr == arg || *endptr != '\0' || val <= 0)
+		return -1;
+
+	switch (opt) {
+	case 'b' :
+		if (val <= RECHDR || val > 1024 * 1024)
+			return -1;
+		bulk_rec = val;
+		break;
+	case 'c' :
+	case 'l' :
+		if (val > 65535)
+			return -1;
+		if (opt == 'c')
+			connport = val;
+		else
+			listport = val;
+		break;
+	case 'i' :
+		int_every = val / 1000;
+		break;
+	case 'm' :
+		int_count = val;
+		break;
+	case 'n' :
+		bulk_bytes = val;
+		break;
+	case 's' :
+		if (val < RECHDR || val > 1024 * 1024)
+			return -1;
+		int_size = val;
+		break;
+	case 't' :
+		time_limit = val;
+		break;
+	default :
+		return -1;
+	}
+	return 0;
+}
+
+
+static double
+percentile (double *v, unsigned long n, double p)
+{
+	/* v e' ordinato. Ritorna 0 se vuoto. */
+
+	unsigned long i;
+
+	if (n == 0)
+		return 0;
+	i = p * n;
+	return v[MIN (i, n - 1)];
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ opzioni ]\n", program_name);
+	printf ("\n"
+"Fa da Sender e da Receiver: si connette a psend e accetta la connessione\n"
+"di precv, spedisce il carico richiesto e misura goodput e latenza di\n"
+"consegna dei record. Stampa una riga chiave=valore; esce con successo\n"
+"solo se tutti i dati sono arrivati intatti entro il limite di tempo.\n"
+		);
+	printf ("\n"
+"Opzioni:\n"
+"  -w carico     bulk, interactive o mixed (predefinito bulk)\n"
+"  -n byte       byte del carico bulk (predefinito 4 MiB)\n"
+"  -b byte       dimensione dei record bulk (predefinita 16384)\n"
+"  -m numero     messaggi interattivi (predefinito 200)\n"
+"  -s byte       dimensione dei messaggi interattivi (predefinita 64)\n"
+"  -i ms         intervallo tra i messaggi interattivi (predefinito 20)\n"
+		);
+	printf (
+"  -t secondi    limite di tempo (predefinito 60)\n"
+"  -c porta      porta di psend (predefinita 6001)\n"
+"  -l porta      porta su cui attendere precv (predefinita 9001)\n"
+		);
+}
+
+
+static void
+put_record (struct flow *fl, uint32_t num, size_t len)
+{
+	/* Prepara in fl il record num lungo len byte, marcato con l'istante
+	 * attuale. Il payload e' il byte basso di num ripetuto. */
+
+	uint32_t hdr[4];
+	uint64_t now;
+
+	now = clock_now ();
+	hdr[0] = htonl (len);
+	hdr[1] = htonl (num);
+	hdr[2] = htonl ((uint32_t)(now >> 32));
+	hdr[3] = htonl ((uint32_t)now);
+	memcpy (fl->f_buf, hdr, RECHDR);
+	memset (fl->f_buf + RECHDR, num & 0xff, len - RECHDR);
+	fl->f_len = len;
+	fl->f_off = 0;
+}
+
+
+static unsigned long
+take_records (struct flow *fl, uint32_t *next)
+{
+	/* Elabora i record completi in fl: registra la latenza e controlla
+	 * ordine e contenuto. I byte di un record incompleto restano in
+	 * testa al buffer.
+	 * Ritorna il numero di record errati. */
+
+	unsigned long errors;
+	uint64_t now;
+
+	errors = 0;
+	now = clock_now ();
+	for (;;) {
+		uint32_t hdr[4];
+		uint32_t len;
+		uint32_t num;
+		uint64_t sent;
+		int kind;
+		char *rec;
+
+		if (fl->f_len - fl->f_off < RECHDR)
+			break;
+		rec = fl->f_buf + fl->f_off;
+		memcpy (hdr, rec, RECHDR);
+		len = ntohl (hdr[0]);
+		num = ntohl (hdr[1]);
+		if (len < RECHDR || len > MAX (bulk_rec, int_size)) {
+			/* Flusso corrotto, inutile proseguire. */
+			fprintf (stderr, "record %lu: lunghezza %lu\n",
+					(unsigned long)*next,
+					(unsigned long)len);
+			fl->f_off = fl->f_len;
+			return errors + 1;
+		}
+		if (fl->f_len - fl->f_off < len)
+			break;
+
+		sent = (uint64_t)ntohl (hdr[2]) << 32 | ntohl (hdr[3]);
+		kind = (num & RECINT ? 1 : 0);
+		if (nlat[kind] < maxlat[kind])
+			lat[kind][nlat[kind]++] = (now - sent) / NS;
+		if ((num & ~RECINT) != *next
+		    || (len > RECHDR && (rec[RECHDR] != (char)(num & 0xff)
+		                         || rec[len - 1] != (char)(num & 0xff))))
+			errors++;
+		*next = (num & ~RECINT) + 1;
+		fl->f_off += len;
+	}
+
+	/* Compatta il buffer. */
+	memmove (fl->f_buf, fl->f_buf + fl->f_off, fl->f_len - fl->f_off);
+	fl->f_len -= fl->f_off;
+	fl->f_off = 0;
+	return errors;
+}
@@ -0,0 +1,488 @@
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Intestazione dei messaggi, in network byte order:
+ *   lunghezza | numero | istante di spedizione in ns (2 x 32 bit) */
+#define     MSGHDR       16
+#define     MSGMAX       4096
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+/* Connessioni: il terminale spedisce a psend della coppia di andata e
+ * riceve gli echi da precv della coppia di ritorno; l'host remoto riceve
+ * da precv della coppia di andata e rispedisce a psend di quella di
+ * ritorno. */
+#define     HOST_IN      0
+#define     TERM_IN      1
+#define     TERM_OUT     2
+#define     HOST_OUT     3
+#define     CONNS        4
+
+/* Byte letti e non ancora elaborati o scritti. */
+struct conn {
+	fd_t c_fd;
+	fd_t c_listfd;
+	port_t c_port;
+	char c_buf[2 * MSGMAX];
+	size_t c_len;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static struct conn conns[CONNS];
+
+static unsigned long count = 300;
+static size_t msgsize = MSGHDR;
+static double every = 0.150;
+static double deadline = 0.500;
+static double drain = 5;
+
+/* Round trip dei messaggi tornati, in secondi. */
+static double *rtt;
+static unsigned long nrtt;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static uint64_t clock_now (void);
+static int connect_to (struct conn *c);
+static int dblcmp (const void *a, const void *b);
+static int listen_on (struct conn *c);
+static int parse_option (int opt, char *arg);
+static double percentile (double *v, unsigned long n, double p);
+static void print_help (const char *program_name);
+static void take_echoes (struct conn *c, uint64_t now);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int i;
+	int opt;
+	unsigned seed;
+	unsigned long sent;
+	unsigned long late;
+	uint64_t now;
+	uint64_t next;
+	uint64_t end;
+	char *endptr;
+	char msg[MSGMAX];
+
+	conns[TERM_OUT].c_port = 6001;
+	conns[HOST_IN].c_port = 9001;
+	conns[HOST_OUT].c_port = 6101;
+	conns[TERM_IN].c_port = 9101;
+	seed = 1;
+	while ((opt = getopt (argc, argv, "c:C:D:i:l:L:m:s:S:w:")) != -1) {
+		if (opt == 'S') {
+			seed = strtoul (optarg, &endptr, 10);
+			if (*endptr != '\0')
+				goto error;
+		} else if (opt == '?' || parse_option (opt, optarg))
+			goto error;
+	}
+	if (optind != argc)
+		goto error;
+
+	srand (seed);
+	signal (SIGPIPE, SIG_IGN);
+
+	rtt = malloc (count * sizeof (double));
+	if (rtt == NULL) {
+		perror ("malloc");
+		return EXIT_FAILURE;
+	}
+
+	/* In ascolto prima che i precv si connettano, poi i psend. */
+	for (i = 0; i < CONNS; i++)
+		conns[i].c_fd = conns[i].c_listfd = -1;
+	if (listen_on (&conns[HOST_IN]) || listen_on (&conns[TERM_IN])
+	    || connect_to (&conns[TERM_OUT]) || connect_to (&conns[HOST_OUT]))
+		return EXIT_FAILURE;
+
+	sent = 0;
+	next = clock_now ();
+	end = 0;
+	for (;;) {
+		int maxfd;
+		int rdy;
+		uint64_t wake;
+		fd_set rdset;
+		fd_set wrset;
+		struct timeval tv;
+
+		now = clock_now ();
+
+		/* Un tasto: scritto tutto insieme, se il buffer di psend non
+		 * lo accetta il terminale e' bloccato ed e' in ritardo anche
+		 * lui. */
+		if (sent < count && next <= now) {
+			uint32_t hdr[4];
+
+			hdr[0] = htonl (msgsize);
+			hdr[1] = htonl (sent);
+			hdr[2] = htonl ((uint32_t)(now >> 32));
+			hdr[3] = htonl ((uint32_t)now);
+			memcpy (msg, hdr, MSGHDR);
+			memset (msg + MSGHDR, 'x', msgsize - MSGHDR);
+			if (write (conns[TERM_OUT].c_fd, msg, msgsize)
+			    != msgsize) {
+				perror ("scrittura verso psend");
+				break;
+			}
+			sent++;
+			/* Intervallo uniforme in [every / 2, every * 3 / 2]. */
+			next += every * (0.5 + (double)rand () / RAND_MAX)
+				* NS;
+			if (sent == count)
+				end = now + drain * NS;
+		}
+		if (end != 0 && (now >= end || nrtt == count))
+			break;
+
+		FD_ZERO (&rdset);
+		FD_ZERO (&wrset);
+		maxfd = -1;
+		for (i = HOST_IN; i <= TERM_IN; i++) {
+			fd_t fd = (conns[i].c_fd >= 0 ? conns[i].c_fd
+			                              : conns[i].c_listfd);
+			if (conns[i].c_len < sizeof (conns[i].c_buf)) {
+				FD_SET (fd, &rdset);
+				maxfd = MAX (maxfd, fd);
+			}
+		}
+		if (conns[HOST_IN].c_len > 0) {
+			FD_SET (conns[HOST_OUT].c_fd, &wrset);
+			maxfd = MAX (maxfd, conns[HOST_OUT].c_fd);
+		}
+
+		wake = (end != 0 ? end : next);
+		wake = (wake > now ? wake - now : 0);
+		tv.tv_sec = wake / 1000000000;
+		tv.tv_usec = (wake % 1000000000) / 1000;
+		rdy = select (maxfd + 1, &rdset, &wrset, NULL, &tv);
+		if (rdy < 0) {
+			if (errno == EINTR)
+				continue;
+			perror ("select");
+			return EXIT_FAILURE;
+		}
+		now = clock_now ();
+
+		for (i = HOST_IN; i <= TERM_IN; i++) {
+			struct conn *c = &conns[i];
+			ssize_t nr;
+
+			if (c->c_fd < 0) {
+				if (FD_ISSET (c->c_listfd, &rdset)) {
+					c->c_fd = accept (c->c_listfd, NULL,
+							NULL);
+					if (c->c_fd >= 0)
+						fcntl (c->c_fd, F_SETFL,
+						       fcntl (c->c_fd, F_GETFL)
+						       | O_NONBLOCK);
+				}
+				continue;
+			}
+			if (!FD_ISSET (c->c_fd, &rdset))
+				continue;
+			nr = read (c->c_fd, c->c_buf + c->c_len,
+					sizeof (c->c_buf) - c->c_len);
+			if (nr == 0 || (nr < 0 && errno != EAGAIN
+			                && errno != EINTR)) {
+				fprintf (stderr, "connessione chiusa da "
+						"precv\n");
+				goto report;
+			}
+			if (nr > 0) {
+				c->c_len += nr;
+				if (i == TERM_IN)
+					take_echoes (c, now);
+			}
+		}
+
+		/* L'host remoto rimanda indietro quello che riceve, come
+		 * l'eco di una shell. */
+		if (conns[HOST_IN].c_len > 0
+		    && FD_ISSET (conns[HOST_OUT].c_fd, &wrset)) {
+			struct conn *c = &conns[HOST_IN];
+			ssize_t nw;
+
+			nw = write (conns[HOST_OUT].c_fd, c->c_buf, c->c_len);
+			if (nw > 0) {
+				memmove (c->c_buf, c->c_buf + nw,
+						c->c_len - nw);
+				c->c_len -= nw;
+			}
+		}
+	}
+
+report:
+	/* I messaggi non tornati contano come in ritardo. */
+	qsort (rtt, nrtt, sizeof (double), dblcmp);
+	late = sent - nrtt;
+	for (i = 0; i < nrtt; i++)
+		if (rtt[i] > deadline)
+			late++;
+	printf ("sent=%lu echoed=%lu lost=%lu rtt_p50_ms=%.3f "
+	        "rtt_p90_ms=%.3f rtt_p99_ms=%.3f rtt_max_ms=%.3f "
+	        "deadline_ms=%.0f over_deadline_pct=%.2f\n",
+	        sent, nrtt, sent - nrtt,
+	        percentile (rtt, nrtt, 0.50) * 1000,
+	        percentile (rtt, nrtt, 0.90) * 1000,
+	        percentile (rtt, nrtt, 0.99) * 1000,
+	        percentile (rtt, nrtt, 1) * 1000, deadline * 1000,
+	        (sent > 0 ? 100.0 * late / sent : 0));
+
+	return (sent == count && nrtt == count ? EXIT_SUCCESS : EXIT_FAILURE);
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static uint64_t
+clock_now (void)
+{
+	/* Come clock_ns di crono.c, che non puo' essere collegata senza il
+	 * resto del proxy. */
+
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static int
+connect_to (struct conn *c)
+{
+	/* Si connette a psend sulla porta di c, riprovando per qualche
+	 * secondo finche' psend non e' in ascolto.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	int err;
+	int optval;
+	int tries;
+	struct sockaddr_in addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (c->c_port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	for (tries = 0; ; tries++) {
+		c->c_fd = socket (AF_INET, SOCK_STREAM, 0);
+		if (c->c_fd < 0) {
+			perror ("socket");
+			return -1;
+		}
+		if (connect (c->c_fd, (struct sockaddr *)&addr,
+		             sizeof (addr)) == 0)
+			break;
+		err = errno;
+		close (c->c_fd);
+		c->c_fd = -1;
+		if (err != ECONNREFUSED || tries == 100) {
+			fprintf (stderr, "connessione a psend, porta %d: %s\n",
+					c->c_port, strerror (err));
+			return -1;
+		}
+		usleep (50000);
+	}
+
+	/* Il terminale scrive bloccando: un tasto alla volta. */
+	if (c != &conns[TERM_OUT])
+		fcntl (c->c_fd, F_SETFL, fcntl (c->c_fd, F_GETFL) | O_NONBLOCK);
+	optval = 1;
+	setsockopt (c->c_fd, IPPROTO_TCP, TCP_NODELAY, &optval,
+			sizeof (optval));
+	return 0;
+}
+
+
+static int
+dblcmp (const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+
+static int
+listen_on (struct conn *c)
+{
+	int optval;
+	struct sockaddr_in addr;
+
+	c->c_listfd = socket (AF_INET, SOCK_STREAM, 0);
+	if (c->c_listfd < 0) {
+		perror ("socket");
+		return -1;
+	}
+	optval = 1;
+	setsockopt (c->c_listfd, SOL_SOCKET, SO_REUSEADDR, &optval,
+			sizeof (optval));
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (c->c_port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if (bind (c->c_listfd, (struct sockaddr *)&addr, sizeof (addr))
+	    || listen (c->c_listfd, 1)) {
+		fprintf (stderr, "porta %d: %s\n", c->c_port,
+				strerror (errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+static int
+parse_option (int opt, char *arg)
+{
+	/* Ritorna 0 se riesce, -1 altrimenti. */
+
+	double val;
+	char *endptr;
+
+	val = strtod (arg, &endptr);
+	if (endptr == arg || *endptr != '\0' || val <= 0)
+		return -1;
+
+	switch (opt) {
+	case 'c' :
+	case 'C' :
+	case 'l' :
+	case 'L' :
+		if (val > 65535)
+			return -1;
+		conns[opt == 'c' ? TERM_OUT : opt == 'C' ? HOST_OUT :
+		      opt == 'l' ? HOST_IN : TERM_IN].c_port = val;
+		break;
+	case 'D' :
+		deadline = val / 1000;
+		break;
+	case 'i' :
+		every = val / 1000;
+		break;
+	case 'm' :
+		count = val;
+		break;
+	case 's' :
+		if (val < MSGHDR || val > MSGMAX)
+			return -1;
+		msgsize = val;
+		break;
+	case 'w' :
+		drain = val;
+		break;
+	default :
+		return -1;
+	}
+	return 0;
+}
+
+
+static double
+percentile (double *v, unsigned long n, double p)
+{
+	/* v e' ordinato. Ritorna 0 se vuoto. */
+
+	unsigned long i;
+
+	if (n == 0)
+		return 0;
+	i = p * n;
+	return v[MIN (i, n - 1)];
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ opzioni ]\n", program_name);
+	printf ("\n"
+"Misura il tempo tra la pressione di un tasto e il suo eco, come in una\n"
+"shell remota: spedisce piccoli messaggi con il ritmo di chi scrive a psend\n"
+"della coppia di andata, li riceve da precv e li rimanda indietro attraverso\n"
+"la coppia di ritorno. Stampa una riga chiave=valore con la distribuzione\n"
+"dei round trip e la percentuale di messaggi oltre la scadenza; i messaggi\n"
+"mai tornati contano come oltre la scadenza.\n"
+		);
+	printf ("\n"
+"Opzioni:\n"
+"  -m numero     messaggi (predefinito 300)\n"
+"  -i ms         intervallo medio tra i messaggi, uniforme tra meta' e una\n"
+"                volta e mezza (predefinito 150)\n"
+"  -s byte       dimensione dei messaggi (predefinita e minima 16)\n"
+"  -D ms         scadenza (predefinita 500)\n"
+"  -w secondi    attesa degli echi dopo l'ultimo messaggio (predefinita 5)\n"
+"  -S seme       seme del generatore casuale\n"
+		);
+	printf (
+"  -c porta      porta di psend di andata (predefinita 6001)\n"
+"  -l porta      porta su cui attendere precv di andata (predefinita 9001)\n"
+"  -C porta      porta di psend di ritorno (predefinita 6101)\n"
+"  -L porta      porta su cui attendere precv di ritorno (predefinita 9101)\n"
+		);
+}
+
+
+static void
+take_echoes (struct conn *c, uint64_t now)
+{
+	/* Registra il round trip degli echi completi in c. */
+
+	size_t off;
+
+	for (off = 0; c->c_len - off >= MSGHDR; ) {
+		uint32_t hdr[4];
+		uint64_t sent;
+
+		memcpy (hdr, c->c_buf + off, MSGHDR);
+		if (ntohl (hdr[0]) != msgsize) {
+			fprintf (stderr, "eco corrotto\n");
+			c->c_len = 0;
+			return;
+		}
+		if (c->c_len - off < msgsize)
+			break;
+		sent = (uint64_t)ntohl (hdr[2]) << 32 | ntohl (hdr[3]);
+		if (nrtt < count)
+			rtt[nrtt++] = (now - sent) / NS;
+		off += msgsize;
+	}
+	memmove (c->c_buf, c->c_buf + off, c->c_len - off);
+	c->c_len -= off;
+}
@@ -0,0 +1,657 @@
+#include "h/types.h"
+#include "h/channel.h"
+#include "h/cqueue.h"
+#include "h/crono.h"
+#include "h/rqueue.h"
+#include "h/segment.h"
+#include "h/seghash.h"
+#include "h/timeout.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define     TYPE     struct segwrap
+#define     NEXT     sw_next
+#define     PREV     sw_prev
+#define     EMPTYQ   NULL
+#include "src/queue_template"
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+/* Segmenti preparati fuori dalla misura per ogni blocco misurato. */
+#define     BATCH        256
+
+/* Limite alle iterazioni di un caso. */
+#define     MAXITERS     1000000000UL
+
+/* Un caso: esegue iters operazioni con parametro arg e ritorna i ns spesi
+ * in quelle, esclusa la preparazione. */
+typedef uint64_t (*bench_t) (unsigned long iters, int arg);
+
+struct bench {
+	const char *b_name;
+	bench_t b_fun;
+	int b_arg;
+};
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static uint64_t bm_check_timeouts (unsigned long iters, int ntimers);
+static uint64_t bm_cqueue (unsigned long iters, int chunk);
+static uint64_t bm_cqueue_wrap (unsigned long iters, int chunk);
+static uint64_t bm_cqueue_seglen (unsigned long iters, int wrap);
+static uint64_t bm_join_add (unsigned long iters, int block);
+static uint64_t bm_rqueue_churn (unsigned long iters, int depth);
+static uint64_t bm_seghash (unsigned long iters, int depth);
+static uint64_t bm_seghash_rm_acked (unsigned long iters, int depth);
+static uint64_t bm_segwrap_churn (unsigned long iters, int live);
+static uint64_t bm_urgent_add (unsigned long iters, int depth);
+static uint64_t cqueue_add_remove (unsigned long iters, size_t chunk,
+		bool wrap);
+static void cqueue_place (cqueue_t *cq, size_t pos);
+static struct segwrap *data_seg (seq_t seq);
+static void drain_urgent (void);
+static void dummy_handler (proxy_t *owner, int arg);
+static bool matches (char *name, int nfilters, char **filters);
+static void print_help (const char *program_name);
+static void run (struct bench *b, char *name);
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static struct bench benches[] = {
+	{ "cqueue_add_remove",      bm_cqueue,           64 },
+	{ "cqueue_add_remove",      bm_cqueue,           1460 },
+	{ "cqueue_add_remove_wrap", bm_cqueue_wrap,      64 },
+	{ "cqueue_add_remove_wrap", bm_cqueue_wrap,      1460 },
+	{ "cqueue_seglen",          bm_cqueue_seglen,    0 },
+	{ "cqueue_seglen_wrap",     bm_cqueue_seglen,    1 },
+	{ "rqueue_churn",           bm_rqueue_churn,     8 },
+	{ "rqueue_churn",           bm_rqueue_churn,     64 },
+	{ "join_add_shuffle",       bm_join_add,         8 },
+	{ "join_add_shuffle",       bm_join_add,         32 },
+	{ "join_add_shuffle",       bm_join_add,         64 },
+	{ "seghash_add_remove",     bm_seghash,          32 },
+	{ "seghash_rm_acked",       bm_seghash_rm_acked, 8 },
+	{ "seghash_rm_acked",       bm_seghash_rm_acked, 64 },
+	{ "segwrap_churn",          bm_segwrap_churn,    64 },
+	{ "segwrap_churn",          bm_segwrap_churn,    4096 },
+	{ "urgent_add",             bm_urgent_add,       4 },
+	{ "urgent_add",             bm_urgent_add,       32 },
+	{ "check_timeouts",         bm_check_timeouts,   10 },
+	{ "check_timeouts",         bm_check_timeouts,   100 },
+	{ "check_timeouts",         bm_check_timeouts,   1000 }
+};
+
+/* Proxy senza connessioni su cui girano i casi: le code (joinq, urgentq,
+ * host_sndbuf) si usano direttamente, senza socket ne' canali connessi. */
+static proxy_t *px;
+
+/* Durata minima della misura di un caso, in secondi. */
+static double min_time = 0.5;
+
+/* Destinazione dei risultati, perche' il compilatore non elimini i
+ * calcoli misurati. */
+static volatile size_t sink;
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	int err;
+	int i;
+	char name[64];
+	char *endptr;
+	char *netconnaddr[NETCHANNELS] = { "127.0.0.1", "127.0.0.1",
+		"127.0.0.1" };
+	port_t netconnport[NETCHANNELS] = { 7001, 7002, 7003 };
+
+	while ((opt = getopt (argc, argv, "t:")) != -1) {
+		if (opt != 't')
+			goto error;
+		min_time = strtod (optarg, &endptr);
+		if (endptr == optarg || *endptr != '\0' || min_time <= 0)
+			goto error;
+	}
+
+	/* Stato del proxy come in psend, senza connessioni. */
+	px = proxy_create ();
+	err = proxy_init (px, 6001, netconnaddr, netconnport, NULL, NULL, 0);
+	if (err)
+		return EXIT_FAILURE;
+
+	printf ("%-30s %12s %12s\n", "caso", "ns/op", "iterazioni");
+	for (i = 0; i < sizeof (benches) / sizeof (benches[0]); i++) {
+		sprintf (name, "%s/%d", benches[i].b_name, benches[i].b_arg);
+		if (matches (name, argc - optind, argv + optind))
+			run (&benches[i], name);
+	}
+	return EXIT_SUCCESS;
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static uint64_t
+bm_check_timeouts (unsigned long iters, int ntimers)
+{
+	/* Una scansione di check_timeouts con ntimers timeout attivi che non
+	 * scadono, oltre a quello degli ack del modulo. */
+
+	int i;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	timeout_t **to;
+
+	to = xmalloc (ntimers * sizeof (timeout_t *));
+	for (i = 0; i < ntimers; i++) {
+		to[i] = timeout_create (px, 3600, dummy_handler, i, FALSE);
+		timeout_reset (to[i]);
+		add_timeout (px, to[i], TOPRB);
+	}
+
+	start = clock_ns ();
+	for (n = 0; n < iters; n++)
+		sink += check_timeouts (px) > 0;
+	ns = clock_ns () - start;
+
+	for (i = 0; i < ntimers; i++) {
+		del_timeout (px, to[i], TOPRB);
+		timeout_destroy (px, to[i]);
+	}
+	xfree (to);
+	drain_urgent ();
+	return ns;
+}
+
+
+static uint64_t
+bm_cqueue (unsigned long iters, int chunk)
+{
+	/* Ogni copia parte dall'inizio del buffer, nessuna attraversa la
+	 * fine. */
+
+	return cqueue_add_remove (iters, chunk, FALSE);
+}
+
+
+static uint64_t
+bm_cqueue_wrap (unsigned long iters, int chunk)
+{
+	/* Ogni copia parte mezzo chunk prima della fine del buffer e lo
+	 * attraversa. */
+
+	return cqueue_add_remove (iters, chunk, TRUE);
+}
+
+
+static uint64_t
+bm_cqueue_seglen (unsigned long iters, int wrap)
+{
+	/* Riconoscimento di un segmento dati con timestamp in testa alla
+	 * coda; se wrap, l'intestazione e' spezzata in fondo al buffer. */
+
+	int err;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	cqueue_t *cq;
+	struct segwrap *sw;
+
+	cq = cqueue_create (SEGMAXLEN + 2);
+	sw = data_seg (0);
+	if (wrap)
+		cqueue_place (cq, cq->cq_len - 2);
+	sw->sw_seg[FLG] |= TSTFLAG;
+	sw->sw_seglen += TSTLEN;
+	err = cqueue_add (cq, sw->sw_seg, sw->sw_seglen);
+	assert (!err);
+
+	start = clock_ns ();
+	for (n = 0; n < iters; n++)
+		sink += cqueue_seglen (cq);
+	ns = clock_ns () - start;
+
+	segwrap_destroy (px, sw);
+	cqueue_destroy (cq);
+	return ns;
+}
+
+
+static uint64_t
+bm_join_add (unsigned long iters, int block)
+{
+	/* join_add di blocchi di block segmenti consecutivi in ordine
+	 * casuale, seguiti dalla consegna all'host con feed_download; il
+	 * buffer dell'host viene svuotato fuori dalla misura. */
+
+	int i;
+	int j;
+	int nsw;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	seq_t next;
+	struct segwrap *sw[BATCH];
+
+	assert (BATCH % block == 0);
+
+	px->px_host_sndbuf = cqueue_create (BATCH * SEGMAXLEN);
+	srand (1);
+	next = px->px_last_sent + 1;
+	ns = 0;
+	for (n = 0; n < iters; n += nsw) {
+		nsw = MIN (iters - n, BATCH);
+		for (i = 0; i < nsw; i++)
+			sw[i] = data_seg (next++);
+		/* Fisher-Yates dentro ogni blocco. */
+		for (i = 0; i < nsw; i += block)
+			for (j = MIN (block, nsw - i) - 1; j > 0; j--) {
+				int k = rand () % (j + 1);
+				struct segwrap *tmp = sw[i + j];
+
+				sw[i + j] = sw[i + k];
+				sw[i + k] = tmp;
+			}
+
+		start = clock_ns ();
+		for (i = 0; i < nsw; i++) {
+			join_add (px, sw[i]);
+			if ((i + 1) % block == 0 || i + 1 == nsw)
+				feed_download (px);
+		}
+		ns += clock_ns () - start;
+
+		assert (isEmpty (px->px_joinq));
+		cqueue_drop_head (px->px_host_sndbuf,
+				cqueue_get_used (px->px_host_sndbuf));
+		drain_urgent ();
+	}
+
+	cqueue_destroy (px->px_host_sndbuf);
+	px->px_host_sndbuf = NULL;
+	return ns;
+}
+
+
+static uint64_t
+bm_rqueue_churn (unsigned long iters, int depth)
+{
+	/* rqueue_add di un segmento alla volta; ogni depth / 2 aggiunte un
+	 * ACK conferma i piu' vecchi, riportando la coda a depth segmenti, e
+	 * rqueue_rm_acked li toglie dalla coda. */
+
+	int i;
+	int nsw;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	seq_t next;
+	rqueue_t *rq;
+	struct segwrap *ack;
+	struct segwrap *sw[BATCH];
+
+	assert (depth % 2 == 0 && BATCH % (depth / 2) == 0);
+	assert (depth + depth / 2 < SEQWIN);
+
+	rq = rqueue_create (px, NETCD, 64 * 1024, TRUE);
+	next = 0;
+	for (i = 0; i < depth; i++)
+		rqueue_add (rq, data_seg (next++));
+	ack = segwrap_ack_create (px, 0);
+
+	ns = 0;
+	for (n = 0; n < iters; n += nsw) {
+		nsw = MIN (iters - n, BATCH);
+		for (i = 0; i < nsw; i++)
+			sw[i] = data_seg (next + i);
+
+		start = clock_ns ();
+		for (i = 0; i < nsw; i++) {
+			rqueue_add (rq, sw[i]);
+			next++;
+			if ((i + 1) % (depth / 2) == 0) {
+				ack->sw_seg[SEQ] = next - depth - 1;
+				rqueue_rm_acked (rq, ack);
+			}
+		}
+		ns += clock_ns () - start;
+	}
+
+	ack->sw_seg[SEQ] = next - 1;
+	rqueue_rm_acked (rq, ack);
+	segwrap_destroy (px, ack);
+	rqueue_destroy (rq);
+	return ns;
+}
+
+
+static uint64_t
+bm_seghash (unsigned long iters, int depth)
+{
+	/* seghash_add del segmento nuovo e seghash_remove di quello spedito
+	 * depth segmenti prima, come per i segmenti in attesa di conferma. */
+
+	int i;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	seq_t next;
+	struct segwrap *ht[HT_SENT_SIZE];
+	struct segwrap *sw;
+
+	seghash_init (ht, HT_SENT_SIZE);
+	for (next = 0; next < depth; next++)
+		seghash_add (ht, HT_SENT_SIZE, data_seg (next));
+
+	start = clock_ns ();
+	for (n = 0; n < iters; n++) {
+		sw = seghash_remove (ht, HT_SENT_SIZE, (seq_t)(next - depth));
+		sw->sw_seg[SEQ] = next++;
+		seghash_add (ht, HT_SENT_SIZE, sw);
+	}
+	ns = clock_ns () - start;
+
+	for (i = 0; i < depth; i++)
+		segwrap_destroy (px, seghash_remove (ht, HT_SENT_SIZE,
+					(seq_t)(next - depth + i)));
+	return ns;
+}
+
+
+static uint64_t
+bm_seghash_rm_acked (unsigned long iters, int depth)
+{
+	/* seghash_add di depth segmenti e seghash_rm_acked con l'ACK
+	 * dell'ultimo; ns/op e' per segmento. */
+
+	int i;
+	int nsw;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	seq_t next;
+	struct segwrap *ht[HT_SENT_SIZE];
+	struct segwrap *ack;
+	struct segwrap *rmvdq;
+	struct segwrap *sw[BATCH];
+
+	assert (BATCH % depth == 0);
+
+	seghash_init (ht, HT_SENT_SIZE);
+	ack = segwrap_ack_create (px, 0);
+	next = 0;
+	ns = 0;
+	for (n = 0; n < iters; n += nsw) {
+		nsw = MIN (iters - n, BATCH);
+		for (i = 0; i < nsw; i++)
+			sw[i] = data_seg (next + i);
+
+		start = clock_ns ();
+		for (i = 0; i < nsw; i++) {
+			seghash_add (ht, HT_SENT_SIZE, sw[i]);
+			next++;
+			if ((i + 1) % depth == 0 || i + 1 == nsw) {
+				ack->sw_seg[SEQ] = next - 1;
+				rmvdq = seghash_rm_acked (ht, HT_SENT_SIZE,
+						ack);
+				while (!isEmpty (rmvdq))
+					segwrap_destroy (px,
+							qdequeue (&rmvdq));
+			}
+		}
+		ns += clock_ns () - start;
+	}
+
+	segwrap_destroy (px, ack);
+	return ns;
+}
+
+
+static uint64_t
+bm_segwrap_churn (unsigned long iters, int live)
+{
+	/* segwrap_destroy del segwrap piu' vecchio e segwrap_create di uno
+	 * nuovo, con live segwrap in uso: con molti le arene della slab
+	 * sono piu' d'una. */
+
+	int i;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	struct segwrap **sw;
+
+	sw = xmalloc (live * sizeof (struct segwrap *));
+	for (i = 0; i < live; i++)
+		sw[i] = segwrap_create (px);
+
+	start = clock_ns ();
+	for (n = 0, i = 0; n < iters; n++) {
+		segwrap_destroy (px, sw[i]);
+		sw[i] = segwrap_create (px);
+		if (++i == live)
+			i = 0;
+	}
+	ns = clock_ns () - start;
+
+	for (i = 0; i < live; i++)
+		segwrap_destroy (px, sw[i]);
+	xfree (sw);
+	return ns;
+}
+
+
+static uint64_t
+bm_urgent_add (unsigned long iters, int depth)
+{
+	/* urgent_add di un segmento e urgent_remove del piu' urgente, con
+	 * depth segmenti in coda. I segmenti alternano NAK, ACK, dati da
+	 * rispedire e dati, con timestamp casuali. */
+
+	int i;
+	int nsw;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	seq_t next;
+	struct segwrap *sw[BATCH];
+
+	srand (1);
+	next = 0;
+	ns = 0;
+	for (n = 0; n < iters + depth; n += nsw) {
+		nsw = MIN (iters + depth - n, BATCH);
+		for (i = 0; i < nsw; i++) {
+			switch ((n + i) % 4) {
+			case 0 :
+				sw[i] = segwrap_nak_create (px, next);
+				break;
+			case 1 :
+				sw[i] = segwrap_ack_create (px, next);
+				break;
+			case 2 :
+				sw[i] = data_seg (next);
+				sw[i]->sw_seg[FLG] |= CRTFLAG;
+				break;
+			default :
+				sw[i] = data_seg (next);
+			}
+			sw[i]->sw_tstamp = (double)rand () / RAND_MAX;
+			next++;
+		}
+
+		start = clock_ns ();
+		for (i = 0; i < nsw; i++) {
+			urgent_add (px, sw[i]);
+			if (n + i >= depth)
+				segwrap_destroy (px, urgent_remove (px));
+		}
+		ns += clock_ns () - start;
+	}
+
+	drain_urgent ();
+	return ns;
+}
+
+
+static uint64_t
+cqueue_add_remove (unsigned long iters, size_t chunk, bool wrap)
+{
+	/* Aggiunge e rimuove chunk byte dalla coda vuota; se wrap, la copia
+	 * attraversa la fine del buffer. */
+
+	int err;
+	unsigned long n;
+	uint64_t start;
+	uint64_t ns;
+	size_t pos;
+	cqueue_t *cq;
+	seg_t *buf;
+
+	cq = cqueue_create (2 * chunk);
+	buf = xmalloc (chunk);
+	memset (buf, 0, chunk);
+	pos = (wrap ? cq->cq_len - chunk / 2 : 0);
+
+	start = clock_ns ();
+	for (n = 0; n < iters; n++) {
+		cqueue_place (cq, pos);
+		err = cqueue_add (cq, buf, chunk);
+		err |= cqueue_remove (cq, buf, chunk);
+		sink += err;
+	}
+	ns = clock_ns () - start;
+
+	xfree (buf);
+	cqueue_destroy (cq);
+	return ns;
+}
+
+
+static void
+cqueue_place (cqueue_t *cq, size_t pos)
+{
+	/* Sposta testa e coda della coda vuota cq a pos. */
+
+	assert (cqueue_get_used (cq) == 0);
+	assert (pos < cq->cq_len);
+
+	cq->cq_head = cq->cq_tail = pos;
+}
+
+
+static struct segwrap *
+data_seg (seq_t seq)
+{
+	/* Segmento dati con payload standard e seqnum seq. Il contenuto del
+	 * payload non interessa. */
+
+	struct segwrap *sw;
+
+	sw = segwrap_create (px);
+	sw->sw_seg[FLG] = PLDFLAG;
+	sw->sw_seg[SEQ] = seq;
+	sw->sw_seglen = seg_hdr_len (sw->sw_seg) + PLDDEFLEN;
+	return sw;
+}
+
+
+static void
+drain_urgent (void)
+{
+	/* Scarta gli ACK e i NAK accodati da join_ack e dai timeout. */
+
+	while (urgent_head (px) != NULL)
+		segwrap_destroy (px, urgent_remove (px));
+}
+
+
+static void
+dummy_handler (proxy_t *owner, int arg)
+{
+	sink += arg;
+}
+
+
+static bool
+matches (char *name, int nfilters, char **filters)
+{
+	/* Senza filtri vanno eseguiti tutti i casi, altrimenti quelli il cui
+	 * nome contiene almeno uno dei filtri. */
+
+	int i;
+
+	if (nfilters == 0)
+		return TRUE;
+	for (i = 0; i < nfilters; i++)
+		if (strstr (name, filters[i]) != NULL)
+			return TRUE;
+	return FALSE;
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ -t secondi ] [ filtro ... ]\n", program_name);
+	printf ("\n"
+"Misura in isolamento le strutture dati del proxy: cqueue, rqueue, joinq,\n"
+"tabella hash dei segmenti spediti, code urgenti e timeout. Per ogni caso\n"
+"stampa i nanosecondi per operazione e le iterazioni misurate. I filtri\n"
+"restringono i casi a quelli il cui nome ne contiene uno (es. rqueue).\n"
+		);
+	printf ("\n"
+"Opzioni:\n"
+"  -t secondi    durata minima della misura di ogni caso (predefinita 0.5)\n"
+		);
+}
+
+
+static void
+run (struct bench *b, char *name)
+{
+	/* Come Google Benchmark: raddoppia almeno, e al piu' decuplica, le
+	 * iterazioni finche' la misura non dura min_time, puntando al 40% in
+	 * piu' per non sbagliare per difetto. */
+
+	double mult;
+	unsigned long iters;
+	uint64_t ns;
+
+	iters = 1;
+	for (;;) {
+		ns = b->b_fun (iters, b->b_arg);
+		if (ns >= min_time * NS || iters >= MAXITERS)
+			break;
+		mult = (ns > 0 ? min_time * NS * 1.4 / ns : 10);
+		mult = MAX (MIN (mult, 10), 2);
+		iters = MIN (iters * mult, MAXITERS);
+	}
+	printf ("%-30s %12.1f %12lu\n", name, (double)ns / iters, iters);
+	fflush (stdout);
+}
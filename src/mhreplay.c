@@ -0,0 +1,540 @@
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Il byte off del flusso riprodotto. Il periodo e' primo, per non allinearsi
+ * alle dimensioni delle letture. */
+#define     PERIOD       251
+#define     PATTERN(off) ((char)((off) % PERIOD))
+
+/* Byte letti in una volta dal Receiver. */
+#define     RCVBUF       65536
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static double speed = 1;
+static double time_limit = 60;
+static port_t connport = 6001;
+static port_t listport = 9001;
+
+/* Letture catturate e istante in ns, dall'inizio, a cui riprodurle. */
+static struct capture_read *reads;
+static uint64_t *due;
+static unsigned long nreads;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static uint64_t clock_now (void);
+static int connect_sender (uint64_t deadline);
+static int dblcmp (const void *a, const void *b);
+static int listen_receiver (void);
+static int load_capture (const char *path);
+static int parse_option (int opt, char *arg);
+static double percentile (double *v, unsigned long n, double p);
+static void print_help (const char *program_name);
+static void print_info (void);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	int listfd;
+	fd_t outfd;
+	fd_t infd;
+	unsigned long cur;
+	unsigned long done;
+	unsigned long i;
+	unsigned long errors;
+	uint64_t start;
+	uint64_t last;
+	uint64_t deadline;
+	uint64_t sent;
+	uint64_t rcvd;
+	uint64_t total;
+	uint64_t end;
+	uint64_t lag_max;
+	size_t maxlen;
+	size_t cur_off;
+	char *pattern;
+	char *inbuf;
+	double *lat;
+	bool info;
+	bool complete;
+
+	info = FALSE;
+	while ((opt = getopt (argc, argv, "c:il:s:t:")) != -1) {
+		if (opt == 'i')
+			info = TRUE;
+		else if (opt == '?' || parse_option (opt, optarg))
+			goto error;
+	}
+	if (optind != argc - 1)
+		goto error;
+	if (load_capture (argv[optind]))
+		return EXIT_FAILURE;
+	if (info) {
+		print_info ();
+		return EXIT_SUCCESS;
+	}
+
+	signal (SIGPIPE, SIG_IGN);
+
+	/* Il flusso e' PATTERN ripetuto: ogni scrittura parte dal punto
+	 * giusto di un buffer che ne contiene abbastanza periodi. */
+	total = 0;
+	maxlen = 0;
+	for (i = 0; i < nreads; i++) {
+		total += reads[i].ca_len;
+		maxlen = MAX (maxlen, reads[i].ca_len);
+	}
+	pattern = malloc (maxlen + PERIOD);
+	inbuf = malloc (RCVBUF);
+	lat = malloc (nreads * sizeof (double));
+	if (pattern == NULL || inbuf == NULL || lat == NULL) {
+		perror ("malloc");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < maxlen + PERIOD; i++)
+		pattern[i] = PATTERN (i);
+
+	/* Il Receiver deve essere in ascolto prima che precv si connetta. */
+	listfd = listen_receiver ();
+	if (listfd < 0)
+		return EXIT_FAILURE;
+
+	start = clock_now ();
+	outfd = connect_sender (start + time_limit * NS);
+	if (outfd < 0)
+		return EXIT_FAILURE;
+
+	start = last = clock_now ();
+	deadline = start + due[nreads - 1] + time_limit * NS;
+	infd = -1;
+	cur = done = 0;
+	cur_off = 0;
+	sent = rcvd = 0;
+	end = reads[0].ca_len;
+	errors = 0;
+	lag_max = 0;
+	while (rcvd < total) {
+		int maxfd;
+		int rdy;
+		uint64_t now;
+		uint64_t wake;
+		fd_set rdset;
+		fd_set wrset;
+		struct timeval tv;
+
+		now = clock_now ();
+		if (now >= deadline)
+			break;
+
+		/* La lettura cur va scritta al suo istante: se psend non
+		 * la accetta in tempo il ritardo accumulato e' il lag. */
+		FD_ZERO (&rdset);
+		FD_ZERO (&wrset);
+		maxfd = -1;
+		wake = deadline;
+		if (cur < nreads) {
+			if (start + due[cur] <= now) {
+				FD_SET (outfd, &wrset);
+				maxfd = MAX (maxfd, outfd);
+			} else
+				wake = MIN (wake, start + due[cur]);
+		}
+		if (infd < 0) {
+			FD_SET (listfd, &rdset);
+			maxfd = MAX (maxfd, listfd);
+		} else {
+			FD_SET (infd, &rdset);
+			maxfd = MAX (maxfd, infd);
+		}
+
+		wake = (wake > now ? wake - now : 0);
+		tv.tv_sec = wake / 1000000000;
+		tv.tv_usec = (wake % 1000000000) / 1000;
+		rdy = select (maxfd + 1, &rdset, &wrset, NULL, &tv);
+		if (rdy < 0) {
+			if (errno == EINTR)
+				continue;
+			perror ("select");
+			return EXIT_FAILURE;
+		}
+
+		if (cur < nreads && FD_ISSET (outfd, &wrset)) {
+			ssize_t nw;
+
+			if (cur_off == 0)
+				lag_max = MAX (lag_max,
+						clock_now () - start - due[cur]);
+			nw = write (outfd, pattern + sent % PERIOD,
+					reads[cur].ca_len - cur_off);
+			if (nw < 0 && errno != EAGAIN && errno != EINTR) {
+				perror ("scrittura verso psend");
+				break;
+			}
+			if (nw > 0) {
+				sent += nw;
+				cur_off += nw;
+				if (cur_off == reads[cur].ca_len) {
+					cur++;
+					cur_off = 0;
+				}
+			}
+		}
+
+		if (infd < 0 && FD_ISSET (listfd, &rdset)) {
+			infd = accept (listfd, NULL, NULL);
+			if (infd >= 0)
+				fcntl (infd, F_SETFL,
+				       fcntl (infd, F_GETFL) | O_NONBLOCK);
+		} else if (infd >= 0 && FD_ISSET (infd, &rdset)) {
+			ssize_t nr;
+			ssize_t j;
+
+			nr = read (infd, inbuf, RCVBUF);
+			if (nr == 0 || (nr < 0 && errno != EAGAIN
+			                && errno != EINTR)) {
+				fprintf (stderr, "precv ha chiuso la "
+						"connessione\n");
+				break;
+			}
+			if (nr <= 0)
+				continue;
+
+			for (j = 0; j < nr; j++)
+				if (inbuf[j] != PATTERN (rcvd + j))
+					errors++;
+			rcvd += nr;
+			last = clock_now ();
+
+			/* Latenza di ogni lettura riprodotta: dal suo istante
+			 * all'arrivo del suo ultimo byte. */
+			while (done < nreads && end <= rcvd) {
+				lat[done] = (last - start - due[done]) / NS;
+				if (++done < nreads)
+					end += reads[done].ca_len;
+			}
+		}
+	}
+	complete = (rcvd == total && errors == 0 ? TRUE : FALSE);
+
+	/* Una riga chiave=valore come quella di mhbench, piu' il ritardo
+	 * massimo delle scritture rispetto alla cattura. */
+	qsort (lat, done, sizeof (double), dblcmp);
+	printf ("workload=replay complete=%d bytes=%.0f secs=%.3f "
+	        "goodput_Bps=%.0f records=%lu errors=%lu lag_max_ms=%.3f "
+	        "lat_n=%lu lat_p50_ms=%.3f lat_p99_ms=%.3f lat_max_ms=%.3f\n",
+	        complete, (double)rcvd, (last - start) / NS,
+	        (last > start ? rcvd / ((last - start) / NS) : 0),
+	        nreads, errors, lag_max / NS * 1000, done,
+	        percentile (lat, done, 0.50) * 1000,
+	        percentile (lat, done, 0.99) * 1000,
+	        percentile (lat, done, 1) * 1000);
+
+	return (complete ? EXIT_SUCCESS : EXIT_FAILURE);
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static uint64_t
+clock_now (void)
+{
+	/* Come clock_ns di crono.c, che non puo' essere collegata senza il
+	 * resto del proxy. */
+
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static int
+connect_sender (uint64_t deadline)
+{
+	/* Si connette a psend come farebbe il Sender, riprovando finche'
+	 * psend non e' in ascolto o scade deadline.
+	 * Ritorna il socket non bloccante, -1 in caso di errore. */
+
+	fd_t fd;
+	int err;
+	int optval;
+	struct sockaddr_in addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (connport);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	for (;;) {
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror ("socket");
+			return -1;
+		}
+		if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) == 0)
+			break;
+		err = errno;
+		close (fd);
+		if (err != ECONNREFUSED || clock_now () >= deadline) {
+			fprintf (stderr, "connessione a psend, porta %d: %s\n",
+					connport, strerror (err));
+			return -1;
+		}
+		usleep (50000);
+	}
+
+	/* Senza Nagle ogni lettura catturata parte da sola, come da
+	 * un'applicazione interattiva. */
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	optval = 1;
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+	return fd;
+}
+
+
+static int
+dblcmp (const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+
+static int
+listen_receiver (void)
+{
+	int fd;
+	int optval;
+	struct sockaddr_in addr;
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror ("socket");
+		return -1;
+	}
+	optval = 1;
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof (optval));
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (listport);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if (bind (fd, (struct sockaddr *)&addr, sizeof (addr))
+	    || listen (fd, 1)) {
+		fprintf (stderr, "porta %d: %s\n", listport, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static int
+load_capture (const char *path)
+{
+	/* Legge le letture catturate da path, scritto da psend -C, e calcola
+	 * l'istante di ciascuna alla velocita' speed.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	FILE *f;
+	unsigned long size;
+	unsigned long i;
+	double t;
+	struct trace_header th;
+
+	f = fopen (path, "r");
+	if (f == NULL) {
+		fprintf (stderr, "%s: %s\n", path, strerror (errno));
+		return -1;
+	}
+	if (fread (&th, sizeof (th), 1, f) != 1
+	    || th.th_magic != CAPTURE_MAGIC
+	    || th.th_version != CAPTURE_VERSION
+	    || th.th_evsize != sizeof (struct capture_read)) {
+		fprintf (stderr, "%s: non e' una cattura di psend\n", path);
+		fclose (f);
+		return -1;
+	}
+
+	size = 1024;
+	nreads = 0;
+	reads = malloc (size * sizeof (struct capture_read));
+	for (;;) {
+		if (reads == NULL) {
+			perror ("malloc");
+			fclose (f);
+			return -1;
+		}
+		nreads += fread (reads + nreads, sizeof (struct capture_read),
+				size - nreads, f);
+		if (nreads < size)
+			break;
+		size *= 2;
+		reads = realloc (reads, size * sizeof (struct capture_read));
+	}
+	fclose (f);
+	if (nreads == 0) {
+		fprintf (stderr, "%s: nessuna lettura catturata\n", path);
+		return -1;
+	}
+
+	due = malloc (nreads * sizeof (uint64_t));
+	if (due == NULL) {
+		perror ("malloc");
+		return -1;
+	}
+	t = 0;
+	for (i = 0; i < nreads; i++) {
+		t += reads[i].ca_gap_us * 1000.0 / speed;
+		due[i] = t;
+	}
+	return 0;
+}
+
+
+static int
+parse_option (int opt, char *arg)
+{
+	/* Ritorna 0 se riesce, -1 altrimenti. */
+
+	double val;
+	char *endptr;
+
+	val = strtod (arg, &endptr);
+	if (endptr == arg || *endptr != '\0' || val <= 0)
+		return -1;
+
+	switch (opt) {
+	case 'c' :
+	case 'l' :
+		if (val > 65535)
+			return -1;
+		if (opt == 'c')
+			connport = val;
+		else
+			listport = val;
+		break;
+	case 's' :
+		speed = val;
+		break;
+	case 't' :
+		time_limit = val;
+		break;
+	default :
+		return -1;
+	}
+	return 0;
+}
+
+
+static double
+percentile (double *v, unsigned long n, double p)
+{
+	/* v e' ordinato. Ritorna 0 se vuoto. */
+
+	unsigned long i;
+
+	if (n == 0)
+		return 0;
+	i = p * n;
+	return v[MIN (i, n - 1)];
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ opzioni ] cattura\n", program_name);
+	printf ("\n"
+"Riproduce una cattura scritta da psend -C: si connette a psend come il\n"
+"Sender e ripete ogni lettura con la stessa dimensione e allo stesso\n"
+"istante, poi accetta la connessione di precv come il Receiver e controlla\n"
+"il flusso. Stampa una riga chiave=valore come mhbench, con la latenza di\n"
+"consegna di ogni lettura e il ritardo massimo accumulato dalle scritture\n"
+"rispetto alla cattura; esce con successo solo se tutti i dati sono\n"
+"arrivati intatti.\n"
+		);
+	printf ("\n"
+"Opzioni:\n"
+"  -i            stampa un riepilogo della cattura senza riprodurla\n"
+"  -s fattore    velocita' di riproduzione (predefinita 1, 2 = doppia)\n"
+"  -t secondi    tempo concesso dopo l'ultima lettura (predefinito 60)\n"
+"  -c porta      porta di psend (predefinita 6001)\n"
+"  -l porta      porta su cui attendere precv (predefinita 9001)\n"
+		);
+}
+
+
+static void
+print_info (void)
+{
+	/* Riepilogo chiave=valore della cattura: numero e dimensioni delle
+	 * letture, durata e intervalli alla velocita' scelta. */
+
+	unsigned long i;
+	uint64_t bytes;
+	size_t maxlen;
+	double *len;
+	double *gap;
+
+	len = malloc (nreads * sizeof (double));
+	gap = malloc (nreads * sizeof (double));
+	if (len == NULL || gap == NULL) {
+		perror ("malloc");
+		exit (EXIT_FAILURE);
+	}
+	bytes = 0;
+	maxlen = 0;
+	for (i = 0; i < nreads; i++) {
+		bytes += reads[i].ca_len;
+		maxlen = MAX (maxlen, reads[i].ca_len);
+		len[i] = reads[i].ca_len;
+		gap[i] = (i > 0 ? (due[i] - due[i - 1]) / NS : 0);
+	}
+	qsort (len, nreads, sizeof (double), dblcmp);
+	qsort (gap, nreads, sizeof (double), dblcmp);
+	printf ("reads=%lu bytes=%.0f secs=%.3f len_p50=%.0f len_max=%lu "
+	        "gap_p50_ms=%.3f gap_p99_ms=%.3f gap_max_ms=%.3f\n",
+	        nreads, (double)bytes, due[nreads - 1] / NS,
+	        percentile (len, nreads, 0.50), (unsigned long)maxlen,
+	        percentile (gap, nreads, 0.50) * 1000,
+	        percentile (gap, nreads, 0.99) * 1000,
+	        percentile (gap, nreads, 1) * 1000);
+}
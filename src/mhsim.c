@@ -0,0 +1,1216 @@
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Byte letti in una volta e byte in attesa per direzione, come in
+ * ritardatore. */
+#define     CHUNKMAX     16384
+#define     QUEUEMAX     (256 * 1024)
+
+/* MSS dei socket del simulatore, quello di Ethernet: con l'MSS di loopback,
+ * 64 KiB, il kernel riapre una finestra chiusa solo allo scadere del persist
+ * timer, in tempo reale. */
+#define     SIM_MSS      1460
+
+/* Direzioni di un canale. */
+#define     DIRS         2
+#define     FWD          0     /* Da psend a precv. */
+#define     REV          1     /* Da precv a psend. */
+
+/* Proxy simulati: l'indice e' quello del lato dei canali a cui sono
+ * connessi. */
+#define     PROXIES      2
+#define     PSEND        FWD
+#define     PRECV        REV
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+/* Istante virtuale di partenza: per crono.c 0 vuol dire orologio di
+ * sistema. */
+#define     EPOCH        ((uint64_t)1000 * 1000000000)
+
+/* Intestazione dei record del flusso di prova, come in mhbench. */
+#define     RECHDR       16
+#define     RECINT       0x80000000UL
+
+/* Carichi. */
+#define     BULK         0x1
+#define     INTERACTIVE  0x2
+#define     MIXED        (BULK | INTERACTIVE)
+
+/* Argomenti al massimo sulla riga di comando di un proxy. */
+#define     ARGMAX       32
+
+/* Dati letti da una parte e in attesa di essere scritti dall'altra. */
+struct chunk {
+	struct chunk *c_next;
+	uint64_t c_release;
+	size_t c_len;
+	size_t c_off;
+	char *c_data;
+};
+
+/* Una direzione di un canale. */
+struct pipe {
+	struct chunk *p_head;
+	struct chunk *p_tail;
+	size_t p_queued;
+	uint64_t p_link_free;
+	uint64_t p_last_release;
+};
+
+/* Un canale simulato e i suoi disturbi. */
+struct link {
+	fd_t l_listfd;
+	fd_t l_fd[DIRS];          /* Lato psend e lato precv. */
+	struct pipe l_pipe[DIRS];
+
+	double l_delay;           /* Secondi. */
+	double l_jitter;          /* Secondi, uniforme in [-jitter, jitter]. */
+	double l_rate;            /* Byte al secondo, 0 illimitata. */
+	double l_loss;            /* Probabilita' di perdita di un blocco. */
+	double l_stall_every;     /* Secondi tra l'inizio di due stalli. */
+	double l_stall_len;       /* Secondi di ogni stallo. */
+};
+
+/* Un proxy figlio e il suo turno. */
+struct child {
+	char *x_name;
+	pid_t x_pid;
+	fd_t x_ctl;
+	uint64_t x_deadline;      /* Istante a cui vuole essere risvegliato. */
+	bool x_wake;              /* I suoi socket sono cambiati. */
+};
+
+/* Una direzione del flusso di prova, come in mhbench. */
+struct flow {
+	fd_t f_fd;
+	char *f_buf;
+	size_t f_len;
+	size_t f_off;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static struct link links[NETCHANNELS];
+static struct child proxies[PROXIES] = {
+	{ "psend", -1, -1, 0, FALSE },
+	{ "precv", -1, -1, 0, FALSE }
+};
+
+/* Porte: psend ascolta il Sender su baseport e si connette ai canali su
+ * baseport + 1..3, precv ascolta i canali su baseport + 4..6 e si connette
+ * al Receiver su baseport + 7. */
+static port_t baseport = 17000;
+static char *bindir;
+static char *proxy_opts = "";
+static bool verbose = FALSE;
+
+/* Ritardo aggiunto a un blocco perso: il TCP del canale lo ritrasmette dopo
+ * un RTO, e i blocchi successivi aspettano. */
+static double rto = 0.200;
+
+static int workload = BULK;
+static uint64_t bulk_bytes = 4 * 1024 * 1024;
+static size_t bulk_rec = 16384;
+static unsigned long int_count = 200;
+static size_t int_size = 64;
+static double int_every = 0.020;
+static double time_limit = 120;
+
+/* Tempo virtuale. */
+static uint64_t now;
+static uint64_t start;
+
+/* Sender e Receiver. */
+static struct flow out;
+static struct flow in;
+static fd_t recv_listfd;
+static bool host_failed = FALSE;
+static unsigned long int_sent;
+static uint64_t int_next;
+static uint64_t bulk_left;
+static uint32_t num;
+static uint32_t next;
+static uint64_t rcvd;
+static uint64_t last;
+static unsigned long errors;
+
+/* Latenze di consegna in secondi virtuali, separate per tipo di record. */
+static double *lat[2];
+static unsigned long nlat[2];
+static unsigned long maxlat[2];
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void accept_link (int cd, fd_t fd);
+static uint64_t clock_now (void);
+static void close_link (int cd);
+static fd_t connect_local (port_t port);
+static int dblcmp (const void *a, const void *b);
+static bool host_io (void);
+static fd_t listen_local (port_t port);
+static uint64_t next_event (void);
+static int parse_chan (char *arg, int *first, int *last, char **rest);
+static int parse_option (int opt, char *arg);
+static double percentile (double *v, unsigned long n, double p);
+static ssize_t pipe_read (int cd, int dir);
+static ssize_t pipe_write (int cd, int dir);
+static void print_help (const char *program_name);
+static void put_record (struct flow *fl, uint32_t num, size_t len);
+static int run_proxy (int x);
+static bool sim_io (void);
+static void quick_ack (fd_t fd);
+static fd_t socket_create (void);
+static void socket_setup (fd_t fd);
+static int spawn_proxy (int x, char **args, int nargs);
+static uint64_t stall_end (struct link *l, uint64_t t);
+static unsigned long take_records (struct flow *fl, uint32_t *next);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	int cd;
+	int x;
+	int kind;
+	int nargs;
+	unsigned seed;
+	unsigned long rounds;
+	unsigned long instants;
+	uint64_t total;
+	uint64_t wall;
+	char *endptr;
+	char *args[NETCHANNELS * 2 + 1];
+	char ports[8][8];
+	bool complete;
+
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		links[cd].l_listfd = -1;
+		links[cd].l_fd[FWD] = -1;
+		links[cd].l_fd[REV] = -1;
+	}
+
+	seed = 1;
+	while ((opt = getopt (argc, argv, "b:d:D:e:i:j:k:m:n:P:r:R:s:S:t:vw:x:"))
+	       != -1) {
+		switch (opt) {
+		case 'D' :
+			bindir = optarg;
+			break;
+		case 'S' :
+			seed = strtoul (optarg, &endptr, 10);
+			if (*endptr != '\0')
+				goto error;
+			break;
+		case 'v' :
+			verbose = TRUE;
+			break;
+		case 'x' :
+			proxy_opts = optarg;
+			break;
+		case '?' :
+			goto error;
+		default :
+			if (parse_option (opt, optarg))
+				goto error;
+		}
+	}
+	if (optind != argc)
+		goto error;
+	if (!(workload & INTERACTIVE))
+		int_count = 0;
+	if (!(workload & BULK))
+		bulk_bytes = 0;
+
+	/* Gli eseguibili dei proxy stanno di norma accanto a mhsim. */
+	if (bindir == NULL) {
+		char *slash;
+
+		bindir = strdup (argv[0]);
+		slash = strrchr (bindir, '/');
+		if (slash != NULL)
+			*slash = '\0';
+		else
+			bindir = ".";
+	}
+
+	srand (seed);
+	signal (SIGPIPE, SIG_IGN);
+
+	/* Byte attesi dal Receiver, intestazioni comprese, come in mhbench. */
+	total = int_count * int_size + bulk_bytes
+		+ (bulk_bytes + bulk_rec - RECHDR - 1) / (bulk_rec - RECHDR)
+		* RECHDR;
+	maxlat[0] = bulk_bytes / (bulk_rec - RECHDR) + 1;
+	maxlat[1] = int_count + 1;
+	lat[0] = malloc (maxlat[0] * sizeof (double));
+	lat[1] = malloc (maxlat[1] * sizeof (double));
+	out.f_buf = malloc (MAX (bulk_rec, int_size));
+	in.f_buf = malloc (2 * MAX (bulk_rec, int_size));
+	if (lat[0] == NULL || lat[1] == NULL || out.f_buf == NULL
+	    || in.f_buf == NULL) {
+		perror ("malloc");
+		return EXIT_FAILURE;
+	}
+	out.f_fd = in.f_fd = -1;
+	out.f_len = out.f_off = 0;
+	in.f_len = in.f_off = 0;
+
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		links[cd].l_listfd = listen_local (baseport + 1 + cd);
+		if (links[cd].l_listfd < 0)
+			return EXIT_FAILURE;
+	}
+	recv_listfd = listen_local (baseport + 7);
+	if (recv_listfd < 0)
+		return EXIT_FAILURE;
+
+	for (x = 0; x < 8; x++)
+		sprintf (ports[x], "%d", baseport + x);
+
+	/* Prima precv, che si mette in ascolto, poi psend, che si connette
+	 * ai canali: ciascuno gira il primo turno prima del successivo. */
+	now = EPOCH;
+	nargs = 0;
+	for (cd = 0; cd < NETCHANNELS; cd++)
+		args[nargs++] = ports[4 + cd];
+	args[nargs++] = "127.0.0.1";
+	args[nargs++] = ports[7];
+	if (spawn_proxy (PRECV, args, nargs) || run_proxy (PRECV))
+		goto fail;
+	nargs = 0;
+	args[nargs++] = ports[0];
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		args[nargs++] = "127.0.0.1";
+		args[nargs++] = ports[1 + cd];
+	}
+	if (spawn_proxy (PSEND, args, nargs) || run_proxy (PSEND))
+		goto fail;
+
+	out.f_fd = connect_local (baseport);
+	if (out.f_fd < 0)
+		goto fail;
+	proxies[PSEND].x_wake = TRUE;
+
+	start = last = int_next = now;
+	bulk_left = bulk_bytes;
+	wall = clock_now ();
+	rounds = instants = 0;
+	for (;;) {
+		uint64_t wake;
+
+		/* Turni allo stesso istante virtuale, finche' qualcosa si
+		 * muove: il simulatore sposta i dati, poi gira chi ha i socket
+		 * cambiati o un timeout scaduto. */
+		for (;;) {
+			bool moved;
+			bool ran;
+
+			rounds++;
+			moved = sim_io ();
+			ran = FALSE;
+			for (x = 0; x < PROXIES; x++)
+				if (proxies[x].x_wake
+				    || proxies[x].x_deadline <= now) {
+					if (run_proxy (x))
+						goto fail;
+					ran = TRUE;
+				}
+			if (!moved && !ran)
+				break;
+		}
+		if (rcvd >= total || host_failed
+		    || now - start >= time_limit * NS)
+			break;
+
+		wake = next_event ();
+		if (wake == UINT64_MAX) {
+			fprintf (stderr, "simulazione bloccata all'istante "
+					"%.3f\n", (now - start) / NS);
+			break;
+		}
+		now = MIN (wake, start + (uint64_t)(time_limit * NS));
+		instants++;
+	}
+
+fail:
+	for (x = 0; x < PROXIES; x++)
+		if (proxies[x].x_pid > 0) {
+			kill (proxies[x].x_pid, SIGTERM);
+			waitpid (proxies[x].x_pid, NULL, 0);
+		}
+	if (out.f_fd < 0)
+		return EXIT_FAILURE;
+	wall = clock_now () - wall;
+	complete = (rcvd == total && errors == 0 ? TRUE : FALSE);
+
+	/* Una riga chiave=valore come quella di mhbench, con i tempi
+	 * virtuali, piu' il costo della simulazione. */
+	kind = (nlat[1] > 0 ? 1 : 0);
+	qsort (lat[kind], nlat[kind], sizeof (double), dblcmp);
+	printf ("workload=%s complete=%d bytes=%.0f secs=%.3f "
+	        "goodput_Bps=%.0f records=%lu errors=%lu "
+	        "lat_n=%lu lat_p50_ms=%.3f lat_p99_ms=%.3f lat_max_ms=%.3f "
+	        "instants=%lu rounds=%lu wall_secs=%.3f\n",
+	        (workload == MIXED ? "mixed" :
+	         workload == BULK ? "bulk" : "interactive"),
+	        complete, (double)rcvd, (last - start) / NS,
+	        (last > start ? rcvd / ((last - start) / NS) : 0),
+	        (unsigned long)(nlat[0] + nlat[1]), errors, nlat[kind],
+	        percentile (lat[kind], nlat[kind], 0.50) * 1000,
+	        percentile (lat[kind], nlat[kind], 0.99) * 1000,
+	        percentile (lat[kind], nlat[kind], 1) * 1000,
+	        instants, rounds, wall / NS);
+
+	return (complete ? EXIT_SUCCESS : EXIT_FAILURE);
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+accept_link (int cd, fd_t fd)
+{
+	/* Ha accettato la connessione di psend fd sul canale cd e apre quella
+	 * verso precv, come accept_link di ritardatore. */
+
+	int dir;
+	struct link *l = &links[cd];
+
+	l->l_fd[FWD] = fd;
+	l->l_fd[REV] = connect_local (baseport + 4 + cd);
+	if (l->l_fd[REV] < 0) {
+		close_link (cd);
+		return;
+	}
+	for (dir = 0; dir < DIRS; dir++) {
+		socket_setup (l->l_fd[dir]);
+		memset (&l->l_pipe[dir], 0, sizeof (struct pipe));
+		proxies[dir].x_wake = TRUE;
+	}
+	if (verbose)
+		fprintf (stderr, "%.6f canale %d connesso\n",
+				(now - EPOCH) / NS, cd);
+}
+
+
+static uint64_t
+clock_now (void)
+{
+	/* Orologio reale, solo per misurare quanto costa la simulazione. */
+
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static void
+close_link (int cd)
+{
+	/* Chiude entrambe le connessioni del canale cd, scartando i dati in
+	 * attesa, come farebbe un percorso che cade. */
+
+	int dir;
+	struct chunk *c;
+	struct link *l = &links[cd];
+
+	for (dir = 0; dir < DIRS; dir++) {
+		if (l->l_fd[dir] >= 0)
+			close (l->l_fd[dir]);
+		l->l_fd[dir] = -1;
+		while ((c = l->l_pipe[dir].p_head) != NULL) {
+			l->l_pipe[dir].p_head = c->c_next;
+			free (c);
+		}
+		memset (&l->l_pipe[dir], 0, sizeof (struct pipe));
+		proxies[dir].x_wake = TRUE;
+	}
+	if (verbose)
+		fprintf (stderr, "%.6f canale %d chiuso\n",
+				(now - EPOCH) / NS, cd);
+}
+
+
+static fd_t
+connect_local (port_t port)
+{
+	/* Si connette a 127.0.0.1:port. La connect bloccante si conclude
+	 * subito se il proxy e' in ascolto, senza che debba girare.
+	 * Ritorna il socket, -1 se la connessione e' rifiutata. */
+
+	fd_t fd;
+	struct sockaddr_in addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	fd = socket_create ();
+	if (fd < 0)
+		return -1;
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr))) {
+		if (verbose)
+			fprintf (stderr, "porta %d: %s\n", port,
+					strerror (errno));
+		close (fd);
+		return -1;
+	}
+	socket_setup (fd);
+	return fd;
+}
+
+
+static int
+dblcmp (const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+
+static bool
+host_io (void)
+{
+	/* Fa da Sender e da Receiver all'istante now, come mhbench.
+	 * Ritorna TRUE se ha spostato dei dati. */
+
+	ssize_t n;
+	bool moved;
+
+	moved = FALSE;
+
+	if (in.f_fd < 0) {
+		in.f_fd = accept (recv_listfd, NULL, NULL);
+		if (in.f_fd >= 0) {
+			socket_setup (in.f_fd);
+			proxies[PRECV].x_wake = TRUE;
+			moved = TRUE;
+		}
+	}
+
+	/* I messaggi interattivi hanno la precedenza tra un record e
+	 * l'altro. */
+	for (;;) {
+		if (out.f_len == 0) {
+			if (int_sent < int_count && int_next <= now) {
+				put_record (&out, num++ | RECINT, int_size);
+				int_sent++;
+				int_next += int_every * NS;
+			} else if (bulk_left > 0) {
+				size_t pld = MIN (bulk_left, bulk_rec - RECHDR);
+				put_record (&out, num++, pld + RECHDR);
+				bulk_left -= pld;
+			} else
+				break;
+		}
+		n = write (out.f_fd, out.f_buf + out.f_off,
+				out.f_len - out.f_off);
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			perror ("scrittura verso psend");
+			host_failed = TRUE;
+		}
+		if (n <= 0)
+			break;
+		out.f_off += n;
+		if (out.f_off == out.f_len)
+			out.f_len = out.f_off = 0;
+		proxies[PSEND].x_wake = TRUE;
+		moved = TRUE;
+	}
+
+	while (in.f_fd >= 0) {
+		n = read (in.f_fd, in.f_buf + in.f_len,
+				2 * MAX (bulk_rec, int_size) - in.f_len);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+			fprintf (stderr, "precv ha chiuso la connessione\n");
+			host_failed = TRUE;
+		}
+		if (n <= 0)
+			break;
+		quick_ack (in.f_fd);
+		in.f_len += n;
+		rcvd += n;
+		last = now;
+		errors += take_records (&in, &next);
+		proxies[PRECV].x_wake = TRUE;
+		moved = TRUE;
+	}
+	return moved;
+}
+
+
+static fd_t
+listen_local (port_t port)
+{
+	fd_t fd;
+	int optval;
+	struct sockaddr_in addr;
+
+	fd = socket_create ();
+	if (fd < 0)
+		return -1;
+	optval = 1;
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof (optval));
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if (bind (fd, (struct sockaddr *)&addr, sizeof (addr))
+	    || listen (fd, 1)) {
+		fprintf (stderr, "porta %d: %s\n", port, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+
+static uint64_t
+next_event (void)
+{
+	/* Ritorna il prossimo istante in cui succede qualcosa: un timeout di
+	 * un proxy, dati da consegnare o la fine di uno stallo, il prossimo
+	 * messaggio interattivo. UINT64_MAX se non succedera' piu' niente.
+	 * I dati gia' consegnabili ma fermi perche' il proxy non legge non
+	 * contano: ripartono quando il proxy si muove per altro. */
+
+	int x;
+	int cd;
+	int dir;
+	uint64_t wake;
+
+	wake = UINT64_MAX;
+	for (x = 0; x < PROXIES; x++)
+		wake = MIN (wake, proxies[x].x_deadline);
+
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		struct link *l = &links[cd];
+
+		if (l->l_fd[FWD] < 0)
+			continue;
+		for (dir = 0; dir < DIRS; dir++) {
+			uint64_t when;
+
+			if (l->l_pipe[dir].p_head == NULL)
+				continue;
+			when = MAX (l->l_pipe[dir].p_head->c_release,
+			            stall_end (l, now));
+			if (when > now)
+				wake = MIN (wake, when);
+		}
+	}
+
+	if (out.f_len == 0 && int_sent < int_count)
+		wake = MIN (wake, int_next);
+	return wake;
+}
+
+
+static int
+parse_chan (char *arg, int *first, int *last, char **rest)
+{
+	/* Legge da arg un canale (0, 1, 2 oppure * per tutti) seguito da
+	 * ':'. *rest punta a quello che segue.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	if (arg[0] == '\0' || arg[1] != ':')
+		return -1;
+
+	if (arg[0] == '*') {
+		*first = 0;
+		*last = NETCHANNELS - 1;
+	} else if (arg[0] >= '0' && arg[0] < '0' + NETCHANNELS)
+		*first = *last = arg[0] - '0';
+	else
+		return -1;
+
+	*rest = &arg[2];
+	return 0;
+}
+
+
+static int
+parse_option (int opt, char *arg)
+{
+	/* Gestisce le opzioni del carico e quelle per canale.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	int cd;
+	int first;
+	int last;
+	double val;
+	double len;
+	char *rest;
+	char *endptr;
+
+	if (opt == 'w') {
+		if (strcmp (arg, "bulk") == 0)
+			workload = BULK;
+		else if (strcmp (arg, "interactive") == 0)
+			workload = INTERACTIVE;
+		else if (strcmp (arg, "mixed") == 0)
+			workload = MIXED;
+		else
+			return -1;
+		return 0;
+	}
+
+	if (strchr ("djrse", opt) == NULL) {
+		val = strtod (arg, &endptr);
+		if (endptr == arg || *endptr != '\0' || val <= 0)
+			return -1;
+		switch (opt) {
+		case 'b' :
+			if (val <= RECHDR || val > 1024 * 1024)
+				return -1;
+			bulk_rec = val;
+			break;
+		case 'i' :
+			int_every = val / 1000;
+			break;
+		case 'k' :
+			if (val < RECHDR || val > 1024 * 1024)
+				return -1;
+			int_size = val;
+			break;
+		case 'm' :
+			int_count = val;
+			break;
+		case 'n' :
+			bulk_bytes = val;
+			break;
+		case 'P' :
+			if (val + 7 > 65535)
+				return -1;
+			baseport = val;
+			break;
+		case 'R' :
+			rto = val / 1000;
+			break;
+		case 't' :
+			time_limit = val;
+			break;
+		default :
+			return -1;
+		}
+		return 0;
+	}
+
+	if (parse_chan (arg, &first, &last, &rest))
+		return -1;
+	val = strtod (rest, &endptr);
+	if (endptr == rest || val < 0 || (opt == 'e' && val > 1))
+		return -1;
+
+	len = 0;
+	if (opt == 's') {
+		if (*endptr != ':')
+			return -1;
+		rest = endptr + 1;
+		len = strtod (rest, &endptr);
+		if (endptr == rest || len <= 0 || len >= val)
+			return -1;
+	}
+	if (*endptr != '\0')
+		return -1;
+
+	for (cd = first; cd <= last; cd++)
+		switch (opt) {
+		case 'd' :
+			links[cd].l_delay = val / 1000;
+			break;
+		case 'j' :
+			links[cd].l_jitter = val / 1000;
+			break;
+		case 'r' :
+			links[cd].l_rate = val;
+			break;
+		case 'e' :
+			links[cd].l_loss = val;
+			break;
+		case 's' :
+			links[cd].l_stall_every = val;
+			links[cd].l_stall_len = len;
+			break;
+		}
+	return 0;
+}
+
+
+static double
+percentile (double *v, unsigned long n, double p)
+{
+	/* v e' ordinato. Ritorna 0 se vuoto. */
+
+	unsigned long i;
+
+	if (n == 0)
+		return 0;
+	i = p * n;
+	return v[MIN (i, n - 1)];
+}
+
+
+static ssize_t
+pipe_read (int cd, int dir)
+{
+	/* Legge dal lato dir del canale cd e accoda i dati con l'istante in
+	 * cui potranno essere consegnati, come pipe_read di ritardatore. Un
+	 * blocco perso arriva dopo un RTO, e l'ordine del flusso TCP fa
+	 * aspettare anche quelli dopo.
+	 * Ritorna i byte letti, -1 se il canale e' stato chiuso. */
+
+	ssize_t nread;
+	double delay;
+	uint64_t release;
+	char buf[CHUNKMAX];
+	struct chunk *c;
+	struct link *l = &links[cd];
+	struct pipe *p = &l->l_pipe[dir];
+
+	if (p->p_queued >= QUEUEMAX)
+		return 0;
+	nread = read (l->l_fd[dir], buf, MIN (sizeof (buf),
+	                                      QUEUEMAX - p->p_queued));
+	if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (nread <= 0) {
+		close_link (cd);
+		return -1;
+	}
+	quick_ack (l->l_fd[dir]);
+	proxies[dir].x_wake = TRUE;
+
+	release = now;
+	if (l->l_rate > 0) {
+		release = MAX (release, p->p_link_free)
+			+ (uint64_t)(nread / l->l_rate * NS);
+		p->p_link_free = release;
+	}
+	delay = l->l_delay;
+	if (l->l_jitter > 0)
+		delay += l->l_jitter * (2.0 * rand () / RAND_MAX - 1);
+	if (l->l_loss > 0 && rand () < l->l_loss * RAND_MAX)
+		delay += rto;
+	if (delay > 0)
+		release += (uint64_t)(delay * NS);
+	release = MAX (release, p->p_last_release);
+	p->p_last_release = release;
+
+	c = malloc (sizeof (struct chunk) + nread);
+	if (c == NULL) {
+		perror ("malloc");
+		exit (EXIT_FAILURE);
+	}
+	c->c_next = NULL;
+	c->c_release = release;
+	c->c_len = nread;
+	c->c_off = 0;
+	c->c_data = (char *)(c + 1);
+	memcpy (c->c_data, buf, nread);
+
+	if (p->p_tail != NULL)
+		p->p_tail->c_next = c;
+	else
+		p->p_head = c;
+	p->p_tail = c;
+	p->p_queued += nread;
+	return nread;
+}
+
+
+static ssize_t
+pipe_write (int cd, int dir)
+{
+	/* Scrive sul lato opposto a dir del canale cd i dati gia'
+	 * consegnabili.
+	 * Ritorna i byte scritti, -1 se il canale e' stato chiuso. */
+
+	ssize_t nwrite;
+	ssize_t total;
+	struct chunk *c;
+	struct link *l = &links[cd];
+	struct pipe *p = &l->l_pipe[dir];
+
+	if (stall_end (l, now) > now)
+		return 0;
+
+	total = 0;
+	while ((c = p->p_head) != NULL && c->c_release <= now) {
+		nwrite = write (l->l_fd[!dir], c->c_data + c->c_off,
+				c->c_len - c->c_off);
+		if (nwrite < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+		if (nwrite < 0) {
+			close_link (cd);
+			return -1;
+		}
+		proxies[!dir].x_wake = TRUE;
+		total += nwrite;
+		c->c_off += nwrite;
+		p->p_queued -= nwrite;
+		if (c->c_off < c->c_len)
+			break;
+
+		p->p_head = c->c_next;
+		if (p->p_head == NULL)
+			p->p_tail = NULL;
+		free (c);
+	}
+	return total;
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ opzioni ]\n", program_name);
+	printf ("\n"
+"Simula in tempo virtuale la coppia psend/precv con i tre canali, il Sender\n"
+"e il Receiver. I proxy sono quelli veri, ma girano un turno alla volta e il\n"
+"loro orologio e' quello del simulatore, che salta direttamente al prossimo\n"
+"evento: a parita' di opzioni e seme il risultato e' lo stesso. Stampa una\n"
+"riga chiave=valore come mhbench, con i tempi virtuali, seguita dal costo\n"
+"della simulazione: istanti, turni e secondi reali.\n"
+		);
+	printf ("\n"
+"Opzioni del carico, come mhbench:\n"
+"  -w carico      bulk, interactive o mixed (predefinito bulk)\n"
+"  -n byte        byte del carico bulk (predefinito 4 MiB)\n"
+"  -b byte        dimensione dei record bulk (predefinita 16384)\n"
+"  -m numero      messaggi interattivi (predefinito 200)\n"
+"  -k byte        dimensione dei messaggi interattivi (predefinita 64)\n"
+"  -i ms          intervallo tra i messaggi interattivi (predefinito 20)\n"
+"  -t secondi     limite di tempo virtuale (predefinito 120)\n"
+		);
+	printf ("\n"
+"Opzioni dei canali (c e' il canale, 0-2, oppure * per tutti):\n"
+"  -d c:ms        ritardo di propagazione\n"
+"  -j c:ms        jitter, uniforme in [-ms, ms]; l'ordine e' mantenuto\n"
+"  -r c:byte/s    banda massima\n"
+"  -e c:prob      probabilita' che un blocco vada perso e arrivi dopo un RTO\n"
+"  -R ms          RTO dei blocchi persi (predefinito 200)\n"
+"  -s c:ogni:per  ogni 'ogni' secondi il canale si blocca per 'per' secondi\n"
+"  -S seme        seme del generatore casuale\n"
+		);
+	printf ("\n"
+"Altre opzioni:\n"
+"  -x opzioni     opzioni passate a psend e precv (es. \"-t 0.5 -p 0.1\")\n"
+"  -D directory   directory di psend e precv (predefinita quella di mhsim)\n"
+"  -P porta       prima delle 8 porte locali usate (predefinita 17000)\n"
+"  -v             stampa apertura e chiusura dei canali\n"
+		);
+}
+
+
+static void
+put_record (struct flow *fl, uint32_t num, size_t len)
+{
+	/* Prepara in fl il record num lungo len byte, marcato con l'istante
+	 * virtuale. Il payload e' il byte basso di num ripetuto. */
+
+	uint32_t hdr[4];
+
+	hdr[0] = htonl (len);
+	hdr[1] = htonl (num);
+	hdr[2] = htonl ((uint32_t)(now >> 32));
+	hdr[3] = htonl ((uint32_t)now);
+	memcpy (fl->f_buf, hdr, RECHDR);
+	memset (fl->f_buf + RECHDR, num & 0xff, len - RECHDR);
+	fl->f_len = len;
+	fl->f_off = 0;
+}
+
+
+static void
+quick_ack (fd_t fd)
+{
+	/* Conferma subito i dati letti da fd: con l'ack ritardato il proxy
+	 * dall'altra parte resterebbe con il buffer pieno per un tempo
+	 * reale, che il simulatore non vede. */
+
+	int optval = 1;
+
+	setsockopt (fd, IPPROTO_TCP, TCP_QUICKACK, &optval, sizeof (optval));
+}
+
+
+static int
+run_proxy (int x)
+{
+	/* Fa girare il proxy x all'istante now finche' non ha piu' niente da
+	 * fare e registra quando vuole essere risvegliato.
+	 * Ritorna 0 se riesce, -1 se il proxy e' terminato. */
+
+	struct child *px = &proxies[x];
+
+	if (write (px->x_ctl, &now, sizeof (now)) != sizeof (now)
+	    || read (px->x_ctl, &px->x_deadline, sizeof (px->x_deadline))
+	       != sizeof (px->x_deadline)) {
+		fprintf (stderr, "%s terminato all'istante %.3f\n",
+				px->x_name, (now - EPOCH) / NS);
+		return -1;
+	}
+	px->x_wake = FALSE;
+	return 0;
+}
+
+
+static bool
+sim_io (void)
+{
+	/* Accetta le connessioni dei canali e sposta i dati tra i proxy e
+	 * dentro e fuori dai canali, all'istante now.
+	 * Ritorna TRUE se e' cambiato qualcosa. */
+
+	int cd;
+	int dir;
+	ssize_t n;
+	bool moved;
+
+	moved = FALSE;
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		struct link *l = &links[cd];
+
+		if (l->l_fd[FWD] < 0) {
+			fd_t fd = accept (l->l_listfd, NULL, NULL);
+
+			if (fd >= 0) {
+				accept_link (cd, fd);
+				moved = TRUE;
+			}
+			continue;
+		}
+		for (dir = 0; dir < DIRS && l->l_fd[FWD] >= 0; dir++) {
+			while ((n = pipe_read (cd, dir)) > 0)
+				moved = TRUE;
+			if (n == 0 && l->l_fd[FWD] >= 0)
+				n = pipe_write (cd, dir);
+			if (n != 0)
+				moved = TRUE;
+		}
+	}
+	if (host_io ())
+		moved = TRUE;
+	return moved;
+}
+
+
+static fd_t
+socket_create (void)
+{
+	/* Crea un socket tcp con buffer di dimensione fissa, perche'
+	 * l'autotuning del kernel dipende dal tempo reale, e MSS SIM_MSS.
+	 * Il buffer di invio e' piu' piccolo della finestra del proxy, cosi'
+	 * il simulatore non aspetta mai che si riapra. Vanno impostati prima
+	 * di connect e listen: i socket accettati li ereditano.
+	 * Ritorna il socket, -1 in caso di errore. */
+
+	fd_t fd;
+	int optval;
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror ("socket");
+		return -1;
+	}
+	optval = TCP_SIM_BUF_SIZE;
+	setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof (optval));
+	optval = TCP_SIM_BUF_SIZE / 4;
+	setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &optval, sizeof (optval));
+	optval = SIM_MSS;
+	setsockopt (fd, IPPROTO_TCP, TCP_MAXSEG, &optval, sizeof (optval));
+	return fd;
+}
+
+
+static void
+socket_setup (fd_t fd)
+{
+	/* Socket non bloccante e senza Nagle: i tempi li decide il
+	 * simulatore. */
+
+	int optval;
+
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	optval = 1;
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+}
+
+
+static int
+spawn_proxy (int x, char **args, int nargs)
+{
+	/* Avvia il proxy x con le opzioni comuni e gli argomenti args, con
+	 * il socket di controllo in MHSIM_FD. Il proxy attende il primo
+	 * turno.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	int i;
+	int argc;
+	fd_t sv[2];
+	char *argv[ARGMAX + 1];
+	char *opts;
+	char *tok;
+	char path[1024];
+	char env[16];
+	struct child *px = &proxies[x];
+
+	snprintf (path, sizeof (path), "%s/%s", bindir, px->x_name);
+	argc = 0;
+	argv[argc++] = path;
+	opts = strdup (proxy_opts);
+	for (tok = strtok (opts, " \t"); tok != NULL && argc < ARGMAX - nargs;
+	     tok = strtok (NULL, " \t"))
+		argv[argc++] = tok;
+	for (i = 0; i < nargs; i++)
+		argv[argc++] = args[i];
+	argv[argc] = NULL;
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv)) {
+		perror ("socketpair");
+		return -1;
+	}
+	px->x_pid = fork ();
+	if (px->x_pid < 0) {
+		perror ("fork");
+		return -1;
+	}
+	if (px->x_pid == 0) {
+		/* Nel figlio restano aperti solo il controllo e, con -v,
+		 * stdout e stderr. */
+		fd_t fd;
+
+		for (fd = 3; fd < 256; fd++)
+			if (fd != sv[1])
+				close (fd);
+		if (!verbose) {
+			fd = open ("/dev/null", O_WRONLY);
+			dup2 (fd, STDOUT_FILENO);
+			dup2 (fd, STDERR_FILENO);
+		}
+		sprintf (env, "%d", sv[1]);
+		setenv ("MHSIM_FD", env, 1);
+		execv (path, argv);
+		perror (path);
+		_exit (EXIT_FAILURE);
+	}
+	close (sv[1]);
+	free (opts);
+	px->x_ctl = sv[0];
+	return 0;
+}
+
+
+static uint64_t
+stall_end (struct link *l, uint64_t t)
+{
+	/* Ritorna l'istante in cui finisce lo stallo in corso all'istante t
+	 * sul canale l, t se non e' in stallo. Lo stallo occupa la fine di
+	 * ogni periodo. */
+
+	double secs;
+	double phase;
+
+	if (l->l_stall_every <= 0)
+		return t;
+
+	secs = (t - EPOCH) / NS;
+	phase = fmod (secs, l->l_stall_every);
+	if (phase < l->l_stall_every - l->l_stall_len)
+		return t;
+	return EPOCH + (uint64_t)((secs - phase + l->l_stall_every) * NS);
+}
+
+
+static unsigned long
+take_records (struct flow *fl, uint32_t *next)
+{
+	/* Elabora i record completi in fl come take_records di mhbench, con
+	 * le latenze in tempo virtuale.
+	 * Ritorna il numero di record errati. */
+
+	unsigned long errors;
+
+	errors = 0;
+	for (;;) {
+		uint32_t hdr[4];
+		uint32_t len;
+		uint32_t num;
+		uint64_t sent;
+		int kind;
+		char *rec;
+
+		if (fl->f_len - fl->f_off < RECHDR)
+			break;
+		rec = fl->f_buf + fl->f_off;
+		memcpy (hdr, rec, RECHDR);
+		len = ntohl (hdr[0]);
+		num = ntohl (hdr[1]);
+		if (len < RECHDR || len > MAX (bulk_rec, int_size)) {
+			fprintf (stderr, "record %lu: lunghezza %lu\n",
+					(unsigned long)*next,
+					(unsigned long)len);
+			fl->f_off = fl->f_len;
+			return errors + 1;
+		}
+		if (fl->f_len - fl->f_off < len)
+			break;
+
+		sent = (uint64_t)ntohl (hdr[2]) << 32 | ntohl (hdr[3]);
+		kind = (num & RECINT ? 1 : 0);
+		if (nlat[kind] < maxlat[kind])
+			lat[kind][nlat[kind]++] = (now - sent) / NS;
+		if ((num & ~RECINT) != *next
+		    || (len > RECHDR && (rec[RECHDR] != (char)(num & 0xff)
+		                         || rec[len - 1] != (char)(num & 0xff))))
+			errors++;
+		*next = (num & ~RECINT) + 1;
+		fl->f_off += len;
+	}
+
+	memmove (fl->f_buf, fl->f_buf + fl->f_off, fl->f_len - fl->f_off);
+	fl->f_len -= fl->f_off;
+	fl->f_off = 0;
+	return errors;
+}
@@ -0,0 +1,339 @@
+#include "h/histo.h"
+#include "h/stats.h"
+#include "h/types.h"
+
+#include <config.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Nomi delle classi, nello stesso ordine degli indici. */
+static char *urg_names[URGNO] = { "prb", "nak", "crt", "ack", "dat" };
+static char *to_names[TMOUTS] = { "nak", "act", "ack", "prb" };
+static char *slab_names[SLABS] = { "segwrap", "timeout", "ctrl" };
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static int list_regions (void);
+static struct mhstats *open_region (char *pid);
+static void print_help (const char *program_name);
+static void print_stats (struct mhstats *st, struct mhstats *prev,
+		double interval);
+static void snapshot (struct mhstats *dst, struct mhstats *src);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	long count;
+	double interval;
+	char *endptr;
+	struct mhstats *region;
+	struct mhstats cur;
+	struct mhstats prev;
+
+	count = -1;
+	interval = 1;
+	while ((opt = getopt (argc, argv, "i:n:")) != -1) {
+		switch (opt) {
+		case 'i' :
+			interval = strtod (optarg, &endptr);
+			if (*endptr != '\0' || interval <= 0)
+				goto error;
+			break;
+		case 'n' :
+			count = strtol (optarg, &endptr, 10);
+			if (*endptr != '\0' || count <= 0)
+				goto error;
+			break;
+		default :
+			goto error;
+		}
+	}
+
+	if (optind == argc)
+		return list_regions ();
+	if (optind != argc - 1)
+		goto error;
+
+	region = open_region (argv[optind]);
+	if (region == NULL)
+		return EXIT_FAILURE;
+
+	snapshot (&prev, region);
+	while (count != 0) {
+		struct timeval tv;
+
+		tv.tv_sec = interval;
+		tv.tv_usec = (interval - tv.tv_sec) * 1000000;
+		select (0, NULL, NULL, NULL, &tv);
+
+		snapshot (&cur, region);
+		print_stats (&cur, &prev, interval);
+		prev = cur;
+		if (count > 0)
+			count--;
+	}
+	return EXIT_SUCCESS;
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static int
+list_regions (void)
+{
+	/* Elenca le regioni presenti in /dev/shm, segnalando quelle lasciate
+	 * da processi terminati. */
+
+	DIR *dir;
+	struct dirent *ent;
+	struct mhstats *region;
+
+	dir = opendir ("/dev/shm");
+	if (dir == NULL) {
+		perror ("/dev/shm");
+		return EXIT_FAILURE;
+	}
+
+	while ((ent = readdir (dir)) != NULL) {
+		if (strncmp (ent->d_name, STATS_PREFIX + 1,
+		             strlen (STATS_PREFIX) - 1) != 0)
+			continue;
+		region = open_region (ent->d_name + strlen (STATS_PREFIX) - 1);
+		if (region == NULL)
+			continue;
+		printf ("%-8s %s%s\n", ent->d_name + strlen (STATS_PREFIX) - 1,
+				region->st_name,
+				kill (STATS_GET (region->st_pid), 0) == 0
+				|| errno != ESRCH ? "" : " (terminato)");
+		munmap (region, sizeof (struct mhstats));
+	}
+	closedir (dir);
+	return EXIT_SUCCESS;
+}
+
+
+static struct mhstats *
+open_region (char *pid)
+{
+	fd_t fd;
+	char name[32];
+	struct mhstats *region;
+
+	if (strlen (pid) > 16) {
+		fprintf (stderr, "pid non valido: %s\n", pid);
+		return NULL;
+	}
+	sprintf (name, STATS_PREFIX "%s", pid);
+
+	fd = shm_open (name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf (stderr, "%s: %s\n", name, strerror (errno));
+		return NULL;
+	}
+	region = mmap (NULL, sizeof (struct mhstats), PROT_READ, MAP_SHARED,
+			fd, 0);
+	close (fd);
+	if (region == MAP_FAILED) {
+		fprintf (stderr, "%s: %s\n", name, strerror (errno));
+		return NULL;
+	}
+
+	if (__atomic_load_n (&region->st_magic, __ATOMIC_ACQUIRE)
+	    != STATS_MAGIC
+	    || STATS_GET (region->st_version) != STATS_VERSION) {
+		fprintf (stderr, "%s: regione non valida\n", name);
+		munmap (region, sizeof (struct mhstats));
+		return NULL;
+	}
+	return region;
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ -i secondi ] [ -n volte ] [ pid ]\n", program_name);
+	printf ("\n"
+"Senza pid elenca i proxy che espongono statistiche. Con pid stampa le\n"
+"statistiche del proxy ogni intervallo di secondi (predefinito 1), per il\n"
+"numero di volte indicato o fino all'interruzione.\n"
+		);
+}
+
+
+static void
+print_stats (struct mhstats *st, struct mhstats *prev, double interval)
+{
+	int i;
+	cd_t cd;
+
+	printf ("\n%s pid %lu, cicli %lu (%.0f/s), a vuoto in busy poll %lu "
+			"(%.0f/s)\n", st->st_name,
+			(unsigned long)st->st_pid,
+			(unsigned long)st->st_loops,
+			(st->st_loops - prev->st_loops) / interval,
+			(unsigned long)st->st_polls,
+			(st->st_polls - prev->st_polls) / interval);
+
+	printf ("%-6s %4s %12s %12s %10s %10s %8s %8s %6s %6s %6s %8s\n",
+			"canale", "conn", "byte in", "byte out",
+			"B/s in", "B/s out", "seg in", "seg out",
+			"nak in", "nakout", "ritr", "srtt ms");
+	for (cd = 0; cd < CHANNELS; cd++) {
+		struct chanstats *cs = &st->st_chan[cd];
+		struct chanstats *ps = &prev->st_chan[cd];
+		char label[8];
+
+		if (cd == HOSTCD)
+			strcpy (label, "host");
+		else
+			sprintf (label, "%d", cd);
+
+		printf ("%-6s %4lu %12lu %12lu %10.0f %10.0f %8lu %8lu "
+				"%6lu %6lu %6lu %8.3f\n",
+				label,
+				(unsigned long)cs->cs_connected,
+				(unsigned long)cs->cs_bytes_in,
+				(unsigned long)cs->cs_bytes_out,
+				(cs->cs_bytes_in - ps->cs_bytes_in) / interval,
+				(cs->cs_bytes_out - ps->cs_bytes_out)
+				/ interval,
+				(unsigned long)cs->cs_segs_in,
+				(unsigned long)cs->cs_segs_out,
+				(unsigned long)cs->cs_naks_in,
+				(unsigned long)cs->cs_naks_out,
+				(unsigned long)cs->cs_retrans,
+				cs->cs_srtt_us / 1000.0);
+	}
+
+	printf ("joinq %lu, scartati %lu\n",
+			(unsigned long)st->st_joinq,
+			(unsigned long)st->st_dups);
+	printf ("slab (in uso/liberi, arene, KiB, arene mappate/rilasciate)");
+	for (i = 0; i < SLABS; i++) {
+		struct slabstats *ss = &st->st_slab[i];
+
+		printf (" %s %lu/%lu %lu %lu %lu/%lu", slab_names[i],
+				(unsigned long)ss->ss_used,
+				(unsigned long)ss->ss_free,
+				(unsigned long)ss->ss_arenas,
+				(unsigned long)(ss->ss_bytes / 1024),
+				(unsigned long)ss->ss_maps,
+				(unsigned long)ss->ss_unmaps);
+	}
+	printf ("\nallocazioni del ciclo principale %lu (%lu byte)\n",
+			(unsigned long)st->st_allocs,
+			(unsigned long)st->st_alloc_bytes);
+
+	printf ("urgentq");
+	for (i = 0; i < URGNO; i++)
+		printf (" %s %lu", urg_names[i],
+				(unsigned long)st->st_urgentq[i]);
+	printf ("\ntimeout (attivi/scaduti)");
+	for (i = 0; i < TMOUTS; i++)
+		printf (" %s %lu/%lu", to_names[i],
+				(unsigned long)st->st_timers[i],
+				(unsigned long)st->st_fired[i]);
+	putchar ('\n');
+
+	/* Latenze, solo se il proxy e' stato avviato con -l. */
+	for (i = 0; i < HSTAGES && st->st_histo[i].h_count == 0; i++)
+		;
+	if (i < HSTAGES) {
+		printf ("%-16s %10s %10s %10s %10s %10s\n", "fase (ms)",
+				"campioni", "p50", "p99", "p999", "max");
+		for (i = 0; i < HSTAGES; i++)
+			if (st->st_histo[i].h_count > 0)
+				histo_print (stdout, &st->st_histo[i],
+						histo_stage_name (i));
+	}
+	fflush (stdout);
+}
+
+
+static void
+snapshot (struct mhstats *dst, struct mhstats *src)
+{
+	/* Copia src in dst campo per campo con load atomici, senza
+	 * disturbare il proxy. */
+
+	int i;
+	cd_t cd;
+
+	memcpy (dst->st_name, src->st_name, sizeof (dst->st_name));
+	dst->st_name[sizeof (dst->st_name) - 1] = '\0';
+	dst->st_pid = STATS_GET (src->st_pid);
+
+	for (cd = 0; cd < CHANNELS; cd++) {
+		struct chanstats *d = &dst->st_chan[cd];
+		struct chanstats *s = &src->st_chan[cd];
+
+		d->cs_bytes_in = STATS_GET (s->cs_bytes_in);
+		d->cs_bytes_out = STATS_GET (s->cs_bytes_out);
+		d->cs_segs_in = STATS_GET (s->cs_segs_in);
+		d->cs_segs_out = STATS_GET (s->cs_segs_out);
+		d->cs_naks_in = STATS_GET (s->cs_naks_in);
+		d->cs_naks_out = STATS_GET (s->cs_naks_out);
+		d->cs_retrans = STATS_GET (s->cs_retrans);
+		d->cs_srtt_us = STATS_GET (s->cs_srtt_us);
+		d->cs_connected = STATS_GET (s->cs_connected);
+	}
+
+	dst->st_dups = STATS_GET (src->st_dups);
+	dst->st_joinq = STATS_GET (src->st_joinq);
+	for (i = 0; i < URGNO; i++)
+		dst->st_urgentq[i] = STATS_GET (src->st_urgentq[i]);
+	for (i = 0; i < SLABS; i++) {
+		struct slabstats *d = &dst->st_slab[i];
+		struct slabstats *s = &src->st_slab[i];
+
+		d->ss_used = STATS_GET (s->ss_used);
+		d->ss_free = STATS_GET (s->ss_free);
+		d->ss_arenas = STATS_GET (s->ss_arenas);
+		d->ss_bytes = STATS_GET (s->ss_bytes);
+		d->ss_maps = STATS_GET (s->ss_maps);
+		d->ss_unmaps = STATS_GET (s->ss_unmaps);
+	}
+	for (i = 0; i < TMOUTS; i++) {
+		dst->st_timers[i] = STATS_GET (src->st_timers[i]);
+		dst->st_fired[i] = STATS_GET (src->st_fired[i]);
+	}
+	dst->st_loops = STATS_GET (src->st_loops);
+	dst->st_polls = STATS_GET (src->st_polls);
+	dst->st_allocs = STATS_GET (src->st_allocs);
+	dst->st_alloc_bytes = STATS_GET (src->st_alloc_bytes);
+	for (i = 0; i < HSTAGES; i++) {
+		int j;
+		struct histo *d = &dst->st_histo[i];
+		struct histo *s = &src->st_histo[i];
+
+		for (j = 0; j < HISTO_BUCKETS; j++)
+			d->h_bucket[j] = STATS_GET (s->h_bucket[j]);
+		d->h_max = STATS_GET (s->h_max);
+		d->h_count = STATS_GET (s->h_count);
+	}
+}
@@ -0,0 +1,471 @@
+#include "h/types.h"
+
+#include <config.h>
+#include <string.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Al massimo tanti file di traccia, tipicamente psend e precv. */
+#define     MAXFILES     8
+
+/* Nomi degli eventi, nello stesso ordine dei TR_*. */
+static char *ev_names[TRTYPES] = {
+	"creato", "urgentq", "accodato", "spedito", "ricevuto", "duplicato",
+	"nak generato", "ritrasmesso", "consegnato", "ack"
+};
+
+/* Un evento letto da file. */
+struct rec {
+	struct trace_event r_ev;
+	int r_file;
+	size_t r_idx;       /* Posizione nel file, per un ordinamento stabile. */
+	bool r_dup;         /* Ricezione scartata come duplicato. */
+	long r_life;        /* Vita del segmento a cui appartiene, -1 nessuna. */
+	long r_next;        /* Evento successivo della stessa vita. */
+};
+
+/* Vita di un segmento: dalla creazione (o dal primo evento visto) alla
+ * consegna. */
+struct life {
+	seq_t l_seq;
+	long l_first;
+	long l_last;
+	bool l_delivered;
+};
+
+/* Contatori per canale. */
+struct chanrec {
+	unsigned long c_sent;
+	unsigned long c_crt;
+	unsigned long c_recv;
+	unsigned long c_late;
+	unsigned long c_displ;
+	unsigned long c_maxdispl;
+	unsigned long c_dups;
+	unsigned long c_naks;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static struct trace_header headers[MAXFILES];
+static char *paths[MAXFILES];
+static int nfiles;
+
+static struct rec *recs;
+static size_t nrecs;
+
+static struct life *lives;
+static size_t nlives;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void build_lives (void);
+static int load_file (char *path);
+static void mark_dups (size_t from, size_t to);
+static long new_life (seq_t seq, long first);
+static void print_help (const char *program_name);
+static void print_life (struct life *l);
+static void print_summary (void);
+static int reccmp (const void *a, const void *b);
+static int seqcmp (seq_t a, seq_t b);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	long only;
+	bool timelines;
+	size_t i;
+	char *endptr;
+
+	only = -1;
+	timelines = FALSE;
+	while ((opt = getopt (argc, argv, "s:t")) != -1) {
+		switch (opt) {
+		case 's' :
+			only = strtol (optarg, &endptr, 10);
+			if (*endptr != '\0' || only < 0 || only > SEQMAX)
+				goto error;
+			timelines = TRUE;
+			break;
+		case 't' :
+			timelines = TRUE;
+			break;
+		default :
+			goto error;
+		}
+	}
+
+	if (optind == argc || argc - optind > MAXFILES)
+		goto error;
+
+	for (; optind < argc; optind++)
+		if (load_file (argv[optind]))
+			return EXIT_FAILURE;
+
+	/* Gli eventi di file diversi sono confrontabili perche' usano lo
+	 * stesso CLOCK_MONOTONIC, se i proxy girano sulla stessa macchina. */
+	qsort (recs, nrecs, sizeof (struct rec), reccmp);
+	build_lives ();
+
+	if (!timelines) {
+		print_summary ();
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 0; i < nlives; i++)
+		if (only < 0 || lives[i].l_seq == only)
+			print_life (&lives[i]);
+	return EXIT_SUCCESS;
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+build_lives (void)
+{
+	/* Assegna gli eventi alle vite dei segmenti. Se nelle tracce c'e' il
+	 * Sender una vita inizia con la creazione, altrimenti con il primo
+	 * evento di un seqnum non ancora consegnato. Sonde ed echi non
+	 * appartengono a nessuna vita. */
+
+	size_t i;
+	long cur[SEQMAX + 1];
+	bool has_create;
+
+	has_create = FALSE;
+	for (i = 0; i < nrecs; i++)
+		if (recs[i].r_ev.te_type == TR_CREATE)
+			has_create = TRUE;
+
+	for (i = 0; i <= SEQMAX; i++)
+		cur[i] = -1;
+
+	for (i = 0; i < nrecs; i++) {
+		struct rec *r = &recs[i];
+		seq_t seq = r->r_ev.te_seq;
+		long id;
+
+		r->r_life = -1;
+		r->r_next = -1;
+		if (r->r_ev.te_flags & (PRBFLAG | ECHFLAG))
+			continue;
+
+		if (r->r_ev.te_type == TR_CREATE)
+			cur[seq] = new_life (seq, i);
+		else if (!has_create
+		         && r->r_ev.te_type != TR_ACK && !r->r_dup
+		         && (cur[seq] < 0 || lives[cur[seq]].l_delivered))
+			cur[seq] = new_life (seq, i);
+		else if (cur[seq] < 0)
+			continue;
+
+		id = cur[seq];
+		r->r_life = id;
+		if (lives[id].l_first != (long)i)
+			recs[lives[id].l_last].r_next = i;
+		lives[id].l_last = i;
+		if (r->r_ev.te_type == TR_DELIVER)
+			lives[id].l_delivered = TRUE;
+	}
+}
+
+
+static int
+load_file (char *path)
+{
+	/* Legge la traccia in path e ne accoda gli eventi a recs.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	FILE *f;
+	size_t first;
+	size_t alloc;
+	struct trace_event ev;
+	struct trace_header *th;
+
+	f = fopen (path, "rb");
+	if (f == NULL) {
+		fprintf (stderr, "%s: %s\n", path, strerror (errno));
+		return -1;
+	}
+
+	th = &headers[nfiles];
+	if (fread (th, sizeof (*th), 1, f) != 1
+	    || th->th_magic != TRACE_MAGIC
+	    || th->th_version != TRACE_VERSION
+	    || th->th_evsize != sizeof (struct trace_event)) {
+		fprintf (stderr, "%s: traccia non valida\n", path);
+		fclose (f);
+		return -1;
+	}
+	th->th_name[sizeof (th->th_name) - 1] = '\0';
+	paths[nfiles] = path;
+
+	first = nrecs;
+	alloc = nrecs;
+	while (fread (&ev, sizeof (ev), 1, f) == 1) {
+		if (nrecs == alloc) {
+			alloc = (alloc == 0 ? TRACE_EVENTS : alloc * 2);
+			recs = realloc (recs, alloc * sizeof (struct rec));
+			if (recs == NULL) {
+				perror ("realloc");
+				exit (EXIT_FAILURE);
+			}
+		}
+		recs[nrecs].r_ev = ev;
+		recs[nrecs].r_file = nfiles;
+		recs[nrecs].r_idx = nrecs - first;
+		recs[nrecs].r_dup = FALSE;
+		nrecs++;
+	}
+	fclose (f);
+
+	mark_dups (first, nrecs);
+	nfiles++;
+	return 0;
+}
+
+
+static void
+mark_dups (size_t from, size_t to)
+{
+	/* Un duplicato viene scartato subito dopo la ricezione: la
+	 * ricezione che precede un TR_DUP dello stesso seqnum e' marcata,
+	 * cosi' resta attribuita al suo canale. */
+
+	size_t i;
+
+	for (i = from + 1; i < to; i++)
+		if (recs[i].r_ev.te_type == TR_DUP
+		    && recs[i - 1].r_ev.te_type == TR_RECV
+		    && recs[i - 1].r_ev.te_seq == recs[i].r_ev.te_seq)
+			recs[i - 1].r_dup = TRUE;
+}
+
+
+static long
+new_life (seq_t seq, long first)
+{
+	static size_t alloc;
+
+	if (nlives == alloc) {
+		alloc = (alloc == 0 ? SEQMAX + 1 : alloc * 2);
+		lives = realloc (lives, alloc * sizeof (struct life));
+		if (lives == NULL) {
+			perror ("realloc");
+			exit (EXIT_FAILURE);
+		}
+	}
+	lives[nlives].l_seq = seq;
+	lives[nlives].l_first = first;
+	lives[nlives].l_last = first;
+	lives[nlives].l_delivered = FALSE;
+	return nlives++;
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ -t | -s seqnum ] traccia...\n", program_name);
+	printf ("\n"
+"Analizza le tracce scritte dai proxy con l'opzione -T. Senza opzioni\n"
+"stampa un riepilogo degli eventi e il riordinamento per canale; con -t\n"
+"la storia di ogni segmento, con -s solo quella dei segmenti con il\n"
+"seqnum indicato.\n"
+		);
+}
+
+
+static void
+print_life (struct life *l)
+{
+	long i;
+	uint64_t start;
+
+	start = recs[l->l_first].r_ev.te_time;
+	printf ("seq %u\n", (unsigned)l->l_seq);
+	for (i = l->l_first; i >= 0; i = recs[i].r_next) {
+		struct trace_event *ev = &recs[i].r_ev;
+
+		printf ("  %10.3f ms  %-8s %-12s", (ev->te_time - start) / 1e6,
+				headers[recs[i].r_file].th_name,
+				ev_names[ev->te_type]);
+		if (ev->te_cd >= 0)
+			printf (" canale %d", ev->te_cd);
+		if (ev->te_flags & NAKFLAG)
+			printf (" nak");
+		if (ev->te_flags & CRTFLAG)
+			printf (" critico");
+		if (recs[i].r_dup)
+			printf (" duplicato");
+		putchar ('\n');
+	}
+}
+
+
+static void
+print_summary (void)
+{
+	int f;
+	int t;
+	cd_t cd;
+	size_t i;
+	unsigned long count[TRTYPES];
+	unsigned long nlat;
+	double lat;
+	double maxlat;
+	struct chanrec ch[MAXFILES][NETCHANNELS];
+
+	memset (ch, 0, sizeof (ch));
+	memset (count, 0, sizeof (count));
+
+	for (f = 0; f < nfiles; f++) {
+		seq_t maxseen = 0;
+		bool seen = FALSE;
+		cd_t lastcd = -1;
+
+		for (i = 0; i < nrecs; i++) {
+			struct trace_event *ev = &recs[i].r_ev;
+			struct chanrec *c;
+
+			if (recs[i].r_file != f)
+				continue;
+			count[ev->te_type]++;
+			if (ev->te_type == TR_DUP && lastcd >= 0)
+				ch[f][lastcd].c_dups++;
+			if (ev->te_cd < 0 || ev->te_cd >= NETCHANNELS)
+				continue;
+
+			c = &ch[f][ev->te_cd];
+			if (ev->te_type == TR_SENT
+			    && (ev->te_flags & PLDFLAG)) {
+				c->c_sent++;
+				if (ev->te_flags & CRTFLAG)
+					c->c_crt++;
+			}
+			if (ev->te_type != TR_RECV)
+				continue;
+			if (ev->te_flags & NAKFLAG)
+				c->c_naks++;
+			if (!(ev->te_flags & PLDFLAG))
+				continue;
+
+			/* Riordinamento: quanto il segmento arriva dietro al
+			 * seqnum piu' avanzato gia' ricevuto. */
+			lastcd = ev->te_cd;
+			c->c_recv++;
+			if (recs[i].r_dup)
+				continue;
+			if (seen && seqcmp (ev->te_seq, maxseen) < 0) {
+				seq_t displ = maxseen - ev->te_seq;
+				c->c_late++;
+				c->c_displ += displ;
+				if (displ > c->c_maxdispl)
+					c->c_maxdispl = displ;
+			} else
+				maxseen = ev->te_seq;
+			seen = TRUE;
+		}
+	}
+
+	/* Latenza dalla creazione alla consegna, solo se le tracce dei due
+	 * proxy sono state unite. */
+	nlat = 0;
+	lat = maxlat = 0;
+	for (i = 0; i < nlives; i++) {
+		struct rec *first = &recs[lives[i].l_first];
+		struct rec *last = &recs[lives[i].l_last];
+		long j;
+
+		if (first->r_ev.te_type != TR_CREATE || !lives[i].l_delivered)
+			continue;
+		for (j = lives[i].l_first; j >= 0; j = recs[j].r_next)
+			if (recs[j].r_ev.te_type == TR_DELIVER)
+				last = &recs[j];
+		nlat++;
+		lat += (last->r_ev.te_time - first->r_ev.te_time) / 1e6;
+		if ((last->r_ev.te_time - first->r_ev.te_time) / 1e6 > maxlat)
+			maxlat = (last->r_ev.te_time - first->r_ev.te_time)
+				/ 1e6;
+	}
+
+	for (f = 0; f < nfiles; f++)
+		printf ("%s: %s pid %lu\n", paths[f], headers[f].th_name,
+				(unsigned long)headers[f].th_pid);
+	printf ("%lu eventi, %lu segmenti\n", (unsigned long)nrecs,
+			(unsigned long)nlives);
+	for (t = 0; t < TRTYPES; t++)
+		printf ("  %-12s %10lu\n", ev_names[t], count[t]);
+	if (nlat > 0)
+		printf ("creato-consegnato: %lu segmenti, media %.3f ms, "
+				"max %.3f ms\n", nlat, lat / nlat, maxlat);
+
+	printf ("\n%-8s %6s %8s %8s %8s %8s %8s %8s %8s %6s\n", "proxy",
+			"canale", "spediti", "critici", "ricevuti",
+			"ritardo", "spost", "max", "dup", "nak");
+	for (f = 0; f < nfiles; f++)
+		for (cd = 0; cd < NETCHANNELS; cd++) {
+			struct chanrec *c = &ch[f][cd];
+
+			printf ("%-8s %6d %8lu %8lu %8lu %8lu %8.2f %8lu "
+					"%8lu %6lu\n",
+					headers[f].th_name, cd,
+					c->c_sent, c->c_crt, c->c_recv,
+					c->c_late,
+					c->c_late > 0 ? (double)c->c_displ
+					                / c->c_late : 0.0,
+					c->c_maxdispl, c->c_dups, c->c_naks);
+		}
+}
+
+
+static int
+reccmp (const void *a, const void *b)
+{
+	const struct rec *ra = a;
+	const struct rec *rb = b;
+
+	if (ra->r_ev.te_time != rb->r_ev.te_time)
+		return (ra->r_ev.te_time < rb->r_ev.te_time ? -1 : 1);
+	if (ra->r_file != rb->r_file)
+		return ra->r_file - rb->r_file;
+	return (ra->r_idx < rb->r_idx ? -1 : ra->r_idx > rb->r_idx);
+}
+
+
+static int
+seqcmp (seq_t a, seq_t b)
+{
+	/* Come seqcmp di segment.c. */
+
+	if (a == b)
+		return 0;
+
+	if ((a < b && (b - a) > (SEQMAX / 2))
+	     || (a > b && (a - b) < (SEQMAX / 2)))
+		return 1;
+
+	return -1;
+}
@@ -0,0 +1,198 @@
+#include "h/multihoming.h"
+#include "h/channel.h"
+#include "h/core.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <string.h>
+
+
+/*******************************************************************************
+				  Strutture
+*******************************************************************************/
+
+/*
+ * Un proxy con l'host nello stesso processo e il thread che ne esegue il
+ * ciclo principale.
+ */
+struct mh {
+	proxy_t *mh_px;
+	bool mh_sender;
+	pthread_t mh_thread;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/*
+ * Valori di default, gli stessi di psend e precv.
+ */
+
+static char* netconnaddr_def[NETCHANNELS] = {
+	"127.0.0.1",
+	"127.0.0.1",
+	"127.0.0.1"
+};
+
+static port_t netconnport_def[NETCHANNELS] = {
+	7001,
+	7002,
+	7003
+};
+
+static port_t netlistport_def[NETCHANNELS] = {
+	8001,
+	8002,
+	8003
+};
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void *run_core (void *arg);
+static mh_t *start (proxy_t *px, bool sender);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+void
+mh_close (mh_t *mh)
+{
+	assert (mh != NULL);
+
+	proxy_stop (mh->mh_px);
+	pthread_join (mh->mh_thread, NULL);
+	proxy_destroy (mh->mh_px);
+	xfree (mh);
+}
+
+
+int
+mh_fd (mh_t *mh)
+{
+	assert (mh != NULL);
+	return channel_host_readyfd (mh->mh_px);
+}
+
+
+mh_t *
+mh_open_receiver (unsigned short netlistport[MH_CHANNELS])
+{
+	int err;
+	cd_t cd;
+	proxy_t *px;
+	port_t listport[NETCHANNELS];
+
+	for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++)
+		listport[cd] = (netlistport != NULL ? netlistport[cd]
+		                                    : netlistport_def[cd]);
+
+	px = proxy_create ();
+	channel_set_host_local (px, FALSE);
+	err = proxy_init (px, 0, NULL, NULL, listport, NULL, 0);
+	if (err) {
+		proxy_destroy (px);
+		return NULL;
+	}
+	return start (px, FALSE);
+}
+
+
+mh_t *
+mh_open_sender (char *netconnaddr[MH_CHANNELS],
+		unsigned short netconnport[MH_CHANNELS])
+{
+	int err;
+	cd_t cd;
+	proxy_t *px;
+	char *connaddr[NETCHANNELS];
+	port_t connport[NETCHANNELS];
+
+	for (cd = NETCD; cd < NETCD + NETCHANNELS; cd++) {
+		connaddr[cd] = (netconnaddr != NULL ? netconnaddr[cd]
+		                                    : netconnaddr_def[cd]);
+		connport[cd] = (netconnport != NULL ? netconnport[cd]
+		                                    : netconnport_def[cd]);
+	}
+
+	px = proxy_create ();
+	channel_set_host_local (px, TRUE);
+	err = proxy_init (px, 0, connaddr, connport, NULL, NULL, 0);
+	if (err) {
+		proxy_destroy (px);
+		return NULL;
+	}
+	return start (px, TRUE);
+}
+
+
+ssize_t
+mh_recv (mh_t *mh, void *buf, size_t len)
+{
+	assert (mh != NULL);
+	assert (buf != NULL);
+
+	if (mh->mh_sender) {
+		errno = EINVAL;
+		return -1;
+	}
+	return channel_host_get (mh->mh_px, (seg_t *) buf, len);
+}
+
+
+ssize_t
+mh_send (mh_t *mh, const void *buf, size_t len)
+{
+	assert (mh != NULL);
+	assert (buf != NULL);
+
+	if (!mh->mh_sender) {
+		errno = EINVAL;
+		return -1;
+	}
+	return channel_host_put (mh->mh_px, (seg_t *) buf, len);
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void *
+run_core (void *arg)
+{
+	core ((proxy_t *) arg);
+	return NULL;
+}
+
+
+static mh_t *
+start (proxy_t *px, bool sender)
+{
+	/* Lancia il ciclo principale di px in un thread.
+	 * Ritorna NULL, con errno impostato, se fallisce. */
+
+	int err;
+	mh_t *mh;
+
+	mh = xmalloc (sizeof (mh_t));
+	mh->mh_px = px;
+	mh->mh_sender = sender;
+
+	err = pthread_create (&mh->mh_thread, NULL, run_core, px);
+	if (err) {
+		fprintf (stderr, "pthread_create: %s\n", strerror (err));
+		proxy_destroy (px);
+		xfree (mh);
+		errno = err;
+		return NULL;
+	}
+	return mh;
+}
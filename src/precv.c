@@ -1,6 +1,8 @@
 #include "h/core.h"
 #include "h/channel.h"
 #include "h/getargs.h"
+#include "h/sim.h"
+#include "h/stats.h"
 #include "h/util.h"
 #include "h/types.h"
 
@@ -32,7 +34,8 @@ static port_t hostconnport = 9001;
 *******************************************************************************/
 
 static int
-get_precv_args (int argc, char **argv, port_t netlistport[NETCHANNELS],
+get_precv_args (proxy_t *px, int argc, char **argv,
+		port_t netlistport[NETCHANNELS],
 		char **hostconnaddr, port_t *hostconnport);
 static void print_help (const char *);
 
@@ -46,13 +49,18 @@ main (int argc, char **argv)
 {
 	int err;
 	cd_t cd;
+	proxy_t *px;
 
-	err = get_precv_args (argc, argv,
+	px = proxy_create ();
+	err = get_precv_args (px, argc, argv,
 			netlistport, &hostconnaddr, &hostconnport);
 	if (err)
 		goto error;
 
-	err = proxy_init (0, NULL, NULL,
+	stats_init (argv[0]);
+	sim_init ();
+
+	err = proxy_init (px, 0, NULL, NULL,
 			netlistport, hostconnaddr, hostconnport);
 	if (err)
 		goto error;
@@ -60,11 +68,13 @@ main (int argc, char **argv)
 	/* Stampa informazioni. */
 	for (cd = NETCD; cd < NETCHANNELS; cd++) {
 		printf ("Canale %d con il Ritardatore: %s\n",
-		         cd, channel_name (cd));
+		         cd, channel_name (px, cd));
 	}
-	printf ("Canale con il Receiver: %s\n", channel_name (HOSTCD));
+	printf ("Canale con il Receiver: %s\n", channel_name (px, HOSTCD));
+	if (stats_region_name () != NULL)
+		printf ("Statistiche: %s\n", stats_region_name ());
 
-	return core ();
+	return core (px);
 
 error:
 	print_help (argv[0]);
@@ -77,11 +87,19 @@ error:
 *******************************************************************************/
 
 static int
-get_precv_args (int argc, char **argv, port_t netlistport[NETCHANNELS],
+get_precv_args (proxy_t *px, int argc, char **argv,
+		port_t netlistport[NETCHANNELS],
 		char **hostconnaddr, port_t *hostconnport)
 {
-	/* TODO get_precv_args */
-	return 0;
+	int argi;
+
+	argi = getopts_proxy (px, argc, argv);
+	if (argi < 0)
+		return -1;
+
+	return getargs (argc - argi, argv + argi, "pppap",
+			&netlistport[0], &netlistport[1], &netlistport[2],
+			hostconnaddr, hostconnport);
 }
 
 
@@ -89,7 +107,8 @@ static void
 print_help (const char *program_name)
 {
 	printf (
-"%s [[[[[ porta_locale ] porta_locale ] porta_locale ] ip ] porta ]\n",
+"%s [ opzioni ] [[[[[ porta_locale ] porta_locale ] porta_locale ] ip ]\n"
+"    porta ]\n",
 	        program_name);
 	printf ("\n"
 "Attende una connessione dal Ritardatore su una delle porte locali e si\n"
@@ -97,4 +116,5 @@ print_help (const char *program_name)
 "un argomento non viene specificato oppure e' -, viene usato il valore\n"
 "predefinito.\n"
 		);
+	print_options_help ();
 }
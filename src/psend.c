@@ -1,6 +1,8 @@
 #include "h/core.h"
 #include "h/channel.h"
 #include "h/getargs.h"
+#include "h/sim.h"
+#include "h/stats.h"
 #include "h/util.h"
 #include "h/types.h"
 
@@ -38,7 +40,7 @@ static port_t hostlistport = 6001;
 *******************************************************************************/
 
 static int
-get_psend_args (int argc, char **argv,
+get_psend_args (proxy_t *px, int argc, char **argv,
 		port_t *hostlistport,
 		char *netconnaddr[NETCHANNELS],
 		port_t netconnport[NETCHANNELS]);
@@ -54,25 +56,32 @@ main (int argc, char **argv)
 {
 	int err;
 	cd_t cd;
+	proxy_t *px;
 
-	err = get_psend_args (argc, argv,
+	px = proxy_create ();
+	err = get_psend_args (px, argc, argv,
 			&hostlistport, netconnaddr, netconnport);
 	if (err)
 		goto error;
 
-	err = proxy_init (hostlistport, netconnaddr, netconnport,
+	stats_init (argv[0]);
+	sim_init ();
+
+	err = proxy_init (px, hostlistport, netconnaddr, netconnport,
 			NULL, NULL, 0);
 	if (err)
 		goto error;
 
 	/* Stampa informazioni. */
-	printf ("Canale con il Sender: %s\n", channel_name (HOSTCD));
+	printf ("Canale con il Sender: %s\n", channel_name (px, HOSTCD));
 	for (cd = NETCD; cd < NETCHANNELS; cd++) {
 		printf ("Canale %d con il Ritardatore: %s\n", cd,
-				channel_name (cd));
+				channel_name (px, cd));
 	}
+	if (stats_region_name () != NULL)
+		printf ("Statistiche: %s\n", stats_region_name ());
 
-	return core ();
+	return core (px);
 
 error:
 	print_help (argv[0]);
@@ -85,25 +94,34 @@ error:
 *******************************************************************************/
 
 static int
-get_psend_args (int argc, char **argv,
+get_psend_args (proxy_t *px, int argc, char **argv,
 		port_t *hostlistport,
 		char *netconnaddr[NETCHANNELS],
 		port_t netconnport[NETCHANNELS])
 {
-	/* TODO get_psend_args */
-	return 0;
+	int argi;
+
+	argi = getopts_proxy (px, argc, argv);
+	if (argi < 0)
+		return -1;
+
+	return getargs (argc - argi, argv + argi, "papapap", hostlistport,
+			&netconnaddr[0], &netconnport[0],
+			&netconnaddr[1], &netconnport[1],
+			&netconnaddr[2], &netconnport[2]);
 }
 
 
 static void
 print_help (const char *program_name)
 {
-	printf ("%s [[[ porta_locale ] ip ] porta ] ...\n",
+	printf ("%s [ opzioni ] [[[ porta_locale ] ip ] porta ] ...\n",
 	        program_name);
 	printf ("\n"
 "Attende la connessione dal Sender su porta_locale e si connette al\n"
-"Ritardatore, che deve essere in ascolto sugli indirizzi ip:porta. Se un\n"
-"un argomento non viene specificato oppure e' -, viene usato il valore\n"
-"predefinito.\n"
+"Ritardatore, che deve essere in ascolto sugli indirizzi ip:porta, una\n"
+"coppia per ciascuno dei tre canali. Se un argomento non viene specificato\n"
+"oppure e' -, viene usato il valore predefinito.\n"
 		);
+	print_options_help ();
 }
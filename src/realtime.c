@@ -0,0 +1,193 @@
+#include "h/realtime.h"
+#include "h/stats.h"
+#include "h/types.h"
+
+#include <config.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef LINUX_OS
+#include <malloc.h>
+#endif
+
+
+/*******************************************************************************
+				    Macro
+*******************************************************************************/
+
+/* Stack scritto da realtime_start perche' il ciclo principale lo trovi gia'
+ * mappato. */
+#define     STACK_PREFAULT     (64 * 1024)
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Impostazioni di realtime_start: cpu negativa e priorita' nulla le
+ * lasciano come sono. */
+static bool rt_enabled = FALSE;
+static int rt_cpu = -1;
+static int rt_prio = 0;
+
+/* Le impostazioni del processo si applicano al primo proxy che parte. */
+static pthread_once_t rt_once = PTHREAD_ONCE_INIT;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void lock_process (void);
+static void prefault_stack (void);
+static void print_footprint (void);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+void
+realtime_enable (void)
+{
+	rt_enabled = TRUE;
+}
+
+
+void
+realtime_set_cpu (int cpu)
+{
+	assert (cpu >= 0);
+
+	rt_cpu = cpu;
+	rt_enabled = TRUE;
+}
+
+
+void
+realtime_set_priority (int prio)
+{
+	assert (prio > 0);
+
+	rt_prio = prio;
+	rt_enabled = TRUE;
+}
+
+
+void
+realtime_start (void)
+{
+	/* Il blocco della memoria vale per tutto il processo e si fa una
+	 * volta sola, lo stack e la schedulazione sono del thread
+	 * chiamante. */
+
+	if (!rt_enabled)
+		return;
+
+	pthread_once (&rt_once, lock_process);
+	prefault_stack ();
+
+	if (rt_cpu >= 0) {
+#ifdef CPU_SET
+		cpu_set_t set;
+
+		CPU_ZERO (&set);
+		CPU_SET (rt_cpu, &set);
+		if (sched_setaffinity (0, sizeof (set), &set))
+			fprintf (stderr, "sched_setaffinity, cpu %d: %s.\n",
+					rt_cpu, strerror (errno));
+#else
+		fprintf (stderr, "cpu %d ignorata: sched_setaffinity non "
+				"disponibile.\n", rt_cpu);
+#endif
+	}
+
+	if (rt_prio > 0) {
+		int err;
+		struct sched_param sp;
+
+		memset (&sp, 0, sizeof (sp));
+		sp.sched_priority = rt_prio;
+		err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &sp);
+		if (err)
+			fprintf (stderr, "SCHED_FIFO, priorita' %d: %s.\n",
+					rt_prio, strerror (err));
+	}
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+lock_process (void)
+{
+	/* Le slab del primo proxy sono gia' riservate da proxy_init:
+	 * mlockall ne mappa le arene e, con MCL_FUTURE, mappa alla creazione
+	 * anche quelle dei proxy successivi, i buffer dei canali e l'heap che
+	 * verranno. malloc non restituisce piu' memoria al sistema, che
+	 * andrebbe poi rimappata. */
+
+#ifdef M_TRIM_THRESHOLD
+	mallopt (M_TRIM_THRESHOLD, -1);
+	mallopt (M_MMAP_MAX, 0);
+#endif
+	if (mlockall (MCL_CURRENT | MCL_FUTURE))
+		fprintf (stderr, "mlockall: %s, memoria non bloccata.\n",
+				strerror (errno));
+	print_footprint ();
+}
+
+
+static void
+prefault_stack (void)
+{
+	/* Scrive una pagina alla volta STACK_PREFAULT byte di stack oltre
+	 * quello in uso. */
+
+	volatile char stack[STACK_PREFAULT];
+	size_t page;
+	size_t i;
+
+	page = sysconf (_SC_PAGESIZE);
+	for (i = 0; i < sizeof (stack); i += page)
+		stack[i] = 0;
+}
+
+
+static void
+print_footprint (void)
+{
+	/* Stampa la memoria residente e bloccata del processo, dove il
+	 * sistema la espone in /proc, e quella mappata dalle slab. */
+
+	int i;
+	FILE *fp;
+	char line[128];
+	unsigned long rss;
+	unsigned long lck;
+	uint64_t slab;
+
+	slab = 0;
+	for (i = 0; i < SLABS; i++)
+		slab += mh_stats->st_slab[i].ss_bytes;
+
+	fp = fopen ("/proc/self/status", "r");
+	if (fp == NULL) {
+		printf ("Memoria: slab %lu KiB.\n",
+				(unsigned long)(slab / 1024));
+		return;
+	}
+
+	rss = 0;
+	lck = 0;
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		sscanf (line, "VmRSS: %lu", &rss);
+		sscanf (line, "VmLck: %lu", &lck);
+	}
+	fclose (fp);
+
+	printf ("Memoria: residente %lu KiB, bloccata %lu KiB, slab %lu "
+			"KiB.\n", rss, lck, (unsigned long)(slab / 1024));
+}
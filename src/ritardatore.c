@@ -0,0 +1,732 @@
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+/*******************************************************************************
+				 Definizioni
+*******************************************************************************/
+
+/* Byte letti in una volta e byte in attesa per direzione: oltre il limite si
+ * smette di leggere e il TCP del mittente rallenta. */
+#define     CHUNKMAX     16384
+#define     QUEUEMAX     (256 * 1024)
+
+/* Direzioni di un canale. */
+#define     DIRS         2
+#define     FWD          0     /* Da psend a precv. */
+#define     REV          1     /* Da precv a psend. */
+
+/* Nanosecondi. */
+#define     NS           1000000000.0
+
+/* Dati letti da una parte e in attesa di essere scritti dall'altra. */
+struct chunk {
+	struct chunk *c_next;
+	uint64_t c_release;
+	size_t c_len;
+	size_t c_off;
+	char *c_data;
+};
+
+/* Una direzione di un canale. */
+struct pipe {
+	struct chunk *p_head;
+	struct chunk *p_tail;
+	size_t p_queued;
+	uint64_t p_link_free;
+	uint64_t p_last_release;
+};
+
+/* Un canale emulato e i suoi disturbi. */
+struct link {
+	fd_t l_listfd;
+	fd_t l_fd[DIRS];          /* Lato psend e lato precv. */
+	struct pipe l_pipe[DIRS];
+
+	double l_delay;           /* Secondi. */
+	double l_jitter;          /* Secondi, uniforme in [-jitter, jitter]. */
+	double l_rate;            /* Byte al secondo, 0 illimitata. */
+	double l_stall_every;     /* Secondi tra l'inizio di due stalli. */
+	double l_stall_len;       /* Secondi di ogni stallo. */
+	bool l_stalled;           /* Stallo imposto dalla schedule. */
+};
+
+/* Riga della schedule: da l'istante s_time il canale s_cd ha i valori
+ * indicati. */
+struct sched {
+	double s_time;
+	int s_cd;
+	double s_delay;
+	double s_jitter;
+	double s_rate;
+	bool s_stalled;
+};
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+static struct link links[NETCHANNELS];
+
+static char *connaddr = "127.0.0.1";
+static port_t listport = 7001;
+static port_t connport = 8001;
+
+static struct sched *sched;
+static size_t nsched;
+static size_t nextsched;
+
+static uint64_t start;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void accept_link (int cd);
+static void apply_schedule (uint64_t now);
+static uint64_t clock_now (void);
+static void close_link (int cd);
+static int listen_link (int cd);
+static void link_socket_setup (fd_t fd);
+static int make_addr (struct sockaddr_in *addr, char *ip, int port);
+static int load_schedule (char *path);
+static int parse_chan (char *arg, int *first, int *last, char **rest);
+static int parse_option (int opt, char *arg);
+static void pipe_read (int cd, int dir, uint64_t now);
+static void pipe_write (int cd, int dir, uint64_t now);
+static void print_help (const char *program_name);
+static uint64_t stall_end (struct link *l, uint64_t now);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+main (int argc, char **argv)
+{
+	int opt;
+	int cd;
+	int dir;
+	unsigned seed;
+	char *endptr;
+
+	for (cd = 0; cd < NETCHANNELS; cd++) {
+		links[cd].l_listfd = -1;
+		links[cd].l_fd[FWD] = -1;
+		links[cd].l_fd[REV] = -1;
+	}
+
+	seed = 1;
+	while ((opt = getopt (argc, argv, "a:c:d:f:j:l:r:s:S:")) != -1) {
+		switch (opt) {
+		case 'S' :
+			seed = strtoul (optarg, &endptr, 10);
+			if (*endptr != '\0')
+				goto error;
+			break;
+		case 'f' :
+			if (load_schedule (optarg))
+				return EXIT_FAILURE;
+			break;
+		case '?' :
+			goto error;
+		default :
+			if (parse_option (opt, optarg))
+				goto error;
+		}
+	}
+	if (optind != argc)
+		goto error;
+
+	srand (seed);
+	signal (SIGPIPE, SIG_IGN);
+
+	for (cd = 0; cd < NETCHANNELS; cd++)
+		if (listen_link (cd))
+			return EXIT_FAILURE;
+
+	start = clock_now ();
+	for (;;) {
+		int maxfd;
+		int rdy;
+		uint64_t now;
+		uint64_t wake;
+		fd_set rdset;
+		fd_set wrset;
+		struct timeval tv;
+
+		now = clock_now ();
+		apply_schedule (now);
+
+		/* Scadenza piu' vicina: prossima riga della schedule, dati da
+		 * rilasciare o fine di uno stallo. */
+		wake = (nextsched < nsched ?
+		        start + sched[nextsched].s_time * NS : 0);
+
+		FD_ZERO (&rdset);
+		FD_ZERO (&wrset);
+		maxfd = -1;
+		for (cd = 0; cd < NETCHANNELS; cd++) {
+			struct link *l = &links[cd];
+
+			if (l->l_fd[FWD] < 0) {
+				FD_SET (l->l_listfd, &rdset);
+				maxfd = MAX (maxfd, l->l_listfd);
+				continue;
+			}
+			for (dir = 0; dir < DIRS; dir++) {
+				struct pipe *p = &l->l_pipe[dir];
+				uint64_t when;
+
+				if (p->p_queued < QUEUEMAX) {
+					FD_SET (l->l_fd[dir], &rdset);
+					maxfd = MAX (maxfd, l->l_fd[dir]);
+				}
+				if (p->p_head == NULL)
+					continue;
+				when = MAX (p->p_head->c_release,
+				            stall_end (l, now));
+				if (when <= now) {
+					FD_SET (l->l_fd[!dir], &wrset);
+					maxfd = MAX (maxfd, l->l_fd[!dir]);
+				} else if (when != UINT64_MAX
+				           && (wake == 0 || when < wake))
+					wake = when;
+			}
+		}
+
+		if (wake != 0) {
+			uint64_t left = (wake > now ? wake - now : 0);
+			tv.tv_sec = left / 1000000000;
+			tv.tv_usec = (left % 1000000000) / 1000;
+		}
+		rdy = select (maxfd + 1, &rdset, &wrset, NULL,
+				wake != 0 ? &tv : NULL);
+		if (rdy < 0) {
+			if (errno == EINTR)
+				continue;
+			perror ("select");
+			return EXIT_FAILURE;
+		}
+
+		now = clock_now ();
+		for (cd = 0; cd < NETCHANNELS; cd++) {
+			struct link *l = &links[cd];
+
+			if (l->l_fd[FWD] < 0) {
+				if (FD_ISSET (l->l_listfd, &rdset))
+					accept_link (cd);
+				continue;
+			}
+			for (dir = 0; dir < DIRS && l->l_fd[FWD] >= 0; dir++) {
+				if (FD_ISSET (l->l_fd[dir], &rdset))
+					pipe_read (cd, dir, now);
+				if (l->l_fd[FWD] >= 0
+				    && FD_ISSET (l->l_fd[!dir], &wrset))
+					pipe_write (cd, dir, now);
+			}
+		}
+	}
+
+error:
+	print_help (argv[0]);
+	return EXIT_FAILURE;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+accept_link (int cd)
+{
+	/* Accetta la connessione di psend sul canale cd e apre quella verso
+	 * precv. Il canale resta chiuso, e si torna in ascolto, se precv non
+	 * risponde. */
+
+	int dir;
+	fd_t fd;
+	struct link *l = &links[cd];
+	struct sockaddr_in addr;
+
+	fd = accept (l->l_listfd, NULL, NULL);
+	if (fd < 0) {
+		perror ("accept");
+		return;
+	}
+	l->l_fd[FWD] = fd;
+
+	l->l_fd[REV] = socket (AF_INET, SOCK_STREAM, 0);
+	if (l->l_fd[REV] < 0
+	    || make_addr (&addr, connaddr, connport + cd)
+	    || connect (l->l_fd[REV], (struct sockaddr *)&addr,
+	                sizeof (addr))) {
+		fprintf (stderr, "Canale %d, connessione a %s:%d fallita: "
+				"%s\n", cd, connaddr, connport + cd,
+				strerror (errno));
+		close_link (cd);
+		return;
+	}
+
+	for (dir = 0; dir < DIRS; dir++) {
+		link_socket_setup (l->l_fd[dir]);
+		memset (&l->l_pipe[dir], 0, sizeof (struct pipe));
+	}
+	printf ("Canale %d connesso.\n", cd);
+	fflush (stdout);
+}
+
+
+static void
+apply_schedule (uint64_t now)
+{
+	int cd;
+
+	while (nextsched < nsched
+	       && start + sched[nextsched].s_time * NS <= now) {
+		struct sched *s = &sched[nextsched++];
+
+		for (cd = 0; cd < NETCHANNELS; cd++)
+			if (s->s_cd < 0 || s->s_cd == cd) {
+				links[cd].l_delay = s->s_delay;
+				links[cd].l_jitter = s->s_jitter;
+				links[cd].l_rate = s->s_rate;
+				links[cd].l_stalled = s->s_stalled;
+			}
+	}
+}
+
+
+static uint64_t
+clock_now (void)
+{
+	/* Come clock_ns di crono.c, che non puo' essere collegata senza il
+	 * resto del proxy. */
+
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static void
+close_link (int cd)
+{
+	/* Chiude entrambe le connessioni del canale cd, scartando i dati in
+	 * attesa, come farebbe un percorso che cade. */
+
+	int dir;
+	struct chunk *c;
+	struct link *l = &links[cd];
+
+	for (dir = 0; dir < DIRS; dir++) {
+		if (l->l_fd[dir] >= 0)
+			close (l->l_fd[dir]);
+		l->l_fd[dir] = -1;
+		while ((c = l->l_pipe[dir].p_head) != NULL) {
+			l->l_pipe[dir].p_head = c->c_next;
+			free (c);
+		}
+		memset (&l->l_pipe[dir], 0, sizeof (struct pipe));
+	}
+	printf ("Canale %d chiuso.\n", cd);
+	fflush (stdout);
+}
+
+
+static int
+listen_link (int cd)
+{
+	int err;
+	int optval;
+	struct sockaddr_in addr;
+	struct link *l = &links[cd];
+
+	l->l_listfd = socket (AF_INET, SOCK_STREAM, 0);
+	if (l->l_listfd < 0) {
+		perror ("socket");
+		return -1;
+	}
+	optval = 1;
+	setsockopt (l->l_listfd, SOL_SOCKET, SO_REUSEADDR, &optval,
+			sizeof (optval));
+	make_addr (&addr, "127.0.0.1", listport + cd);
+
+	err = bind (l->l_listfd, (struct sockaddr *)&addr, sizeof (addr));
+	if (!err)
+		err = listen (l->l_listfd, 1);
+	if (err) {
+		fprintf (stderr, "Canale %d, porta %d: %s\n", cd,
+				listport + cd, strerror (errno));
+		return -1;
+	}
+	printf ("Canale %d: 127.0.0.1:%d -> %s:%d\n", cd, listport + cd,
+			connaddr, connport + cd);
+	return 0;
+}
+
+
+static void
+link_socket_setup (fd_t fd)
+{
+	/* Socket non bloccante e senza Nagle: il ritardo lo decide
+	 * l'emulatore. */
+
+	int optval;
+
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	optval = 1;
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+}
+
+
+static int
+load_schedule (char *path)
+{
+	/* Legge la schedule da path. Ogni riga ha il formato
+	 *   secondi canale ritardo_ms jitter_ms banda stallo
+	 * con canale * per tutti, banda in byte al secondo (0 illimitata) e
+	 * stallo 0 o 1. Le righe vuote o che iniziano con # sono ignorate.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	FILE *f;
+	int lineno;
+	size_t alloc;
+	char line[256];
+
+	f = fopen (path, "r");
+	if (f == NULL) {
+		fprintf (stderr, "%s: %s\n", path, strerror (errno));
+		return -1;
+	}
+
+	alloc = 0;
+	lineno = 0;
+	while (fgets (line, sizeof (line), f) != NULL) {
+		struct sched s;
+		char chan[8];
+		int stalled;
+
+		lineno++;
+		if (line[strspn (line, " \t\r\n")] == '\0'
+		    || line[strspn (line, " \t")] == '#')
+			continue;
+
+		if (sscanf (line, "%lf %7s %lf %lf %lf %d", &s.s_time, chan,
+		            &s.s_delay, &s.s_jitter, &s.s_rate,
+		            &stalled) != 6
+		    || s.s_time < 0 || s.s_delay < 0 || s.s_jitter < 0
+		    || s.s_rate < 0
+		    || (nsched > 0 && s.s_time < sched[nsched - 1].s_time))
+			goto error;
+
+		if (strcmp (chan, "*") == 0)
+			s.s_cd = -1;
+		else if (strlen (chan) == 1 && chan[0] >= '0'
+		         && chan[0] < '0' + NETCHANNELS)
+			s.s_cd = chan[0] - '0';
+		else
+			goto error;
+		s.s_delay /= 1000;
+		s.s_jitter /= 1000;
+		s.s_stalled = (stalled ? TRUE : FALSE);
+
+		if (nsched == alloc) {
+			alloc = (alloc == 0 ? 64 : alloc * 2);
+			sched = realloc (sched, alloc * sizeof (struct sched));
+			if (sched == NULL) {
+				perror ("realloc");
+				exit (EXIT_FAILURE);
+			}
+		}
+		sched[nsched++] = s;
+	}
+	fclose (f);
+	return 0;
+
+error:
+	fprintf (stderr, "%s:%d: riga non valida\n", path, lineno);
+	fclose (f);
+	return -1;
+}
+
+
+static int
+make_addr (struct sockaddr_in *addr, char *ip, int port)
+{
+	/* Ritorna 0 se ip e' un indirizzo valido, -1 altrimenti. */
+
+	memset (addr, 0, sizeof (struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons (port);
+	if (inet_pton (AF_INET, ip, &addr->sin_addr) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+
+static int
+parse_chan (char *arg, int *first, int *last, char **rest)
+{
+	/* Legge da arg un canale (0, 1, 2 oppure * per tutti) seguito da
+	 * ':'. *rest punta a quello che segue.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	if (arg[0] == '\0' || arg[1] != ':')
+		return -1;
+
+	if (arg[0] == '*') {
+		*first = 0;
+		*last = NETCHANNELS - 1;
+	} else if (arg[0] >= '0' && arg[0] < '0' + NETCHANNELS)
+		*first = *last = arg[0] - '0';
+	else
+		return -1;
+
+	*rest = &arg[2];
+	return 0;
+}
+
+
+static int
+parse_option (int opt, char *arg)
+{
+	/* Gestisce le opzioni sugli indirizzi e quelle per canale.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	int cd;
+	int first;
+	int last;
+	long port;
+	double val;
+	double len;
+	char *rest;
+	char *endptr;
+
+	switch (opt) {
+	case 'a' :
+		connaddr = arg;
+		return 0;
+	case 'c' :
+	case 'l' :
+		port = strtol (arg, &endptr, 10);
+		if (*endptr != '\0' || port <= 0
+		    || port + NETCHANNELS > 65536)
+			return -1;
+		if (opt == 'c')
+			connport = port;
+		else
+			listport = port;
+		return 0;
+	}
+
+	if (parse_chan (arg, &first, &last, &rest))
+		return -1;
+	val = strtod (rest, &endptr);
+	if (endptr == rest || val < 0)
+		return -1;
+
+	len = 0;
+	if (opt == 's') {
+		if (*endptr != ':')
+			return -1;
+		rest = endptr + 1;
+		len = strtod (rest, &endptr);
+		if (endptr == rest || len <= 0 || len >= val)
+			return -1;
+	}
+	if (*endptr != '\0')
+		return -1;
+
+	for (cd = first; cd <= last; cd++)
+		switch (opt) {
+		case 'd' :
+			links[cd].l_delay = val / 1000;
+			break;
+		case 'j' :
+			links[cd].l_jitter = val / 1000;
+			break;
+		case 'r' :
+			links[cd].l_rate = val;
+			break;
+		case 's' :
+			links[cd].l_stall_every = val;
+			links[cd].l_stall_len = len;
+			break;
+		default :
+			return -1;
+		}
+	return 0;
+}
+
+
+static void
+pipe_read (int cd, int dir, uint64_t now)
+{
+	/* Legge dal lato dir del canale cd e accoda i dati con l'istante in
+	 * cui potranno essere consegnati: prima la trasmissione alla banda
+	 * del canale, poi il ritardo con il jitter. L'ordine del flusso TCP
+	 * viene mantenuto. */
+
+	ssize_t nread;
+	double delay;
+	uint64_t release;
+	char buf[CHUNKMAX];
+	struct chunk *c;
+	struct link *l = &links[cd];
+	struct pipe *p = &l->l_pipe[dir];
+
+	nread = read (l->l_fd[dir], buf, MIN (sizeof (buf),
+	                                      QUEUEMAX - p->p_queued));
+	if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (nread <= 0) {
+		if (nread < 0)
+			fprintf (stderr, "Canale %d, lettura: %s\n", cd,
+					strerror (errno));
+		close_link (cd);
+		return;
+	}
+
+	release = now;
+	if (l->l_rate > 0) {
+		release = MAX (release, p->p_link_free)
+			+ (uint64_t)(nread / l->l_rate * NS);
+		p->p_link_free = release;
+	}
+	delay = l->l_delay;
+	if (l->l_jitter > 0)
+		delay += l->l_jitter * (2.0 * rand () / RAND_MAX - 1);
+	if (delay > 0)
+		release += (uint64_t)(delay * NS);
+	release = MAX (release, p->p_last_release);
+	p->p_last_release = release;
+
+	c = malloc (sizeof (struct chunk) + nread);
+	if (c == NULL) {
+		perror ("malloc");
+		exit (EXIT_FAILURE);
+	}
+	c->c_next = NULL;
+	c->c_release = release;
+	c->c_len = nread;
+	c->c_off = 0;
+	c->c_data = (char *)(c + 1);
+	memcpy (c->c_data, buf, nread);
+
+	if (p->p_tail != NULL)
+		p->p_tail->c_next = c;
+	else
+		p->p_head = c;
+	p->p_tail = c;
+	p->p_queued += nread;
+}
+
+
+static void
+pipe_write (int cd, int dir, uint64_t now)
+{
+	/* Scrive sul lato opposto a dir del canale cd i dati gia'
+	 * consegnabili. */
+
+	ssize_t nwrite;
+	struct chunk *c;
+	struct link *l = &links[cd];
+	struct pipe *p = &l->l_pipe[dir];
+
+	if (stall_end (l, now) > now)
+		return;
+
+	while ((c = p->p_head) != NULL && c->c_release <= now) {
+		nwrite = write (l->l_fd[!dir], c->c_data + c->c_off,
+				c->c_len - c->c_off);
+		if (nwrite < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (nwrite < 0) {
+			fprintf (stderr, "Canale %d, scrittura: %s\n", cd,
+					strerror (errno));
+			close_link (cd);
+			return;
+		}
+		c->c_off += nwrite;
+		p->p_queued -= nwrite;
+		if (c->c_off < c->c_len)
+			return;
+
+		p->p_head = c->c_next;
+		if (p->p_head == NULL)
+			p->p_tail = NULL;
+		free (c);
+	}
+}
+
+
+static void
+print_help (const char *program_name)
+{
+	printf ("%s [ opzioni ]\n", program_name);
+	printf ("\n"
+"Emula i tre canali del Ritardatore: accetta le connessioni di psend su\n"
+"127.0.0.1, porte 7001-7003, e le inoltra in entrambe le direzioni a\n"
+"precv, porte 8001-8003, applicando i disturbi richiesti.\n"
+		);
+	printf ("\n"
+"Opzioni (c e' il canale, 0-2, oppure * per tutti):\n"
+"  -a ip          indirizzo di precv (predefinito 127.0.0.1)\n"
+"  -l porta       prima porta di ascolto (predefinita 7001)\n"
+"  -c porta       prima porta di precv (predefinita 8001)\n"
+"  -d c:ms        ritardo di propagazione\n"
+"  -j c:ms        jitter, uniforme in [-ms, ms]; l'ordine e' mantenuto\n"
+"  -r c:byte/s    banda massima\n"
+		);
+	printf (
+"  -s c:ogni:per  ogni 'ogni' secondi il canale si blocca per 'per'\n"
+"                 secondi\n"
+"  -f file        schedule: righe 'secondi canale ritardo_ms jitter_ms\n"
+"                 banda stallo', applicate all'istante indicato\n"
+"  -S seme        seme del generatore casuale del jitter\n"
+		);
+}
+
+
+static uint64_t
+stall_end (struct link *l, uint64_t now)
+{
+	/* Ritorna l'istante in cui finisce lo stallo in corso sul canale l,
+	 * now se non e' in stallo. Uno stallo della schedule dura fino alla
+	 * riga successiva. */
+
+	double t;
+	double phase;
+
+	if (l->l_stalled)
+		return (nextsched < nsched ?
+		        start + (uint64_t)(sched[nextsched].s_time * NS) :
+		        UINT64_MAX);
+
+	if (l->l_stall_every <= 0)
+		return now;
+
+	/* Lo stallo occupa la fine di ogni periodo. */
+	t = (now - start) / NS;
+	phase = fmod (t, l->l_stall_every);
+	if (phase < l->l_stall_every - l->l_stall_len)
+		return now;
+	return start + (uint64_t)((t - phase + l->l_stall_every) * NS);
+}
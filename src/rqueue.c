@@ -1,12 +1,23 @@
 #include "h/rqueue.h"
 #include "h/cqueue.h"
 #include "h/channel.h"
+#include "h/crono.h"
+#include "h/histo.h"
+#include "h/probes.h"
 #include "h/segment.h"
+#include "h/stats.h"
+#include "h/trace.h"
 #include "h/types.h"
 #include "h/util.h"
 
 #include <config.h>
+#include <string.h>
+#include <sys/uio.h>
 
+/* Senza MSG_NOSIGNAL SIGPIPE e' ignorato, vedi proxy_init. */
+#ifndef MSG_NOSIGNAL
+#define     MSG_NOSIGNAL     0
+#endif
 
 #define     TYPE     struct segwrap
 #define     NEXT     sw_next
@@ -19,7 +30,6 @@
 			       Funzioni locali
 *******************************************************************************/
 
-static void consolidate (rqueue_t *rq);
 static bool is_first_partially_sent (rqueue_t *rq);
 
 
@@ -31,18 +41,18 @@ static bool is_first_partially_sent (rqueue_t *rq);
 int
 rqueue_add (rqueue_t *rq, struct segwrap *sw)
 {
-	/* Accoda sw alla coda rq e lo copia nel buffer.
+	/* Accoda sw alla coda in uscita rq, senza copiarlo: fino alla
+	 * spedizione il segmento non va modificato.
 	 * La coda deve risultare in ordine di urgenza e sw deve poter essere
-	 * contenuto nel buffer. */
-
-	int err;
+	 * contenuto nella capacita' di rq. */
 
 	assert (rq != NULL);
+	assert (rq->rq_data == NULL);
 	assert (sw != NULL);
 	assert (sw->sw_next == NULL);
 	assert (sw->sw_prev == NULL);
 	assert (sw->sw_seglen > 0);
-	assert (sw->sw_seglen <= cqueue_get_aval (rq->rq_data));
+	assert (sw->sw_seglen <= rqueue_get_aval (rq));
 	assert (isEmpty (rq->rq_sgmt)
 	        || is_first_partially_sent (rq)
 	        || segwrap_urgcmp (rq->rq_sgmt, sw) < 0);
@@ -51,8 +61,43 @@ rqueue_add (rqueue_t *rq, struct segwrap *sw)
 		rq->rq_nbytes = sw->sw_seglen;
 
 	qenqueue (&rq->rq_sgmt, sw);
-	err = cqueue_add (rq->rq_data, sw->sw_seg, sw->sw_seglen);
-	assert (!err);
+	rq->rq_used += sw->sw_seglen;
+
+	return 0;
+}
+
+
+int
+rqueue_add_urgent (rqueue_t *rq, struct segwrap *sw)
+{
+	/* Inserisce sw in rq secondo l'ordine di urgenza, anche davanti ai
+	 * segmenti gia' accodati ma non ancora spediti, spostando solo i
+	 * puntatori della lista.
+	 * Ritorna 0 se riesce, -1 se sw non puo' essere contenuto nella
+	 * capacita' di rq. */
+
+	struct segwrap *partial;
+
+	assert (rq != NULL);
+	assert (rq->rq_data == NULL);
+	assert (sw != NULL);
+	assert (sw->sw_next == NULL);
+	assert (sw->sw_prev == NULL);
+	assert (sw->sw_seglen > 0);
+
+	if (sw->sw_seglen > rqueue_get_aval (rq))
+		return -1;
+
+	/* Il primo segmento, se parzialmente spedito, resta in testa;
+	 * altrimenti sw puo' diventare la nuova testa. */
+	partial = (is_first_partially_sent (rq) ? qdequeue (&rq->rq_sgmt)
+	                                        : NULL);
+	qinorder_insert (&rq->rq_sgmt, sw, &segwrap_urgcmp);
+	if (partial != NULL)
+		qpush (&rq->rq_sgmt, partial);
+	else
+		rq->rq_nbytes = getHead (rq->rq_sgmt)->sw_seglen;
+	rq->rq_used += sw->sw_seglen;
 
 	return 0;
 }
@@ -70,21 +115,30 @@ bool
 rqueue_can_write (rqueue_t *rq)
 {
 	assert (rq != NULL);
-	return cqueue_can_write ((void *)rq->rq_data);
+	return (rqueue_get_used (rq) > 0);
 }
 
 
 rqueue_t *
-rqueue_create (size_t len)
+rqueue_create (proxy_t *px, cd_t cd, size_t len, bool out)
 {
+	/* Crea la rqueue del canale cd di px, in uscita se out, con una
+	 * capacita' di len byte. Solo quella in entrata ha un buffer. */
+
 	rqueue_t *newrq;
 
+	assert (px != NULL);
+	assert (VALID_CD (cd) && cd != HOSTCD);
 	assert (len > 0);
 
 	newrq = xmalloc (sizeof (rqueue_t));
-	newrq->rq_data = cqueue_create (len);
+	newrq->rq_data = (out ? NULL : cqueue_create (len));
 	newrq->rq_sgmt = newQueue ();
 	newrq->rq_nbytes = 0;
+	newrq->rq_len = len;
+	newrq->rq_used = 0;
+	newrq->rq_px = px;
+	newrq->rq_cd = cd;
 
 	return newrq;
 }
@@ -94,8 +148,7 @@ struct segwrap *
 rqueue_cut_unsent (rqueue_t *rq)
 {
 	/* Ritorna una coda contenente i segmenti non ancora spediti, che
-	 * vengono rimossi da rq_sgmt. Il buffer circolare viene modificato di
-	 * conseguenza.
+	 * vengono rimossi da rq_sgmt.
 	 * Puo' ritornare una coda vuota. */
 
 	struct segwrap *head;
@@ -119,8 +172,8 @@ rqueue_cut_unsent (rqueue_t *rq)
 		qenqueue (&rq->rq_sgmt, qdequeue (&rmvdq));
 	else
 		rq->rq_nbytes = 0;
+	rq->rq_used = rq->rq_nbytes;
 
-	consolidate (rq);
 	return rmvdq;
 }
 
@@ -131,7 +184,8 @@ rqueue_destroy (rqueue_t *rq)
 	assert (rq != NULL);
 	assert (isEmpty (rq->rq_sgmt));
 
-	cqueue_destroy (rq->rq_data);
+	if (rq->rq_data != NULL)
+		cqueue_destroy (rq->rq_data);
 	xfree (rq);
 }
 
@@ -139,39 +193,25 @@ rqueue_destroy (rqueue_t *rq)
 size_t
 rqueue_get_aval (rqueue_t *rq)
 {
-	size_t cqaval;
+	/* Ritorna i byte che si possono ancora accodare in uscita. */
 
 	assert (rq != NULL);
-	cqaval = cqueue_get_aval (rq->rq_data);
-
-#ifndef NDEBUG
-	if (cqaval == rq->rq_data->cq_len) {
-		assert (isEmpty (rq->rq_sgmt));
-		assert (rq->rq_nbytes == 0);
-	} else {
-		struct segwrap *head;
-		head = getHead (rq->rq_sgmt);
-		assert (!isEmpty (rq->rq_sgmt));
-		assert (rq->rq_nbytes > 0);
-		assert (head->sw_seglen >= rq->rq_nbytes);
-	}
-#endif /* NDEBUG */
+	assert (rqueue_get_used (rq) <= rq->rq_len);
 
-	return cqaval;
+	return (rq->rq_len - rqueue_get_used (rq));
 }
 
 
 size_t
 rqueue_get_used (rqueue_t *rq)
 {
-	size_t cqused;
+	/* Ritorna i byte accodati in uscita e non ancora spediti. */
 
 	assert (rq != NULL);
-
-	cqused = cqueue_get_used (rq->rq_data);
+	assert (rq->rq_data == NULL);
 
 #ifndef NDEBUG
-	if (cqused == 0) {
+	if (rq->rq_used == 0) {
 		assert (isEmpty (rq->rq_sgmt));
 		assert (rq->rq_nbytes == 0);
 	} else {
@@ -184,7 +224,7 @@ rqueue_get_used (rqueue_t *rq)
 	}
 #endif /* NDEBUG */
 
-	return cqused;
+	return rq->rq_used;
 }
 
 
@@ -192,12 +232,14 @@ size_t
 rqueue_read (fd_t fd, rqueue_t *rq)
 {
 	/* Chiama cqueue_read su fd e rq->rq_data e gestisce i segmenti letti
-	 * completamente.
+	 * completamente, senza copiarli se possibile (join_add_inplace).
 	 * Ritorna esattamente il valore e l'errno di cqueue_read. */
 
 	int errno_s;
 	int err;
+	cd_t cd;
 	size_t nread;
+	proxy_t *px;
 
 	assert (fd >= 0);
 	assert (rq != NULL);
@@ -205,29 +247,42 @@ rqueue_read (fd_t fd, rqueue_t *rq)
 	assert (rq->rq_nbytes == 0);
 	assert (rqueue_can_read (rq));
 
+	px = rq->rq_px;
+	cd = rq->rq_cd;
 	nread = cqueue_read (fd, rq->rq_data);
 	errno_s = errno;
 
 	if (nread > 0) {
 		size_t seglen;
 		bool full_segment;
-#ifndef NDEBUG
-		fprintf (stdout, "rqueue_read %d bytes\n", nread);
-		fflush (stdout);
-#endif
 
 		full_segment = FALSE;
 		while ((seglen = cqueue_seglen (rq->rq_data)) > 0) {
 			struct segwrap *sw;
-			sw = segwrap_create ();
+			seg_t *seg;
+
+			/* I duplicati e il prossimo segmento in ordine sono
+			 * gestiti dove sono, nel buffer. */
+			seg = cqueue_head (rq->rq_data);
+			MH_PROBE3 (rqueue_read, cd, seg_seq (seg), seglen);
+			full_segment = TRUE;
+			if (join_add_inplace (px, seg, seglen, cd) == 0) {
+				cqueue_drop_head (rq->rq_data, seglen);
+				continue;
+			}
+
+			if (seg_pld (seg) == NULL) {
+				assert (seglen <= CTRLMAXLEN);
+				sw = segwrap_ctrl_create (px);
+			} else
+				sw = segwrap_create (px);
 			sw->sw_seglen = seglen;
 			err = cqueue_remove (rq->rq_data, sw->sw_seg, seglen);
 			assert (!err);
-			handle_rcvd_segment (sw);
-			full_segment = TRUE;
+			handle_rcvd_segment (px, sw, cd);
 		}
 		if (full_segment)
-			channel_activity_notice (get_cd_from (rq, ELRQUEUE));
+			channel_activity_notice (px, cd);
 }
 
 	errno = errno_s;
@@ -240,11 +295,11 @@ rqueue_rm_acked (rqueue_t *rq, struct segwrap *ack)
 {
 	/* Rimuove e distrugge tutti i segwrap che non devono piu' essere
 	 * spediti perche' hanno il seqnum minore o uguale ad ack, tranne il
-	 * primo se e' parzialmente spedito.
-	 * Se necessario, consolida rq. */
+	 * primo se e' parzialmente spedito. */
 
 	struct segwrap *head;
 	struct segwrap *rmvdq;
+	struct segwrap *sw;
 
 	head = getHead (rq->rq_sgmt);
 	if (head == NULL)
@@ -260,42 +315,79 @@ rqueue_rm_acked (rqueue_t *rq, struct segwrap *ack)
 	/* Rimozione acked. */
 	rmvdq = qremove_all_that (&rq->rq_sgmt, &segwrap_is_acked, ack);
 
-	/* Ripristino primo segmento parziale. */
+	/* Ripristino primo segmento parziale. Altrimenti la testa puo' essere
+	 * cambiata e rq_nbytes deve riferirsi alla nuova, che non e' ancora
+	 * stata spedita. */
 	if (head != NULL)
 		qpush (&rq->rq_sgmt, head);
+	else if (!isEmpty (rq->rq_sgmt))
+		rq->rq_nbytes = getHead (rq->rq_sgmt)->sw_seglen;
+	else
+		rq->rq_nbytes = 0;
 
-	/* Se sono stati rimossi dei segmenti, la coda va riportata in uno
-	 * stato coerente. */
-	if (!isEmpty (rmvdq))
-		consolidate (rq);
-
-	/* Deallocazione rimossi. */
-	while (!isEmpty (rmvdq))
-		segwrap_destroy (qdequeue (&rmvdq));
+	/* Deallocazione rimossi, nessuno dei quali era parzialmente
+	 * spedito. */
+	while ((sw = qdequeue (&rmvdq)) != NULL) {
+		rq->rq_used -= sw->sw_seglen;
+		segwrap_destroy (rq->rq_px, sw);
+	}
 }
 
 
 size_t
 rqueue_write (fd_t fd, rqueue_t *rq)
 {
-	/* Chiama cqueue_write su fd e rq->rq_data e gestisce di conseguenza
-	 * la coda dei segwrap uscenti.
-	 * Ritorna esattamente il valore e l'errno di cqueue_write. */
+	/* Spedisce su fd piu' segmenti possibile di rq, con una sola sendmsg
+	 * che raccoglie i byte direttamente dai segwrap, e gestisce di
+	 * conseguenza la coda dei segwrap uscenti.
+	 * Ritorna il numero di byte spediti (0 o piu'). In caso di errore
+	 * imposta errno come quello di sendmsg, altrimenti a zero. */
 
 	int errno_s;
+	int niov;
+	cd_t cd;
+	ssize_t nwrite;
 	size_t nsent;
 	size_t retval;
-	bool full_segment;
+	struct segwrap *cur;
+	struct iovec iov[IOVLEN];
+	struct msghdr msg;
 
 	assert (fd >= 0);
 	assert (rq != NULL);
 	assert (rqueue_can_write (rq));
 	assert (rq->rq_nbytes > 0);
 
-	retval = nsent = cqueue_write (fd, rq->rq_data);
-	errno_s = errno;
+	cd = rq->rq_cd;
+
+	/* Il primo segmento puo' essere gia' stato spedito in parte. La coda
+	 * punta all'ultimo. */
+	cur = getHead (rq->rq_sgmt);
+	iov[0].iov_base = &cur->sw_seg[cur->sw_seglen - rq->rq_nbytes];
+	iov[0].iov_len = rq->rq_nbytes;
+	for (niov = 1; niov < IOVLEN && cur != rq->rq_sgmt; niov++) {
+		cur = getNext (cur);
+		iov[niov].iov_base = cur->sw_seg;
+		iov[niov].iov_len = cur->sw_seglen;
+	}
+
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+	do {
+		nwrite = sendmsg (fd, &msg, MSG_NOSIGNAL);
+	} while (nwrite == -1 && errno == EINTR);
+	assert (nwrite != 0);
+
+	if (nwrite > 0) {
+		errno_s = 0;
+		retval = nsent = nwrite;
+		rq->rq_used -= nsent;
+	} else {
+		errno_s = (errno == EAGAIN ? 0 : errno);
+		retval = nsent = 0;
+	}
 
-	full_segment = FALSE;
 	while (nsent > 0) {
 		size_t min;
 
@@ -311,8 +403,24 @@ rqueue_write (fd_t fd, rqueue_t *rq)
 			head = qdequeue (&rq->rq_sgmt);
 			assert (head != NULL);
 
-			handle_sent_segment (head);
-			full_segment = TRUE;
+			trace_segment (TR_SENT, head, cd);
+			MH_PROBE3 (rqueue_write, cd, seg_seq (head->sw_seg),
+					head->sw_seglen);
+			STATS_ADD (st_chan[cd].cs_segs_out, 1);
+			if (seg_is_nak (head->sw_seg))
+				STATS_ADD (st_chan[cd].cs_naks_out, 1);
+			else if (seg_is_critical (head->sw_seg)
+			         && !seg_is_ack (head->sw_seg))
+				STATS_ADD (st_chan[cd].cs_retrans, 1);
+			else if (latency_enabled ()
+			         && seg_pld (head->sw_seg) != NULL) {
+				struct timeval now;
+				gettime (&now);
+				histo_add (&mh_stats->st_histo[HS_SNDQ],
+						tv2d (&now, FALSE)
+						- head->sw_tstamp, 1);
+			}
+			handle_sent_segment (rq->rq_px, head);
 
 			/* Ricalcola rq_nbytes. */
 			head = getHead (rq->rq_sgmt);
@@ -322,8 +430,6 @@ rqueue_write (fd_t fd, rqueue_t *rq)
 				assert (nsent == 0);
 		}
 	}
-	if (full_segment)
-		channel_activity_notice (get_cd_from (rq, ELRQUEUE));
 
 	errno = errno_s;
 	return retval;
@@ -334,41 +440,6 @@ rqueue_write (fd_t fd, rqueue_t *rq)
 			       Funzioni locali
 *******************************************************************************/
 
-static void
-consolidate (rqueue_t *rq)
-{
-	/* Riporta rq_data in uno stato coerente con rq_sgmt.
-	 * Se il segmento in testa e' stato parzialmente spedito lo ignora,
-	 * perche' assume che le altre funzioni non lo modifichino. */
-
-	struct segwrap *head;
-	struct segwrap *tmp;
-	size_t todrop;
-
-	assert (rq != NULL);
-
-	todrop = cqueue_get_used (rq->rq_data);
-	if (todrop == 0)
-		return;
-
-	tmp = rq->rq_sgmt;
-	rq->rq_sgmt = newQueue ();
-	head = getHead (tmp);
-	if (head != NULL && head->sw_seglen > rq->rq_nbytes) {
-		qenqueue (&rq->rq_sgmt, qdequeue (&tmp));
-		todrop -= rq->rq_nbytes;
-	} else
-		rq->rq_nbytes = 0;
-
-	if (todrop)
-		cqueue_drop_tail (rq->rq_data, todrop);
-
-	while (!isEmpty (tmp))
-		rqueue_add (rq, qdequeue (&tmp));
-
-}
-
-
 static bool
 is_first_partially_sent (rqueue_t * rq)
 {
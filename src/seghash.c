@@ -100,22 +100,28 @@ seghash_remove (struct segwrap **hash_table, size_t table_size, seq_t key)
 }
 
 
-void
+struct segwrap *
 seghash_rm_acked
 (struct segwrap **hash_table, size_t table_size, struct segwrap *ack)
 {
+	/* Rimuove i segwrap confermati da ack e li ritorna in una coda, da
+	 * deallocare a cura del chiamante. */
+
 	int i;
 	struct segwrap *rmvdq;
+	struct segwrap *bucketq;
 
 	assert (hash_table != NULL);
 	assert (table_size > 0);
 
+	rmvdq = newQueue ();
 	for (i = 0; i < table_size; i++) {
-		rmvdq = qremove_all_that (&hash_table[i], &segwrap_is_acked,
+		bucketq = qremove_all_that (&hash_table[i], &segwrap_is_acked,
 				ack);
-		while (!isEmpty (rmvdq))
-			segwrap_destroy (qdequeue (&rmvdq));
+		while (!isEmpty (bucketq))
+			qenqueue (&rmvdq, qdequeue (&bucketq));
 	}
+	return rmvdq;
 }
 
 
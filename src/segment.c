@@ -3,10 +3,15 @@
 #include "h/channel.h"
 #include "h/cqueue.h"
 #include "h/crono.h"
+#include "h/probes.h"
 #include "h/seghash.h"
+#include "h/slab.h"
+#include "h/stats.h"
+#include "h/trace.h"
 #include "h/util.h"
 
 #include <config.h>
+#include <string.h>
 
 #define     TYPE     struct segwrap
 #define     NEXT     sw_next
@@ -16,25 +21,26 @@
 
 
 /*******************************************************************************
-			       Variabili locali
+		       Prototipi delle funzioni locali
 *******************************************************************************/
 
-/* Coda dei segwrap inutilizzati. */
-static struct segwrap *swcache;
-/* Tabella hash dei segwrap spediti. */
-#define     HT_SENT_SIZE     10
-static struct segwrap *ht_sent[HT_SENT_SIZE];
-
-static bool init_done = FALSE;
+static int urgcmp (struct segwrap *sw_1, struct segwrap *sw_2);
+static void handle_rcvd_ack (proxy_t *px, struct segwrap *ack);
+static void handle_rcvd_nak (proxy_t *px, struct segwrap *nak);
+static void handle_rcvd_probe (proxy_t *px, struct segwrap *prb, cd_t cd);
+static int flags_prio (flag_t flg);
+static void prio_tab_init (void);
+static struct segwrap *wrap_alloc (proxy_t *px, bool ctrl);
 
 
 /*******************************************************************************
-		       Prototipi delle funzioni locali
+			       Variabili locali
 *******************************************************************************/
 
-static int urgcmp (struct segwrap *sw_1, struct segwrap *sw_2);
-static void handle_rcvd_ack (struct segwrap *ack);
-static void handle_rcvd_nak (struct segwrap *nak);
+/* segwrap_prio per ogni valore del campo flag, vedi flags_prio. E' comune ai
+ * proxy del processo e viene riempita una volta sola. */
+static uint8_t prio_tab[UINT8_MAX + 1];
+static pthread_once_t prio_once = PTHREAD_ONCE_INIT;
 
 
 /*******************************************************************************
@@ -42,65 +48,120 @@ static void handle_rcvd_nak (struct segwrap *nak);
 *******************************************************************************/
 
 void
-handle_rcvd_segment (struct segwrap *rcvd)
+destroy_segment_module (proxy_t *px)
 {
-	seq_t seq;
+	/* Dealloca i segwrap della tabella di quelli spediti e rilascia le
+	 * slab con quelli rimasti altrove. */
 
-	assert (rcvd != NULL);
+	int s;
+	struct segwrap *sw;
 
-	seq = seg_seq (rcvd->sw_seg);
+	assert (px->px_segment_ready == TRUE);
 
-#ifndef NDEBUG
-	/* segwrap_print (rcvd); */
-#endif
+	for (s = 0; s <= SEQMAX; s++) {
+		sw = seghash_remove (px->px_ht_sent, HT_SENT_SIZE, s);
+		if (sw != NULL)
+			segwrap_destroy (px, sw);
+	}
+	slab_destroy (&px->px_sw_slab);
+	slab_destroy (&px->px_ct_slab);
+
+	px->px_segment_ready = FALSE;
+}
+
+
+void
+handle_rcvd_segment (proxy_t *px, struct segwrap *rcvd, cd_t cd)
+{
+	/* Gestisce il segmento rcvd, ricevuto dal canale cd. */
+
+	assert (rcvd != NULL);
+	assert (VALID_CD (cd));
 
-	if (seg_is_nak (rcvd->sw_seg)) {
-		handle_rcvd_nak (rcvd);
-		rcvd->sw_seg[SEQ]--;
-		handle_rcvd_ack (rcvd);
+	STATS_ADD (st_chan[cd].cs_segs_in, 1);
+	trace_segment (TR_RECV, rcvd, cd);
+
+	if (seg_is_probe (rcvd->sw_seg) || seg_is_echo (rcvd->sw_seg)) {
+		handle_rcvd_probe (px, rcvd, cd);
+	} else if (seg_is_nak (rcvd->sw_seg)) {
+		STATS_ADD (st_chan[cd].cs_naks_in, 1);
+		handle_rcvd_nak (px, rcvd);
+		segwrap_destroy (px, rcvd);
 	} else if (seg_is_ack (rcvd->sw_seg)) {
-		handle_rcvd_ack (rcvd);
+		handle_rcvd_ack (px, rcvd);
 	} else {
 		assert (seg_pld (rcvd->sw_seg) != NULL);
-		join_add (rcvd);
+		join_add (px, rcvd);
 	}
 }
 
 
 void
-handle_sent_segment (struct segwrap *sent)
+handle_sent_segment (proxy_t *px, struct segwrap *sent)
 {
 	assert (sent != NULL);
 
-#ifndef NDEBUG
-	/* segwrap_print (sent); */
-#endif
-
 	if (seg_pld (sent->sw_seg) == NULL)
-		segwrap_destroy (sent);
+		segwrap_destroy (px, sent);
 	else {
 		struct segwrap *old;
 
 		/* ht_sent non deve contenere due segwrap con lo stesso
 		 * seqnum. */
-		old = seghash_remove (ht_sent, HT_SENT_SIZE,
+		old = seghash_remove (px->px_ht_sent, HT_SENT_SIZE,
 				seg_seq (sent->sw_seg));
 		if (old != NULL)
-			segwrap_destroy (old);
-		seghash_add (ht_sent, HT_SENT_SIZE, sent);
+			segwrap_destroy (px, old);
+		seghash_add (px->px_ht_sent, HT_SENT_SIZE, sent);
 	}
 }
 
 
 void
-init_segment_module (void)
+init_segment_module (proxy_t *px)
+{
+	/* I segwrap sono allineati alla linea di cache, che contiene i
+	 * campi usati per ordinarli e l'header del segmento. Ogni seqnum ha
+	 * al piu' un segwrap dati e un NAK, per cui con SEQMAX + 1 segwrap
+	 * di ciascun tipo gia' mappati il ciclo principale non alloca. */
+
+	assert (px->px_segment_ready == FALSE);
+
+	slab_init (&px->px_sw_slab, sizeof (struct segwrap), CACHE_LINE,
+			SLSW);
+	slab_init (&px->px_ct_slab, CTRLWRAPLEN, CACHE_LINE, SLCT);
+	slab_reserve (&px->px_sw_slab, SEQMAX + 1);
+	slab_reserve (&px->px_ct_slab, SEQMAX + 1);
+	seghash_init (px->px_ht_sent, HT_SENT_SIZE);
+	pthread_once (&prio_once, prio_tab_init);
+
+	px->px_segment_ready = TRUE;
+}
+
+
+size_t
+seg_hdr_len (seg_t *seg)
 {
-	assert (init_done == FALSE);
+	/* Ritorna la lunghezza dell'header di un segmento dati: il campo len
+	 * e il timestamp sono opzionali. */
+
+	assert (seg != NULL);
+	assert (!seg_is_probe (seg) && !seg_is_echo (seg));
 
-	swcache = newQueue ();
-	seghash_init (ht_sent, HT_SENT_SIZE);
+	return FLGLEN + SEQLEN
+		+ (seg[FLG] & LENFLAG ? LENLEN : 0)
+		+ (seg[FLG] & TSTFLAG ? TSTLEN : 0);
+}
+
+
+bool
+seg_has_tst (seg_t *seg)
+{
+	/* Ritorna TRUE se seg porta un timestamp: sempre per sonde ed echi,
+	 * con TSTFLAG per i segmenti dati. */
 
-	init_done = TRUE;
+	assert (seg != NULL);
+	return (seg[FLG] & (TSTFLAG | PRBFLAG | ECHFLAG) ? TRUE : FALSE);
 }
 
 
@@ -120,6 +181,14 @@ seg_is_critical (seg_t *seg)
 }
 
 
+bool
+seg_is_echo (seg_t *seg)
+{
+	assert (seg != NULL);
+	return (seg[FLG] & ECHFLAG ? TRUE : FALSE);
+}
+
+
 bool
 seg_is_nak (seg_t *seg)
 {
@@ -128,6 +197,14 @@ seg_is_nak (seg_t *seg)
 }
 
 
+bool
+seg_is_probe (seg_t *seg)
+{
+	assert (seg != NULL);
+	return (seg[FLG] & PRBFLAG ? TRUE : FALSE);
+}
+
+
 pld_t *
 seg_pld (seg_t *seg)
 {
@@ -136,7 +213,7 @@ seg_pld (seg_t *seg)
 
 	assert (seg != NULL);
 	if (seg[FLG] & PLDFLAG)
-		return (seg[FLG] & LENFLAG ? &seg[LEN + 1] : &seg[LEN]);
+		return &seg[seg_hdr_len (seg)];
 	return NULL;
 }
 
@@ -165,39 +242,53 @@ seg_seq (seg_t *seg)
 }
 
 
-struct segwrap *
-segwrap_create (void)
+tst_t
+seg_tst (seg_t *seg)
 {
-	/* Ritorna un nuovo segwrap, recuperandolo dalla cache di quelli
-	 * inutilizzati oppure, se questa e' vuota, allocandone uno nuovo.
-	 * Il segwrap viene marcato con il timestamp dell'istante attuale. */
+	/* Ritorna il timestamp di seg, che viaggia in network byte order.
+	 * Nei segmenti dati segue il campo len, se presente. */
 
-	struct segwrap *newsw;
-	static struct timeval now;
+	tst_t tst;
+	size_t pos;
 
-	assert (init_done == TRUE);
+	assert (seg != NULL);
+	assert (seg_has_tst (seg));
 
-	if (isEmpty (swcache)) {
-		newsw = xmalloc (sizeof (struct segwrap));
-		newsw->sw_prev = NULL;
-		newsw->sw_next = NULL;
-	} else
-		newsw = qdequeue (&swcache);
+	pos = TST;
+	if (!seg_is_probe (seg) && !seg_is_echo (seg))
+		pos = seg_hdr_len (seg) - TSTLEN;
 
-	/* Timestamp. */
-	gettime (&now);
-	newsw->sw_tstamp = tv2d (&now, FALSE);
+	memcpy (&tst, &seg[pos], TSTLEN);
+	return ntohl (tst);
+}
 
-	return newsw;
+
+struct segwrap *
+segwrap_create (proxy_t *px)
+{
+	/* Ritorna un nuovo segwrap, marcato con il timestamp dell'istante
+	 * attuale. */
+
+	return wrap_alloc (px, FALSE);
+}
+
+
+struct segwrap *
+segwrap_ctrl_create (proxy_t *px)
+{
+	/* Come segwrap_create, per un segmento di controllo: il segwrap
+	 * contiene solo CTRLMAXLEN byte di sw_seg. */
+
+	return wrap_alloc (px, TRUE);
 }
 
 
 struct segwrap *
-segwrap_nak_create (seq_t nakseq)
+segwrap_nak_create (proxy_t *px, seq_t nakseq)
 {
 	struct segwrap *nak;
 
-	nak = segwrap_create ();
+	nak = segwrap_ctrl_create (px);
 	nak->sw_seg[FLG] = 0 | NAKFLAG;
 	nak->sw_seg[SEQ] = nakseq;
 	nak->sw_seglen = NAKLEN;
@@ -206,23 +297,60 @@ segwrap_nak_create (seq_t nakseq)
 }
 
 
+struct segwrap *
+segwrap_ack_create (proxy_t *px, seq_t ackseq)
+{
+	struct segwrap *ack;
+
+	ack = segwrap_ctrl_create (px);
+	ack->sw_seg[FLG] = 0 | ACKFLAG;
+	ack->sw_seg[SEQ] = ackseq;
+	ack->sw_seglen = ACKLEN;
+
+	return ack;
+}
+
+
+struct segwrap *
+segwrap_probe_create (proxy_t *px, seq_t prbseq)
+{
+	/* Ritorna una sonda con seqnum prbseq, marcata con l'istante
+	 * attuale. Il peer la rispedisce indietro come echo. */
+
+	tst_t tst;
+	struct segwrap *prb;
+
+	prb = segwrap_ctrl_create (px);
+	prb->sw_seg[FLG] = 0 | PRBFLAG;
+	prb->sw_seg[SEQ] = prbseq;
+	tst = htonl (tstamp_now ());
+	memcpy (&prb->sw_seg[TST], &tst, TSTLEN);
+	prb->sw_seglen = PRBLEN;
+
+	return prb;
+}
+
+
 void
-segwrap_destroy (struct segwrap *sw)
+segwrap_destroy (proxy_t *px, struct segwrap *sw)
 {
-	assert (init_done == TRUE);
-	qenqueue (&swcache, sw);
+	assert (px->px_segment_ready == TRUE);
+	slab_free (sw->sw_ctrl ? &px->px_ct_slab : &px->px_sw_slab, sw);
 }
 
 
 void
-segwrap_fill (struct segwrap *sw, cqueue_t *src, len_t pldlen, seq_t seqnum)
+segwrap_fill (struct segwrap *sw, cqueue_t *src, len_t pldlen, seq_t seqnum,
+		tst_t *tst)
 {
 	/* Riempe il segmento del segwrap sw con i dati presi dalla coda src.
 	 * Il segmento avra' payload lungo pldlen, il numero di sequenza
-	 * seqnum e le flag PLDFLAG e LENFLAG appropriate. */
+	 * seqnum e le flag PLDFLAG e LENFLAG appropriate. Se tst non e' NULL
+	 * il segmento porta anche il timestamp *tst. */
 
 	int err;
 	pld_t *pld;
+	tst_t nettst;
 
 	assert (sw != NULL);
 	assert (src != NULL);
@@ -238,32 +366,29 @@ segwrap_fill (struct segwrap *sw, cqueue_t *src, len_t pldlen, seq_t seqnum)
 	}
 	/* Seqnum. */
 	sw->sw_seg[SEQ] = seqnum;
+	/* Timestamp. */
+	if (tst != NULL) {
+		sw->sw_seg[FLG] |= TSTFLAG;
+		nettst = htonl (*tst);
+		memcpy (&sw->sw_seg[seg_hdr_len (sw->sw_seg) - TSTLEN],
+				&nettst, TSTLEN);
+	}
 	/* Payload. */
 	pld = seg_pld (sw->sw_seg);
 	err = cqueue_remove (src, pld, pldlen);
 	assert (!err);
 	/* Seqlen. */
-	sw->sw_seglen = FLGLEN + SEQLEN
-		+ (pldlen == PLDDEFLEN ? 0 : LENLEN) + pldlen;
-}
-
-
-void
-segwrap_flush_cache (void)
-{
-	struct segwrap *cur;
-
-	while ((cur = qdequeue (&swcache)) != NULL)
-		xfree (cur);
-
-	assert (isEmpty (swcache));
+	sw->sw_seglen = seg_hdr_len (sw->sw_seg) + pldlen;
 }
 
 
 bool
 segwrap_is_acked (struct segwrap *sw, struct segwrap *ack)
 {
-	if (segwrap_seqcmp (sw, ack) <= 0)
+	/* Solo i segmenti dati sono confermati dagli ack: sonde, nak e ack
+	 * usano il seqnum per altro. */
+
+	if (seg_pld (sw->sw_seg) != NULL && segwrap_seqcmp (sw, ack) <= 0)
 		return TRUE;
 	return FALSE;
 }
@@ -272,21 +397,11 @@ segwrap_is_acked (struct segwrap *sw, struct segwrap *ack)
 int
 segwrap_prio (struct segwrap *sw)
 {
-	/* Ritorna
-	 * 0 se sw e' un NAK
-	 * 1 se sw e' un segmento dati da rispedire
-	 * 2 se sw e' un ACK
-	 * 3 se sw e' un segmento dati. */
-
-	if (seg_is_nak (sw->sw_seg))
-		return 0;
-	if (seg_is_ack (sw->sw_seg))
-		return 2;
+	/* Ritorna la classe di urgenza di sw, vedi flags_prio. */
 
-	assert (seg_pld (sw->sw_seg) != NULL);
-	if (seg_is_critical (sw->sw_seg))
-		return 1;
-	return 3;
+	assert (sw != NULL);
+	assert (prio_tab[sw->sw_seg[FLG]] != 4 || seg_pld (sw->sw_seg) != NULL);
+	return prio_tab[sw->sw_seg[FLG]];
 }
 
 
@@ -301,8 +416,8 @@ segwrap_print (struct segwrap *sw)
 	pldlen = seg_pld_len (sw->sw_seg);
 
 	/* Flag, seqnum, pldlen e seglen. */
-	printf ("%u,%d,%d/%d ", sw->sw_seg[FLG], seg_seq (sw->sw_seg),
-			pldlen, sw->sw_seglen);
+	printf ("%u,%d,%d/%lu ", sw->sw_seg[FLG], seg_seq (sw->sw_seg),
+			pldlen, (unsigned long)sw->sw_seglen);
 
 	if (pld != NULL) for (i = 0; i < pldlen; i++) {
 		putchar (pld[i]);
@@ -328,11 +443,14 @@ segwrap_urgcmp (struct segwrap *sw_1, struct segwrap *sw_2)
 	 * A parita' di tipo e' piu' urgente quello con timestamp minore.
 	 * A parita' di timestamp, quello con il seqnum minore. */
 
+	int prio_1;
+	int prio_2;
+
 	/* Controllo priorita'. */
-	if (segwrap_prio (sw_1) < segwrap_prio (sw_2))
-		return -1;
-	if (segwrap_prio (sw_1) > segwrap_prio (sw_2))
-		return 1;
+	prio_1 = segwrap_prio (sw_1);
+	prio_2 = segwrap_prio (sw_2);
+	if (prio_1 != prio_2)
+		return (prio_1 < prio_2 ? -1 : 1);
 
 	/* Priorita' identica, controllo timestamp. */
 	if (sw_1->sw_tstamp < sw_2->sw_tstamp)
@@ -340,9 +458,11 @@ segwrap_urgcmp (struct segwrap *sw_1, struct segwrap *sw_2)
 	if (sw_1->sw_tstamp > sw_2->sw_tstamp)
 		return 1;
 
-	/* Timestamp identico, controllo seqnum. */
-	assert (segwrap_seqcmp (sw_1, sw_2) != 0);
-	return segwrap_seqcmp (sw_1, sw_2);
+	/* Timestamp identico, controllo seqnum. Due ACK dello stesso
+	 * seqnum, la conferma e la sua ripetizione, sono intercambiabili. */
+	assert (sw_1->sw_seg[SEQ] != sw_2->sw_seg[SEQ]
+	        || seg_is_ack (sw_1->sw_seg));
+	return seqcmp (sw_1->sw_seg[SEQ], sw_2->sw_seg[SEQ]);
 }
 
 
@@ -368,36 +488,125 @@ seqcmp (seq_t a, seq_t b)
 *******************************************************************************/
 
 static void
-handle_rcvd_ack (struct segwrap *ack)
+handle_rcvd_ack (proxy_t *px, struct segwrap *ack)
 {
 	/* Rimuove e dealloca tutti i segmenti con seqnum minore o uguale ad
-	 * ack da tutte le strutture dati del proxy. */
+	 * ack da tutte le strutture dati del proxy.
+	 * Un ack uguale all'ultimo, spedito dal peer per dati ricevuti,
+	 * segnala che il segmento successivo e' perso: se e' ancora in
+	 * ht_sent va rispedito. La ripetizione periodica (RPTFLAG) no, il
+	 * successivo puo' essere ancora in volo, e nemmeno un ack vecchio
+	 * arrivato in ritardo da un canale lento. */
 
 	struct segwrap *old_ack;
-
-	assert (init_done);
-
-	seghash_rm_acked (ht_sent, HT_SENT_SIZE, ack);
-	urgent_rm_acked (ack);
-	old_ack = set_last_ack_rcvd (ack);
+	struct segwrap *rmvdq;
+
+	assert (px->px_segment_ready);
+
+	trace_segment (TR_ACK, ack, -1);
+	rmvdq = seghash_rm_acked (px->px_ht_sent, HT_SENT_SIZE, ack);
+	while (!isEmpty (rmvdq))
+		segwrap_destroy (px, qdequeue (&rmvdq));
+	urgent_rm_acked (px, ack);
+	old_ack = set_last_ack_rcvd (px, ack);
+	if (old_ack == ack && !(ack->sw_seg[FLG] & RPTFLAG)
+	    && segwrap_seqcmp (ack, px->px_last_ack_rcvd) == 0) {
+		ack->sw_seg[SEQ]++;
+		handle_rcvd_nak (px, ack);
+	}
 	if (old_ack != NULL)
-		segwrap_destroy (old_ack);
-	else
-		segwrap_destroy (ack);
+		segwrap_destroy (px, old_ack);
 }
 
 
 static void
-handle_rcvd_nak (struct segwrap *nak)
+handle_rcvd_nak (proxy_t *px, struct segwrap *nak)
 {
 	/* Recupera il segmento con il seqnum indicato dal nak e lo
 	 * aggiunge ai segmenti urgenti, dopo aver impostato CRTFLAG. */
 
 	struct segwrap *urg;
 
-	urg = seghash_remove (ht_sent, HT_SENT_SIZE, seg_seq (nak->sw_seg));
+	urg = seghash_remove (px->px_ht_sent, HT_SENT_SIZE,
+			seg_seq (nak->sw_seg));
+	MH_PROBE2 (nak_rcvd, seg_seq (nak->sw_seg), urg != NULL);
 	if (urg != NULL) {
+		trace_segment (TR_RETRANS, urg, -1);
 		urg->sw_seg[FLG] |= CRTFLAG;
-		urgent_add (urg);
+		urgent_add (px, urg);
+	}
+}
+
+
+static void
+handle_rcvd_probe (proxy_t *px, struct segwrap *prb, cd_t cd)
+{
+	/* Una sonda viene rispedita sullo stesso canale come echo, senza
+	 * toccare il timestamp del mittente; un echo fornisce un campione di
+	 * RTT del canale. */
+
+	if (seg_is_probe (prb->sw_seg)) {
+		prb->sw_seg[FLG] = 0 | ECHFLAG;
+		channel_add_ctrl (px, cd, prb);
+	} else {
+		channel_rtt_sample (px, cd, tstamp_diff (tstamp_now (),
+					seg_tst (prb->sw_seg)));
+		segwrap_destroy (px, prb);
 	}
 }
+
+
+static int
+flags_prio (flag_t flg)
+{
+	/* Ritorna la classe di urgenza di un segmento con campo flag flg:
+	 * 0 se e' una sonda o un echo
+	 * 1 se e' un NAK
+	 * 2 se e' un segmento dati da rispedire
+	 * 3 se e' un ACK
+	 * 4 se e' un segmento dati. */
+
+	if (flg & (PRBFLAG | ECHFLAG))
+		return 0;
+	if (flg & NAKFLAG)
+		return 1;
+	if (flg & ACKFLAG)
+		return 3;
+	if (flg & CRTFLAG)
+		return 2;
+	return 4;
+}
+
+
+static void
+prio_tab_init (void)
+{
+	int flg;
+
+	for (flg = 0; flg <= UINT8_MAX; flg++)
+		prio_tab[flg] = flags_prio (flg);
+}
+
+
+static struct segwrap *
+wrap_alloc (proxy_t *px, bool ctrl)
+{
+	/* Prende un segwrap dalla slab dei segwrap di controllo se ctrl e'
+	 * TRUE, altrimenti da quella dei segwrap completi. */
+
+	struct segwrap *newsw;
+	struct timeval now;
+
+	assert (px->px_segment_ready == TRUE);
+
+	newsw = slab_alloc (ctrl ? &px->px_ct_slab : &px->px_sw_slab);
+	newsw->sw_prev = NULL;
+	newsw->sw_next = NULL;
+	newsw->sw_ctrl = ctrl;
+
+	/* Timestamp. */
+	gettime (&now);
+	newsw->sw_tstamp = tv2d (&now, FALSE);
+
+	return newsw;
+}
@@ -0,0 +1,145 @@
+#include "h/crono.h"
+#include "h/sim.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Socket di controllo verso mhsim, -1 se il proxy gira in tempo reale.
+ * Il proxy vi scrive la scadenza a cui vuole essere risvegliato quando non ha
+ * niente da fare, il simulatore risponde con l'istante virtuale a cui lo
+ * risveglia; entrambi sono uint64_t in ns. Gira un solo processo alla volta,
+ * per cui la simulazione e' deterministica. */
+static fd_t sim_fd = -1;
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void sim_flush_acks (int nfds);
+static void sim_wait (uint64_t deadline);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+bool
+sim_enabled (void)
+{
+	return (sim_fd >= 0 ? TRUE : FALSE);
+}
+
+
+void
+sim_init (void)
+{
+	char *env;
+	char *endptr;
+	long fd;
+	uint64_t now;
+
+	env = getenv ("MHSIM_FD");
+	if (env == NULL)
+		return;
+
+	fd = strtol (env, &endptr, 10);
+	if (endptr == env || *endptr != '\0' || fd < 0) {
+		fprintf (stderr, "MHSIM_FD non valido: %s\n", env);
+		exit (EXIT_FAILURE);
+	}
+	sim_fd = fd;
+
+	/* Il primo turno arriva quando il simulatore lo decide. */
+	if (read (sim_fd, &now, sizeof (now)) != sizeof (now))
+		exit (EXIT_SUCCESS);
+	crono_set_virtual (now);
+}
+
+
+int
+sim_select (int nfds, fd_set *rdset, fd_set *wrset, struct timeval *timeout)
+{
+	/* Ogni volta che il proxy viene risvegliato ricontrolla i fd senza
+	 * attendere: i dati scritti dal simulatore sono gia' nei socket.
+	 * L'attesa dura almeno un microsecondo, la risoluzione di gettime,
+	 * altrimenti un timeout arrotondato a zero da d2tv non scadrebbe mai
+	 * perche' il tempo virtuale non avanza. */
+
+	int rdy;
+	fd_set rdsave;
+	fd_set wrsave;
+	uint64_t deadline;
+
+	assert (sim_enabled ());
+
+	deadline = UINT64_MAX;
+	if (timeout != NULL)
+		deadline = clock_ns () + MAX ((uint64_t)timeout->tv_sec
+				* 1000000000 + timeout->tv_usec * 1000, 1000);
+	rdsave = *rdset;
+	wrsave = *wrset;
+	for (;;) {
+		struct timeval zero;
+
+		zero.tv_sec = 0;
+		zero.tv_usec = 0;
+		rdy = select (nfds, rdset, wrset, NULL, &zero);
+		if (rdy != 0 || clock_ns () >= deadline)
+			return rdy;
+
+		sim_flush_acks (nfds);
+		sim_wait (deadline);
+		*rdset = rdsave;
+		*wrset = wrsave;
+	}
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+sim_flush_acks (int nfds)
+{
+	/* Conferma subito i dati ricevuti su tutti i socket prima di cedere il
+	 * turno: l'ack ritardato del kernel scade in tempo reale e il
+	 * simulatore vedrebbe i buffer dall'altra parte liberarsi a caso.
+	 * Sui fd che non sono socket tcp setsockopt fallisce senza danni. */
+
+	int fd;
+	int optval;
+
+	optval = 1;
+	for (fd = 0; fd < nfds; fd++)
+		if (fd != sim_fd)
+			setsockopt (fd, IPPROTO_TCP, TCP_QUICKACK, &optval,
+					sizeof (optval));
+}
+
+
+static void
+sim_wait (uint64_t deadline)
+{
+	/* Cede il turno al simulatore fino a deadline e aggiorna l'orologio
+	 * virtuale. Se il simulatore ha chiuso la simulazione e' finita. */
+
+	uint64_t now;
+
+	if (write (sim_fd, &deadline, sizeof (deadline)) != sizeof (deadline)
+	    || read (sim_fd, &now, sizeof (now)) != sizeof (now))
+		exit (EXIT_SUCCESS);
+	crono_set_virtual (now);
+}
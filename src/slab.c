@@ -0,0 +1,256 @@
+#include "h/slab.h"
+#include "h/stats.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <sys/mman.h>
+
+#define     TYPE     struct slab_arena
+#define     NEXT     sa_next
+#define     PREV     sa_prev
+#define     EMPTYQ   NULL
+#include "src/queue_template"
+
+
+/*******************************************************************************
+				    Macro
+*******************************************************************************/
+
+#define     ROUNDUP(x,a)   (((x) + (a) - 1) & ~(size_t)((a) - 1))
+
+/* Inizio degli oggetti in un'arena. */
+#define     OBJOFF         ROUNDUP (sizeof (struct slab_arena), CACHE_LINE)
+#define     OBJS(sa)       ((char *)(sa) + OBJOFF)
+
+/* Arena dell'oggetto obj. */
+#define     ARENA(sl,obj)  ((struct slab_arena *)((uintptr_t)(obj)          \
+                            & ~(uintptr_t)((sl)->sl_arenasize - 1)))
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static struct slab_arena *arena_create (slab_t *sl);
+static void arena_destroy (slab_t *sl, struct slab_arena *sa);
+static void trim (slab_t *sl);
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Dimensione delle arene delle prossime slab, vedi slab_hugepages_enable. */
+static size_t arena_size = SLAB_ARENA;
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+void *
+slab_alloc (slab_t *sl)
+{
+	/* Prende l'oggetto dalla prima arena con oggetti liberi: prima quelli
+	 * liberati, poi quelli mai usati. */
+
+	void *obj;
+	struct slab_arena *sa;
+
+	assert (sl != NULL);
+
+	sa = getHead (sl->sl_partial);
+	if (sa == NULL) {
+		sa = qdequeue (&sl->sl_empty);
+		if (sa == NULL)
+			sa = arena_create (sl);
+		qpush (&sl->sl_partial, sa);
+	}
+
+	if (sa->sa_free != NULL) {
+		obj = sa->sa_free;
+		sa->sa_free = *(void **) obj;
+	} else {
+		obj = sa->sa_bump;
+		sa->sa_bump += sl->sl_objsize;
+	}
+	if (++sa->sa_used == sl->sl_perarena)
+		qenqueue (&sl->sl_full, qremove (&sl->sl_partial, sa));
+
+	sl->sl_nfree--;
+	STATS_ADD (st_slab[sl->sl_id].ss_used, 1);
+	STATS_SET (st_slab[sl->sl_id].ss_free, sl->sl_nfree);
+	return obj;
+}
+
+
+void
+slab_destroy (slab_t *sl)
+{
+	struct slab_arena *sa;
+
+	assert (sl != NULL);
+
+	while ((sa = qdequeue (&sl->sl_partial)) != NULL)
+		arena_destroy (sl, sa);
+	while ((sa = qdequeue (&sl->sl_full)) != NULL)
+		arena_destroy (sl, sa);
+	while ((sa = qdequeue (&sl->sl_empty)) != NULL)
+		arena_destroy (sl, sa);
+	assert (sl->sl_nfree == 0);
+}
+
+
+void
+slab_free (slab_t *sl, void *obj)
+{
+	/* L'oggetto torna in testa alla lista della sua arena, che passa
+	 * tra le vuote se non ne ha piu' in uso. */
+
+	struct slab_arena *sa;
+
+	assert (sl != NULL);
+	assert (obj != NULL);
+
+	sa = ARENA (sl, obj);
+	assert (sa->sa_used > 0);
+
+	*(void **) obj = sa->sa_free;
+	sa->sa_free = obj;
+	if (sa->sa_used-- == sl->sl_perarena)
+		qenqueue (&sl->sl_partial, qremove (&sl->sl_full, sa));
+	if (sa->sa_used == 0)
+		qpush (&sl->sl_empty, qremove (&sl->sl_partial, sa));
+
+	sl->sl_nfree++;
+	STATS_SUB (st_slab[sl->sl_id].ss_used, 1);
+	STATS_SET (st_slab[sl->sl_id].ss_free, sl->sl_nfree);
+	if (sl->sl_nfree > sl->sl_hiwat)
+		trim (sl);
+}
+
+
+void
+slab_hugepages_enable (void)
+{
+	arena_size = SLAB_HUGE_ARENA;
+}
+
+
+void
+slab_init (slab_t *sl, size_t objsize, size_t align, int id)
+{
+	/* Gli oggetti partono da OBJOFF, multiplo di CACHE_LINE, e hanno
+	 * dimensione multipla di align, per cui restano tutti allineati. */
+
+	assert (sl != NULL);
+	assert (objsize > 0);
+	assert (align >= sizeof (void *) && align <= CACHE_LINE);
+	assert ((align & (align - 1)) == 0);
+	assert (id >= 0 && id < SLABS);
+
+	sl->sl_objsize = ROUNDUP (MAX (objsize, sizeof (void *)), align);
+	sl->sl_arenasize = arena_size;
+	sl->sl_perarena = (arena_size - OBJOFF) / sl->sl_objsize;
+	assert (sl->sl_perarena > 0);
+	sl->sl_partial = newQueue ();
+	sl->sl_full = newQueue ();
+	sl->sl_empty = newQueue ();
+	sl->sl_nfree = 0;
+	sl->sl_hiwat = SLAB_HIWAT * sl->sl_perarena;
+	sl->sl_lowat = SLAB_LOWAT * sl->sl_perarena;
+	sl->sl_id = id;
+}
+
+
+void
+slab_reserve (slab_t *sl, size_t nobj)
+{
+	assert (sl != NULL);
+
+	sl->sl_lowat = MAX (sl->sl_lowat, nobj);
+	sl->sl_hiwat = MAX (sl->sl_hiwat, sl->sl_lowat
+			+ (SLAB_HIWAT - SLAB_LOWAT) * sl->sl_perarena);
+	while (sl->sl_nfree < nobj)
+		qpush (&sl->sl_empty, arena_create (sl));
+	STATS_SET (st_slab[sl->sl_id].ss_free, sl->sl_nfree);
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static struct slab_arena *
+arena_create (slab_t *sl)
+{
+	/* Mappa un'arena allineata alla sua dimensione: ne riserva il
+	 * doppio e rilascia quanto avanza prima e dopo. Le pagine sono
+	 * toccate solo quando gli oggetti vengono usati. */
+
+	char *base;
+	char *end;
+	size_t len;
+	struct slab_arena *sa;
+
+	len = sl->sl_arenasize;
+	base = mmap (NULL, 2 * len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		perror ("Impossibile allocare memoria");
+		exit (EXIT_FAILURE);
+	}
+	end = base + 2 * len;
+	sa = (struct slab_arena *) ROUNDUP ((uintptr_t) base, len);
+	if ((char *) sa > base)
+		munmap (base, (char *) sa - base);
+	if ((char *) sa + len < end)
+		munmap ((char *) sa + len, end - ((char *) sa + len));
+#ifdef MADV_HUGEPAGE
+	if (len == SLAB_HUGE_ARENA)
+		madvise (sa, len, MADV_HUGEPAGE);
+#endif
+
+	alloc_note ("slab", len);
+	sa->sa_free = NULL;
+	sa->sa_bump = OBJS (sa);
+	sa->sa_used = 0;
+	sa->sa_next = NULL;
+	sa->sa_prev = NULL;
+
+	sl->sl_nfree += sl->sl_perarena;
+	STATS_ADD (st_slab[sl->sl_id].ss_arenas, 1);
+	STATS_ADD (st_slab[sl->sl_id].ss_bytes, len);
+	STATS_ADD (st_slab[sl->sl_id].ss_maps, 1);
+	return sa;
+}
+
+
+static void
+arena_destroy (slab_t *sl, struct slab_arena *sa)
+{
+	/* Restituisce al sistema l'arena sa, gia' tolta dalle code. */
+
+	STATS_SUB (st_slab[sl->sl_id].ss_used, sa->sa_used);
+	sl->sl_nfree -= sl->sl_perarena - sa->sa_used;
+	STATS_SET (st_slab[sl->sl_id].ss_free, sl->sl_nfree);
+	STATS_SUB (st_slab[sl->sl_id].ss_arenas, 1);
+	STATS_SUB (st_slab[sl->sl_id].ss_bytes, sl->sl_arenasize);
+	STATS_ADD (st_slab[sl->sl_id].ss_unmaps, 1);
+	munmap (sa, sl->sl_arenasize);
+}
+
+
+static void
+trim (slab_t *sl)
+{
+	/* Oltre sl_hiwat oggetti liberi rilascia le arene vuote, finche' ne
+	 * restano liberi almeno sl_lowat. */
+
+	struct slab_arena *sa;
+
+	while ((sa = getHead (sl->sl_empty)) != NULL
+	       && sl->sl_nfree - sl->sl_perarena >= sl->sl_lowat)
+		arena_destroy (sl, qremove (&sl->sl_empty, sa));
+}
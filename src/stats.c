@@ -0,0 +1,133 @@
+#include "h/stats.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*******************************************************************************
+				  Variabili
+*******************************************************************************/
+
+/* Usata finche' la regione condivisa non e' stata creata, o se non puo'
+ * esserlo. */
+static struct mhstats local_stats;
+
+struct mhstats *mh_stats = &local_stats;
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Nome della regione condivisa, stringa vuota se non e' stata creata. */
+static char region_name[32];
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static void stats_unlink (void);
+static void stats_unlink_on_signal (int sig);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+void
+stats_init (char *name)
+{
+	int err;
+	fd_t fd;
+	struct mhstats *region;
+	char *base;
+
+	assert (name != NULL);
+	assert (mh_stats == &local_stats);
+
+	sprintf (region_name, STATS_PREFIX "%ld", (long)getpid ());
+
+	fd = shm_open (region_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto error;
+
+	err = ftruncate (fd, sizeof (struct mhstats));
+	if (err) {
+		close (fd);
+		shm_unlink (region_name);
+		goto error;
+	}
+
+	region = mmap (NULL, sizeof (struct mhstats), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close (fd);
+	if (region == MAP_FAILED) {
+		shm_unlink (region_name);
+		goto error;
+	}
+
+	/* Il contenuto e' zero grazie a ftruncate, i contatori accumulati
+	 * prima della creazione vengono riportati. */
+	memcpy (region, &local_stats, sizeof (struct mhstats));
+	mh_stats = region;
+
+	atexit (stats_unlink);
+	signal (SIGINT, stats_unlink_on_signal);
+	signal (SIGTERM, stats_unlink_on_signal);
+	goto header;
+
+error:
+	fprintf (stderr, "Statistiche non condivise, %s: %s\n", region_name,
+			strerror (errno));
+	region_name[0] = '\0';
+
+header:
+	/* Il magic per ultimo: mhstat non deve vedere un'intestazione
+	 * incompleta. */
+	base = strrchr (name, '/');
+	strncpy (mh_stats->st_name, base != NULL ? base + 1 : name,
+			sizeof (mh_stats->st_name) - 1);
+	STATS_SET (st_pid, getpid ());
+	STATS_SET (st_version, STATS_VERSION);
+	__atomic_store_n (&mh_stats->st_magic, STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+
+char *
+stats_region_name (void)
+{
+	if (region_name[0] == '\0')
+		return NULL;
+	return region_name;
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static void
+stats_unlink (void)
+{
+	if (region_name[0] != '\0')
+		shm_unlink (region_name);
+}
+
+
+static void
+stats_unlink_on_signal (int sig)
+{
+	/* Rimuove la regione e termina con il comportamento predefinito del
+	 * segnale. */
+
+	stats_unlink ();
+	signal (sig, SIG_DFL);
+	raise (sig);
+}
@@ -1,8 +1,13 @@
 #include "h/types.h"
 #include "h/util.h"
+#include "h/channel.h"
 #include "h/crono.h"
+#include "h/probes.h"
 #include "h/segment.h"
+#include "h/slab.h"
+#include "h/stats.h"
 #include "h/timeout.h"
+#include "h/trace.h"
 
 #include <assert.h>
 #include <config.h>
@@ -23,34 +28,16 @@
 #define     HUGE_TIMEOUT     1000000000
 
 #define     VALID_CLASS(cn)                             \
-	((cn) == TOACK || (cn) == TOACT || (cn) == TONAK)
-
-
-/*******************************************************************************
-			       Variabili locali
-*******************************************************************************/
-
-/* Code di timeout.
- * Per ogni coda l'ordine dei timeout e' indifferente. */
-static timeout_t *tqueue[TMOUTS];
-
-/* Intervallo spedizione ACK.
- * XXX per ora viene solo inizializzato da init_timeout_module, quindi non
- * XXX viene controllato da check_timeouts.
- * XXX Sara' passato ad add_timeout alla ricezione del primo segmento. */
-static timeout_t ack_timeout;
-
-/* Controllo paranoia. */
-static bool init_done = FALSE;
+	((cn) == TOACK || (cn) == TOACT || (cn) == TONAK || (cn) == TOPRB)
 
 
 /*******************************************************************************
 		       Prototipi delle funzioni locali
 *******************************************************************************/
 
-static void ack_handler (int seq);
-static void nak_handler (int seq);
-static double timeout_check (timeout_t *to);
+static void ack_handler (proxy_t *px, int seq);
+static void nak_handler (proxy_t *px, int seq);
+static double timeout_check (proxy_t *px, timeout_t *to);
 
 
 /*******************************************************************************
@@ -59,7 +46,7 @@ static double timeout_check (timeout_t *to);
 
 
 void
-add_timeout (timeout_t *to, int class)
+add_timeout (proxy_t *px, timeout_t *to, int class)
 {
 	/* Aggiunge to alla lista dei timeout di classe class, in modo che
 	 * venga gestito da check_timeouts.
@@ -69,56 +56,71 @@ add_timeout (timeout_t *to, int class)
 
 	assert (to != NULL);
 	assert (VALID_CLASS (class));
-	assert (init_done);
-	assert (!qcontains (tqueue[class], to));
+	assert (px->px_timeout_ready);
+	assert (!qcontains (px->px_tqueue[class], to));
 
-	qenqueue (&tqueue[class], to);
+	qenqueue (&px->px_tqueue[class], to);
+	STATS_ADD (st_timers[class], 1);
 }
 
 
 void
-add_nak_timeout (seq_t seq)
+add_nak_timeout (proxy_t *px, seq_t seq)
 {
 	timeout_t *to;
 
-	assert (init_done);
+	assert (px->px_timeout_ready);
 
 	/* XXX Non e' oneshot perche' i nak non vengono spediti duplicati,
 	 * XXX quindi tocca insistere. */
-	to = timeout_create (TONAK_VAL, nak_handler, seq, FALSE);
+	to = timeout_create (px, TONAK_VAL, nak_handler, seq, FALSE);
 	timeout_reset (to);
-	add_timeout (to, TONAK);
+	add_timeout (px, to, TONAK);
 }
 
 
 double
-check_timeouts (void)
+check_timeouts (proxy_t *px)
 {
 	/* Chiama timeout_check su tutti i timeout.
 	 * Ritorna il valore del timeout piu' prossimo a scadere. */
 
 	int i;
+	bool oneshot;
 	double left;
+	double maxval;
 	double min = HUGE_TIMEOUT;
 	timeout_t *cur;
 	timeout_t *nxt;
 
-	assert (init_done);
+	assert (px->px_timeout_ready);
 
 	for (i = 0; i < TMOUTS; i++) {
-		cur = getHead (tqueue[i]);
-		while (!isEmpty (tqueue[i]) && cur != NULL) {
-			if (getNext (cur) == getHead (tqueue[i]))
+		cur = getHead (px->px_tqueue[i]);
+		while (!isEmpty (px->px_tqueue[i]) && cur != NULL) {
+			if (getNext (cur) == getHead (px->px_tqueue[i]))
 				nxt = NULL;
 			else
 				nxt = getNext (cur);
-			left = timeout_check (cur);
+			/* Il trigger puo' deallocare il suo stesso timeout (es.
+			 * channel_close), cur non va piu' usato dopo il
+			 * controllo se non e' oneshot. */
+			oneshot = cur->to_oneshot;
+			maxval = cur->to_maxval;
+			left = timeout_check (px, cur);
+			if (left <= 0) {
+				STATS_ADD (st_fired[i], 1);
+				MH_PROBE2 (timeout_fired, i,
+						(long)(-left * 1000000));
+			}
 			if (left > 0)
 				min = MIN (min, left);
-			else if (cur->to_oneshot == TRUE) {
-				del_timeout (cur, i);
-				timeout_destroy (cur);
-			}
+			else if (oneshot == TRUE) {
+				del_timeout (px, cur, i);
+				timeout_destroy (px, cur);
+			} else
+				/* Appena ripartito, riscade tra maxval. */
+				min = MIN (min, maxval);
 			cur = nxt;
 		}
 	}
@@ -128,44 +130,70 @@ check_timeouts (void)
 
 
 void
-del_timeout (timeout_t *to, int class)
+del_timeout (proxy_t *px, timeout_t *to, int class)
 {
-	/* Rimuove to dalla lista di classe class. */
+	/* Rimuove to dalla lista di classe class, se presente. */
 
 	assert (to != NULL);
 	assert (class < TMOUTS);
-	assert (init_done);
+	assert (px->px_timeout_ready);
 
-	qremove (&tqueue[class], to);
+	if (qcontains (px->px_tqueue[class], to)) {
+		qremove (&px->px_tqueue[class], to);
+		STATS_SUB (st_timers[class], 1);
+	}
 }
 
 
 void
-del_nak_timeout (seq_t seq)
+del_nak_timeout (proxy_t *px, seq_t seq)
 {
 	timeout_t *nakto;
 
-	assert (init_done);
+	assert (px->px_timeout_ready);
 
-	nakto = get_timeout (TONAK, seq);
+	nakto = get_timeout (px, TONAK, seq);
 
 	if (nakto != NULL) {
-		del_timeout (nakto, TONAK);
-		timeout_destroy (nakto);
+		del_timeout (px, nakto, TONAK);
+		timeout_destroy (px, nakto);
 	}
 }
 
 
+void
+destroy_timeout_module (proxy_t *px)
+{
+	/* Dealloca i timeout rimasti nelle code, tranne quello degli ACK che
+	 * sta in px, e rilascia la slab. */
+
+	int i;
+	timeout_t *to;
+
+	assert (px->px_timeout_ready);
+
+	for (i = 0; i < TMOUTS; i++)
+		while ((to = qdequeue (&px->px_tqueue[i])) != NULL) {
+			STATS_SUB (st_timers[i], 1);
+			if (to != &px->px_ack_timeout)
+				timeout_destroy (px, to);
+		}
+	slab_destroy (&px->px_to_slab);
+
+	px->px_timeout_ready = FALSE;
+}
+
+
 timeout_t *
-get_timeout (int class, int id)
+get_timeout (proxy_t *px, int class, int id)
 {
 	timeout_t *cur;
 	timeout_t *head;
 
 	assert (VALID_CLASS (class));
-	assert (init_done);
+	assert (px->px_timeout_ready);
 
-	head = getHead (tqueue[class]);
+	head = getHead (px->px_tqueue[class]);
 	if (head == NULL)
 		return NULL;
 
@@ -175,6 +203,7 @@ get_timeout (int class, int id)
 
 	case TOACT :
 	case TONAK :
+	case TOPRB :
 		cur = head;
 		while (cur->to_trigger_arg != id
 		       && (cur = getNext (cur)) != head)
@@ -191,30 +220,37 @@ get_timeout (int class, int id)
 
 
 void
-init_timeout_module (void)
+init_timeout_module (proxy_t *px)
 {
 	/* Inizializza le code delle classi dei timeout e imposta il timeout
-	 * degli ack. */
+	 * degli ack: oltre a quelli spediti ogni ACKEVERY segmenti
+	 * consegnati, ripete la conferma nel caso che l'ultimo ACK sia andato
+	 * perso con la chiusura di un canale. */
 
 	int i;
 
-	assert (!init_done);
+	assert (!px->px_timeout_ready);
 
 	for (i = 0; i < TMOUTS; i++)
-		tqueue[i] = newQueue ();
+		px->px_tqueue[i] = newQueue ();
+	slab_init (&px->px_to_slab, sizeof (timeout_t), sizeof (double), SLTO);
+	/* Un NAK per seqnum, attivita' e sonda per canale. */
+	slab_reserve (&px->px_to_slab, SEQMAX + 1 + 2 * NETCHANNELS);
 
-	timeout_init (&ack_timeout, TOACK, ack_handler, 0, FALSE);
+	px->px_timeout_ready = TRUE;
 
-	init_done = TRUE;
+	timeout_init (&px->px_ack_timeout, TOACK_VAL, ack_handler, 0, FALSE);
+	timeout_reset (&px->px_ack_timeout);
+	add_timeout (px, &px->px_ack_timeout, TOACK);
 }
 
 
 timeout_t *
-timeout_create
-(double maxval, timeout_handler_t trigger, int trigger_arg, bool oneshot)
+timeout_create (proxy_t *px, double maxval, timeout_handler_t trigger,
+		int trigger_arg, bool oneshot)
 {
-	/* Crea e inizializza un timeout, restituendone il puntatore.
-	 * Il timeout puo' essere attivato con timeout_reset. */
+	/* Crea e inizializza un timeout dalla slab di px, restituendone il
+	 * puntatore. Il timeout puo' essere attivato con timeout_reset. */
 
 	timeout_t *newto;
 
@@ -222,7 +258,7 @@ timeout_create
 	assert (trigger != NULL);
 	assert (BOOL_VALUE (oneshot));
 
-	newto = xmalloc (sizeof (timeout_t));
+	newto = slab_alloc (&px->px_to_slab);
 	timeout_init (newto, maxval, trigger, trigger_arg, oneshot);
 
 	return newto;
@@ -230,12 +266,12 @@ timeout_create
 
 
 void
-timeout_destroy (timeout_t *to)
+timeout_destroy (proxy_t *px, timeout_t *to)
 {
-	/* Dealloca le strutture dati associate a to. */
+	/* Restituisce to, creato con timeout_create, alla slab di px. */
 
 	assert (to != NULL);
-	xfree (to);
+	slab_free (&px->px_to_slab, to);
 }
 
 
@@ -269,30 +305,40 @@ timeout_reset (timeout_t *to)
 }
 
 
+void
+timeout_set_maxval (timeout_t *to, double maxval)
+{
+	assert (to != NULL);
+	assert (maxval > 0);
+
+	to->to_maxval = maxval;
+}
+
+
 /*******************************************************************************
 			       Funzioni locali
 *******************************************************************************/
 
 static void
-ack_handler (int seq)
+ack_handler (proxy_t *px, int seq)
 {
-	/* TODO manda ack */
-	fprintf (stderr, "ACK!\n");
+	join_ack (px, TRUE);
 }
 
 
 static void
-nak_handler (int seq)
+nak_handler (proxy_t *px, int seq)
 {
 	struct segwrap *nak;
 
-	nak = segwrap_nak_create (seq);
-	urgent_add (nak);
+	nak = segwrap_nak_create (px, seq);
+	trace_segment (TR_NAKGEN, nak, -1);
+	urgent_add (px, nak);
 }
 
 
 static double
-timeout_check (timeout_t *to)
+timeout_check (proxy_t *px, timeout_t *to)
 {
 	/* Controlla il tempo rimasto in to e, se scaduto, esegue il trigger
 	 * associato e lo fa ripartire.
@@ -305,7 +351,7 @@ timeout_check (timeout_t *to)
 	left = to->to_maxval - crono_measure (&to->to_crono);
 	if (left <= 0) {
 		timeout_reset (to);
-		to->to_trigger (to->to_trigger_arg);
+		to->to_trigger (px, to->to_trigger_arg);
 	}
 	return left;
 }
@@ -0,0 +1,260 @@
+#include "h/crono.h"
+#include "h/segment.h"
+#include "h/trace.h"
+#include "h/types.h"
+#include "h/util.h"
+
+#include <config.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+
+
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* Eventi non ancora scritti sul file. Anelli e file sono del processo: li
+ * aprono solo psend e precv, che hanno un solo proxy e registrano tutto dal
+ * suo thread. Con il file chiuso, come in libmultihoming, non si tocca
+ * niente. */
+static struct trace_event trace_ring[TRACE_EVENTS];
+static size_t trace_next;
+
+static fd_t trace_fd = -1;
+
+/* Letture dall'host catturate, con l'istante dell'ultima. */
+static struct capture_read capture_ring[CAPTURE_READS];
+static size_t capture_next;
+static uint64_t capture_last;
+
+static fd_t capture_fd = -1;
+
+/* Gestori precedenti, richiamati dopo lo scaricamento. */
+static void (*prev_sigint) (int);
+static void (*prev_sigterm) (int);
+
+
+/*******************************************************************************
+		       Prototipi delle funzioni locali
+*******************************************************************************/
+
+static fd_t trace_create (char *path, char *name, uint32_t magic,
+		uint32_t version, size_t evsize);
+static void trace_flush_on_signal (int sig);
+static int trace_write (fd_t fd, void *buf, size_t nbytes);
+
+
+/*******************************************************************************
+			      Funzioni pubbliche
+*******************************************************************************/
+
+int
+capture_open (char *path, char *name)
+{
+	assert (path != NULL);
+	assert (name != NULL);
+	assert (capture_fd < 0);
+
+	capture_fd = trace_create (path, name, CAPTURE_MAGIC, CAPTURE_VERSION,
+			sizeof (struct capture_read));
+	if (capture_fd < 0)
+		return -1;
+
+	capture_next = 0;
+	capture_last = 0;
+	return 0;
+}
+
+
+void
+capture_host_read (size_t nread)
+{
+	uint64_t now;
+	uint64_t gap;
+	struct capture_read *cr;
+
+	assert (nread > 0);
+
+	if (capture_fd < 0)
+		return;
+
+	now = clock_ns ();
+	gap = (capture_last != 0 ? (now - capture_last) / 1000 : 0);
+	capture_last = now;
+
+	cr = &capture_ring[capture_next];
+	cr->ca_gap_us = MIN (gap, UINT32_MAX);
+	cr->ca_len = nread;
+
+	if (++capture_next == CAPTURE_READS)
+		trace_flush ();
+}
+
+
+void
+init_trace_module (void)
+{
+	/* Gli eventi ancora nell'anello vanno scritti anche quando il proxy
+	 * termina per un segnale. Da chiamare dopo stats_init, di cui
+	 * rispetta i gestori. */
+
+	if (trace_fd < 0 && capture_fd < 0)
+		return;
+
+	atexit (trace_flush);
+	prev_sigint = signal (SIGINT, trace_flush_on_signal);
+	prev_sigterm = signal (SIGTERM, trace_flush_on_signal);
+}
+
+
+void
+trace_flush (void)
+{
+	/* Niente messaggi in caso di errore: potremmo essere in un gestore
+	 * di segnale. */
+
+	if (trace_fd >= 0 && trace_next > 0
+	    && trace_write (trace_fd, trace_ring,
+	                    trace_next * sizeof (struct trace_event))) {
+		close (trace_fd);
+		trace_fd = -1;
+	}
+	trace_next = 0;
+
+	if (capture_fd >= 0 && capture_next > 0
+	    && trace_write (capture_fd, capture_ring,
+	                    capture_next * sizeof (struct capture_read))) {
+		close (capture_fd);
+		capture_fd = -1;
+	}
+	capture_next = 0;
+}
+
+
+int
+trace_open (char *path, char *name)
+{
+	assert (path != NULL);
+	assert (name != NULL);
+	assert (trace_fd < 0);
+
+	trace_fd = trace_create (path, name, TRACE_MAGIC, TRACE_VERSION,
+			sizeof (struct trace_event));
+	if (trace_fd < 0)
+		return -1;
+
+	trace_next = 0;
+	return 0;
+}
+
+
+void
+trace_seg (int type, seg_t *seg, size_t seglen, cd_t cd)
+{
+	struct trace_event *ev;
+
+	assert (type >= 0 && type < TRTYPES);
+	assert (seg != NULL);
+	assert (cd == -1 || VALID_CD (cd));
+
+	if (trace_fd < 0)
+		return;
+
+	ev = &trace_ring[trace_next];
+	ev->te_time = clock_ns ();
+	ev->te_len = seglen;
+	ev->te_type = type;
+	ev->te_seq = seg_seq (seg);
+	ev->te_flags = seg[FLG];
+	ev->te_cd = cd;
+
+	if (++trace_next == TRACE_EVENTS)
+		trace_flush ();
+}
+
+
+void
+trace_segment (int type, struct segwrap *sw, cd_t cd)
+{
+	assert (sw != NULL);
+	trace_seg (type, sw->sw_seg, sw->sw_seglen, cd);
+}
+
+
+/*******************************************************************************
+			       Funzioni locali
+*******************************************************************************/
+
+static fd_t
+trace_create (char *path, char *name, uint32_t magic, uint32_t version,
+		size_t evsize)
+{
+	/* Crea il file path e vi scrive l'intestazione, con il nome del
+	 * programma name.
+	 * Ritorna il descrittore, -1 in caso di errore. */
+
+	fd_t fd;
+	char *base;
+	struct trace_header th;
+
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf (stderr, "Traccia %s: %s\n", path, strerror (errno));
+		return -1;
+	}
+
+	memset (&th, 0, sizeof (th));
+	th.th_magic = magic;
+	th.th_version = version;
+	th.th_evsize = evsize;
+	th.th_pid = getpid ();
+	base = strrchr (name, '/');
+	strncpy (th.th_name, base != NULL ? base + 1 : name,
+			sizeof (th.th_name) - 1);
+
+	if (trace_write (fd, &th, sizeof (th))) {
+		fprintf (stderr, "Traccia %s: %s\n", path, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static void
+trace_flush_on_signal (int sig)
+{
+	void (*prev) (int);
+
+	trace_flush ();
+
+	prev = (sig == SIGINT ? prev_sigint : prev_sigterm);
+	if (prev != SIG_DFL && prev != SIG_IGN && prev != SIG_ERR)
+		prev (sig);
+	signal (sig, SIG_DFL);
+	raise (sig);
+}
+
+
+static int
+trace_write (fd_t fd, void *buf, size_t nbytes)
+{
+	/* Scrive nbytes byte di buf su fd, anche in piu' volte.
+	 * Ritorna 0 se riesce, -1 altrimenti. */
+
+	ssize_t nw;
+	char *ptr;
+
+	ptr = buf;
+	while (nbytes > 0) {
+		nw = write (fd, ptr, nbytes);
+		if (nw < 0 && errno == EINTR)
+			continue;
+		if (nw <= 0)
+			return -1;
+		ptr += nw;
+		nbytes -= nw;
+	}
+	return 0;
+}
@@ -1,6 +1,6 @@
 #include "h/types.h"
+#include "h/stats.h"
 #include "h/util.h"
-#include "h/segment.h"
 
 #include <config.h>
 #include <fcntl.h>
@@ -9,26 +9,53 @@
 #include <sys/ioctl.h>
 
 
+/*******************************************************************************
+			       Variabili locali
+*******************************************************************************/
+
+/* TRUE nei thread che eseguono il ciclo principale di un proxy, vedi
+ * alloc_loop_enter. */
+static __thread bool in_loop = FALSE;
+
+/* Impostata da alloc_report_enable. */
+static bool alloc_report = FALSE;
+
+
 /*******************************************************************************
 			      Funzioni pubbliche
 *******************************************************************************/
 
 /*
- * Funzioni su struct sockaddr_in.
+ * Funzioni sugli indirizzi dei canali.
  */
 
+socklen_t
+addr_len (addr_t *addr)
+{
+	/* Ritorna la lunghezza della struct sockaddr contenuta in addr, da
+	 * passare a bind e connect. */
+
+	assert (addr != NULL);
+
+	if (addr->a_sa.sa_family == AF_UNIX)
+		return sizeof (struct sockaddr_un);
+	return sizeof (struct sockaddr_in);
+}
+
+
 bool
-addr_is_set (struct sockaddr_in *addr)
+addr_is_set (addr_t *addr)
 {
 	/* Ritorna FALSE se addr e' ancora inizializzata a zero, TRUE
 	 * altrimenti.
 	 *
 	 * XXX Non controlla tutta la struttura, si affida al valore di
-	 * sin_family. */
+	 * sa_family. */
 
 	assert (addr != NULL);
 
-	if (addr->sin_family == AF_INET) {
+	if (addr->a_sa.sa_family == AF_INET
+	    || addr->a_sa.sa_family == AF_UNIX) {
 		return TRUE;
 	}
 	return FALSE;
@@ -36,24 +63,36 @@ addr_is_set (struct sockaddr_in *addr)
 
 
 char *
-addrstr (struct sockaddr_in *addr, char *buf)
+addrstr (addr_t *addr, char *buf)
 {
-	/* Copia la stringa in formato xxx.xxx.xxx.xxx:yyyyy nel buffer buf,
-	 * che deve essere grande a sufficienza. */
+	/* Copia la stringa in formato xxx.xxx.xxx.xxx:yyyyy, oppure il path
+	 * del socket AF_UNIX ("unix" se non ha nome), nel buffer buf, che
+	 * deve essere lungo almeno ADDRSTRLEN.
+	 * Ritorna il puntatore al terminatore della stringa. */
 
 	char *name;
 
 	assert (addr != NULL);
 	assert (buf != NULL);
 
+	if (addr->a_sa.sa_family == AF_UNIX) {
+		if (addr->a_un.sun_path[0] == '\0')
+			strcpy (buf, "unix");
+		else {
+			strncpy (buf, addr->a_un.sun_path, ADDRSTRLEN - 1);
+			buf[ADDRSTRLEN - 1] = '\0';
+		}
+		return strchr (buf, '\0');
+	}
+
 	/* Copia dell'indirizzo ip. */
-	name = (char *) inet_ntop (AF_INET, &addr->sin_addr, buf,
+	name = (char *) inet_ntop (AF_INET, &addr->a_in.sin_addr, buf,
 	                           INET_ADDRSTRLEN);
 	assert (name != NULL);
 
 	/* Copia del numero di porta. */
 	name = strchr (name, '\0');
-	sprintf (name, ":%d", ntohs (addr->sin_port));
+	sprintf (name, ":%d", ntohs (addr->a_in.sin_port));
 	/* Posiziona name alla fine della stringa. */
 	name = strchr (name, '\0');
 	/* Overflow? */
@@ -64,7 +103,7 @@ addrstr (struct sockaddr_in *addr, char *buf)
 
 
 int
-set_addr (struct sockaddr_in *addr, char *ip, port_t port)
+set_addr (addr_t *addr, char *ip, port_t port)
 {
 	/* Imposta addr secondo l'indirizzo ip, in formato xxx.xxx.xxx.xxx, e
 	 * la porta port.
@@ -73,16 +112,37 @@ set_addr (struct sockaddr_in *addr, char *ip, port_t port)
 
 	assert (addr != NULL);
 
-	memset (addr, 0, sizeof (struct sockaddr_in));
-	addr->sin_family = AF_INET;
+	memset (addr, 0, sizeof (addr_t));
+	addr->a_in.sin_family = AF_INET;
 
 	if (ip == NULL) {
-		addr->sin_addr.s_addr = htonl (INADDR_ANY);
-	} else if (inet_pton (AF_INET, ip, &addr->sin_addr) == 0) {
+		addr->a_in.sin_addr.s_addr = htonl (INADDR_ANY);
+	} else if (inet_pton (AF_INET, ip, &addr->a_in.sin_addr) == 0) {
 		/* La stringa ip non ha un formato valido. */
 		return -1;
 	}
-	addr->sin_port = htons (port);
+	addr->a_in.sin_port = htons (port);
+
+	return 0;
+}
+
+
+int
+set_unix_addr (addr_t *addr, char *path)
+{
+	/* Imposta addr con il path di un socket AF_UNIX.
+	 *
+	 * Ritorna -1 se path e' troppo lungo, 0 altrimenti. */
+
+	assert (addr != NULL);
+	assert (path != NULL);
+
+	memset (addr, 0, sizeof (addr_t));
+	if (strlen (path) >= sizeof (addr->a_un.sun_path))
+		return -1;
+
+	addr->a_un.sun_family = AF_UNIX;
+	strcpy (addr->a_un.sun_path, path);
 
 	return 0;
 }
@@ -113,6 +173,37 @@ streq (char *str1, char *str2)
  * Funzioni per la gestione della memoria.
  */
 
+void
+alloc_loop_enter (void)
+{
+	in_loop = TRUE;
+}
+
+
+void
+alloc_note (const char *what, size_t size)
+{
+	/* Conta l'allocazione se avviene nel ciclo principale e, con
+	 * alloc_report_enable, la segnala su stderr. */
+
+	if (!in_loop)
+		return;
+	STATS_ADD (st_allocs, 1);
+	STATS_ADD (st_alloc_bytes, size);
+	if (alloc_report)
+		fprintf (stderr, "allocazione nel ciclo principale: %s, %lu "
+				"byte, ciclo %lu\n", what, (unsigned long)size,
+				(unsigned long)mh_stats->st_loops);
+}
+
+
+void
+alloc_report_enable (void)
+{
+	alloc_report = TRUE;
+}
+
+
 void
 xfree (void *ptr)
 {
@@ -134,13 +225,10 @@ xmalloc (size_t size)
 
 	ptr = malloc (size);
 	if (ptr == NULL) {
-		segwrap_flush_cache ();
-		ptr = malloc (size);
-		if (ptr == NULL) {
-			perror ("Impossibile allocare memoria");
-			exit (EXIT_FAILURE);
-		}
+		perror ("Impossibile allocare memoria");
+		exit (EXIT_FAILURE);
 	}
+	alloc_note ("xmalloc", size);
 	return ptr;
 }
 
@@ -247,6 +335,30 @@ tcp_set_buffer_size (fd_t sockfd, int bufname, size_t buflen)
 }
 
 
+int
+tcp_set_busy_poll (fd_t fd, double interval)
+{
+	/* Imposta SO_BUSY_POLL: le letture bloccanti e select sul socket
+	 * interrogano la coda della scheda di rete per interval secondi
+	 * prima di addormentarsi. Sui sistemi che non hanno l'opzione non fa
+	 * nulla e ritorna 0. */
+
+#ifdef SO_BUSY_POLL
+	int optval;
+
+	assert (fd >= 0);
+	assert (interval > 0);
+
+	optval = interval * 1000000;
+	return setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL,
+	                   &optval, sizeof (optval));
+#else
+	assert (fd >= 0);
+	return 0;
+#endif
+}
+
+
 int
 tcp_set_nagle (fd_t fd, bool active)
 {
@@ -287,8 +399,31 @@ tcp_set_reusable (fd_t fd, bool reusable)
 }
 
 
+int
+tcp_set_user_timeout (fd_t fd, double timeout)
+{
+	/* Imposta TCP_USER_TIMEOUT: il kernel chiude la connessione se i dati
+	 * spediti restano senza riscontro per piu' di timeout secondi.
+	 * Sui sistemi che non hanno l'opzione non fa nulla e ritorna 0. */
+
+#ifdef TCP_USER_TIMEOUT
+	unsigned int optval;
+
+	assert (fd >= 0);
+	assert (timeout > 0);
+
+	optval = timeout * 1000;
+	return setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+	                   &optval, sizeof (optval));
+#else
+	assert (fd >= 0);
+	return 0;
+#endif
+}
+
+
 void
-tcp_sockname (fd_t fd, struct sockaddr_in *laddr)
+tcp_sockname (fd_t fd, addr_t *laddr)
 {
 	/* Wrapper per nascondere le bruttezze di getsockname. */
 
@@ -301,17 +436,18 @@ tcp_sockname (fd_t fd, struct sockaddr_in *laddr)
 
 	len = sizeof (*laddr);
 
-	err = getsockname (fd, (struct sockaddr *) laddr, &len);
+	err = getsockname (fd, &laddr->a_sa, &len);
 	assert (!err);
 }
 
 
 fd_t
-xtcp_socket (void)
+xtcp_socket (int family)
 {
-	/* Socket sicura. */
+	/* Socket sicura, di tipo stream, della famiglia di indirizzi family
+	 * (AF_INET o AF_UNIX). */
 
-	fd_t newfd = socket (AF_INET, SOCK_STREAM, 0);
+	fd_t newfd = socket (family, SOCK_STREAM, 0);
 	if (newfd < 0) {
 		perror ("Impossibile creare il socket");
 		exit (EXIT_FAILURE);